@@ -728,8 +728,18 @@ bool Application::RenderTarget(bool nextVideoFrame)
 
 	if ((!options.isStatic) && nextVideoFrame) {
 		framebuffers.ReceivedNewVideoFrame();
+	}
+	// the depth maps and the output view (and both eyes) use the same levels of detail. In a video, the levels only change
+	// with the video frame, when the depth maps are drawn again anyway. In a static scene, the depth maps are drawn again when a level changes
+	bool newDepthMaps = (!options.isStatic) && nextVideoFrame;
+	if (options.isStatic || nextVideoFrame) {
+		if (framebuffers.SelectLevelsOfDetail(glm::vec3(pcOutputCamera.model[3]))) newDepthMaps = true;
+	}
+	if (newDepthMaps) {
 		UpdateProjectedDepths();
 	}
+	// the GPU time of the output view (not of the depth maps, or the waits for the videos and meshes) adjusts the triangle budget
+	framebuffers.BeginFrame();
 
 
 	RenderScene();
@@ -748,22 +758,25 @@ bool Application::RenderTarget(bool nextVideoFrame)
 
 		// TODO UpdateProjectedDepths(); !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
 	}
-
+	framebuffers.EndFrame();
 
 	return true;
 }
 
 void Application::RenderScene()
 {
+	// the view of vertex.fs, see ShaderController::updateOutputParams()
+	Frustum frustum = Frustum::Perspective(pcOutputCamera.view, glm::vec2(pcOutputCamera.focal_x, pcOutputCamera.focal_y),
+		glm::vec2(pcOutputCamera.principal_point_x, pcOutputCamera.principal_point_y), (float)m_nRenderWidth, (float)m_nRenderHeight, pcOutputCamera.z_far);
 	if (options.inpaint && !useWireframe) {
 		shaders.shader.use();
-		framebuffers.renderMesh(textures_color, textures_depth, current_inputsToUse, texture_out_color_tmp, texture_out_depth_tmp);
+		framebuffers.renderMesh(textures_color, textures_depth, current_inputsToUse, frustum, texture_out_color_tmp, texture_out_depth_tmp);
 		shaders.inpaintShader.use();
 		framebuffers.InpaintImage(0, texture_out_color_tmp, texture_out_depth_tmp);
 	}
 	else {
 		shaders.shader.use();
-		framebuffers.renderMesh(0, textures_color, textures_depth, current_inputsToUse);
+		framebuffers.renderMesh(0, textures_color, textures_depth, current_inputsToUse, frustum);
 	}
 }
 
@@ -793,7 +806,9 @@ void Application::UpdateProjectedDepths() {
 		shaders.toInputShader.setVec2("out_pp", glm::vec2(input.principal_point_x, input.principal_point_y));
 		shaders.toInputShader.setVec2("out_near_far", glm::vec2(input.z_near, input.z_far));
 		shaders.toInputShader.setMat4("out_view", input.view);
-		framebuffers.renderMeshAsDepthTexture(texture_depth_tmp);
+		Frustum frustum = Frustum::Perspective(input.view, glm::vec2(input.focal_x, input.focal_y), glm::vec2(input.principal_point_x, input.principal_point_y),
+			(float)input.res_x, (float)input.res_y, input.z_far);
+		framebuffers.renderMeshAsDepthTexture(texture_depth_tmp, frustum);
 	
 		shaders.dilateShader.use();
 		framebuffers.dilateDepth(texture_depth_tmp, textures_depth[i]);
@@ -0,0 +1,87 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+
+#include <glm.hpp>
+#include <cmath>
+#include "MeshFile.h"
+
+
+/*
+* Frustum is the part of world space that a view shows, as planes that point inwards, so FrameBufferController can skip
+* the Meshlets (see MeshFile.h) that are completely outside of it.
+* Perspective() is the view of vertex.fs and toinput_vertex.fs (an output or input camera with focal lengths and principal point),
+* FromMatrix() that of a projection matrix (the VR headset). Only the four sides and the far plane are used:
+* vertex.fs does not clip at a near plane, and the four sides already reject everything behind the viewer.
+* A default Frustum culls nothing.
+*/
+class Frustum {
+private:
+	glm::vec4 planes[5];   // (normal, d), a point p is inside if dot(normal, p) + d >= 0 for all of them
+	int nrPlanes = 0;
+	glm::vec3 eye = glm::vec3(0);
+
+public:
+	Frustum() {}
+
+	// view is the world to camera matrix (looking along -z), f and pp are in pixels of an image of width x height, zFar the distance of the far plane
+	static Frustum Perspective(const glm::mat4& view, glm::vec2 f, glm::vec2 pp, float width, float height, float zFar) {
+		Frustum frustum;
+		// in camera space: 0 <= u = x / -z * f.x + pp.x <= width and 0 <= v = -y / -z * f.y + pp.y <= height, and -z <= zFar
+		glm::vec4 cameraPlanes[5] = {
+			glm::vec4(f.x, 0, -pp.x, 0),
+			glm::vec4(-f.x, 0, pp.x - width, 0),
+			glm::vec4(0, -f.y, -pp.y, 0),
+			glm::vec4(0, f.y, pp.y - height, 0),
+			glm::vec4(0, 0, 1, zFar)
+		};
+		// a plane of camera space is transpose(view) * plane in world space
+		glm::mat4 toWorld = glm::transpose(view);
+		for (int p = 0; p < 5; p++) {
+			frustum.AddPlane(toWorld * cameraPlanes[p]);
+		}
+		frustum.eye = glm::vec3(glm::inverse(view)[3]);
+		return frustum;
+	}
+
+	// viewProject is the projection matrix times the view matrix, its clip space is that of OpenGL (or Direct3D, the near plane is not used)
+	static Frustum FromMatrix(const glm::mat4& viewProject) {
+		Frustum frustum;
+		glm::mat4 rows = glm::transpose(viewProject);
+		frustum.AddPlane(rows[3] + rows[0]);
+		frustum.AddPlane(rows[3] - rows[0]);
+		frustum.AddPlane(rows[3] + rows[1]);
+		frustum.AddPlane(rows[3] - rows[1]);
+		frustum.AddPlane(rows[3] - rows[2]);
+		// the eye is projected to x = y = w = 0
+		glm::mat3 sides = glm::transpose(glm::mat3(glm::vec3(rows[0]), glm::vec3(rows[1]), glm::vec3(rows[3])));
+		frustum.eye = glm::inverse(sides) * -glm::vec3(rows[0].w, rows[1].w, rows[3].w);
+		return frustum;
+	}
+
+	// false if no triangle of the meshlet is in view. With cullBackFacing, also false if they all face away from the eye
+	bool MayBeVisible(const Meshlet& meshlet, bool cullBackFacing) const {
+		glm::vec3 center(meshlet.center[0], meshlet.center[1], meshlet.center[2]);
+		for (int p = 0; p < nrPlanes; p++) {
+			if (glm::dot(glm::vec3(planes[p]), center) + planes[p].w < -meshlet.radius) return false;
+		}
+		if (cullBackFacing && nrPlanes > 0 && meshlet.coneCutoff < 1.0f) {
+			glm::vec3 toCenter = center - eye;
+			glm::vec3 axis(meshlet.coneAxis[0], meshlet.coneAxis[1], meshlet.coneAxis[2]);
+			if (glm::dot(toCenter, axis) >= meshlet.coneCutoff * glm::length(toCenter) + meshlet.radius) return false;
+		}
+		return true;
+	}
+
+private:
+	// normalized, so that the distance to a plane can be compared with the radius of a meshlet
+	void AddPlane(glm::vec4 plane) {
+		float length = glm::length(glm::vec3(plane));
+		if (length > 0.0f) {
+			planes[nrPlanes++] = plane / length;
+		}
+	}
+};
+
+
+#endif
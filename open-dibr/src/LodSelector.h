@@ -0,0 +1,216 @@
+#ifndef LOD_SELECTOR_H
+#define LOD_SELECTOR_H
+
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include "ioHelper.h"
+#include "MeshFile.h"
+
+
+/*
+* LodSelector picks which level of detail (see Meshlet::level) of the mesh of every input camera FrameBufferController draws,
+* if the mesh file has more than one (CreateMeshes --lod_levels). Every next level has about a quarter of the triangles,
+* so it looks as good from twice as far away: the mesh of an input camera is drawn at level 0 up to levelDistance from the viewer,
+* and one level coarser every time that distance doubles. levelDistance is options.lodDistance times the mean distance
+* between an input camera and the one closest to it.
+* The levels are then coarsened further (those of the input cameras furthest away first) until they fit in a triangle budget.
+* With options.adaptiveLod, that budget follows the GPU time of the frames (measured with timer queries around BeginFrame() and EndFrame()):
+* it is lowered right away when a frame takes longer than options.targetFps allows, and raised slowly again while there is time left.
+* The depth maps of the input views are drawn with the levels too, so they have to be drawn again whenever Select() changes a level.
+*/
+class LodSelector {
+private:
+	static const int nrQueries = 4;      // the GPU is at most this many frames behind
+	int nrLevels = 1;
+	std::vector<glm::vec3> cameraPositions;
+	float levelDistance = 1.0f;
+	std::vector<int> levels;             // per input camera
+	std::vector<int> previousLevels;     // Select(): per input camera, before it
+	std::vector<uint64_t> nrTriangles;   // per input camera and level, of the mesh that is drawn
+	std::vector<float> distances;        // Select(): per input camera
+	std::vector<int> order;              // Select(): the input cameras, furthest away first
+	double triangleBudget = INFINITY;
+	uint64_t selectedTriangles = 0;      // of the levels of the last Select()
+	uint64_t finestTriangles = 0;        // of level 0 of the last Select()
+
+	bool adaptive = false;
+	double targetMs = 0.0;               // of the GPU time of a frame
+	GLuint queries[nrQueries];
+	long long nrQueriesStarted = 0;
+	long long nrQueriesRead = 0;
+	int nrFramesToSkip = 0;              // after the budget is lowered, the frames that were already in flight still take too long
+
+	long long nrSelections = 0;          // statistics
+	long long levelSum = 0;
+	long long nrSlowFrames = 0;
+	long long nrFramesMeasured = 0;
+
+public:
+	LodSelector() {}
+
+	void Init(const std::vector<InputCamera>& inputCameras, int nrLevels, const Options& options) {
+		this->nrLevels = nrLevels;
+		if (nrLevels <= 1) return;
+		int nrCameras = (int)inputCameras.size();
+		cameraPositions.resize(nrCameras);
+		for (int i = 0; i < nrCameras; i++) {
+			cameraPositions[i] = glm::vec3(inputCameras[i].model[3]);
+		}
+		float sum = 0.0f;
+		for (int i = 0; i < nrCameras; i++) {
+			float closest = INFINITY;
+			for (int j = 0; j < nrCameras; j++) {
+				if (j != i) closest = std::min(closest, glm::length(cameraPositions[i] - cameraPositions[j]));
+			}
+			if (closest < INFINITY) sum += closest;
+		}
+		float spacing = nrCameras > 1 ? sum / nrCameras : 0.0f;
+		levelDistance = options.lodDistance * (spacing > 0.0f ? spacing : 1.0f);
+		levels.assign(nrCameras, 0);
+		previousLevels.assign(nrCameras, 0);
+		nrTriangles.assign(nrCameras * nrLevels, 0);
+		distances.resize(nrCameras);
+		order.resize(nrCameras);
+		triangleBudget = options.triangleBudget > 0 ? (double)options.triangleBudget : INFINITY;
+
+		// the output images that are saved should not depend on how fast the GPU is
+		adaptive = options.adaptiveLod && !options.saveOutputImages;
+		if (adaptive) {
+			targetMs = 1000.0 / options.targetFps;
+			glGenQueries(nrQueries, queries);
+		}
+		printf("Drawing %d levels of detail, the finest up to %g from the input cameras%s\n", nrLevels, levelDistance,
+			adaptive ? ", and coarser ones when the GPU can not keep up" : "");
+	}
+
+	bool Enabled() const {
+		return nrLevels > 1;
+	}
+
+	// the level of detail of the mesh of the input camera
+	int Level(int camera) const {
+		return camera < (int)levels.size() ? levels[camera] : 0;
+	}
+
+	// picks the levels of the mesh with these meshlets for a viewer at eye (at most once per frame, so that both eyes of the headset use the same ones),
+	// true if a level changed
+	bool Select(const glm::vec3& eye, const std::vector<Meshlet>& meshlets) {
+		if (nrLevels <= 1) return false;
+		int nrCameras = (int)levels.size();
+		previousLevels = levels;
+		std::fill(nrTriangles.begin(), nrTriangles.end(), 0);
+		for (const Meshlet& meshlet : meshlets) {
+			if (meshlet.camera < nrCameras && meshlet.level < nrLevels) {
+				nrTriangles[meshlet.camera * nrLevels + meshlet.level] += meshlet.nrIndices / 3;
+			}
+		}
+
+		// by distance
+		selectedTriangles = 0;
+		finestTriangles = 0;
+		for (int c = 0; c < nrCameras; c++) {
+			distances[c] = glm::length(eye - cameraPositions[c]);
+			int level = distances[c] > levelDistance ? 1 + (int)std::floor(std::log2(distances[c] / levelDistance)) : 0;
+			levels[c] = std::min(level, nrLevels - 1);
+			selectedTriangles += nrTriangles[c * nrLevels + levels[c]];
+			finestTriangles += nrTriangles[c * nrLevels];
+		}
+
+		// and then one level coarser at a time, furthest away first, until they fit in the budget
+		if (selectedTriangles > triangleBudget) {
+			for (int c = 0; c < nrCameras; c++) {
+				order[c] = c;
+			}
+			std::sort(order.begin(), order.end(), [this](int a, int b) { return distances[a] > distances[b]; });
+			bool coarsened = true;
+			while (selectedTriangles > triangleBudget && coarsened) {
+				coarsened = false;
+				for (int c : order) {
+					if (selectedTriangles <= triangleBudget) break;
+					if (levels[c] == nrLevels - 1) continue;
+					selectedTriangles -= nrTriangles[c * nrLevels + levels[c]];
+					levels[c]++;
+					selectedTriangles += nrTriangles[c * nrLevels + levels[c]];
+					coarsened = true;
+				}
+			}
+		}
+
+		nrSelections++;
+		for (int c = 0; c < nrCameras; c++) {
+			levelSum += levels[c];
+		}
+		return levels != previousLevels;
+	}
+
+	// around the GPU work of a frame
+	void BeginFrame() {
+		if (!adaptive) return;
+		// the oldest query is reused, which has to wait for it if the GPU is that far behind
+		if (nrQueriesStarted - nrQueriesRead == nrQueries) ReadFrameTime(true);
+		glBeginQuery(GL_TIME_ELAPSED, queries[nrQueriesStarted % nrQueries]);
+	}
+
+	void EndFrame() {
+		if (!adaptive) return;
+		glEndQuery(GL_TIME_ELAPSED);
+		nrQueriesStarted++;
+		while (nrQueriesRead < nrQueriesStarted && ReadFrameTime(false)) {}
+	}
+
+	void Cleanup() {
+		if (nrSelections > 0) {
+			printf("Levels of detail: mean level %.2f", (double)levelSum / (nrSelections * levels.size()));
+			if (nrFramesMeasured > 0) {
+				printf(", %.1f%% of the frames took longer than %.1f ms on the GPU", 100.0 * nrSlowFrames / nrFramesMeasured, targetMs);
+			}
+			if (triangleBudget < finestTriangles) {
+				printf(", the triangle budget ended at %.0f triangles", triangleBudget);
+			}
+			printf("\n");
+		}
+		if (adaptive) {
+			glDeleteQueries(nrQueries, queries);
+			adaptive = false;
+		}
+		nrSelections = 0;
+	}
+
+private:
+	// the GPU time of the oldest frame whose query was not read yet, false if it is not available yet (without wait)
+	bool ReadFrameTime(bool wait) {
+		GLuint query = queries[nrQueriesRead % nrQueries];
+		if (!wait) {
+			GLint available = 0;
+			glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) return false;
+		}
+		GLuint64 ns = 0;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+		nrQueriesRead++;
+		UpdateBudget(ns / 1e6);
+		return true;
+	}
+
+	void UpdateBudget(double ms) {
+		nrFramesMeasured++;
+		nrSlowFrames += ms > targetMs;
+		if (nrFramesToSkip > 0) {
+			nrFramesToSkip--;
+			return;
+		}
+		if (ms > targetMs) {
+			// most of the time goes to the triangles, so the budget is scaled with the time (but at most halved at once)
+			triangleBudget = selectedTriangles * std::max(0.5, std::min(0.95, targetMs / ms));
+			nrFramesToSkip = (int)(nrQueriesStarted - nrQueriesRead);
+		}
+		else if (ms < 0.8 * targetMs && triangleBudget < finestTriangles) {
+			triangleBudget *= 1.02;
+		}
+	}
+};
+
+
+#endif
@@ -0,0 +1,694 @@
+#ifndef MESH_FILE_H
+#define MESH_FILE_H
+
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <atomic>
+#include "MeshCodec.h"
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*
+* The header and frame table of a v2, v3 or v4 meshes.bin, written by CreateMeshes (see preprocessing/src/MeshFile.h, the layout must match).
+* The payload of every frame (float xyz per vertex, then uint32 indices) starts at a multiple of 64 bytes.
+* In a v3 file, the payload is a MeshBlockTable and its MeshBlocks, then uint16 xyz per vertex and uint16 indices (local to their block).
+* The last blocks of a v3 frame can be kept from an earlier frame (see MeshBlockSource), their vertices and indices are not in the payload.
+* A v4 file is a v3 file in which the vertices and indices of every block are compressed (see MeshChunk and MeshCodec).
+* The triangles of a frame can also be grouped into Meshlets (see Meshlet), which are culled before drawing.
+* If nrLevels > 1, the mesh of every input camera is there at that many levels of detail (see Meshlet::level), of which only one is drawn.
+*/
+struct MeshFileHeader {          // 64 bytes
+	char magic[8];               // "DIBRMESH"
+	uint32_t version;            // 2, 3 or 4
+	uint32_t nrCameras;          // nr input cameras (0 if unknown)
+	uint32_t width;              // resolution of the input cameras (0 if unknown)
+	uint32_t height;
+	uint32_t nrFrames;
+	uint32_t maxNrVertices;      // of all frames
+	uint32_t maxNrTriangles;
+	uint32_t alignment;          // of the payloads, 64
+	uint64_t frameTableOffset;
+	uint32_t nrLevels;           // nr of levels of detail of the meshlets, 0 (in older files) is the same as 1
+	uint8_t reserved[12];
+};
+
+struct MeshFrameEntry {          // 32 bytes
+	uint64_t offset;             // of the vertices, v3 and v4: of the MeshBlockTable
+	uint64_t size;               // of the whole payload
+	uint32_t nrVertices;
+	uint32_t nrTriangles;
+	uint64_t indexOffset;        // of the indices (0 in v4)
+};
+
+struct MeshBlockTable {          // 16 bytes, followed by nrBlocks MeshBlocks, nrKeptBlocks MeshBlockSources and nrMeshlets Meshlets (and in v4 the MeshChunks)
+	uint32_t nrBlocks;
+	uint32_t vertexOffset;       // of the vertices, relative to the MeshBlockTable (v4: of the chunks)
+	uint32_t nrKeptBlocks;       // the last nrKeptBlocks of the blocks
+	uint32_t nrMeshlets;         // 0 if the frame has none
+};
+
+// the vertices of a block are drawn with its decode matrix as meshDecode (see vertex.fs)
+struct MeshBlock {               // 80 bytes
+	float decode[16];            // column-major 4x4 matrix from the quantized vertex to homogeneous world space
+	uint32_t firstVertex;        // in the vertices of the frame
+	uint32_t nrVertices;
+	uint32_t firstIndex;         // in the indices of the frame
+	uint32_t nrIndices;
+};
+
+// a kept block is placed after the vertices and indices that its frame stores, but they are those of a block that is stored in an earlier frame.
+// That block is also a block of every frame in between, so when playing in order, a kept block can be copied from the previous frame
+struct MeshBlockSource {         // 8 bytes
+	uint32_t frame;
+	uint32_t block;              // index in the blocks of that frame
+};
+
+// in a v4 file, where the vertices and indices of a block that the frame stores are (compressed by MeshCodec::Encode()), one per stored block
+struct MeshChunk {               // 8 bytes
+	uint32_t offset;             // relative to the MeshBlockTable
+	uint32_t size;
+};
+
+// a group of triangles that are consecutive in the indices of one block, with the bounding sphere and normal cone (in world space) that Frustum culls it with.
+// In a v2 frame (which is block 0) the meshlets are in a MeshletTable at the first multiple of 64 bytes after the indices, if the payload goes on after them
+struct Meshlet {                 // 48 bytes
+	float center[3];             // of the bounding sphere
+	float radius;
+	float coneAxis[3];           // the mean normal of the triangles (unit length)
+	float coneCutoff;            // all triangles face away from eye if dot(center - eye, coneAxis) >= coneCutoff * |center - eye| + radius, 1 if never
+	uint32_t block;              // in the blocks of the frame (0 in v2)
+	uint32_t firstIndex;         // relative to the first index of that block
+	uint32_t nrIndices;
+	uint16_t camera;             // the input camera that the triangles are from
+	uint16_t level;              // of detail, 0 is the finest (and the only one unless header.nrLevels > 1)
+};
+
+struct MeshletTable {            // 16 bytes, followed by nrMeshlets Meshlets
+	uint32_t nrMeshlets;
+	uint32_t reserved[3];
+};
+
+struct Mesh {
+	std::vector<float> vertices;
+	std::vector<uint32_t> triangles;
+};
+
+// a decoded v4 frame
+struct QuantizedMesh {
+	std::vector<uint16_t> vertices;
+	std::vector<uint16_t> indices;
+	std::vector<MeshBlock> blocks;
+	std::vector<MeshBlockSource> keptSources;
+	std::vector<Meshlet> meshlets;
+};
+
+// scratch space to read a v4 frame, every thread that reads frames needs its own
+struct MeshReadBuffers {
+	std::vector<uint8_t> payload;
+	std::vector<uint8_t> planes;
+};
+
+// the mesh of one frame, pointing into the MeshFile
+struct MeshView {
+	const void* vertices = NULL;        // xyz per vertex (float, or uint16 if quantized)
+	const void* triangles = NULL;       // 3 indices per triangle (uint32, or uint16 if quantized)
+	int nrVertices = 0;
+	int nrTriangles = 0;
+	const MeshBlock* blocks = NULL;     // only if quantized
+	int nrBlocks = 0;
+	const MeshBlockSource* keptSources = NULL; // of the last nrKeptBlocks blocks, whose vertices and indices are not in vertices and triangles
+	int nrKeptBlocks = 0;
+	const Meshlet* meshlets = NULL;     // none if the file has no meshlets
+	int nrMeshlets = 0;
+	bool keptBlocksLoaded = false;      // if they are in vertices and triangles after all (see MeshLoader)
+};
+
+/*
+* MeshFile gives access to the meshes of all frames in meshes.bin.
+* Open() reads the index of the file: the frame table of a v2 file, or for a v1 file (without a header) the
+* frame sizes, by seeking from one frame to the next. With this index, ReadFrame() reads a frame to memory of the caller
+* (MeshLoader, or the upload of all frames to the GPU).
+* The vertices and indices of a v3 file are quantized to uint16 (see VertexSize() and IndexSize()) and are decoded by the vertex shader.
+* With inMemory (or LoadIntoMemory() later on), GetFrame() can be used instead: a v2 file is then memory-mapped, so the OS only loads
+* (and can drop again) the pages of the frames that are actually shown, but a v1 file is read into memory completely.
+* The kept blocks of a v3 frame are not read by ReadFrame() and GetFrame(), ReadKeptBlocks() or GetBlock() get them from the frame that stores them.
+* A v4 file can not be memory-mapped, ReadFrame() decodes its frames (which takes about as long as reading a v3 frame from disk, so the callers
+* read frames on several threads, see ForAllFrames() and MeshLoader), and LoadIntoMemory() decodes all of them.
+* ReadFrame() and GetFrame() also give the meshlets of a frame, if it has them.
+*/
+class MeshFile {
+private:
+	const uint8_t* data = NULL; // the mapped file (v2)
+	uint64_t size = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+#endif
+
+	std::vector<Mesh> meshes; // v1 with inMemory
+	std::vector<QuantizedMesh> decodedMeshes; // v4 with inMemory
+	std::vector<MeshFrameEntry> entries;
+	std::string path;
+	int version = 0;
+	int nrFrames = 0;
+	int maxNrVertices = 0;
+	int maxNrTriangles = 0;
+	int nrLevels = 1;
+
+public:
+	static const int maxNrLevels = 4;
+
+	MeshFile() {}
+
+	bool Open(const std::string& path, bool inMemory) {
+		this->path = path;
+		std::ifstream in(path, std::ios::binary);
+		char magic[8] = {};
+		in.read(magic, 8);
+		in.close();
+		version = memcmp(magic, "DIBRMESH", 8) == 0 ? 2 : 1; // ReadIndexV2() sets the actual version
+		nrLevels = 1;
+		if (!(version == 2 ? ReadIndexV2(path) : ReadIndexV1(path))) return false;
+		return inMemory ? LoadIntoMemory() : true;
+	}
+
+	// for GetFrame(), a v4 file is decoded on nrThreads threads
+	bool LoadIntoMemory(int nrThreads = 1) {
+		if (Compressed()) return DecodeV4(nrThreads);
+		return version >= 2 ? MapV2(path) : ReadV1(path);
+	}
+
+	int Version() {
+		return version;
+	}
+
+	bool Quantized() {
+		return version >= 3;
+	}
+
+	bool Compressed() {
+		return version == 4;
+	}
+
+	// in bytes
+	int VertexSize() {
+		return Quantized() ? 3 * sizeof(uint16_t) : 3 * sizeof(float);
+	}
+
+	int IndexSize() {
+		return Quantized() ? sizeof(uint16_t) : sizeof(uint32_t);
+	}
+
+	const std::string& Path() {
+		return path;
+	}
+
+	int NrFrames() {
+		return nrFrames;
+	}
+
+	// of the meshes of the input cameras (see Meshlet::level), 1 for a v1 file
+	int NrLevels() {
+		return nrLevels;
+	}
+
+	// where the vertices and indices of the frame are in the file
+	const MeshFrameEntry& GetEntry(int frame) {
+		return entries[frame];
+	}
+
+	int MaxNrVertices() {
+		return maxNrVertices;
+	}
+
+	int MaxNrTriangles() {
+		return maxNrTriangles;
+	}
+
+	// of the vertices and indices of all frames (for v3 the whole payloads, without the kept blocks, for v4 with the kept blocks since they are compressed)
+	uint64_t TotalSize() {
+		uint64_t total = 0;
+		for (const MeshFrameEntry& entry : entries) {
+			total += version == 3 ? entry.size : (uint64_t)entry.nrVertices * VertexSize() + 3 * (uint64_t)entry.nrTriangles * IndexSize();
+		}
+		return total;
+	}
+
+	// the nr of vertices and indices in front of the kept blocks, i.e. those that are stored in the frame
+	static void StoredSize(const MeshView& m, /*out*/ size_t& nrVertices, /*out*/ size_t& nrIndices) {
+		nrVertices = m.nrKeptBlocks > 0 ? m.blocks[m.nrBlocks - m.nrKeptBlocks].firstVertex : m.nrVertices;
+		nrIndices = m.nrKeptBlocks > 0 ? m.blocks[m.nrBlocks - m.nrKeptBlocks].firstIndex : 3 * (size_t)m.nrTriangles;
+	}
+
+	// reads the vertices and indices (and blocks) that the frame stores from in (opened on Path()), returns false if that fails.
+	// vertices and triangles must have room for the whole frame, the kept blocks go after the stored vertices and indices (see ReadKeptBlocks())
+	bool ReadFrame(std::ifstream& in, int frame, /*out*/ void* vertices, /*out*/ void* triangles, /*out*/ std::vector<MeshBlock>& blocks, /*out*/ std::vector<MeshBlockSource>& keptSources,
+		/*out*/ std::vector<Meshlet>& meshlets, MeshReadBuffers& buffers) {
+		if (Compressed()) {
+			return ReadCompressedFrame(in, frame, vertices, triangles, blocks, keptSources, meshlets, buffers);
+		}
+		const MeshFrameEntry& entry = entries[frame];
+		size_t nrVertices, nrIndices;
+		uint64_t vertexOffset = ReadBlocks(in, frame, blocks, keptSources, meshlets);
+		StoredSize(GetView(frame, blocks, keptSources, meshlets), nrVertices, nrIndices);
+		in.seekg(vertexOffset);
+		in.read(reinterpret_cast<char*>(vertices), nrVertices * VertexSize());
+		in.seekg(entry.indexOffset);
+		in.read(reinterpret_cast<char*>(triangles), nrIndices * IndexSize());
+		if (!in) {
+			std::cout << "Error: could not read mesh " << frame << " from " << path << std::endl;
+			in.clear();
+			return false;
+		}
+		return true;
+	}
+
+	// reads the blocks and meshlets of the frame from in (no blocks if it is not quantized), returns the offset of its vertices in the file
+	uint64_t ReadBlocks(std::ifstream& in, int frame, /*out*/ std::vector<MeshBlock>& blocks, /*out*/ std::vector<MeshBlockSource>& keptSources,
+		/*out*/ std::vector<Meshlet>& meshlets) {
+		const MeshFrameEntry& entry = entries[frame];
+		blocks.clear();
+		keptSources.clear();
+		meshlets.clear();
+		if (!Quantized()) {
+			if (version >= 2) ReadMeshletsV2(in, entry, meshlets);
+			return entry.offset;
+		}
+		MeshBlockTable table;
+		in.seekg(entry.offset);
+		if (!in.read(reinterpret_cast<char*>(&table), sizeof(table)) || table.nrKeptBlocks > table.nrBlocks) {
+			return entry.offset;
+		}
+		blocks.resize(table.nrBlocks);
+		keptSources.resize(table.nrKeptBlocks);
+		meshlets.resize(table.nrMeshlets);
+		in.read(reinterpret_cast<char*>(blocks.data()), blocks.size() * sizeof(MeshBlock));
+		in.read(reinterpret_cast<char*>(keptSources.data()), keptSources.size() * sizeof(MeshBlockSource));
+		in.read(reinterpret_cast<char*>(meshlets.data()), meshlets.size() * sizeof(Meshlet));
+		if (!in || !ValidMeshlets(meshlets.data(), (int)meshlets.size(), (int)blocks.size())) meshlets.clear();
+		return entry.offset + table.vertexOffset;
+	}
+
+	// the MeshView of the frame with these blocks and meshlets (read by ReadBlocks()), without its vertices and indices
+	MeshView GetView(int frame, const std::vector<MeshBlock>& blocks, const std::vector<MeshBlockSource>& keptSources, const std::vector<Meshlet>& meshlets) {
+		MeshView m;
+		m.nrVertices = entries[frame].nrVertices;
+		m.nrTriangles = entries[frame].nrTriangles;
+		m.blocks = blocks.data();
+		m.nrBlocks = (int)blocks.size();
+		m.keptSources = keptSources.data();
+		m.nrKeptBlocks = (int)keptSources.size();
+		m.meshlets = meshlets.data();
+		m.nrMeshlets = (int)meshlets.size();
+		return m;
+	}
+
+	// calls read(in, buffers, frame) for every frame, on nrThreads threads that each have their own in (on Path()) and buffers for ReadFrame()
+	template <typename Read>
+	void ForAllFrames(int nrThreads, Read read) {
+		std::atomic<int> nextFrame(0);
+		auto readFrames = [this, &nextFrame, &read]() {
+			std::ifstream in(path, std::ios::binary);
+			MeshReadBuffers buffers;
+			for (int frame = nextFrame++; frame < nrFrames; frame = nextFrame++) {
+				read(in, buffers, frame);
+			}
+		};
+		std::vector<std::thread> threads;
+		for (int t = 1; t < nrThreads; t++) {
+			threads.push_back(std::thread(readFrames));
+		}
+		readFrames();
+		for (std::thread& thread : threads) {
+			thread.join();
+		}
+	}
+
+	// reads the kept blocks of a v3 or v4 frame (read by ReadFrame()) from the frames that store them, to their place in vertices and triangles
+	bool ReadKeptBlocks(std::ifstream& in, const MeshView& m, /*out*/ void* vertices, /*out*/ void* triangles, MeshReadBuffers& buffers) {
+		for (int k = 0; k < m.nrKeptBlocks; k++) {
+			const MeshBlock& block = m.blocks[m.nrBlocks - m.nrKeptBlocks + k];
+			const MeshBlockSource& source = m.keptSources[k];
+			MeshBlockTable table;
+			MeshBlock stored;
+			if (source.frame >= (uint32_t)nrFrames) return false;
+			const MeshFrameEntry& entry = entries[source.frame];
+			in.seekg(entry.offset);
+			in.read(reinterpret_cast<char*>(&table), sizeof(table));
+			in.seekg(entry.offset + sizeof(table) + source.block * sizeof(MeshBlock));
+			in.read(reinterpret_cast<char*>(&stored), sizeof(stored));
+			if (!in || source.block >= table.nrBlocks - table.nrKeptBlocks || stored.nrVertices != block.nrVertices || stored.nrIndices != block.nrIndices) {
+				std::cout << "Error: invalid kept block in " << path << std::endl;
+				in.clear();
+				return false;
+			}
+			if (Compressed()) {
+				MeshChunk chunk;
+				in.seekg(entry.offset + ChunkTableOffset(table) + source.block * sizeof(MeshChunk));
+				in.read(reinterpret_cast<char*>(&chunk), sizeof(chunk));
+				buffers.payload.resize(chunk.size);
+				in.seekg(entry.offset + chunk.offset);
+				in.read(reinterpret_cast<char*>(buffers.payload.data()), chunk.size);
+				if (!in || !MeshCodec::Decode(buffers.payload.data(), chunk.size, reinterpret_cast<uint16_t*>(vertices) + 3 * (size_t)block.firstVertex, block.nrVertices,
+					reinterpret_cast<uint16_t*>(triangles) + block.firstIndex, block.nrIndices, buffers.planes)) {
+					std::cout << "Error: could not decode the kept blocks from " << path << std::endl;
+					in.clear();
+					return false;
+				}
+				continue;
+			}
+			in.seekg(entry.offset + table.vertexOffset + (uint64_t)stored.firstVertex * VertexSize());
+			in.read(reinterpret_cast<char*>(vertices) + (size_t)block.firstVertex * VertexSize(), (size_t)block.nrVertices * VertexSize());
+			in.seekg(entry.indexOffset + (uint64_t)stored.firstIndex * IndexSize());
+			in.read(reinterpret_cast<char*>(triangles) + (size_t)block.firstIndex * IndexSize(), (size_t)block.nrIndices * IndexSize());
+		}
+		if (!in) {
+			std::cout << "Error: could not read the kept blocks from " << path << std::endl;
+			in.clear();
+			return false;
+		}
+		return true;
+	}
+
+	// only with inMemory
+	MeshView GetFrame(int frame) {
+		MeshView view;
+		if (data != NULL) {
+			const MeshFrameEntry& entry = entries[frame];
+			view.vertices = data + entry.offset;
+			view.triangles = data + entry.indexOffset;
+			view.nrVertices = entry.nrVertices;
+			view.nrTriangles = entry.nrTriangles;
+			if (Quantized()) {
+				const MeshBlockTable* table = reinterpret_cast<const MeshBlockTable*>(data + entry.offset);
+				view.blocks = reinterpret_cast<const MeshBlock*>(table + 1);
+				view.nrBlocks = table->nrBlocks;
+				view.keptSources = reinterpret_cast<const MeshBlockSource*>(view.blocks + view.nrBlocks);
+				view.nrKeptBlocks = table->nrKeptBlocks;
+				view.vertices = data + entry.offset + table->vertexOffset;
+				view.meshlets = reinterpret_cast<const Meshlet*>(view.keptSources + view.nrKeptBlocks);
+				view.nrMeshlets = table->nrMeshlets;
+			}
+			else if (entry.offset + entry.size > MeshletTableOffset(entry)) {
+				const MeshletTable* table = reinterpret_cast<const MeshletTable*>(data + MeshletTableOffset(entry));
+				view.meshlets = reinterpret_cast<const Meshlet*>(table + 1);
+				view.nrMeshlets = table->nrMeshlets;
+			}
+			if (!ValidMeshlets(view.meshlets, view.nrMeshlets, Quantized() ? view.nrBlocks : 1)) {
+				view.meshlets = NULL;
+				view.nrMeshlets = 0;
+			}
+		}
+		else if (Compressed()) {
+			const QuantizedMesh& m = decodedMeshes[frame];
+			view.vertices = m.vertices.data();
+			view.triangles = m.indices.data();
+			view.nrVertices = entries[frame].nrVertices;
+			view.nrTriangles = entries[frame].nrTriangles;
+			view.blocks = m.blocks.data();
+			view.nrBlocks = (int)m.blocks.size();
+			view.keptSources = m.keptSources.data();
+			view.nrKeptBlocks = (int)m.keptSources.size();
+			view.meshlets = m.meshlets.data();
+			view.nrMeshlets = (int)m.meshlets.size();
+		}
+		else {
+			const Mesh& m = meshes[frame];
+			view.vertices = m.vertices.data();
+			view.triangles = m.triangles.data();
+			view.nrVertices = (int)m.vertices.size() / 3;
+			view.nrTriangles = (int)m.triangles.size() / 3;
+		}
+		return view;
+	}
+
+	// only with inMemory: where the vertices and indices of a (stored) block of a v3 or v4 frame are
+	void GetBlock(const MeshBlockSource& source, /*out*/ const void*& vertices, /*out*/ const void*& indices) {
+		MeshView m = GetFrame(source.frame);
+		const MeshBlock& block = m.blocks[source.block];
+		vertices = reinterpret_cast<const uint8_t*>(m.vertices) + (size_t)block.firstVertex * VertexSize();
+		indices = reinterpret_cast<const uint8_t*>(m.triangles) + (size_t)block.firstIndex * IndexSize();
+	}
+
+	void Close() {
+#ifdef _WIN32
+		if (data != NULL) UnmapViewOfFile(data);
+		if (mapping != NULL) CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+		mapping = NULL;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (data != NULL) munmap((void*)data, size);
+#endif
+		data = NULL;
+		meshes.clear();
+		decodedMeshes.clear();
+		entries.clear();
+		nrFrames = 0;
+	}
+
+private:
+	// v4: reads the whole payload of the frame at once, and decodes the chunks of the blocks that it stores (see ReadFrame())
+	bool ReadCompressedFrame(std::ifstream& in, int frame, /*out*/ void* vertices, /*out*/ void* triangles, /*out*/ std::vector<MeshBlock>& blocks,
+		/*out*/ std::vector<MeshBlockSource>& keptSources, /*out*/ std::vector<Meshlet>& meshlets, MeshReadBuffers& buffers) {
+		const MeshFrameEntry& entry = entries[frame];
+		std::vector<uint8_t>& payload = buffers.payload;
+		payload.resize(entry.size);
+		in.seekg(entry.offset);
+		in.read(reinterpret_cast<char*>(payload.data()), payload.size());
+		MeshBlockTable table;
+		bool valid = in && payload.size() >= sizeof(table);
+		if (valid) {
+			memcpy(&table, payload.data(), sizeof(table));
+			valid = table.nrKeptBlocks <= table.nrBlocks
+				&& ChunkTableOffset(table) + (uint64_t)(table.nrBlocks - table.nrKeptBlocks) * sizeof(MeshChunk) <= payload.size();
+		}
+		if (valid) {
+			size_t nrStoredBlocks = table.nrBlocks - table.nrKeptBlocks;
+			const uint8_t* tables = payload.data() + sizeof(table);
+			blocks.resize(table.nrBlocks);
+			keptSources.resize(table.nrKeptBlocks);
+			meshlets.resize(table.nrMeshlets);
+			std::vector<MeshChunk> chunks(nrStoredBlocks);
+			memcpy(blocks.data(), tables, blocks.size() * sizeof(MeshBlock));
+			tables += blocks.size() * sizeof(MeshBlock);
+			memcpy(keptSources.data(), tables, keptSources.size() * sizeof(MeshBlockSource));
+			tables += keptSources.size() * sizeof(MeshBlockSource);
+			memcpy(meshlets.data(), tables, meshlets.size() * sizeof(Meshlet));
+			tables += meshlets.size() * sizeof(Meshlet);
+			memcpy(chunks.data(), tables, chunks.size() * sizeof(MeshChunk));
+			valid = ValidMeshlets(meshlets.data(), (int)meshlets.size(), (int)blocks.size());
+			for (size_t b = 0; b < nrStoredBlocks && valid; b++) {
+				const MeshBlock& block = blocks[b];
+				valid = (uint64_t)chunks[b].offset + chunks[b].size <= payload.size()
+					&& (uint64_t)block.firstVertex + block.nrVertices <= entry.nrVertices && (uint64_t)block.firstIndex + block.nrIndices <= 3 * (uint64_t)entry.nrTriangles
+					&& MeshCodec::Decode(payload.data() + chunks[b].offset, chunks[b].size, reinterpret_cast<uint16_t*>(vertices) + 3 * (size_t)block.firstVertex, block.nrVertices,
+						reinterpret_cast<uint16_t*>(triangles) + block.firstIndex, block.nrIndices, buffers.planes);
+			}
+		}
+		if (!valid) {
+			std::cout << "Error: could not read mesh " << frame << " from " << path << std::endl;
+			in.clear();
+			blocks.clear();
+			keptSources.clear();
+			meshlets.clear();
+			return false;
+		}
+		return true;
+	}
+
+	// v4 with inMemory: decodes all frames (those that can not be read are empty)
+	bool DecodeV4(int nrThreads) {
+		decodedMeshes = std::vector<QuantizedMesh>(nrFrames);
+		ForAllFrames(nrThreads, [this](std::ifstream& in, MeshReadBuffers& buffers, int frame) {
+			QuantizedMesh& m = decodedMeshes[frame];
+			m.vertices.resize(3 * (size_t)entries[frame].nrVertices);
+			m.indices.resize(3 * (size_t)entries[frame].nrTriangles);
+			if (!ReadFrame(in, frame, m.vertices.data(), m.indices.data(), m.blocks, m.keptSources, m.meshlets, buffers)) {
+				m.indices.clear();
+			}
+		});
+		for (int frame = 0; frame < nrFrames; frame++) {
+			if (decodedMeshes[frame].indices.empty()) entries[frame].nrTriangles = 0;
+		}
+		printf("Decoded %d meshes (v4) on %d threads\n", nrFrames, nrThreads);
+		return true;
+	}
+
+	// v2: where the MeshletTable of the frame would start
+	static uint64_t MeshletTableOffset(const MeshFrameEntry& entry) {
+		return (entry.indexOffset + 12 * (uint64_t)entry.nrTriangles + 63) / 64 * 64;
+	}
+
+	// v3 and v4: the size of the MeshBlockTable and everything up to the MeshChunks
+	static uint64_t ChunkTableOffset(const MeshBlockTable& table) {
+		return sizeof(table) + (uint64_t)table.nrBlocks * sizeof(MeshBlock) + (uint64_t)table.nrKeptBlocks * sizeof(MeshBlockSource)
+			+ (uint64_t)table.nrMeshlets * sizeof(Meshlet);
+	}
+
+	// v2: reads the meshlets of the frame, none if it has no MeshletTable (or it does not fit in the payload)
+	void ReadMeshletsV2(std::ifstream& in, const MeshFrameEntry& entry, /*out*/ std::vector<Meshlet>& meshlets) {
+		uint64_t tableOffset = MeshletTableOffset(entry);
+		MeshletTable table;
+		if (entry.offset + entry.size <= tableOffset) return;
+		in.seekg(tableOffset);
+		if (!in.read(reinterpret_cast<char*>(&table), sizeof(table))
+			|| tableOffset + sizeof(table) + (uint64_t)table.nrMeshlets * sizeof(Meshlet) > entry.offset + entry.size) {
+			in.clear();
+			return;
+		}
+		meshlets.resize(table.nrMeshlets);
+		in.read(reinterpret_cast<char*>(meshlets.data()), meshlets.size() * sizeof(Meshlet));
+		if (!in || !ValidMeshlets(meshlets.data(), (int)meshlets.size(), 1)) meshlets.clear();
+		in.clear();
+	}
+
+	// the meshlets are drawn instead of the blocks, so every one must be in a block
+	static bool ValidMeshlets(const Meshlet* meshlets, int nrMeshlets, int nrBlocks) {
+		for (int k = 0; k < nrMeshlets; k++) {
+			if (meshlets[k].block >= (uint32_t)nrBlocks) return false;
+		}
+		return true;
+	}
+
+	bool ReadIndexV2(const std::string& path) {
+		std::ifstream in(path, std::ios::binary);
+		in.seekg(0, std::ios::end);
+		uint64_t fileSize = (uint64_t)in.tellg();
+		in.seekg(0);
+		MeshFileHeader header;
+		if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.version < 2 || header.version > 4 || header.nrLevels > (uint32_t)maxNrLevels
+			|| header.frameTableOffset + (uint64_t)header.nrFrames * sizeof(MeshFrameEntry) > fileSize) {
+			std::cout << "Error: " << path << " is not a valid v2, v3 or v4 mesh file" << std::endl;
+			return false;
+		}
+		version = header.version;
+		entries.resize(header.nrFrames);
+		in.seekg(header.frameTableOffset);
+		in.read(reinterpret_cast<char*>(entries.data()), entries.size() * sizeof(MeshFrameEntry));
+		// an unfinished file (e.g. CreateMeshes is still running) only has the first frames
+		nrFrames = 0;
+		while (nrFrames < (int)header.nrFrames && entries[nrFrames].size > 0 && entries[nrFrames].offset + entries[nrFrames].size <= fileSize) {
+			nrFrames++;
+		}
+		entries.resize(nrFrames);
+		if (nrFrames == 0) {
+			std::cout << "Error: " << path << " does not contain any frames" << std::endl;
+			return false;
+		}
+		if (nrFrames < (int)header.nrFrames) {
+			std::cout << "Warning: " << path << " only contains " << nrFrames << " of its " << header.nrFrames << " frames" << std::endl;
+		}
+		maxNrVertices = header.maxNrVertices;
+		maxNrTriangles = header.maxNrTriangles;
+		nrLevels = std::max((int)header.nrLevels, 1);
+		return true;
+	}
+
+	bool ReadIndexV1(const std::string& path) {
+		std::ifstream in(path, std::ios::binary);
+		in.seekg(0, std::ios::end);
+		uint64_t fileSize = (uint64_t)in.tellg();
+		uint64_t position = 0;
+		while (position + 8 <= fileSize) {
+			int32_t counts[2];
+			in.seekg(position);
+			if (!in.read(reinterpret_cast<char*>(counts), sizeof(counts)) || counts[0] < 0 || counts[1] < 0) break;
+			MeshFrameEntry entry;
+			entry.offset = position + 8;
+			entry.nrVertices = counts[0];
+			entry.nrTriangles = counts[1];
+			entry.indexOffset = entry.offset + 12 * (uint64_t)entry.nrVertices;
+			entry.size = 12 * ((uint64_t)entry.nrVertices + entry.nrTriangles);
+			if (entry.offset + entry.size > fileSize) break;
+			entries.push_back(entry);
+			maxNrVertices = maxNrVertices < counts[0] ? counts[0] : maxNrVertices;
+			maxNrTriangles = maxNrTriangles < counts[1] ? counts[1] : maxNrTriangles;
+			position = entry.offset + entry.size;
+		}
+		nrFrames = (int)entries.size();
+		if (nrFrames == 0) {
+			std::cout << "Error: " << path << " does not contain any frames" << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	bool MapV2(const std::string& path) {
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		LARGE_INTEGER fileSize;
+		if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize)) {
+			std::cout << "Error: could not open " << path << std::endl;
+			Close();
+			return false;
+		}
+		size = (uint64_t)fileSize.QuadPart;
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping != NULL) {
+			data = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		}
+#else
+		int fd = open(path.c_str(), O_RDONLY);
+		struct stat st;
+		if (fd < 0 || fstat(fd, &st) != 0) {
+			std::cout << "Error: could not open " << path << std::endl;
+			if (fd >= 0) close(fd);
+			return false;
+		}
+		size = (uint64_t)st.st_size;
+		void* mapped = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd); // the mapping stays valid
+		if (mapped != MAP_FAILED) {
+			data = (const uint8_t*)mapped;
+		}
+#endif
+		if (data == NULL) {
+			std::cout << "Error: could not memory-map " << path << std::endl;
+			Close();
+			return false;
+		}
+		printf("Mapped %d meshes (v%d)\n", nrFrames, version);
+		return true;
+	}
+
+	bool ReadV1(const std::string& path) {
+		std::ifstream in(path, std::ios::binary);
+		meshes.resize(nrFrames);
+		for (int frame = 0; frame < nrFrames; frame++) {
+			const MeshFrameEntry& entry = entries[frame];
+			Mesh& m = meshes[frame];
+			m.vertices.resize(3 * (size_t)entry.nrVertices);
+			m.triangles.resize(3 * (size_t)entry.nrTriangles);
+			in.seekg(entry.offset);
+			in.read(reinterpret_cast<char*>(m.vertices.data()), m.vertices.size() * sizeof(float));
+			in.read(reinterpret_cast<char*>(m.triangles.data()), m.triangles.size() * sizeof(uint32_t));
+		}
+		if (!in) {
+			std::cout << "Error: could not read " << path << std::endl;
+			return false;
+		}
+		printf("Loaded %d meshes (v1, convert with ConvertMeshes to memory-map them instead)\n", nrFrames);
+		return true;
+	}
+};
+
+
+#endif
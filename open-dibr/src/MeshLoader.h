@@ -0,0 +1,191 @@
+#ifndef MESH_LOADER_H
+#define MESH_LOADER_H
+
+
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include "MeshFile.h"
+
+
+/*
+* MeshLoader reads the meshes of the upcoming frames from meshes.bin on its own threads, so that the render thread does not wait for the disk.
+*
+* It has a window of slots that are recycled: the loader threads take the frames in playback order
+* (firstFrame, firstFrame + 1, ..., wrapping around at the end of the file) and read them into them, at most windowSize frames ahead of
+* the render thread. One thread suffices to read a v2 or v3 file, but the frames of a v4 file also have to be decoded,
+* so then several threads each read and decode a frame of their own (which can finish out of order). So the memory that is used only depends on windowSize, not on the length of the sequence.
+* The slots are either buffers of its own, or given to Init() (e.g. the persistently mapped mesh buffers of FrameBufferController,
+* so that the meshes are read straight into memory that the GPU can use, each slot large enough for the largest mesh).
+* The render thread calls WaitForNextFrame() (from FrameBufferController::ReceivedNewVideoFrame()) to get the next mesh,
+* and ReleaseFrame() once it no longer uses the oldest one (i.e. after uploading it, or once the GPU is done drawing it),
+* after which that slot is used for a later frame.
+* A frame that is not loaded yet when WaitForNextFrame() is called is counted as late, and the render thread waits for it.
+* The kept blocks of a v3 frame (see MeshBlockSource) are only read for the first frame: the render thread copies them from the frame before it.
+*/
+class MeshLoader {
+	std::vector<std::thread> loaders;
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::vector<std::vector<uint8_t>> buffers; // only if the slots are not given to Init()
+	std::vector<uint8_t*> slotVertices;       // destination of the vertices and indices of each slot
+	std::vector<uint8_t*> slotTriangles;
+	std::vector<std::vector<MeshBlock>> slotBlocks; // of a quantized mesh
+	std::vector<std::vector<MeshBlockSource>> slotKeptSources;
+	std::vector<std::vector<Meshlet>> slotMeshlets;
+	std::vector<MeshView> slotMeshes;         // what is in each slot
+	std::vector<long long> slotSequenceNrs;   // which frame is in each slot (0 for firstFrame, 1 for the one after it, ...), -1 if none
+	long long nextSequenceNrToLoad = 0;       // the next frame that a loader thread takes
+	long long nrLoaded = 0;
+	long long nrReleased = 0;                 // the frames with a lower sequence nr are released by the render thread
+	long long nrWaitedFor = 0;                // the sequence nr of the next WaitForNextFrame()
+	bool terminate_loader = false;
+
+	MeshFile* meshes = NULL;
+	int windowSize = 8;
+	int firstFrame = 0;
+
+	// statistics
+	int nrLateFrames = 0;
+	double waitedMs = 0.0;
+
+public:
+	MeshLoader() {}
+
+	// with buffers of its own
+	void Init(MeshFile* meshes, int windowSize, int firstFrame, int nrThreads = 1) {
+		buffers = std::vector<std::vector<uint8_t>>(2 * windowSize);
+		std::vector<uint8_t*> vertices;
+		std::vector<uint8_t*> triangles;
+		for (int slot = 0; slot < windowSize; slot++) {
+			buffers[2 * slot].resize((size_t)meshes->MaxNrVertices() * meshes->VertexSize());
+			buffers[2 * slot + 1].resize(3 * (size_t)meshes->MaxNrTriangles() * meshes->IndexSize());
+			vertices.push_back(buffers[2 * slot].data());
+			triangles.push_back(buffers[2 * slot + 1].data());
+		}
+		Init(meshes, vertices, triangles, firstFrame, nrThreads);
+	}
+
+	// each slot must have room for MaxNrVertices() vertices and MaxNrTriangles() triangles of the MeshFile (see VertexSize() and IndexSize())
+	void Init(MeshFile* meshes, const std::vector<uint8_t*>& slotVertices, const std::vector<uint8_t*>& slotTriangles, int firstFrame, int nrThreads = 1) {
+		this->meshes = meshes;
+		this->windowSize = (int)slotVertices.size();
+		this->firstFrame = firstFrame;
+		this->slotVertices = slotVertices;
+		this->slotTriangles = slotTriangles;
+		slotBlocks = std::vector<std::vector<MeshBlock>>(windowSize);
+		slotKeptSources = std::vector<std::vector<MeshBlockSource>>(windowSize);
+		slotMeshlets = std::vector<std::vector<Meshlet>>(windowSize);
+		slotMeshes = std::vector<MeshView>(windowSize);
+		slotSequenceNrs = std::vector<long long>(windowSize, -1);
+		nextSequenceNrToLoad = 0;
+		nrLoaded = 0;
+		nrReleased = 0;
+		nrWaitedFor = 0;
+		terminate_loader = false;
+		for (int t = 0; t < nrThreads; t++) {
+			loaders.push_back(std::thread(&MeshLoader::load_loop, this));
+		}
+
+		// fill the window before playback starts, so that only frames that are late during playback are counted
+		std::unique_lock<std::mutex> lock(mutex);
+		condition.wait(lock, [this] { return nrLoaded >= this->windowSize; });
+	}
+
+	// blocks until the next frame (in playback order) is loaded, frame is set to its index in meshes.bin and slot to the slot it is in
+	MeshView WaitForNextFrame(/*out*/ int& frame, /*out*/ int& slot) {
+		std::unique_lock<std::mutex> lock(mutex);
+		long long sequenceNr = nrWaitedFor++;
+		slot = (int)(sequenceNr % windowSize);
+		if (slotSequenceNrs[slot] != sequenceNr) {
+			nrLateFrames++;
+			auto start = std::chrono::steady_clock::now();
+			int s = slot;
+			condition.wait(lock, [this, s, sequenceNr] { return slotSequenceNrs[s] == sequenceNr; });
+			waitedMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}
+		frame = (int)((firstFrame + sequenceNr) % meshes->NrFrames());
+		return slotMeshes[slot];
+	}
+
+	// the oldest MeshView of WaitForNextFrame() that was not released yet is no longer used
+	void ReleaseFrame() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			nrReleased++;
+		} // to unlock
+		condition.notify_all();
+	}
+
+	void Cleanup() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			terminate_loader = true;
+		} // to unlock
+		condition.notify_all();
+		for (std::thread& loader : loaders) {
+			loader.join();
+		}
+		if (!loaders.empty()) {
+			printf("Mesh loader: %d of %lld meshes were not loaded in time (waited %.1f ms in total, %d threads)\n", nrLateFrames, nrWaitedFor, waitedMs, (int)loaders.size());
+		}
+		loaders.clear();
+		buffers.clear();
+	}
+
+private:
+	void load_loop() {
+		std::ifstream in(meshes->Path(), std::ios::binary);
+		MeshReadBuffers readBuffers;
+		while (true) {
+			long long sequenceNr;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				condition.wait(lock, [this] { return terminate_loader || nextSequenceNrToLoad < nrReleased + windowSize; });
+				if (terminate_loader) {
+					break;
+				}
+				sequenceNr = nextSequenceNrToLoad++;
+			}
+
+			// the slot is not used by the render thread, since its previous frame is released
+			int frame = (int)((firstFrame + sequenceNr) % meshes->NrFrames());
+			int slot = (int)(sequenceNr % windowSize);
+			const MeshFrameEntry& entry = meshes->GetEntry(frame);
+			MeshView m;
+			m.vertices = slotVertices[slot];
+			m.triangles = slotTriangles[slot];
+			m.nrVertices = entry.nrVertices;
+			m.nrTriangles = entry.nrTriangles;
+			if (!meshes->ReadFrame(in, frame, slotVertices[slot], slotTriangles[slot], slotBlocks[slot], slotKeptSources[slot], slotMeshlets[slot], readBuffers)) {
+				m.nrVertices = 0;
+				m.nrTriangles = 0;
+				slotBlocks[slot].clear();
+				slotKeptSources[slot].clear();
+				slotMeshlets[slot].clear();
+			}
+			m.blocks = slotBlocks[slot].data();
+			m.nrBlocks = (int)slotBlocks[slot].size();
+			m.keptSources = slotKeptSources[slot].data();
+			m.nrKeptBlocks = (int)slotKeptSources[slot].size();
+			m.meshlets = slotMeshlets[slot].data();
+			m.nrMeshlets = (int)slotMeshlets[slot].size();
+			// there is no frame before the first one to copy the kept blocks from
+			if (sequenceNr == 0 && m.nrKeptBlocks > 0) {
+				m.keptBlocksLoaded = meshes->ReadKeptBlocks(in, m, slotVertices[slot], slotTriangles[slot], readBuffers);
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				slotMeshes[slot] = m;
+				slotSequenceNrs[slot] = sequenceNr;
+				nrLoaded++;
+			} // to unlock
+			condition.notify_all();
+		}
+	}
+};
+
+
+#endif
@@ -493,15 +493,18 @@ void VRApplication::RenderScene()
 		if (eye == vr::EVREye::Eye_Right) {
 			shaders.shader.setMat4("project", pcOutputCamera.projectionRight);
 		}
+		// the view of vertex.fs for this eye
+		glm::mat4 project = eye == vr::EVREye::Eye_Left ? pcOutputCamera.projectionLeft : pcOutputCamera.projectionRight;
+		Frustum frustum = Frustum::FromMatrix(project * pcOutputCamera.view);
 
 		if (options.inpaint && !useWireframe) {
 			shaders.shader.use();
-			framebuffers.renderMesh(textures_color, textures_depth, current_inputsToUse, texture_out_color_tmp, texture_out_depth_tmp);
+			framebuffers.renderMesh(textures_color, textures_depth, current_inputsToUse, frustum, texture_out_color_tmp, texture_out_depth_tmp);
 			shaders.inpaintShader.use();
 			framebuffers.InpaintImage(eye, texture_out_color_tmp, texture_out_depth_tmp);
 		}
 		else {
-			framebuffers.renderMesh(eye, textures_color, textures_depth, current_inputsToUse);
+			framebuffers.renderMesh(eye, textures_color, textures_depth, current_inputsToUse, frustum);
 		}
 	}
 }
@@ -3,6 +3,10 @@
 
 #include "ioHelper.h"
 #include "shader.h"
+#include "MeshFile.h"
+#include "MeshLoader.h"
+#include "Frustum.h"
+#include "LodSelector.h"
 
 /*
 * The ShaderController initializes the OpenGL shaders (in init()) and
@@ -147,12 +151,6 @@ public:
 	}
 };
 
-struct Mesh {
-	std::vector<float> vertices;
-	std::vector<uint32_t> triangles;
-};
-
-
 class FrameBufferController {
 private:
 	// FBOs:
@@ -170,8 +168,58 @@ private:
 	std::vector<GLuint> VAO, VBO, EBO;   // for mesh
 	unsigned int quadVAO, quadVBO = 0; // for copying
 
-	std::vector<Mesh> meshes;
+	MeshFile meshes;
+	MeshLoader loader;
+	int nrMeshThreads = 1;               // that read the meshes (and decode them, for a v4 file)
+	// with residentMeshes, the meshes of all frames are uploaded to VAO[0] once, one after the other, so playing the video
+	// only changes which range of the buffers is drawn (see UploadAllMeshes())
+	struct MeshRange {
+		GLint baseVertex;
+		size_t indexOffset;              // in bytes
+		int nrIndices;
+		std::vector<MeshBlock> blocks;
+		std::vector<Meshlet> meshlets;
+	};
+	bool residentMeshes = false;
+	std::vector<MeshRange> meshRanges;   // per frame
+	bool streamMeshes = false;           // if true, the loader reads the meshes ahead of time, otherwise they are all in memory (see MeshFile)
+	int nrIndicesPerVao[2] = { 0, 0 };   // of the mesh that is uploaded to each VAO
+	// with persistentMeshes, VAO[0] has a ring of slots (each large enough for the largest mesh) in persistently mapped buffers,
+	// which the loader thread reads the meshes into. Switching to the next mesh then only changes baseVertex and indexOffset,
+	// and a fence tells when the GPU is done with a slot. Otherwise the meshes are uploaded to the two VAOs with glBufferSubData().
+	bool persistentMeshes = false;
+	GLsync retiredMeshFence = 0;         // after the last draw call with the previous mesh
+	GLint baseVertex = 0;                // of the current mesh in the ring
+	size_t indexOffset = 0;              // in bytes
 	int nrIndices;
+	// a quantized mesh (v3) is drawn block by block, with the decode matrix of the block as meshDecode
+	std::vector<MeshBlock> meshBlocks;   // of the mesh that is drawn, empty if it is not quantized
+	std::vector<MeshBlock> blocksPerVao[2];
+	// if the mesh file has meshlets, DrawMesh() only draws those that may be in the view frustum,
+	// with one glMultiDrawElementsBaseVertex() per block (its meshlets that follow each other in the indices are merged into one range)
+	bool cullMeshlets = true;
+	bool cullBackfacingMeshlets = false;
+	std::vector<Meshlet> meshMeshlets;   // of the mesh that is drawn
+	std::vector<Meshlet> meshletsPerVao[2];
+	std::vector<GLsizei> drawCounts;     // DrawMesh(): the ranges of the indices of one block
+	std::vector<const void*> drawOffsets;
+	std::vector<GLint> drawBaseVertices;
+	long long nrMeshletsTested = 0;      // statistics of the culling
+	long long nrMeshletsDrawn = 0;
+	long long nrIndicesTested = 0;
+	long long nrIndicesDrawn = 0;
+	// if the mesh file has levels of detail, DrawMesh() only draws the meshlets of the level that lod picked for their input camera
+	LodSelector lod;
+	// the kept blocks of a v3 mesh (see MeshBlockSource) are not uploaded again, but copied on the GPU from where they are in the mesh before it.
+	// A block is identified by the frame that stores it and its index in that frame (see BlockId())
+	std::vector<uint64_t> meshBlockIds;  // persistentMeshes: of the mesh that is drawn
+	std::vector<uint64_t> blockIdsPerVao[2];
+	int framePerVao[2] = { -1, -1 };
+	std::unordered_map<uint64_t, int> previousBlocks; // CopyKeptBlocks(): block id -> index in the blocks of the mesh before
+	std::vector<std::pair<const MeshBlock*, const MeshBlock*>> copies; // CopyKeptBlocks(): (from, to) per kept block
+	double uploadedMB = 0.0;             // statistics of the streamed meshes
+	double copiedMB = 0.0;
+	GLenum indexType = GL_UNSIGNED_INT;
 	int nrFrames;
 	int currFrame = 0;
 
@@ -241,36 +289,24 @@ public:
 		}
 
 		//----------------------------------------
-		// load in depth.bin fully
+		// open meshes.bin: if the meshes of all frames fit in options.meshGpuBudget, they are uploaded to the GPU at once.
+		// Otherwise, with --static or --mesh_window 0, all meshes are in memory (v2 files are memory-mapped, so only the frame that is shown is read),
+		// and else the loader reads the next options.meshWindow meshes on its own thread
 		printf("Reading in %s\n", options.meshPath.c_str());
-		std::ifstream in(options.meshPath, std::ios::binary);
-		int maxNrIndices = 0;
-		int maxNrPositions = 0;
-		nrFrames = 0;
-		while (true) {
-			int n_vertices, n_triangles;
-			if (!in.read(reinterpret_cast<char*>(&n_vertices), sizeof(int))) break;
-			if (!in.read(reinterpret_cast<char*>(&n_triangles), sizeof(int))) break;
-
-			Mesh m;
-			m.vertices.resize(n_vertices * 3);
-			m.triangles.resize(n_triangles * 3);
-
-			in.read(reinterpret_cast<char*>(m.vertices.data()), m.vertices.size() * sizeof(float));
-			in.read(reinterpret_cast<char*>(m.triangles.data()), m.triangles.size() * sizeof(uint32_t));
-			
-			if (!in) break;
-
-			maxNrIndices = maxNrIndices < m.triangles.size() ? m.triangles.size() : maxNrIndices;
-			maxNrPositions = maxNrPositions < m.vertices.size() ? m.vertices.size() : maxNrPositions;
-			meshes.push_back(std::move(m));
-
-			nrFrames++;
+		if (!meshes.Open(options.meshPath, false)) {
+			throw std::runtime_error("could not read " + options.meshPath);
 		}
-		in.close();
-		nrFrames = meshes.size();
-		printf("Loaded %d meshes\n", nrFrames);
-		//printf("maxNrVertices = %d, maxNrTriangles = %d\n", maxNrPositions / 3, maxNrIndices / 3);
+		nrFrames = meshes.NrFrames();
+		// the meshes start at the same frame as the videos
+		currFrame = options.StartingFrameNr % nrFrames;
+		// in bytes
+		size_t maxVerticesSize = (size_t)meshes.MaxNrVertices() * meshes.VertexSize();
+		size_t maxIndicesSize = 3 * (size_t)meshes.MaxNrTriangles() * meshes.IndexSize();
+		indexType = meshes.Quantized() ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+		nrMeshThreads = meshes.Compressed() ? options.meshDecoderThreads : 1;
+		cullMeshlets = options.cullMeshlets;
+		cullBackfacingMeshlets = options.cullBackfacingMeshlets;
+		lod.Init(inputCameras, meshes.NrLevels(), options);
 
 		VAO = std::vector<GLuint>(N_VAO);
 		VBO = std::vector<GLuint>(N_VAO);
@@ -279,23 +315,77 @@ public:
 		glGenBuffers(N_VAO, VBO.data());
 		glGenBuffers(N_VAO, EBO.data());
 
-		for (int i = 0; i < N_VAO; i++) {
-			glBindVertexArray(VAO[i]);
-			// vertex positions
-			glBindBuffer(GL_ARRAY_BUFFER, VBO[i]);
-			glBufferData(GL_ARRAY_BUFFER, maxNrPositions * sizeof(float), nullptr, GL_DYNAMIC_DRAW);
-			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-			glEnableVertexAttribArray(0);
-
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO[i]);
-			glBufferData(GL_ELEMENT_ARRAY_BUFFER, maxNrIndices * sizeof(uint32_t), nullptr, GL_DYNAMIC_DRAW);
+		residentMeshes = false;
+		if (!options.isStatic && options.meshGpuBudget > 0) {
+			double totalMB = meshes.TotalSize() / (1024.0 * 1024.0);
+			if (totalMB <= options.meshGpuBudget) {
+				residentMeshes = UploadAllMeshes();
+			}
+			else {
+				printf("The meshes (%.1f MB) do not fit in --mesh_gpu_budget (%d MB), so they are streamed\n", totalMB, options.meshGpuBudget);
+			}
+		}
+		streamMeshes = !residentMeshes && !options.isStatic && options.meshWindow > 0;
+		if (streamMeshes) {
+			printf("Streaming %d meshes (v%d)\n", nrFrames, meshes.Version());
+		}
+		else if (!residentMeshes && !meshes.LoadIntoMemory(nrMeshThreads)) {
+			throw std::runtime_error("could not read " + options.meshPath);
 		}
 
-		currFrame = 0;
+		persistentMeshes = streamMeshes && GLEW_ARB_buffer_storage;
 		curr_vao = 0;
-		nrIndices = meshes[0].triangles.size();
-		// initialize with first mesh
-		UpdateMesh(curr_vao, currFrame);
+		if (residentMeshes) {
+			SwitchToResidentMesh(currFrame);
+		}
+		else if (persistentMeshes) {
+			// one slot for the mesh that is drawn, one for the previous mesh that the GPU may still be drawing, and at least one to load into
+			int nrSlots = std::max(3, options.meshWindow);
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBindVertexArray(VAO[0]);
+			glBindBuffer(GL_ARRAY_BUFFER, VBO[0]);
+			glBufferStorage(GL_ARRAY_BUFFER, (GLsizeiptr)(nrSlots * maxVerticesSize), nullptr, flags);
+			uint8_t* mappedVertices = (uint8_t*)glMapBufferRange(GL_ARRAY_BUFFER, 0, (GLsizeiptr)(nrSlots * maxVerticesSize), flags);
+			SetVertexFormat();
+
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO[0]);
+			glBufferStorage(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)(nrSlots * maxIndicesSize), nullptr, flags);
+			uint8_t* mappedIndices = (uint8_t*)glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0, (GLsizeiptr)(nrSlots * maxIndicesSize), flags);
+			glBindVertexArray(0);
+
+			std::vector<uint8_t*> slotVertices;
+			std::vector<uint8_t*> slotIndices;
+			for (int slot = 0; slot < nrSlots; slot++) {
+				slotVertices.push_back(mappedVertices + slot * maxVerticesSize);
+				slotIndices.push_back(mappedIndices + slot * maxIndicesSize);
+			}
+			loader.Init(&meshes, slotVertices, slotIndices, currFrame, nrMeshThreads);
+			SwitchToNextMesh();
+		}
+		else {
+			if (streamMeshes) {
+				loader.Init(&meshes, options.meshWindow, currFrame, nrMeshThreads);
+			}
+			for (int i = 0; i < N_VAO; i++) {
+				glBindVertexArray(VAO[i]);
+				// vertex positions
+				glBindBuffer(GL_ARRAY_BUFFER, VBO[i]);
+				glBufferData(GL_ARRAY_BUFFER, maxVerticesSize, nullptr, GL_DYNAMIC_DRAW);
+				SetVertexFormat();
+
+				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO[i]);
+				glBufferData(GL_ELEMENT_ARRAY_BUFFER, maxIndicesSize, nullptr, GL_DYNAMIC_DRAW);
+			}
+
+			// initialize with the first mesh, and pre-upload the second one
+			UpdateMesh(curr_vao, currFrame);
+			if (!options.isStatic) {
+				UpdateMesh(next_vao(curr_vao), (currFrame + 1) % nrFrames);
+			}
+			nrIndices = nrIndicesPerVao[curr_vao];
+			meshBlocks = blocksPerVao[curr_vao];
+			meshMeshlets = meshletsPerVao[curr_vao];
+		}
 
 		//----------------------------------------
 
@@ -388,21 +478,55 @@ public:
 	}
 
 	void ReceivedNewVideoFrame() {
+		currFrame = (currFrame + 1) % nrFrames;
+		if (residentMeshes) {
+			SwitchToResidentMesh(currFrame);
+			return;
+		}
+		if (persistentMeshes) {
+			// the GPU is done with the mesh before the previous one (it was drawn a video frame ago), so its slot can be reused
+			if (retiredMeshFence != 0) {
+				while (glClientWaitSync(retiredMeshFence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {}
+				glDeleteSync(retiredMeshFence);
+				loader.ReleaseFrame();
+			}
+			// all draw calls with the current mesh are issued
+			retiredMeshFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			SwitchToNextMesh();
+			return;
+		}
+
 		// switch to the next vao, which already has a pre-loaded mesh ready
 		curr_vao = next_vao(curr_vao);
-
-		currFrame = (currFrame + 1) % nrFrames;
-		nrIndices = meshes[currFrame].triangles.size();
+		nrIndices = nrIndicesPerVao[curr_vao];
+		meshBlocks = blocksPerVao[curr_vao];
+		meshMeshlets = meshletsPerVao[curr_vao];
 
 		// pre-upload the next mesh
 		UpdateMesh(next_vao(curr_vao), (currFrame + 1) % nrFrames);
 	}
 
+	// the levels of detail of the current mesh that the next draws use, for a viewer at eye. True if a level changed,
+	// then the depth maps of the input views no longer match the levels
+	bool SelectLevelsOfDetail(const glm::vec3& eye) {
+		return lod.Select(eye, meshMeshlets);
+	}
+
+	// around everything that is drawn in a frame, to measure its GPU time for the triangle budget of the levels of detail
+	void BeginFrame() {
+		lod.BeginFrame();
+	}
+
+	void EndFrame() {
+		lod.EndFrame();
+	}
+
 	GLuint getColorTexture(int eyeOffset) {
 		return outputTexColors[index[eyeOffset] + (eyeOffset * 3)];
 	}
 
-	void renderMesh(GLuint* images, std::vector<GLuint> textures_depth, std::unordered_set<int> inputsToUse, /*out*/ GLuint outColorTex, GLuint outDepthTex) {
+	// the meshlets outside of frustum (the view of the shader that is in use) are skipped
+	void renderMesh(GLuint* images, std::vector<GLuint> textures_depth, std::unordered_set<int> inputsToUse, const Frustum& frustum, /*out*/ GLuint outColorTex, GLuint outDepthTex) {
 		glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[0]);
 		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, outColorTex, 0);
 		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, outDepthTex, 0);
@@ -417,10 +541,10 @@ public:
 			glBindTexture(GL_TEXTURE_2D, textures_depth[idx]);
 			i+= 1;
 		}
-		glDrawElements(GL_TRIANGLES, nrIndices, GL_UNSIGNED_INT, 0);
+		DrawMesh(frustum);
 	}
 
-	void renderMesh(int eyeOffset, GLuint* images, std::vector<GLuint> textures_depth, std::unordered_set<int> inputsToUse) {
+	void renderMesh(int eyeOffset, GLuint* images, std::vector<GLuint> textures_depth, std::unordered_set<int> inputsToUse, const Frustum& frustum) {
 		index[eyeOffset] = 0;
 		glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[index[eyeOffset] + (eyeOffset * 3)]); 
 		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, outputTexColors[index[eyeOffset]], 0);
@@ -435,7 +559,7 @@ public:
 			glBindTexture(GL_TEXTURE_2D, textures_depth[idx]);
 			i += 1;
 		}
-		glDrawElements(GL_TRIANGLES, nrIndices, GL_UNSIGNED_INT, 0);
+		DrawMesh(frustum);
 	}
 
 	void InpaintImage(int eyeOffset, GLuint colorTex, GLuint depthTex) {
@@ -452,13 +576,13 @@ public:
 		glDrawArrays(GL_TRIANGLES, 0, 6);
 	}
 
-	void renderMeshAsDepthTexture(GLuint outputTex) {
+	void renderMeshAsDepthTexture(GLuint outputTex, const Frustum& frustum) {
 		glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[0]);
 		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, outputTex, 0);
 		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, outputTexAngleAndDepth[0], 0);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 		glBindVertexArray(VAO[curr_vao]);
-		glDrawElements(GL_TRIANGLES, nrIndices, GL_UNSIGNED_INT, 0);
+		DrawMesh(frustum);
 	}
 
 	void dilateDepth(GLuint inputTex, GLuint outputTex) {
@@ -486,6 +610,22 @@ public:
 	}
 
 	void cleanup() {
+		// before the buffers are deleted, since the loader thread may still be writing to the mapped ring
+		if (streamMeshes) {
+			loader.Cleanup();
+		}
+		if (copiedMB > 0.0) {
+			printf("Meshes: uploaded %.1f MB, and copied %.1f MB of blocks that were kept from the previous frame on the GPU\n", uploadedMB, copiedMB);
+		}
+		if (nrMeshletsTested > 0) {
+			printf("Meshlets: drew %.1f%% of the meshlets (%.1f%% of the triangles), the others were outside of the view\n",
+				100.0 * nrMeshletsDrawn / nrMeshletsTested, 100.0 * nrIndicesDrawn / std::max(1LL, nrIndicesTested));
+		}
+		lod.Cleanup();
+		if (retiredMeshFence != 0) {
+			glDeleteSync(retiredMeshFence);
+			retiredMeshFence = 0;
+		}
 		glDeleteFramebuffers(nrFramebuffers, framebuffers);
 		glDeleteTextures(nrFramebuffers, outputTexColors);
 		glDeleteTextures(nrFramebuffers, outputTexAngleAndDepth);
@@ -493,6 +633,12 @@ public:
 		glDeleteVertexArrays(N_VAO, VAO.data());
 		glDeleteBuffers(N_VAO, VBO.data());
 		glDeleteBuffers(N_VAO, EBO.data());
+		meshes.Close();
+		meshRanges.clear();
+		meshBlocks.clear();
+		meshMeshlets.clear();
+		meshBlockIds.clear();
+		framePerVao[0] = framePerVao[1] = -1;
 		VAO.clear();
 		VBO.clear();
 		EBO.clear();
@@ -519,21 +665,335 @@ private:
 		return (index == N_VAO - 1) ? 0 : index + 1;
 	}
 
+	// the vertex attribute of the bound VAO and GL_ARRAY_BUFFER: float xyz, or uint16 xyz of a quantized mesh (converted to float, so meshDecode can decode them)
+	void SetVertexFormat() {
+		glVertexAttribPointer(0, 3, meshes.Quantized() ? GL_UNSIGNED_SHORT : GL_FLOAT, GL_FALSE, meshes.VertexSize(), (void*)0);
+		glEnableVertexAttribArray(0);
+	}
+
+	// draws the current mesh with the shader that is in use, whose vertex shader has the meshDecode uniform
+	void DrawMesh(const Frustum& frustum) {
+		static const float identity[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+		GLint program = 0;
+		glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+		GLint decodeLocation = glGetUniformLocation(program, "meshDecode");
+		// the levels of detail are told apart by their meshlets, so those are needed even without culling
+		if ((cullMeshlets || lod.Enabled()) && !meshMeshlets.empty()) {
+			DrawMeshlets(cullMeshlets ? frustum : Frustum(), decodeLocation);
+			return;
+		}
+		if (meshBlocks.empty()) {
+			glUniformMatrix4fv(decodeLocation, 1, GL_FALSE, identity);
+			glDrawElementsBaseVertex(GL_TRIANGLES, nrIndices, indexType, (void*)indexOffset, baseVertex);
+			return;
+		}
+		for (const MeshBlock& block : meshBlocks) {
+			glUniformMatrix4fv(decodeLocation, 1, GL_FALSE, block.decode);
+			glDrawElementsBaseVertex(GL_TRIANGLES, block.nrIndices, indexType, (void*)(indexOffset + block.firstIndex * sizeof(uint16_t)), baseVertex + block.firstVertex);
+		}
+	}
+
+	// the meshlets of the current mesh (of the selected levels of detail) that may be in frustum.
+	// A mesh that is not quantized is block 0, drawn with the identity as meshDecode
+	void DrawMeshlets(const Frustum& frustum, GLint decodeLocation) {
+		static const MeshBlock unquantized = { { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 }, 0, 0, 0, 0 };
+		size_t nrBlocks = meshBlocks.empty() ? 1 : meshBlocks.size();
+		bool selectLevels = lod.Enabled();
+		const MeshBlock* block = NULL;
+		uint32_t rangeEnd = 0; // of the last range of drawCounts, in the indices of the block
+		for (const Meshlet& meshlet : meshMeshlets) {
+			if (selectLevels && meshlet.level != lod.Level(meshlet.camera)) continue;
+			nrMeshletsTested++;
+			nrIndicesTested += meshlet.nrIndices;
+			// the blocks that could not be kept from the previous mesh are not drawn (see UpdateMesh())
+			if (meshlet.block >= nrBlocks || !frustum.MayBeVisible(meshlet, cullBackfacingMeshlets)) continue;
+			nrMeshletsDrawn++;
+			nrIndicesDrawn += meshlet.nrIndices;
+			const MeshBlock* meshletBlock = meshBlocks.empty() ? &unquantized : &meshBlocks[meshlet.block];
+			if (meshletBlock != block) {
+				DrawRanges(block, decodeLocation);
+				block = meshletBlock;
+			}
+			if (!drawCounts.empty() && meshlet.firstIndex == rangeEnd) {
+				drawCounts.back() += meshlet.nrIndices;
+			}
+			else {
+				drawCounts.push_back(meshlet.nrIndices);
+				drawOffsets.push_back((const void*)(indexOffset + ((size_t)block->firstIndex + meshlet.firstIndex) * meshes.IndexSize()));
+				drawBaseVertices.push_back(baseVertex + block->firstVertex);
+			}
+			rangeEnd = meshlet.firstIndex + meshlet.nrIndices;
+		}
+		DrawRanges(block, decodeLocation);
+	}
+
+	// draws the ranges of drawCounts, drawOffsets and drawBaseVertices (all of this block) and clears them
+	void DrawRanges(const MeshBlock* block, GLint decodeLocation) {
+		if (drawCounts.empty()) return;
+		glUniformMatrix4fv(decodeLocation, 1, GL_FALSE, block->decode);
+		glMultiDrawElementsBaseVertex(GL_TRIANGLES, drawCounts.data(), indexType, drawOffsets.data(), (GLsizei)drawCounts.size(), drawBaseVertices.data());
+		drawCounts.clear();
+		drawOffsets.clear();
+		drawBaseVertices.clear();
+	}
+
+	// residentMeshes: reads all frames straight into VAO[0], returns false if they do not fit in GPU memory.
+	// Only the vertices and indices that a frame stores are uploaded, its kept blocks are drawn from the frame that stores them
+	bool UploadAllMeshes() {
+		size_t totalNrVertices = 0;
+		size_t totalNrIndices = 0;
+		meshRanges = std::vector<MeshRange>(nrFrames);
+		std::vector<std::vector<MeshBlockSource>> keptSources(nrFrames);
+		std::ifstream in(meshes.Path(), std::ios::binary);
+		for (int frame = 0; frame < nrFrames; frame++) {
+			size_t nrStoredVertices, nrStoredIndices;
+			meshes.ReadBlocks(in, frame, meshRanges[frame].blocks, keptSources[frame], meshRanges[frame].meshlets);
+			MeshFile::StoredSize(meshes.GetView(frame, meshRanges[frame].blocks, keptSources[frame], meshRanges[frame].meshlets), nrStoredVertices, nrStoredIndices);
+			meshRanges[frame].baseVertex = (GLint)totalNrVertices;
+			meshRanges[frame].indexOffset = totalNrIndices * meshes.IndexSize();
+			meshRanges[frame].nrIndices = 3 * meshes.GetEntry(frame).nrTriangles;
+			totalNrVertices += nrStoredVertices;
+			totalNrIndices += nrStoredIndices;
+		}
+		in.close();
+		size_t verticesSize = totalNrVertices * meshes.VertexSize();
+		size_t indicesSize = totalNrIndices * meshes.IndexSize();
+
+		glBindVertexArray(VAO[0]);
+		glBindBuffer(GL_ARRAY_BUFFER, VBO[0]);
+		glBufferData(GL_ARRAY_BUFFER, verticesSize, nullptr, GL_STATIC_DRAW);
+		SetVertexFormat();
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO[0]);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indicesSize, nullptr, GL_STATIC_DRAW);
+		if (glGetError() == GL_OUT_OF_MEMORY) {
+			printf("The meshes do not fit in GPU memory, so they are streamed\n");
+			// free the memory again, the buffers are set up again for streaming
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, 0, nullptr, GL_STATIC_DRAW);
+			glBufferData(GL_ARRAY_BUFFER, 0, nullptr, GL_STATIC_DRAW);
+			glBindVertexArray(0);
+			meshRanges.clear();
+			return false;
+		}
+
+		uint8_t* vertices = (uint8_t*)glMapBufferRange(GL_ARRAY_BUFFER, 0, verticesSize, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		uint8_t* indices = (uint8_t*)glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0, indicesSize, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		if (vertices != NULL && indices != NULL) {
+			// every frame has its own range of the buffers, so they can be read (and decoded) in parallel
+			meshes.ForAllFrames(nrMeshThreads, [&](std::ifstream& in, MeshReadBuffers& buffers, int frame) {
+				MeshRange& range = meshRanges[frame];
+				if (!meshes.ReadFrame(in, frame, vertices + range.baseVertex * (size_t)meshes.VertexSize(), indices + range.indexOffset, range.blocks, keptSources[frame], range.meshlets, buffers)) {
+					range.nrIndices = 0;
+					range.blocks.clear();
+					range.meshlets.clear();
+					keptSources[frame].clear();
+				}
+			});
+			for (int frame = 0; frame < nrFrames; frame++) {
+				if (!meshRanges[frame].blocks.empty()) {
+					ResolveResidentBlocks(frame, keptSources[frame]);
+				}
+			}
+		}
+		// the contents of the buffers are lost if an unmap fails (e.g. the screen mode changed), so then the meshes are streamed instead
+		bool unmappedVertices = vertices != NULL && glUnmapBuffer(GL_ARRAY_BUFFER) == GL_TRUE;
+		bool unmappedIndices = indices != NULL && glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER) == GL_TRUE;
+		glBindVertexArray(0);
+		if (!unmappedVertices || !unmappedIndices) {
+			printf("The upload of the meshes to the GPU failed, so they are streamed\n");
+			meshRanges.clear();
+			return false;
+		}
+		printf("Uploaded %d meshes (%.1f MB) to the GPU\n", nrFrames, (verticesSize + indicesSize) / (1024.0 * 1024.0));
+		return true;
+	}
+
+	// residentMeshes: makes the blocks of the (quantized) frame point to where they are in the buffers, i.e. relative to baseVertex and indexOffset 0.
+	// A kept block is drawn from the earlier frame that stores it, and the meshlets of a kept block that can not be resolved are dropped with it
+	void ResolveResidentBlocks(int frame, const std::vector<MeshBlockSource>& keptSources) {
+		MeshRange& range = meshRanges[frame];
+		int nrStoredBlocks = (int)(range.blocks.size() - keptSources.size());
+		for (int b = 0; b < nrStoredBlocks; b++) {
+			range.blocks[b].firstVertex += range.baseVertex;
+			range.blocks[b].firstIndex += (uint32_t)(range.indexOffset / sizeof(uint16_t));
+		}
+		std::vector<int> resolved(range.blocks.size(), -1); // the new index of every block
+		int nrResolved = nrStoredBlocks;
+		for (int b = 0; b < nrStoredBlocks; b++) {
+			resolved[b] = b;
+		}
+		for (size_t k = 0; k < keptSources.size(); k++) {
+			const MeshBlockSource& source = keptSources[k];
+			if (source.frame < (uint32_t)frame && source.block < meshRanges[source.frame].blocks.size()) {
+				resolved[nrStoredBlocks + k] = nrResolved;
+				range.blocks[nrResolved++] = meshRanges[source.frame].blocks[source.block];
+			}
+		}
+		range.blocks.resize(nrResolved);
+		size_t nrMeshlets = 0;
+		for (const Meshlet& meshlet : range.meshlets) {
+			if (resolved[meshlet.block] < 0) continue;
+			range.meshlets[nrMeshlets] = meshlet;
+			range.meshlets[nrMeshlets++].block = resolved[meshlet.block];
+		}
+		range.meshlets.resize(nrMeshlets);
+		range.baseVertex = 0;
+		range.indexOffset = 0;
+	}
+
+	void SwitchToResidentMesh(int frame) {
+		baseVertex = meshRanges[frame].baseVertex;
+		indexOffset = meshRanges[frame].indexOffset;
+		nrIndices = meshRanges[frame].nrIndices;
+		meshBlocks = meshRanges[frame].blocks;
+		meshMeshlets = meshRanges[frame].meshlets;
+	}
+
+	// persistentMeshes: draw the next mesh that the loader has read into the ring, its kept blocks are copied from the slot of the mesh before it
+	void SwitchToNextMesh() {
+		int frame, slot;
+		MeshView m = loader.WaitForNextFrame(frame, slot);
+		GLint nextBaseVertex = (GLint)(slot * (size_t)meshes.MaxNrVertices());
+		size_t nextIndexOffset = slot * 3 * (size_t)meshes.MaxNrTriangles() * meshes.IndexSize();
+		size_t nrStoredVertices, nrStoredIndices;
+		MeshFile::StoredSize(m, nrStoredVertices, nrStoredIndices);
+		uploadedMB += (nrStoredVertices * meshes.VertexSize() + nrStoredIndices * meshes.IndexSize()) / (1024.0 * 1024.0);
+		int nrBlocks = m.nrBlocks;
+		if (m.nrKeptBlocks > 0 && !m.keptBlocksLoaded
+			&& !CopyKeptBlocks(m, VBO[0], EBO[0], meshBlocks, meshBlockIds, baseVertex, indexOffset, VBO[0], EBO[0], nextBaseVertex, nextIndexOffset)) {
+			nrBlocks -= m.nrKeptBlocks;
+		}
+		baseVertex = nextBaseVertex;
+		indexOffset = nextIndexOffset;
+		nrIndices = 3 * m.nrTriangles;
+		meshBlocks.assign(m.blocks, m.blocks + nrBlocks);
+		meshMeshlets.assign(m.meshlets, m.meshlets + m.nrMeshlets);
+		GetBlockIds(m, frame, meshBlockIds);
+	}
+
+	static uint64_t BlockId(uint32_t frame, uint32_t block) {
+		return ((uint64_t)frame << 32) | block;
+	}
+
+	// the ids of the blocks of mesh m of this frame: the stored blocks are its own, the kept blocks those of their MeshBlockSource
+	static void GetBlockIds(const MeshView& m, int frame, /*out*/ std::vector<uint64_t>& ids) {
+		int nrStoredBlocks = m.nrBlocks - m.nrKeptBlocks;
+		ids.resize(m.nrBlocks);
+		for (int b = 0; b < nrStoredBlocks; b++) {
+			ids[b] = BlockId(frame, b);
+		}
+		for (int k = 0; k < m.nrKeptBlocks; k++) {
+			ids[nrStoredBlocks + k] = BlockId(m.keptSources[k].frame, m.keptSources[k].block);
+		}
+	}
+
+	// copies the kept blocks of mesh m from the mesh before it (with srcBlocks and srcIds, at srcBaseVertex and srcIndexOffset in srcVBO and srcEBO)
+	// to their place in the mesh at dstBaseVertex and dstIndexOffset in dstVBO and dstEBO. Blocks that follow each other in both are copied at once.
+	// Returns false if a kept block is not in the mesh before it (then the file is not valid)
+	bool CopyKeptBlocks(const MeshView& m, GLuint srcVBO, GLuint srcEBO, const std::vector<MeshBlock>& srcBlocks, const std::vector<uint64_t>& srcIds, GLint srcBaseVertex, size_t srcIndexOffset,
+		GLuint dstVBO, GLuint dstEBO, GLint dstBaseVertex, size_t dstIndexOffset) {
+		previousBlocks.clear();
+		for (int b = 0; b < srcIds.size(); b++) {
+			previousBlocks[srcIds[b]] = b;
+		}
+		const MeshBlock* kept = m.blocks + m.nrBlocks - m.nrKeptBlocks;
+		copies.clear();
+		for (int k = 0; k < m.nrKeptBlocks; k++) {
+			auto it = previousBlocks.find(BlockId(m.keptSources[k].frame, m.keptSources[k].block));
+			if (it == previousBlocks.end()) {
+				printf("Error: a kept block of the mesh is not in the mesh before it\n");
+				return false;
+			}
+			copies.push_back(std::make_pair(&srcBlocks[it->second], &kept[k]));
+		}
+
+		size_t vertexSize = meshes.VertexSize();
+		size_t indexSize = meshes.IndexSize();
+		for (size_t c = 0; c < copies.size();) {
+			// extend the run while the next block follows the previous one in the source as well
+			size_t end = c + 1;
+			uint32_t runVertices = copies[c].second->nrVertices;
+			uint32_t runIndices = copies[c].second->nrIndices;
+			while (end < copies.size() && copies[end].first->firstVertex == copies[c].first->firstVertex + runVertices
+				&& copies[end].first->firstIndex == copies[c].first->firstIndex + runIndices) {
+				runVertices += copies[end].second->nrVertices;
+				runIndices += copies[end].second->nrIndices;
+				end++;
+			}
+			const MeshBlock& from = *copies[c].first;
+			const MeshBlock& to = *copies[c].second;
+			glBindBuffer(GL_COPY_READ_BUFFER, srcVBO);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, dstVBO);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (srcBaseVertex + from.firstVertex) * vertexSize, (dstBaseVertex + to.firstVertex) * vertexSize, runVertices * vertexSize);
+			glBindBuffer(GL_COPY_READ_BUFFER, srcEBO);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, dstEBO);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, srcIndexOffset + from.firstIndex * indexSize, dstIndexOffset + to.firstIndex * indexSize, runIndices * indexSize);
+			copiedMB += (runVertices * vertexSize + runIndices * indexSize) / (1024.0 * 1024.0);
+			c = end;
+		}
+		return true;
+	}
+
+	// the kept blocks of mesh m, from the memory-mapped file, to their place in the buffers that are bound
+	void UploadKeptBlocks(const MeshView& m) {
+		const MeshBlock* kept = m.blocks + m.nrBlocks - m.nrKeptBlocks;
+		for (int k = 0; k < m.nrKeptBlocks; k++) {
+			const void* vertices;
+			const void* indices;
+			meshes.GetBlock(m.keptSources[k], vertices, indices);
+			glBufferSubData(GL_ARRAY_BUFFER, (size_t)kept[k].firstVertex * meshes.VertexSize(), (size_t)kept[k].nrVertices * meshes.VertexSize(), vertices);
+			glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, (size_t)kept[k].firstIndex * meshes.IndexSize(), (size_t)kept[k].nrIndices * meshes.IndexSize(), indices);
+		}
+	}
+
 	void UpdateMesh(int VAO_index, int frame) {
 
 		//printf("UpdateMesh VAO[d], frame %d\n", VAO_index, frame);
 
-		Mesh m = meshes[frame];
+		MeshView m;
+		if (streamMeshes) {
+			int loadedFrame, slot;
+			m = loader.WaitForNextFrame(loadedFrame, slot); // frames are always uploaded in playback order, so loadedFrame == frame
+		}
+		else {
+			m = meshes.GetFrame(frame);
+		}
 
+		// only the stored vertices and indices, the kept blocks are copied from the other VAO (if it has the frame before)
+		size_t nrUploadedVertices = m.nrVertices;
+		size_t nrUploadedIndices = 3 * (size_t)m.nrTriangles;
+		if (!m.keptBlocksLoaded) {
+			MeshFile::StoredSize(m, nrUploadedVertices, nrUploadedIndices);
+		}
 		glBindVertexArray(VAO[VAO_index]);
 
 		glBindBuffer(GL_ARRAY_BUFFER, VBO[VAO_index]);
-		glBufferSubData(GL_ARRAY_BUFFER, 0, m.vertices.size() * sizeof(float), m.vertices.data());
+		glBufferSubData(GL_ARRAY_BUFFER, 0, nrUploadedVertices * meshes.VertexSize(), m.vertices);
 
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO[VAO_index]);
-		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, m.triangles.size() * sizeof(uint32_t), m.triangles.data());
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, nrUploadedIndices * meshes.IndexSize(), m.triangles);
+		uploadedMB += (nrUploadedVertices * meshes.VertexSize() + nrUploadedIndices * meshes.IndexSize()) / (1024.0 * 1024.0);
+		nrIndicesPerVao[VAO_index] = 3 * m.nrTriangles;
+		int nrBlocks = m.nrBlocks;
+		if (m.nrKeptBlocks > 0 && !m.keptBlocksLoaded) {
+			int other = next_vao(VAO_index);
+			bool copied = framePerVao[other] == (frame + nrFrames - 1) % nrFrames
+				&& CopyKeptBlocks(m, VBO[other], EBO[other], blocksPerVao[other], blockIdsPerVao[other], 0, 0, VBO[VAO_index], EBO[VAO_index], 0, 0);
+			if (!copied && !streamMeshes) {
+				UploadKeptBlocks(m);
+			}
+			else if (!copied) {
+				nrBlocks -= m.nrKeptBlocks;
+			}
+		}
+		blocksPerVao[VAO_index].assign(m.blocks, m.blocks + nrBlocks);
+		meshletsPerVao[VAO_index].assign(m.meshlets, m.meshlets + m.nrMeshlets);
+		GetBlockIds(m, frame, blockIdsPerVao[VAO_index]);
+		framePerVao[VAO_index] = frame;
 
 		glBindVertexArray(0);
+		if (streamMeshes) {
+			loader.ReleaseFrame(); // glBufferSubData() has copied the data
+		}
 	}
 };
 
@@ -47,6 +47,14 @@ public:
 	bool isStatic = false;          // if true, stops decoding after frame StartingFrameNr
 	
 	int nrThreads = 2;              // the number of threads in the thread pool. Only useful if isStatic == false.
+	int meshWindow = 8;             // the number of meshes that are read ahead by the MeshLoader (0 to keep all of them in memory). Only useful if isStatic == false.
+	int meshDecoderThreads = 2;     // the number of threads that read and decode the meshes of a compressed (v4) mesh file
+	int meshGpuBudget = 1024;       // in MB, if the meshes of all frames fit in it, they are uploaded to the GPU at startup instead of streamed (0 to always stream). Only useful if isStatic == false.
+	bool cullMeshlets = true;       // if the mesh file has meshlets, those outside of the view frustum are not drawn
+	bool cullBackfacingMeshlets = false; // also skip the meshlets whose triangles all face away from the viewer (the triangles are drawn double-sided, so this can remove some)
+	float lodDistance = 2.0f;       // if the mesh file has levels of detail, the finest one is drawn up to this many times the spacing of the input cameras from the viewer (see LodSelector)
+	int triangleBudget = 0;         // the number of triangles the levels of detail are coarsened to fit in at the start, 0 for no limit
+	bool adaptiveLod = true;        // lower and raise that budget with the GPU time of the frames, to hold targetFps
 	int maxNrInputsUsed = -1;       // determine the upper limit of inputs that can be used at the same time
 	bool showCameraVisibilityWindow = false;
 	
@@ -81,6 +89,14 @@ public:
 			;
 		options.add_options("Settings to improve performance")
 			("t", "Number of threads for the thread pool that decodes the videos. Should be >= 2. Recommended: #CPUcores - 1", cxxopts::value<int>()->default_value("2"))
+			("mesh_window", "Number of meshes that are read ahead from the mesh file on a separate thread, which bounds the memory use. With 0, all meshes are kept in memory", cxxopts::value<int>()->default_value("8"))
+			("mesh_decoder_threads", "Number of threads that read and decode the meshes of a compressed (v4) mesh file, see CreateMeshes --mesh_format v4", cxxopts::value<int>()->default_value("2"))
+			("mesh_gpu_budget", "If the meshes of all frames fit in this many MB, they are all uploaded to the GPU at startup, instead of streamed during playback. With 0, they are always streamed", cxxopts::value<int>()->default_value("1024"))
+			("no_meshlet_culling", "Draw all meshlets of the mesh file, instead of skipping those that are outside of the view (see CreateMeshes --meshlet_size)")
+			("cull_backfacing_meshlets", "Also skip the meshlets whose triangles all face away from the viewer. The triangles are drawn double-sided, so this can leave holes where the back of a surface was visible")
+			("lod_distance", "If the mesh file has levels of detail (see CreateMeshes --lod_levels), the mesh of an input camera is drawn at the finest level up to this many times the distance between neighboring input cameras from the viewer, and one level coarser every time the distance doubles", cxxopts::value<float>()->default_value("2.0"))
+			("triangle_budget", "The number of triangles that the levels of detail are coarsened to fit in (the meshes of the input cameras furthest away first), 0 for no limit. The budget is then lowered when a frame takes longer than --target_fps allows, and raised again when there is time left", cxxopts::value<int>()->default_value("0"))
+			("no_adaptive_lod", "Keep --triangle_budget as it is, instead of adjusting it to the measured GPU time of the frames")
 			("asap", "Decode and play the image/video frames as soon as possible (basically disabling the Vsync@90Hz)")
 			("benchmark", "To determine the fps for dynamic content")
 			("max_nr_inputs", "The maximum number of input images/videos that will be processed per frame (-1 if all need to be processed)", cxxopts::value<int>()->default_value("-1"))
@@ -188,6 +204,53 @@ public:
 				exit(-1);
 			}
 		}
+		if (result.count("mesh_window")) {
+			meshWindow = result["mesh_window"].as<int>();
+			if (meshWindow < 0) {
+				std::cout << "Error: option --mesh_window should be equal to or greater than 0" << std::endl;
+				exit(-1);
+			}
+		}
+		if (result.count("mesh_decoder_threads")) {
+			meshDecoderThreads = result["mesh_decoder_threads"].as<int>();
+			if (meshDecoderThreads < 1) {
+				std::cout << "Error: option --mesh_decoder_threads should be equal to or greater than 1" << std::endl;
+				exit(-1);
+			}
+		}
+		if (result.count("mesh_gpu_budget")) {
+			meshGpuBudget = result["mesh_gpu_budget"].as<int>();
+			if (meshGpuBudget < 0) {
+				std::cout << "Error: option --mesh_gpu_budget should be equal to or greater than 0" << std::endl;
+				exit(-1);
+			}
+		}
+		if (result.count("no_meshlet_culling")) {
+			cullMeshlets = false;
+			if (result.count("cull_backfacing_meshlets")) {
+				std::cout << "Option --cull_backfacing_meshlets will be ignored since --no_meshlet_culling is present on the command line" << std::endl;
+			}
+		}
+		else if (result.count("cull_backfacing_meshlets")) {
+			cullBackfacingMeshlets = true;
+		}
+		if (result.count("lod_distance")) {
+			lodDistance = result["lod_distance"].as<float>();
+			if (lodDistance <= 0) {
+				std::cout << "Error: option --lod_distance should be greater than 0" << std::endl;
+				exit(-1);
+			}
+		}
+		if (result.count("triangle_budget")) {
+			triangleBudget = result["triangle_budget"].as<int>();
+			if (triangleBudget < 0) {
+				std::cout << "Error: option --triangle_budget should be equal to or greater than 0" << std::endl;
+				exit(-1);
+			}
+		}
+		if (result.count("no_adaptive_lod")) {
+			adaptiveLod = false;
+		}
 		if (result.count("asap")) {
 			if (useVR) {
 				std::cout << "Option --asap does not work when --vr is present on the command line, since SteamVR imposes a Vsync (e.g. HTC Vive (Pro) @90Hz)" << std::endl;
@@ -1,7 +1,7 @@
 // 3D warping
 
 #version 330 core
-layout (location = 0) in vec3 Position;
+layout (location = 0) in vec3 EncodedPosition;
 layout (location = 1) in vec3 Color;
 
 out vs_out
@@ -16,10 +16,14 @@ uniform float out_height;
 uniform vec2 out_f;
 uniform vec2 out_pp;
 uniform vec2 out_near_far;
+uniform mat4 meshDecode; // from the (quantized) vertex to homogeneous world space, the identity matrix if the vertices are not quantized
 
 
 void main()
 {
+	vec4 decoded = meshDecode * vec4(EncodedPosition, 1);
+	vec3 Position = decoded.xyz / decoded.w;
+
 	// project onto the output image
 	vec4 viewPosition = out_view * vec4(Position, 1);
 	viewPosition = viewPosition / viewPosition.w;
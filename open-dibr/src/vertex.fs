@@ -1,7 +1,7 @@
 // 3D warping
 
 #version 330 core
-layout (location = 0) in vec3 Position;
+layout (location = 0) in vec3 EncodedPosition;
 
 out vs_out
 {
@@ -18,6 +18,7 @@ uniform float out_height;
 uniform vec2 out_f;
 uniform vec2 out_pp;
 uniform vec2 out_near_far;
+uniform mat4 meshDecode; // from the (quantized) vertex to homogeneous world space, the identity matrix if the vertices are not quantized
 uniform float isVR;
 uniform mat4 project;    // only used in VR mode
 
@@ -27,6 +28,9 @@ uniform vec3 inputCameraPos[4];
 
 void main()
 {
+	vec4 decoded = meshDecode * vec4(EncodedPosition, 1);
+	vec3 Position = decoded.xyz / decoded.w;
+
 	vertex.worldPosition = Position;
 
 	// project onto the output image
@@ -26,6 +26,9 @@
 #include <string>
 #include <math.h>
 #include <float.h> //FLT_EPSILON, DBL_EPSILON
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 #define loopi(start_l,end_l) for ( int i=start_l;i<end_l;++i )
 #define loopi(start_l,end_l) for ( int i=start_l;i<end_l;++i )
@@ -315,24 +318,138 @@ namespace Simplify
 		TEXCOORD = 4,
 		COLOR = 8
 	};
-	struct Triangle { int v[3]; double err[4]; int deleted, dirty, attr; vec3f n; vec3f uvs[3]; int material; bool keep; };
-	struct Vertex { vec3f p;int tstart,tcount;SymetricMatrix q;int border;};
+	// Real is the precision in which the edge errors are stored (see SimplifierT)
+	template<typename Real> struct TriangleT { int v[3]; Real err[4]; int deleted, dirty, attr; vec3f n; int material; bool keep; };
+	// texture coordinates of a triangle, only used when load_obj() is called with process_uv
+	struct TriangleUV { vec3f uv[3]; };
+	// locked vertices are never moved or removed, id is a user defined identifier that survives compact_mesh()
+	struct Vertex { vec3f p;int tstart,tcount;int border; bool locked=false; int id=-1;};
+	// quadric of a vertex, relative to origin (i.e. the error of position p is the error of p-origin)
+	template<typename Real> struct QuadricT { Real m[10]; Real origin[3]; };
 	struct Ref { int tid,tvertex; };
+
+	//
+	// Binary min-heap of vertex ids, that also knows where each vertex is in
+	// the heap, so the key of a vertex can be changed in O(log n).
+	// Keys that differ less than 1e-9 are considered equal, and then the
+	// vertex with the lowest id comes first. On flat areas (where almost all
+	// errors are ~0) this visits the mesh in memory order instead of randomly.
+	//
+	class VertexHeap
+	{
+		std::vector<int> heap;		// vertex ids
+		std::vector<int> pos;		// index in heap of each vertex, -1 if not in the heap
+		std::vector<double> keys;	// key of each vertex
+
+		bool less(int a,int b) const
+		{
+			double ka=floor(keys[a]*1e9), kb=floor(keys[b]*1e9);
+			return ka<kb || (ka==kb && a<b);
+		}
+		void swap_nodes(int a,int b)
+		{
+			std::swap(heap[a],heap[b]);
+			pos[heap[a]]=a;
+			pos[heap[b]]=b;
+		}
+		void sift_up(int n)
+		{
+			while(n>0 && less(heap[n],heap[(n-1)/2]))
+			{
+				swap_nodes(n,(n-1)/2);
+				n=(n-1)/2;
+			}
+		}
+		void sift_down(int n)
+		{
+			while(true)
+			{
+				int smallest=n, l=2*n+1, r=2*n+2;
+				if(l<heap.size() && less(heap[l],heap[smallest])) smallest=l;
+				if(r<heap.size() && less(heap[r],heap[smallest])) smallest=r;
+				if(smallest==n) return;
+				swap_nodes(n,smallest);
+				n=smallest;
+			}
+		}
+	public:
+		// insert all vertices with the given keys, in O(n)
+		void init(const std::vector<double> &initial_keys)
+		{
+			keys=initial_keys;
+			heap.resize(keys.size());
+			pos.resize(keys.size());
+			loopi(0,keys.size()) { heap[i]=i; pos[i]=i; }
+			for(int n=heap.size()/2-1;n>=0;n--) sift_down(n);
+		}
+		bool empty() const { return heap.empty(); }
+		int top() const { return heap[0]; }
+		double key(int v) const { return keys[v]; }
+		// insert vertex v, or change its key
+		void update(int v,double key)
+		{
+			keys[v]=key;
+			if(pos[v]<0)
+			{
+				pos[v]=heap.size();
+				heap.push_back(v);
+			}
+			sift_up(pos[v]);
+			sift_down(pos[v]);
+		}
+		void remove(int v)
+		{
+			int n=pos[v];
+			if(n<0) return;
+			swap_nodes(n,heap.size()-1);
+			heap.pop_back();
+			pos[v]=-1;
+			keys[v]=DBL_MAX;
+			if(n<heap.size())
+			{
+				sift_up(n);
+				sift_down(n);
+			}
+		}
+	};
+
+	//
+	// All state of one simplification lives in a Simplifier instance (instead of
+	// in global variables), so several meshes can be simplified concurrently
+	// by giving each thread its own Simplifier.
+	//
+	// The quadrics and edge errors are stored in Real precision, but all math
+	// is done in double. With Real = float, each quadric is stored relative to
+	// the original position of its vertex, so the (small) local coordinates
+	// keep enough precision for the nearly zero errors on flat areas.
+	// With Real = double, the origin is always 0 and the results are the same
+	// as those of the original (all double) implementation.
+	// When compiled with AVX2, the edge errors of the initial sweep and of the
+	// triangles around each collapse are calculated 4 at a time (still in
+	// double, and with the same results).
+	//
+	template<typename Real> class SimplifierT
+	{
+	public:
+	typedef TriangleT<Real> Triangle;
+	typedef QuadricT<Real> Quadric;
+	static const bool local_origins = sizeof(Real) < sizeof(double);
+
 	std::vector<Triangle> triangles;
 	std::vector<Vertex> vertices;
+	std::vector<Quadric> quadrics;	// one per vertex
+	std::vector<TriangleUV> triangle_uvs;	// one per triangle, or empty
 	std::vector<Ref> refs;
 	std::string mtllib;
 	std::vector<std::string> materials;
 
-	// Helper functions
+	// scratch memory, kept between calls so that simplifying more meshes of the same size does not allocate
+	std::vector<int> deleted0,deleted1;	// per collapse
+	std::vector<int> vcount,vids;		// update_mesh()
+	std::vector<int> updated;		// update_triangles()
+	std::vector<double> heap_keys;		// simplify_mesh_heap()
+	VertexHeap heap;			// simplify_mesh_heap()
 
-	double vertex_error(SymetricMatrix q, double x, double y, double z);
-	double calculate_error(int id_v1, int id_v2, vec3f &p_result);
-	bool flipped(vec3f p,int i0,int i1,Vertex &v0,Vertex &v1,std::vector<int> &deleted);
-	void update_uvs(int i0,const Vertex &v,const vec3f &p,std::vector<int> &deleted);
-	void update_triangles(int i0,Vertex &v,std::vector<int> &deleted,int &deleted_triangles);
-	void update_mesh(int iteration);
-	void compact_mesh();
 	//
 	// Main simplification function
 	//
@@ -352,7 +469,6 @@ namespace Simplify
 
 		// main iteration loop
 		int deleted_triangles=0;
-		std::vector<int> deleted0,deleted1;
 		int triangle_count=triangles.size();
 		//int iteration = 0;
 		//loop(iteration,0,100)
@@ -398,6 +514,8 @@ namespace Simplify
 					int i1=t.v[(j+1)%3]; Vertex &v1 = vertices[i1];
 					// Border check
 					if(v0.border != v1.border)  continue;
+					// Locked vertices stay where they are
+					if(v0.locked || v1.locked) continue;
 
 					// Compute vertex to collapse to
 					vec3f p;
@@ -417,7 +535,7 @@ namespace Simplify
 
 					// not flipped, so remove edge
 					v0.p=p;
-					v0.q=v1.q+v0.q;
+					merge_quadrics(i0,i1);
 					int tstart=refs.size();
 
 					update_triangles(i0,v0,deleted0,deleted_triangles);
@@ -445,6 +563,197 @@ namespace Simplify
 		compact_mesh();
 	} //simplify_mesh()
 
+	//
+	// Same as simplify_mesh(), but instead of sweeping over all triangles with
+	// a growing threshold, the edge with the lowest error is always collapsed
+	// first. Every vertex knows its cheapest edge, and the vertices are kept in
+	// an indexed min-heap on that error, so after a collapse only the new
+	// vertex and its neighbors are updated (in O(log n) each), and the
+	// simplification stops exactly at target_count (or when no edge is below
+	// the error of the last sweep of simplify_mesh() anymore).
+	//
+	void simplify_mesh_heap(int target_count, double agressiveness=7, bool useKeep=false, bool verbose=false)
+	{
+		// init
+		loopi(0,triangles.size())
+		{
+			triangles[i].deleted=0;
+		}
+		update_mesh(0);
+
+		int deleted_triangles=0;
+		int triangle_count=triangles.size();
+		double max_error = 0.000000001*pow(double(99+3),agressiveness);
+
+		// the edge errors were already computed by update_mesh()
+		std::vector<double> &keys=heap_keys;
+		keys.assign(vertices.size(),DBL_MAX);
+		collapse_targets.assign(vertices.size(),-1);
+		loopi(0,triangles.size())
+		{
+			Triangle &t=triangles[i];
+			loopj(0,3)
+			{
+				int i0=t.v[j], i1=t.v[(j+1)%3];
+				if(t.err[j]>=max_error || !collapse_allowed(t,i0,i1,useKeep)) continue;
+				if(t.err[j]<keys[i0]) { keys[i0]=t.err[j]; collapse_targets[i0]=i1; }
+				if(t.err[j]<keys[i1]) { keys[i1]=t.err[j]; collapse_targets[i1]=i0; }
+			}
+		}
+		heap.init(keys);
+
+		int nr_collapses=0;
+		while(!heap.empty() && triangle_count-deleted_triangles>target_count)
+		{
+			int i0=heap.top();
+			if(heap.key(i0)>=max_error) break;
+			int i1=collapse_targets[i0];
+			Vertex &v0 = vertices[i0];
+			Vertex &v1 = vertices[i1];
+
+			// the triangles around the edge may have been removed by other collapses
+			if(!edge_allowed(i0,i1,useKeep))
+			{
+				heap.update(i0,best_collapse(i0,useKeep,max_error));
+				continue;
+			}
+
+			// Compute vertex to collapse to
+			vec3f p;
+			calculate_error(i0,i1,p);
+			deleted0.resize(v0.tcount); // normals temporarily
+			deleted1.resize(v1.tcount); // normals temporarily
+			// don't remove if flipped, but try again once a neighbor has changed
+			if( flipped(p,i0,i1,v0,v1,deleted0) || flipped(p,i1,i0,v1,v0,deleted1) )
+			{
+				heap.update(i0,DBL_MAX);
+				continue;
+			}
+
+			// not flipped, so remove edge
+			v0.p=p;
+			merge_quadrics(i0,i1);
+			int tstart=refs.size();
+
+			update_triangles(i0,v0,deleted0,deleted_triangles,false);
+			update_triangles(i0,v1,deleted1,deleted_triangles,false);
+
+			int tcount=refs.size()-tstart;
+
+			if(tcount<=v0.tcount)
+			{
+				// save ram
+				if(tcount)memcpy(&refs[v0.tstart],&refs[tstart],tcount*sizeof(Ref));
+			}
+			else
+				// append
+				v0.tstart=tstart;
+
+			v0.tcount=tcount;
+			nr_collapses++;
+
+			// update the cheapest edges of the new vertex and its neighbors
+			heap.remove(i1);
+			heap.update(i0,best_collapse(i0,useKeep,max_error));
+			neighbors.clear();
+			loopk(0,v0.tcount)
+			{
+				Triangle &t=triangles[refs[v0.tstart+k].tid];
+				loopj(0,3)
+				{
+					int i2=t.v[j];
+					if(i2==i0) continue;
+					if(collapse_targets[i2]==i0 || collapse_targets[i2]==i1 || heap.key(i2)==DBL_MAX)
+					{
+						if(first_visit(neighbors,i2)) heap.update(i2,best_collapse(i2,useKeep,max_error));
+					}
+					else if(collapse_allowed(t,i2,i0,useKeep) && first_visit(neighbors,i2))
+					{
+						double err=calculate_error(i2,i0,p);
+						if(err<heap.key(i2))
+						{
+							collapse_targets[i2]=i0;
+							heap.update(i2,err);
+						}
+					}
+				}
+			}
+		}
+		if(verbose)
+		{
+			printf("%d edge collapses - triangles %d\n",nr_collapses,triangle_count-deleted_triangles);
+		}
+
+		// clean up mesh
+		compact_mesh();
+	} //simplify_mesh_heap()
+
+	// the vertex each vertex would collapse with, used by simplify_mesh_heap()
+	std::vector<int> collapse_targets;
+	// the neighbors of a vertex that were already visited, used by simplify_mesh_heap()
+	std::vector<int> neighbors,candidates;
+
+	bool first_visit(std::vector<int> &visited,int i)
+	{
+		loopk(0,visited.size()) if(visited[k]==i) return false;
+		visited.push_back(i);
+		return true;
+	}
+
+	// error of the cheapest edge of vertex i (stored in collapse_targets), DBL_MAX if there is none
+
+	double best_collapse(int i,bool useKeep,double max_error)
+	{
+		double best=DBL_MAX;
+		collapse_targets[i]=-1;
+		Vertex &v=vertices[i];
+		vec3f p;
+		candidates.clear();
+		loopk(0,v.tcount)
+		{
+			Triangle &t=triangles[refs[v.tstart+k].tid];
+			if(t.deleted) continue;
+			loopj(0,3)
+			{
+				int i2=t.v[j];
+				if(i2==i || !collapse_allowed(t,i,i2,useKeep) || !first_visit(candidates,i2)) continue;
+				double err=calculate_error(i,i2,p);
+				if(err<best && err<max_error)
+				{
+					best=err;
+					collapse_targets[i]=i2;
+				}
+			}
+		}
+		return best;
+	}
+
+	// true if the edge i0-i1 is part of a triangle that may still be simplified
+
+	bool edge_allowed(int i0,int i1,bool useKeep)
+	{
+		Vertex &v=vertices[i0];
+		loopk(0,v.tcount)
+		{
+			Triangle &t=triangles[refs[v.tstart+k].tid];
+			if(t.deleted) continue;
+			if((t.v[0]==i1 || t.v[1]==i1 || t.v[2]==i1) && collapse_allowed(t,i0,i1,useKeep)) return true;
+		}
+		return false;
+	}
+
+	// same checks as in the main loop of simplify_mesh()
+
+	bool collapse_allowed(const Triangle &t,int i0,int i1,bool useKeep)
+	{
+		if((useKeep && t.keep) || (!useKeep && !t.keep)) return false;
+		// Border check
+		if(vertices[i0].border != vertices[i1].border) return false;
+		// Locked vertices stay where they are
+		if(vertices[i0].locked || vertices[i1].locked) return false;
+		return true;
+	}
+
 	void simplify_mesh_lossless(bool verbose=false)
 	{
 		// init
@@ -452,7 +761,6 @@ namespace Simplify
 
 		// main iteration loop
 		int deleted_triangles=0;
-		std::vector<int> deleted0,deleted1;
 		int triangle_count=triangles.size();
 		//int iteration = 0;
 		//loop(iteration,0,100)
@@ -488,6 +796,8 @@ namespace Simplify
 
 					// Border check
 					if(v0.border != v1.border)  continue;
+					// Locked vertices stay where they are
+					if(v0.locked || v1.locked) continue;
 
 					// Compute vertex to collapse to
 					vec3f p;
@@ -508,7 +818,7 @@ namespace Simplify
 
 					// not flipped, so remove edge
 					v0.p=p;
-					v0.q=v1.q+v0.q;
+					merge_quadrics(i0,i1);
 					int tstart=refs.size();
 
 					update_triangles(i0,v0,deleted0,deleted_triangles);
@@ -582,15 +892,16 @@ namespace Simplify
 			vec3f p1=vertices[t.v[0]].p;
 			vec3f p2=vertices[t.v[1]].p;
 			vec3f p3=vertices[t.v[2]].p;
-			t.uvs[r.tvertex] = interpolate(p,p1,p2,p3,t.uvs);
+			vec3f *uvs=triangle_uvs[r.tid].uv;
+			uvs[r.tvertex] = interpolate(p,p1,p2,p3,uvs);
 		}
 	}
 
 	// Update triangle connections and edge error after a edge is collapsed
 
-	void update_triangles(int i0,Vertex &v,std::vector<int> &deleted,int &deleted_triangles)
+	void update_triangles(int i0,Vertex &v,std::vector<int> &deleted,int &deleted_triangles,bool update_errors=true)
 	{
-		vec3f p;
+		updated.clear();
 		loopk(0,v.tcount)
 		{
 			Ref &r=refs[v.tstart+k];
@@ -604,12 +915,28 @@ namespace Simplify
 			}
 			t.v[r.tvertex]=i0;
 			t.dirty=1;
-			t.err[0]=calculate_error(t.v[0],t.v[1],p);
-			t.err[1]=calculate_error(t.v[1],t.v[2],p);
-			t.err[2]=calculate_error(t.v[2],t.v[0],p);
-			t.err[3]=min(t.err[0],min(t.err[1],t.err[2]));
+			if(update_errors) updated.push_back(r.tid);
 			refs.push_back(r);
 		}
+		// the quadrics are already merged, so the errors do not depend on the order of the triangles
+		update_errors_of(updated.data(),updated.size());
+	}
+
+	// edge errors of the triangles tids[0..n)
+
+	void update_errors_of(const int *tids,int n)
+	{
+		int i=0;
+#ifdef __AVX2__
+		for(;i+4<=n;i+=4) update_errors4(tids+i);
+#endif
+		vec3f p;
+		for(;i<n;i++)
+		{
+			Triangle &t=triangles[tids[i]];
+			loopj(0,3) t.err[j]=calculate_error(t.v[j],t.v[(j+1)%3],p);
+			t.err[3]=min(t.err[0],min(t.err[1],t.err[2]));
+		}
 	}
 
 	// compact triangles, compute edge error and build reference list
@@ -622,9 +949,11 @@ namespace Simplify
 			loopi(0,triangles.size())
 			if(!triangles[i].deleted)
 			{
+				if(triangle_uvs.size()) triangle_uvs[dst]=triangle_uvs[i];
 				triangles[dst++]=triangles[i];
 			}
 			triangles.resize(dst);
+			if(triangle_uvs.size()) triangle_uvs.resize(dst);
 		}
 		//
 
@@ -672,8 +1001,6 @@ namespace Simplify
 		{
 			// Identify boundary : vertices[].border=0,1
 
-			std::vector<int> vcount,vids;
-
 			loopi(0,vertices.size())
 				vertices[i].border=0;
 
@@ -707,8 +1034,9 @@ namespace Simplify
 					vertices[vids[j]].border=1;
 			}
 			//initialize errors
+			quadrics.resize(vertices.size());
 			loopi(0,vertices.size())
-				vertices[i].q=SymetricMatrix(0.0);
+				set_quadric(i,SymetricMatrix(0.0),local_origins ? vertices[i].p : vec3f(0,0,0));
 
 			loopi(0,triangles.size())
 			{
@@ -718,15 +1046,20 @@ namespace Simplify
 				n.cross(p[1]-p[0],p[2]-p[0]);
 				n.normalize();
 				t.n=n;
-				loopj(0,3) vertices[t.v[j]].q =
-					vertices[t.v[j]].q+SymetricMatrix(n.x,n.y,n.z,-n.dot(p[0]));
+				loopj(0,3)
+				{
+					// the plane relative to the origin of the quadric of the vertex
+					vec3f o=quadric_origin(t.v[j]);
+					set_quadric(t.v[j],quadric(t.v[j],o)+SymetricMatrix(n.x,n.y,n.z,-n.dot(p[0]-o)),o);
+				}
 			}
-			loopi(0,triangles.size())
+			// Calc Edge Error
+			int tids[256];
+			for(int first=0;first<triangles.size();first+=256)
 			{
-				// Calc Edge Error
-				Triangle &t=triangles[i];vec3f p;
-				loopj(0,3) t.err[j]=calculate_error(t.v[j],t.v[(j+1)%3],p);
-				t.err[3]=min(t.err[0],min(t.err[1],t.err[2]));
+				int count=min(256,(int)triangles.size()-first);
+				loopi(0,count) tids[i]=first+i;
+				update_errors_of(tids,count);
 			}
 		}
 	}
@@ -744,16 +1077,20 @@ namespace Simplify
 		if(!triangles[i].deleted)
 		{
 			Triangle &t=triangles[i];
+			if(triangle_uvs.size()) triangle_uvs[dst]=triangle_uvs[i];
 			triangles[dst++]=t;
 			loopj(0,3)vertices[t.v[j]].tcount=1;
 		}
 		triangles.resize(dst);
+		if(triangle_uvs.size()) triangle_uvs.resize(dst);
 		dst=0;
 		loopi(0,vertices.size())
 		if(vertices[i].tcount)
 		{
 			vertices[i].tstart=dst;
 			vertices[dst].p=vertices[i].p;
+			vertices[dst].locked=vertices[i].locked;
+			vertices[dst].id=vertices[i].id;
 			dst++;
 		}
 		loopi(0,triangles.size())
@@ -764,6 +1101,52 @@ namespace Simplify
 		vertices.resize(dst);
 	}
 
+	// Quadric of vertex i, relative to origin o
+
+	vec3f quadric_origin(int i)
+	{
+		const Quadric &q=quadrics[i];
+		return vec3f(q.origin[0],q.origin[1],q.origin[2]);
+	}
+
+	SymetricMatrix quadric(int i,const vec3f &o)
+	{
+		const Quadric &q=quadrics[i];
+		SymetricMatrix m(q.m[0],q.m[1],q.m[2],q.m[3],q.m[4],q.m[5],q.m[6],q.m[7],q.m[8],q.m[9]);
+		vec3f d=o-quadric_origin(i);
+		if(d.x==0 && d.y==0 && d.z==0) return m;
+
+		// e(x) = (x-o_i)A(x-o_i) + 2b(x-o_i) + c, with x-o_i = (x-o) + d
+		double ad[3]={	m[0]*d.x+m[1]*d.y+m[2]*d.z,
+						m[1]*d.x+m[4]*d.y+m[5]*d.z,
+						m[2]*d.x+m[5]*d.y+m[7]*d.z };
+		double c=m[9]+ad[0]*d.x+ad[1]*d.y+ad[2]*d.z+2*(m[3]*d.x+m[6]*d.y+m[8]*d.z);
+		return SymetricMatrix(m[0],m[1],m[2],m[3]+ad[0],m[4],m[5],m[6]+ad[1],m[7],m[8]+ad[2],c);
+	}
+
+	void set_quadric(int i,const SymetricMatrix &m,const vec3f &o)
+	{
+		Quadric &q=quadrics[i];
+		loopj(0,10) q.m[j]=(Real)m[j];
+		q.origin[0]=(Real)o.x; q.origin[1]=(Real)o.y; q.origin[2]=(Real)o.z;
+	}
+
+	// vertex i0 takes over the quadric of vertex i1 (in addition to its own)
+
+	void merge_quadrics(int i0,int i1)
+	{
+		vec3f o=quadric_origin(i0);
+		set_quadric(i0,quadric(i1,o)+quadric(i0,o),o);
+	}
+
+	// nr of bytes allocated for the mesh and the simplification state
+
+	size_t memory_usage()
+	{
+		return triangles.capacity()*sizeof(Triangle) + vertices.capacity()*sizeof(Vertex)
+			+ quadrics.capacity()*sizeof(Quadric) + triangle_uvs.capacity()*sizeof(TriangleUV) + refs.capacity()*sizeof(Ref);
+	}
+
 	// Error between vertex and Quadric
 
 	double vertex_error(SymetricMatrix q, double x, double y, double z)
@@ -778,7 +1161,9 @@ namespace Simplify
 	{
 		// compute interpolated vertex
 
-		SymetricMatrix q = vertices[id_v1].q + vertices[id_v2].q;
+		// both quadrics relative to the origin of the first one
+		vec3f o=quadric_origin(id_v1);
+		SymetricMatrix q = quadric(id_v1,o) + quadric(id_v2,o);
 		bool border = vertices[id_v1].border & vertices[id_v2].border;
 		double error=0;
 		double det = q.det(0, 1, 2, 1, 4, 5, 2, 5, 7);
@@ -791,12 +1176,13 @@ namespace Simplify
 			p_result.z = -1/det*(q.det(0, 1, 3, 1, 4, 6, 2, 5,  8));	// vz = A43/det(q_delta)
 
 			error = vertex_error(q, p_result.x, p_result.y, p_result.z);
+			p_result = p_result + o;
 		}
 		else
 		{
 			// det = 0 -> try to find best result
-			vec3f p1=vertices[id_v1].p;
-			vec3f p2=vertices[id_v2].p;
+			vec3f p1=vertices[id_v1].p-o;
+			vec3f p2=vertices[id_v2].p-o;
 			vec3f p3=(p1+p2)/2;
 			double error1 = vertex_error(q, p1.x,p1.y,p1.z);
 			double error2 = vertex_error(q, p2.x,p2.y,p2.z);
@@ -805,10 +1191,116 @@ namespace Simplify
 			if (error1 == error) p_result=p1;
 			if (error2 == error) p_result=p2;
 			if (error3 == error) p_result=p3;
+			p_result = p_result + o;
 		}
 		return error;
 	}
 
+#ifdef __AVX2__
+	// the quadrics of 4 vertices, in double
+	struct Quadric4 { __m256d m[10],origin[3]; };
+
+	static __m256d gather(const float *a,__m128i ids) { return _mm256_cvtps_pd(_mm_i32gather_ps(a,ids,4)); }
+	static __m256d gather(const double *a,__m128i ids) { return _mm256_i32gather_pd(a,ids,8); }
+
+	void gather_quadrics(__m128i ids,Quadric4 &q)
+	{
+		// the quadrics stay an array of structs, since the collapses read them one vertex at a time
+		ids=_mm_mullo_epi32(ids,_mm_set1_epi32(sizeof(Quadric)/sizeof(Real)));
+		const Real *base=(const Real*)quadrics.data();	// m[0..9] then origin[0..2]
+		loopj(0,10) q.m[j]=gather(base+j,ids);
+		loopj(0,3) q.origin[j]=local_origins ? gather(base+10+j,ids) : _mm256_setzero_pd();
+	}
+
+	// the same operations in the same order as SymetricMatrix::det(), so the results are the same
+	static __m256d det4(const __m256d *m,int a11,int a12,int a13,int a21,int a22,int a23,int a31,int a32,int a33)
+	{
+		__m256d det=_mm256_mul_pd(_mm256_mul_pd(m[a11],m[a22]),m[a33]);
+		det=_mm256_add_pd(det,_mm256_mul_pd(_mm256_mul_pd(m[a13],m[a21]),m[a32]));
+		det=_mm256_add_pd(det,_mm256_mul_pd(_mm256_mul_pd(m[a12],m[a23]),m[a31]));
+		det=_mm256_sub_pd(det,_mm256_mul_pd(_mm256_mul_pd(m[a13],m[a22]),m[a31]));
+		det=_mm256_sub_pd(det,_mm256_mul_pd(_mm256_mul_pd(m[a11],m[a23]),m[a32]));
+		det=_mm256_sub_pd(det,_mm256_mul_pd(_mm256_mul_pd(m[a12],m[a21]),m[a33]));
+		return det;
+	}
+
+	// calculate_error() of the 4 edges a-b (without the vertex to collapse to), with the same operations in the same order.
+	// Where the quadric can not be inverted (det is 0), calculate_error() does something else, so those errors are wrong
+
+	static __m256d calculate_error4(const Quadric4 &a,const Quadric4 &b,__m256d &det)
+	{
+		const __m256d zero=_mm256_setzero_pd(), two=_mm256_set1_pd(2.0);
+		__m256d q[10];
+		loopj(0,10) q[j]=b.m[j];
+		if(local_origins)
+		{
+			// the quadric of b relative to the origin of a, as in quadric()
+			__m256d d[3],ad[3];
+			loopj(0,3) d[j]=_mm256_sub_pd(a.origin[j],b.origin[j]);
+			ad[0]=_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(q[0],d[0]),_mm256_mul_pd(q[1],d[1])),_mm256_mul_pd(q[2],d[2]));
+			ad[1]=_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(q[1],d[0]),_mm256_mul_pd(q[4],d[1])),_mm256_mul_pd(q[5],d[2]));
+			ad[2]=_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(q[2],d[0]),_mm256_mul_pd(q[5],d[1])),_mm256_mul_pd(q[7],d[2]));
+			__m256d c=_mm256_add_pd(_mm256_add_pd(_mm256_add_pd(q[9],_mm256_mul_pd(ad[0],d[0])),_mm256_mul_pd(ad[1],d[1])),_mm256_mul_pd(ad[2],d[2]));
+			__m256d bd=_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(q[3],d[0]),_mm256_mul_pd(q[6],d[1])),_mm256_mul_pd(q[8],d[2]));
+			c=_mm256_add_pd(c,_mm256_mul_pd(two,bd));
+			// quadric() returns the quadric as it is when the origins are the same
+			__m256d same=_mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(d[0],zero,_CMP_EQ_OQ),_mm256_cmp_pd(d[1],zero,_CMP_EQ_OQ)),_mm256_cmp_pd(d[2],zero,_CMP_EQ_OQ));
+			q[3]=_mm256_blendv_pd(_mm256_add_pd(q[3],ad[0]),q[3],same);
+			q[6]=_mm256_blendv_pd(_mm256_add_pd(q[6],ad[1]),q[6],same);
+			q[8]=_mm256_blendv_pd(_mm256_add_pd(q[8],ad[2]),q[8],same);
+			q[9]=_mm256_blendv_pd(c,q[9],same);
+		}
+		loopj(0,10) q[j]=_mm256_add_pd(a.m[j],q[j]);
+
+		// the vertex with the lowest error
+		det=det4(q,0,1,2,1,4,5,2,5,7);
+		__m256d x=_mm256_mul_pd(_mm256_div_pd(_mm256_set1_pd(-1.0),det),det4(q,1,2,3,4,5,6,5,7,8));
+		__m256d y=_mm256_mul_pd(_mm256_div_pd(_mm256_set1_pd(1.0),det),det4(q,0,2,3,1,5,6,2,7,8));
+		__m256d z=_mm256_mul_pd(_mm256_div_pd(_mm256_set1_pd(-1.0),det),det4(q,0,1,3,1,4,6,2,5,8));
+
+		// vertex_error()
+		__m256d e=_mm256_mul_pd(_mm256_mul_pd(q[0],x),x);
+		e=_mm256_add_pd(e,_mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(two,q[1]),x),y));
+		e=_mm256_add_pd(e,_mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(two,q[2]),x),z));
+		e=_mm256_add_pd(e,_mm256_mul_pd(_mm256_mul_pd(two,q[3]),x));
+		e=_mm256_add_pd(e,_mm256_mul_pd(_mm256_mul_pd(q[4],y),y));
+		e=_mm256_add_pd(e,_mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(two,q[5]),y),z));
+		e=_mm256_add_pd(e,_mm256_mul_pd(_mm256_mul_pd(two,q[6]),y));
+		e=_mm256_add_pd(e,_mm256_mul_pd(_mm256_mul_pd(q[7],z),z));
+		e=_mm256_add_pd(e,_mm256_mul_pd(_mm256_mul_pd(two,q[8]),z));
+		return _mm256_add_pd(e,q[9]);
+	}
+
+	// update_errors_of() 4 triangles, the quadric of each vertex is loaded once for its two edges
+
+	void update_errors4(const int *tids)
+	{
+		int ids[3][4];
+		loopi(0,4) loopj(0,3) ids[j][i]=triangles[tids[i]].v[j];
+		Quadric4 q[3];
+		loopj(0,3) gather_quadrics(_mm_loadu_si128((const __m128i*)ids[j]),q[j]);
+		double errors[3][4];
+		vec3f p;
+		loopj(0,3)
+		{
+			int j1=(j+1)%3;
+			__m256d det;
+			_mm256_storeu_pd(errors[j],calculate_error4(q[j],q[j1],det));
+			int singular=_mm256_movemask_pd(_mm256_cmp_pd(det,_mm256_setzero_pd(),_CMP_EQ_OQ));
+			loopi(0,4) if(((singular>>i)&1) || (vertices[ids[j][i]].border & vertices[ids[j1][i]].border))
+			{
+				errors[j][i]=calculate_error(ids[j][i],ids[j1][i],p);
+			}
+		}
+		loopi(0,4)
+		{
+			Triangle &t=triangles[tids[i]];
+			loopj(0,3) t.err[j]=errors[j][i];
+			t.err[3]=min(t.err[0],min(t.err[1],t.err[2]));
+		}
+	}
+#endif
+
 	char *trimwhitespace(char *str)
 	{
 		char *end;
@@ -969,10 +1461,11 @@ namespace Simplify
 		}
 		if ( process_uv && uvs.size() )
 		{
+			triangle_uvs.resize(triangles.size());
 			loopi(0,triangles.size())
 			{
 				loopj(0,3)
-				triangles[i].uvs[j] = uvs[uvMap[i][j]];
+				triangle_uvs[i].uv[j] = uvs[uvMap[i][j]];
 			}
 		}
 
@@ -1007,9 +1500,9 @@ namespace Simplify
 		{
 			loopi(0,triangles.size()) if(!triangles[i].deleted)
 			{
-				fprintf(file, "vt %g %g\n", triangles[i].uvs[0].x, triangles[i].uvs[0].y);
-				fprintf(file, "vt %g %g\n", triangles[i].uvs[1].x, triangles[i].uvs[1].y);
-				fprintf(file, "vt %g %g\n", triangles[i].uvs[2].x, triangles[i].uvs[2].y);
+				fprintf(file, "vt %g %g\n", triangle_uvs[i].uv[0].x, triangle_uvs[i].uv[0].y);
+				fprintf(file, "vt %g %g\n", triangle_uvs[i].uv[1].x, triangle_uvs[i].uv[1].y);
+				fprintf(file, "vt %g %g\n", triangle_uvs[i].uv[2].x, triangle_uvs[i].uv[2].y);
 			}
 		}
 		int uv = 1;
@@ -1155,6 +1648,11 @@ namespace Simplify
 		free(verts32);
 		fclose(fp);
 	}
+	}; // class SimplifierT
+
+	typedef SimplifierT<float> Simplifier;
+	typedef SimplifierT<double> DoubleSimplifier;
+	typedef TriangleT<float> Triangle;
 };
 
 ///////////////////////////////////////////
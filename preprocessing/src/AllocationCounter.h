@@ -0,0 +1,41 @@
+#ifndef ALLOCATION_COUNTER_H
+#define ALLOCATION_COUNTER_H
+
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+
+/*
+* AllocationCounter counts the heap allocations (calls to operator new, on any thread) of the whole program,
+* so that the verbose output can show how many allocations each video frame needs.
+* This replaces the global operator new and delete, so this header must only be included in one .cpp file (main.cpp).
+*/
+namespace AllocationCounter {
+	inline std::atomic<unsigned long long> count{ 0 };
+
+	inline unsigned long long Get() {
+		return count.load(std::memory_order_relaxed);
+	}
+}
+
+void* operator new(std::size_t size) {
+	AllocationCounter::count.fetch_add(1, std::memory_order_relaxed);
+	void* p = std::malloc(size > 0 ? size : 1);
+	if (p == nullptr) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void operator delete(void* p) noexcept {
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+	std::free(p);
+}
+
+
+#endif
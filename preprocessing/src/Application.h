@@ -1,8 +1,10 @@
 #ifndef APPLICATION_H
 #define APPLICATION_H
 
+#ifdef USE_NVDEC
 #include <cuda.h>
 #include <cudaGL.h> // CUDA OpenGL interop needed for cuGraphicsGLRegisterImage
+#endif
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -10,31 +12,23 @@
 #include "shader.h"
 #include "ioHelper.h"
 #include "ShaderController.h"
-#include "TexController.h"
 #include "FramebufferController.h"
 #include "Simplify.h"
-
-void flipVertically(std::vector<unsigned char>& img, int width, int height)
-{
-	std::vector<unsigned char> tmp(width);
-	for (int y = 0; y < height / 2; ++y) {
-		unsigned char* rowTop = img.data() + y * width;
-		unsigned char* rowBottom = img.data() + (height - 1 - y) * width;
-		std::memcpy(tmp.data(), rowTop, width);
-		std::memcpy(rowTop, rowBottom, width);
-		std::memcpy(rowBottom, tmp.data(), width);
-	}
-}
-
-inline uint8_t popcount(uint8_t x) {
-	uint8_t c = 0;
-	while (x) {
-		x &= (x - 1);
-		++c;
-	}
-	return c;
-}
-
+#include "ThreadPool.h"
+#include "AllocationCounter.h"
+#include "GridKernels.h"
+#include "QuadtreeMesher.h"
+#include "MeshFile.h"
+#include "MeshOptimizer.h"
+#include "MeshBuilder.h"
+#include "SoftwareDecoder.h"
+#include "TexController.h"
+#include "MeshWriter.h"
+#include "TileHistory.h"
+#include "GLContext.h"
+#include "ReadbackController.h"
+#include "CameraOverlap.h"
+#include "CpuMaskCalculator.h"
 
 class Application
 {
@@ -44,8 +38,24 @@ protected:
 	ShaderController shaders;
 	FrameBufferController framebuffers;
 	TexController textures;
-
-	GLFWwindow* window = NULL;
+	ReadbackController readback;
+	CameraOverlap overlap;                     // which camera pairs need to be warped to calculate the masks
+	int nrWarpedPairs = 0;                     // by the last CalculateMasksAndEdgeMaps()
+	std::vector<float> depthBoundBlocks;
+	CpuMaskCalculator cpuMasks;                // calculates the masks and edge maps instead of the shaders, with --mask_backend cpu
+
+	// building and simplifying the meshes of the input cameras in parallel
+	ThreadPool pool;
+	std::vector<MeshBuilder> meshBuilders;     // one per worker thread
+	std::vector<Tile> tiles;                   // the tiles of each input camera, if options.tileSize > 0
+	TileHistory tileHistory;                   // which tiles can reuse their mesh of an earlier frame, with --temporal_tolerance
+	int nrReusedTiles = 0;                     // by the last SimplifyMeshesInBackground()
+	MeshWriter writer;                         // writes the finished frames to disk, in order
+	int firstFrame = 0;                        // the first video frame that is decoded (options.startFrame, or later with --resume)
+	bool appendToOutput = false;               // with --resume, if the output file already contains some of the frames
+
+	GLContext context;
+	GLFWwindow* window = NULL;                 // only used with --gui
 
 	int screenWidth = 0;
 	int screenHeight = 0;
@@ -77,37 +87,64 @@ public:
 			printf("Changed GL_UNPACK_ALIGNMENT from 4 to 1\n");
 		}
 
-		glfwInit();
-		if(options.headless) glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
-		window = glfwCreateWindow(screenWidth, screenHeight, "CreateMeshes", NULL, NULL);
-		glfwMakeContextCurrent(window);
-		glfwSwapInterval(0); // disable vsync
+		if (!context.Init(options.glContext, !options.headless, screenWidth, screenHeight, options.verbose)) return false;
+		window = context.window;
 
-		if (!gladLoadGL((GLADloadfunc)glfwGetProcAddress)) {
+		if (!gladLoadGL(context.GetProcAddress())) {
 			std::cerr << "Failed to initialize GLAD\n";
 			return false;
 		}
 
-		int xpos, ypos;
-		glfwGetMonitorPos(glfwGetPrimaryMonitor(), &xpos, &ypos);
-		glfwSetWindowPos(window, xpos, ypos + 20); // Move window to top-left
-
 		glEnable(GL_DEPTH_TEST);
 
+		firstFrame = options.startFrame;
+		if (options.resume) {
+			int nrFramesDone = 0;
+			if (!MeshFile::PrepareResume(options.outputPath, options.shard, options.meshFormat, options.lodLevels, options.startFrame, options.endFrame, nrFramesDone, appendToOutput)) return false;
+			firstFrame += nrFramesDone;
+			printf("Resuming %s: %d of %d frames already done\n", options.outputPath.c_str(), nrFramesDone, options.endFrame - options.startFrame);
+		}
+
 		if (!shaders.Init(inputCameras[0], options)) return false;
-		if (!textures.Init(inputCameras, options.verbose)) return false;
+		// (if all frames are done already, the last one is decoded in vain)
+		if (!textures.Init(inputCameras, options.verbose, options.cpuDecoder, options.nrThreads, std::min(firstFrame, options.endFrame - 1))) return false;
 		if (!framebuffers.Init(inputCameras, options)) return false;
+		readback.Init(inputCameras[0].res_x, inputCameras[0].res_y);
+		overlap.Init(inputCameras);
+		if (options.verbose) printf("%d of %d camera pairs can overlap within their Depth_range\n", overlap.nrOverlappingPairs, NrCameraPairs());
+		if (options.cpuMasks || options.checkMaskBackends) {
+			cpuMasks.Init(inputCameras, options.triangle_deletion_margin, options.nrThreads);
+		}
+
+		pool.init(options.nrThreads);
+		meshBuilders = std::vector<MeshBuilder>(options.nrThreads, MeshBuilder(GetMeshSettings()));
+		if (options.tileSize > 0) {
+			tiles = MeshBuilder::GetTiles(inputCameras[0].res_x, inputCameras[0].res_y, options.tileSize);
+			if (options.temporalTolerance >= 0) {
+				tileHistory.Init((int)inputCameras.size(), inputCameras[0].res_x, tiles, options.temporalTolerance);
+			}
+		}
+		if (!options.useQuadtree) {
+			// the full vertex grid of a camera (or tile) is the largest mesh a MeshBuilder works on
+			int nrPixelsPerTask = options.tileSize > 0 ? (options.tileSize + 1) * (options.tileSize + 1) : inputCameras[0].res_x * inputCameras[0].res_y;
+			for (MeshBuilder& builder : meshBuilders) {
+				builder.Reserve(nrPixelsPerTask);
+			}
+		}
+		if (options.verbose) printf("Building meshes with %d threads, %d frames in flight\n", options.nrThreads, options.framesInFlight);
 
 		return true;
 	}
 
 	void Shutdown()
 	{
+		pool.cleanup();
+		cpuMasks.Cleanup();
+		readback.Cleanup();
 		framebuffers.cleanup();
 		textures.Cleanup();
 
-		if (window != NULL) glfwDestroyWindow(window);
-		glfwTerminate();
+		context.Cleanup();
 	}
 
 	void ProcessInput(bool& quit) {
@@ -174,38 +211,253 @@ public:
 	}
 
 	void RunMeshLoop(std::string outPath) {
-		for (int frame = 0; frame < options.nrFrames; frame++) { 
-			if (!textures.DecodeNextVideoFrame()) return;
-			CalculateMasksAndEdgeMaps();
+		// the GPU decodes and masks the next frames while the worker threads are still simplifying the previous ones,
+		// at most options.framesInFlight frames are in flight at the same time
+		writer.Init(outPath, options, inputCameras, firstFrame, appendToOutput);
+		unsigned long long allocations = AllocationCounter::Get();
+		for (int frame = firstFrame; frame < options.endFrame; frame++) {
+			// with --decoder cpu, the depth maps are decoded straight into the slot of the frame in SimplifyMeshesInBackground()
+			if (!options.cpuDecoder) {
+				if (!textures.DecodeNextVideoFrame()) break;
+				if (!options.cpuMasks) CalculateMasksAndEdgeMaps();
+
+				if (!options.headless) RunMainLoop();
+			}
 
-			if(!options.headless) RunMainLoop();
+			if (!SimplifyMeshesInBackground(frame)) break;
 
-			WriteSimplifiedMeshesToFile(outPath, frame==0, options.verbose);
-			printf("frame %d / %d done\n", frame + 1, options.nrFrames);
+			if (options.verbose) {
+				// on all threads, since the previous frame was handed to the worker threads
+				unsigned long long total = AllocationCounter::Get();
+				printf("frame %d: warped %d of %d camera pairs, %llu heap allocations\n", frame + 1, nrWarpedPairs, NrCameraPairs(), total - allocations);
+				if (options.temporalTolerance >= 0) printf("frame %d: reused the meshes of %d of %d tiles\n", frame + 1, nrReusedTiles, (int)(tiles.size() * inputCameras.size()));
+				allocations = total;
+			}
 		}
+		writer.Finish();
 	}
 	
-	void DownloadDecodedVideoFrame(int i, /*out*/ std::vector<unsigned short>& z) {
-		// download depth
-		glBindTexture(GL_TEXTURE_2D, textures.depths[i]);
-		glGetTexImage(GL_TEXTURE_2D, 0, GL_RED, GL_UNSIGNED_SHORT, z.data());
+	// simplify the first video frame with both simplifiers (on this thread, one camera after the other)
+	// and print how long they take and how many triangles they keep
+	void RunSimplifierBenchmark() {
+		std::vector<CameraFrameData> data;
+		if (!PrepareFirstFrame(data)) return;
+
+		MeshSettings settings = GetMeshSettings();
+		settings.nrLevels = 1; // only the finest level of detail is compared
+		settings.useHeapSimplifier = false;
+		BenchmarkMeshBuilder("sweep simplifier", settings, data);
+		settings.useHeapSimplifier = true;
+		BenchmarkMeshBuilder("heap simplifier", settings, data);
+	}
+
+	// build the meshes of the first video frame from the full vertex grid and with the QuadtreeMesher (with and without refinement)
+	// and print how long they take, how many triangles they keep and how well they fit the depth maps
+	void RunMesherBenchmark() {
+		std::vector<CameraFrameData> data;
+		if (!PrepareFirstFrame(data)) return;
+
+		MeshSettings settings = GetMeshSettings();
+		settings.nrLevels = 1;
+		settings.useQuadtree = false;
+		BenchmarkMeshBuilder("grid", settings, data);
+		settings.useQuadtree = true;
+		settings.quadtreeRefine = false;
+		BenchmarkMeshBuilder("quadtree", settings, data);
+		settings.quadtreeRefine = true;
+		BenchmarkMeshBuilder("quadtree + refine", settings, data);
+	}
+
+	void BenchmarkMeshBuilder(const char* name, const MeshSettings& settings, const std::vector<CameraFrameData>& data) {
+		MeshBuilder builder(settings);
+		CameraMesh mesh;
+		double totalTime = 0;
+		int totalTriangles = 0;
+		double totalError = 0;
+		for (int i = 0; i < inputCameras.size(); i++) {
+			double start = glfwGetTime();
+			builder.BuildMesh(inputCameras[i], data[i], mesh, i, options.verbose);
+			double time = glfwGetTime() - start;
+			int nrTriangles = (int)mesh.triangles.size() / 3;
+			double error = builder.MeanDepthError(inputCameras[i], data[i]);
+			printf("%s, camera %d: %.1f ms, %d triangles, mean depth error %g\n", name, i, time * 1000.0, nrTriangles, error);
+			totalTime += time;
+			totalTriangles += nrTriangles;
+			totalError += error;
+		}
+		printf("%s, all cameras: %.1f ms, %d triangles, mean depth error %g\n", name, totalTime * 1000.0, totalTriangles, totalError / inputCameras.size());
+	}
+
+	// simplify the first video frame with float (the default) and double precision quadrics,
+	// and print how long they take, how many triangles they keep, how much memory they need and how well they fit the depth maps
+	void RunPrecisionCheck() {
+		std::vector<CameraFrameData> data;
+		if (!PrepareFirstFrame(data)) return;
+
+		MeshSettings settings = GetMeshSettings();
+		settings.nrLevels = 1; // only the finest level of detail is compared
+		for (int i = 0; i < inputCameras.size(); i++) {
+			MeshBuilderT<double> doubleBuilder(settings);
+			MeshBuilder floatBuilder(settings);
+			CameraMesh doubleMesh, floatMesh;
+
+			double start = glfwGetTime();
+			doubleBuilder.BuildMesh(inputCameras[i], data[i], doubleMesh, i, options.verbose);
+			double doubleTime = glfwGetTime() - start;
+			start = glfwGetTime();
+			floatBuilder.BuildMesh(inputCameras[i], data[i], floatMesh, i, options.verbose);
+			double floatTime = glfwGetTime() - start;
+
+			printf("camera %d, double: %.1f ms, %d triangles, %.1f MB, mean depth error %g\n", i, doubleTime * 1000.0, (int)doubleMesh.triangles.size() / 3,
+				doubleBuilder.SimplifierMemory() / 1e6, doubleBuilder.MeanDepthError(inputCameras[i], data[i]));
+			printf("camera %d, float:  %.1f ms, %d triangles, %.1f MB, mean depth error %g\n", i, floatTime * 1000.0, (int)floatMesh.triangles.size() / 3,
+				floatBuilder.SimplifierMemory() / 1e6, floatBuilder.MeanDepthError(inputCameras[i], data[i]));
+		}
+	}
+
+	// calculate the masks of the first video frame with and without skipping the camera pairs that can not overlap,
+	// and print how many pairs are skipped and how many pixels differ (which should be none)
+	void RunPairPruningCheck() {
+		if (!textures.DecodeNextVideoFrame()) return;
+		std::vector<CameraFrameData> allPairs(inputCameras.size()), prunedPairs(inputCameras.size());
+
+		glFinish();
+		double start = glfwGetTime();
+		CalculateMasksAndEdgeMaps(false);
+		glFinish();
+		double allTime = glfwGetTime() - start;
+		int nrAllPairs = nrWarpedPairs;
+		DownloadFrame(allPairs);
+
+		start = glfwGetTime();
+		CalculateMasksAndEdgeMaps(true);
+		glFinish();
+		double prunedTime = glfwGetTime() - start;
+		DownloadFrame(prunedPairs);
+
+		printf("all pairs: warped %d camera pairs in %.1f ms\n", nrAllPairs, allTime * 1000.0);
+		printf("pruned pairs: warped %d camera pairs in %.1f ms (%d skipped within the Depth_range, %d more with the depth of this frame)\n",
+			nrWarpedPairs, prunedTime * 1000.0, NrCameraPairs() - overlap.nrOverlappingPairs, overlap.nrOverlappingPairs - nrWarpedPairs);
+		for (int i = 0; i < inputCameras.size(); i++) {
+			int maskDifferences = 0, edgeDifferences = 0;
+			for (int p = 0; p < allPairs[i].mask.size(); p++) {
+				maskDifferences += allPairs[i].mask[p] != prunedPairs[i].mask[p];
+				edgeDifferences += allPairs[i].is_edge[p] != prunedPairs[i].is_edge[p];
+			}
+			printf("camera %d: %d mask pixels and %d edge map pixels differ\n", i, maskDifferences, edgeDifferences);
+		}
+	}
+
+	// calculate the masks and edge maps of the first video frame with the shaders and with the CpuMaskCalculator,
+	// and print how long they take and how many pixels differ (which should be none)
+	void RunMaskBackendCheck() {
+		if (!textures.DecodeNextVideoFrame()) return;
+		std::vector<CameraFrameData> gpuData(inputCameras.size()), cpuData(inputCameras.size());
+
+		glFinish();
+		double start = glfwGetTime();
+		CalculateMasksAndEdgeMaps();
+		readback.Start(textures.packed);
+		for (int i = 0; i < inputCameras.size(); i++) {
+			readback.Receive(i, gpuData[i]);
+		}
+		double gpuTime = glfwGetTime() - start;
+		int nrGpuPairs = nrWarpedPairs;
+
+		// the CPU backend starts from the same (downloaded) depth maps
+		start = glfwGetTime();
+		for (int i = 0; i < inputCameras.size(); i++) {
+			cpuData[i].depth = gpuData[i].depth;
+		}
+		cpuMasks.Calculate(cpuData, overlap);
+		double cpuTime = glfwGetTime() - start;
+
+		printf("gpu: warped %d camera pairs, %.1f ms (including the download)\n", nrGpuPairs, gpuTime * 1000.0);
+		printf("cpu: warped %d camera pairs, %.1f ms on %d threads\n", cpuMasks.nrWarpedPairs, cpuTime * 1000.0, options.nrThreads);
+		for (int i = 0; i < inputCameras.size(); i++) {
+			int maskDifferences = 0, edgeDifferences = 0;
+			for (int p = 0; p < gpuData[i].mask.size(); p++) {
+				maskDifferences += gpuData[i].mask[p] != cpuData[i].mask[p];
+				edgeDifferences += gpuData[i].is_edge[p] != cpuData[i].is_edge[p];
+			}
+			printf("camera %d: %d mask pixels and %d edge map pixels differ\n", i, maskDifferences, edgeDifferences);
+		}
+	}
+
+	int NrCameraPairs() {
+		return (int)(inputCameras.size() * (inputCameras.size() - 1) / 2);
+	}
+
+	MeshSettings GetMeshSettings() {
+		MeshSettings settings;
+		settings.useHeapSimplifier = options.useHeapSimplifier;
+		settings.useQuadtree = options.useQuadtree;
+		settings.quadtreeMaxError = options.quadtreeMaxError;
+		settings.quadtreeRefine = options.quadtreeRefine;
+		settings.optimizeVertexCache = options.optimizeVertexCache;
+		settings.sortFrontToBack = options.sortFrontToBack;
+		settings.meshletSize = options.meshletSize;
+		settings.nrLevels = options.lodLevels;
+		return settings;
+	}
+
+	// decode the first video frame, calculate its masks and edge maps and download them
+	bool PrepareFirstFrame(/*out*/ std::vector<CameraFrameData>& data) {
+		if (!options.cpuDecoder) {
+			if (!textures.DecodeNextVideoFrame()) return false;
+			if (!options.cpuMasks) CalculateMasksAndEdgeMaps();
+		}
+
+		data = std::vector<CameraFrameData>(inputCameras.size());
+		return DownloadFrame(data);
+	}
+
+	// with --mask_backend cpu, only the depth maps are downloaded (or decoded on the CPU, with --decoder cpu)
+	// and the CpuMaskCalculator adds the masks and edge maps
+	bool DownloadFrame(/*out*/ std::vector<CameraFrameData>& data) {
+		if (options.cpuDecoder) {
+			if (!textures.DecodeNextDepthMaps(data)) return false;
+		}
+		else {
+			readback.Start(options.cpuMasks ? textures.depths : textures.packed, options.cpuMasks);
+			for (int i = 0; i < inputCameras.size(); i++) {
+				readback.Receive(i, data[i]);
+			}
+		}
+		if (options.cpuMasks) {
+			cpuMasks.Calculate(data, overlap);
+			nrWarpedPairs = cpuMasks.nrWarpedPairs;
+		}
+		return true;
 	}
 	
-	void CalculateMasksAndEdgeMaps() {
+	// if prunePairs, only the camera pairs that can overlap are warped (see CameraOverlap), which gives the same masks
+	void CalculateMasksAndEdgeMaps(bool prunePairs = true) {
+		int nrViews = inputCameras.size();
+		if (prunePairs) {
+			UpdateFrameDepthRanges();
+		}
+
 		glViewport(0, 0, inputCameras[0].res_x, inputCameras[0].res_y);
+		for (int i = 0; i < nrViews; i++) {
+			framebuffers.ClearMask(textures.masks[i]);
+		}
 		shaders.shader.use();
-		int nrViews = inputCameras.size();
+		nrWarpedPairs = 0;
 		for (int iter = 0; iter < nrViews - 1; iter++) {
 			int mainIdx = iter;
 			shaders.updateInputParams(inputCameras[mainIdx]);
 			for (int neighborIdx = mainIdx + 1; neighborIdx < nrViews; neighborIdx++) {
+				if (prunePairs && !overlap.ShouldWarp(mainIdx, neighborIdx)) {
+					continue;
+				}
 				shaders.updateOutputParams(inputCameras[neighborIdx]);
 				framebuffers.WarpToNeighbor(
 					textures.depths[mainIdx],
 					textures.depths[neighborIdx],
-					textures.masks[neighborIdx], // mask = 0 means unique pixel, mask = 1 means pixel already covered by other view
-					iter == 0
+					textures.masks[neighborIdx] // mask = 0 means unique pixel, mask = 1 means pixel already covered by other view
 				);
+				nrWarpedPairs++;
 			}
 		}
 
@@ -225,219 +477,114 @@ public:
 		for (int i = 0; i < nrViews; i++) {
 			framebuffers.CalculateEdgeMask(textures.depths[i], textures.masks_dilated[i], textures.edges[i]);
 		}
-	}
-
-	void WriteSimplifiedMeshesToFile(std::string outPath, bool isFirstFrame, bool verbose=true) {
 
-		int width = inputCameras[0].res_x;
-		int height = inputCameras[0].res_y;
-		Simplify::Vertex v;
-		Simplify::Triangle t;
-		t.keep = false;
-		t.deleted = false;
-		t.attr = 0;
-		t.material = -1;
-		std::vector<float> all_vertices;
-		std::vector<uint32_t> all_triangles;
-		float depth_thresh = 500; // TODO user-defined threshold
+		// pack the mask (mask == 0 means keep pixel), edge map (0 means pixel not on depth edge) and depth of each camera
+		// into one texture, so that they can be downloaded at once
+		shaders.packShader.use();
+		for (int i = 0; i < nrViews; i++) {
+			framebuffers.PackForReadback(textures.masks_dilated[i], textures.edges[i], textures.depths[i], textures.packed[i]);
+		}
+	}
 
-		std::ofstream outFile(outPath, isFirstFrame ? std::ios::binary:  std::ios::binary | std::ios_base::app);
+	// give the overlap tests the lowest and highest depth of each camera in the current video frame
+	void UpdateFrameDepthRanges() {
+		shaders.depthBoundsShader.use();
+		for (int i = 0; i < inputCameras.size(); i++) {
+			shaders.depthBoundsShader.setInt("rowOffset", i * textures.depthBoundsHeight);
+			framebuffers.CalculateDepthBounds(textures.depths[i], i * textures.depthBoundsHeight, textures.depthBoundsWidth, textures.depthBoundsHeight, textures.depthBounds);
+		}
 
-		int triangles_offset = 0;
+		// only a few values per camera, so this download is small
+		int nrBlocks = textures.depthBoundsWidth * textures.depthBoundsHeight;
+		depthBoundBlocks.resize(2 * nrBlocks * inputCameras.size());
+		glBindTexture(GL_TEXTURE_2D, textures.depthBounds);
+		glGetTexImage(GL_TEXTURE_2D, 0, GL_RG, GL_FLOAT, depthBoundBlocks.data());
 		for (int i = 0; i < inputCameras.size(); i++) {
-			InputCamera input = inputCameras[i];
-			float near = input.z_near;
-			float far = input.z_far;
-			float fx = input.focal_x;
-			float fy = input.focal_y;
-			float cx = input.principal_point_x;
-			float cy = input.principal_point_y;
-			glm::mat4 model = input.model;
-
-			// download mask (mask == 0 means keep pixel) and edge map (0 means pixel on depth edge)
-			int nrPixels = width * height;
-			std::vector<unsigned char> mask(nrPixels);
-			std::vector<unsigned char> is_edge(nrPixels);
-			glBindTexture(GL_TEXTURE_2D, textures.masks_dilated[i]);
-			glGetTexImage(GL_TEXTURE_2D, 0, GL_RED, GL_UNSIGNED_BYTE, mask.data());
-			flipVertically(mask, width, height);
-			glBindTexture(GL_TEXTURE_2D, textures.edges[i]);
-			glGetTexImage(GL_TEXTURE_2D, 0, GL_RED, GL_UNSIGNED_BYTE, is_edge.data());
-			flipVertically(is_edge, width, height);
-
-			// also depth
-			std::vector<unsigned short> depth(width * height);
-			DownloadDecodedVideoFrame(i, depth);
-
-			// turn into mesh
-			Simplify::vertices.clear();
-			Simplify::triangles.clear();
-
-			if (verbose) printf("\nstart simplifying mesh\n");
-
-			// check for elongated triangles in each square
-			std::vector<bool> triangle_is_not_elongated((height-1) * (width-1) * 4, true); // 4 triangles per square
-			for (int row = 0; row < height-1; row++) {
-				for (int col = 0; col < width-1; col++) {
-					float depth_00 = depth[row * width + col];
-					float depth_01 = depth[row * width + col + 1];
-					float depth_10 = depth[(row + 1) * width + col];
-					float depth_11 = depth[(row + 1) * width + col + 1];
-			
-					bool edge_00_01 = abs(depth_00 - depth_01) < depth_thresh;
-					bool edge_00_10 = abs(depth_00 - depth_10) < depth_thresh;
-					bool edge_00_11 = abs(depth_00 - depth_11) < depth_thresh;
-					bool edge_01_11 = abs(depth_01 - depth_11) < depth_thresh;
-					bool edge_10_11 = abs(depth_10 - depth_11) < depth_thresh;
-					bool edge_10_01 = abs(depth_10 - depth_01) < depth_thresh;
-			
-					int offset = (row * (width - 1) + col) * 4;
-					triangle_is_not_elongated[offset    ] = edge_00_01 && edge_00_10 && edge_10_01; // top left triangle
-					triangle_is_not_elongated[offset + 1] = edge_00_01 && edge_01_11 && edge_00_11; // top right triangle
-					triangle_is_not_elongated[offset + 2] = edge_00_10 && edge_10_11 && edge_00_11; // bottom left triangle
-					triangle_is_not_elongated[offset + 3] = edge_01_11 && edge_10_11 && edge_10_01; // bottom right triangle
-				}
+			float lowest = 1.0f;
+			float highest = 0.0f;
+			for (int b = i * nrBlocks; b < (i + 1) * nrBlocks; b++) {
+				lowest = std::min(lowest, depthBoundBlocks[2 * b]);
+				highest = std::max(highest, depthBoundBlocks[2 * b + 1]);
 			}
+			overlap.SetFrameDepthRange(i, lowest, highest);
+		}
+	}
 
-			std::vector<uint8_t> square_types(height * width, 0); // each uint8 contains 4 bools, indicating which vertices are not masked off
-
-			// define vertices
-			for (int row = 0; row < height; row++) {
-				for (int col = 0; col < width; col++) {
-					int pixel = row * width + col;
-					v.p.z = -1.0 / (1.0f / far + (depth[pixel] / 65535.0) * (1.0f / near - 1.0f / far));
-					v.p.x = -(col + 0.5f - cx) / fx * v.p.z;
-					v.p.y = (row + 0.5f - cy) / fy * v.p.z;
-					Simplify::vertices.push_back(v);
-					
-					if (mask[pixel] == 0) {
-						// remember that this vert is not masked away (by setting a bit for each square the vert belongs to)
-						square_types[row * width + col] += 1;
-						if(col > 0) square_types[row * width + col - 1] += 2;
-						if (row > 0) square_types[(row - 1) * width + col] += 4;
-						if (row > 0 && col > 0) square_types[(row - 1) * width+ col - 1] += 8;
-					}
-				}
+	bool SimplifyMeshesInBackground(int frame) {
+		int s = writer.AcquireSlot(frame);
+		FrameSlot& slot = writer.GetSlot(s);
+		int nrTasksPerCamera = options.tileSize > 0 ? (int)tiles.size() : 1;
+		slot.tasks.resize(inputCameras.size() * nrTasksPerCamera); // only allocates for the first frame in this slot
+
+		// the downloads need the OpenGL context, so they happen on this thread,
+		// while the worker threads already build and simplify the meshes of the cameras downloaded before.
+		// The CpuMaskCalculator needs the depth maps of all cameras, so then all of them are downloaded first
+		if (options.cpuMasks) {
+			if (!DownloadFrame(slot.data)) {
+				writer.ReleaseSlot(s);
+				return false;
 			}
-			// define triangles
-			int o = 0;
-			for (int row = 0; row < height - 1; row++) {
-				for (int col = 0; col < width - 1; col++) {
-
-					// check which of the 4 verts were not masked away
-					int square_type = square_types[row * width + col];
-
-					// we can only draw triangles if there are 3+ verts
-					int nr_valid_verts = popcount(square_type);
-					if (nr_valid_verts < 3) {
-						o++;
-						continue;
-					}
-
-					// don't simplify triangles if on edge
-					t.keep = (is_edge[row * width + col] > 0) && (mask[row * width + col] == 0);
-
-					int square = 4 * (row * (width-1) + col);
-					bool check_every_triangle = false;
-					if (square_type == 15) { // two triangles
-						// check if all 4 verts have more or less the same depth
-						if (triangle_is_not_elongated[square] && triangle_is_not_elongated[square + 2]) {
-							// top left triangle
-							t.v[0] = o;
-							t.v[1] = o + width;
-							t.v[2] = o + 1;
-							Simplify::triangles.push_back(t);
-							// bottom right triangle
-							t.v[0] = o + 1;
-							t.v[1] = o + width;
-							t.v[2] = o + width + 1;
-							Simplify::triangles.push_back(t);
-						}
-						else {
-							check_every_triangle = true;
-						}
-					}
-					else if ((check_every_triangle || square_type == 7) && triangle_is_not_elongated[square]) { // top left triangle
-						t.v[0] = o;
-						t.v[1] = o + width;
-						t.v[2] = o + 1;
-						Simplify::triangles.push_back(t);
-					}
-					else if ((check_every_triangle || square_type == 11) && triangle_is_not_elongated[square + 1]) { // top right triangle
-						t.v[0] = o;
-						t.v[1] = o + width + 1;
-						t.v[2] = o + 1;
-						Simplify::triangles.push_back(t);
-					}
-					else if ((check_every_triangle || square_type == 13) && triangle_is_not_elongated[square + 2]) { // bottom left triangle
-						t.v[0] = o;
-						t.v[1] = o + width;
-						t.v[2] = o + width + 1;
-						Simplify::triangles.push_back(t);
-					}
-					else if ((check_every_triangle || square_type == 14) && triangle_is_not_elongated[square + 3]) { // bottom right triangle
-						t.v[0] = o + 1;
-						t.v[1] = o + width;
-						t.v[2] = o + width + 1;
-						Simplify::triangles.push_back(t);
-					}
-					o++;
-				}
-				o++;
-			}
-
-			// simplify mesh (only where edge map says there are no edges)
-			if (verbose) printf("-> %d triangles\n", (int)Simplify::triangles.size());
-			int target_triangle_count = Simplify::triangles.size() / 70;
-			Simplify::simplify_mesh(target_triangle_count, 7.0, true);
-			
-			// simplify mesh (only where edge map says there are edges)
-			if (verbose) printf("-> %d triangles\n", (int)Simplify::triangles.size());
-			target_triangle_count = Simplify::triangles.size() / 4;
-			Simplify::simplify_mesh(target_triangle_count, 7.0, false);
-
-			std::vector<float> vertices(Simplify::vertices.size() * 3);
-			std::vector<uint32_t> triangles(Simplify::triangles.size() * 3);
-			for (int j = 0; j < Simplify::vertices.size(); j ++) {
-				vertices[3 * j] = Simplify::vertices[j].p.x;
-				vertices[3 * j + 1] = Simplify::vertices[j].p.y;
-				vertices[3 * j + 2] = Simplify::vertices[j].p.z;
+		}
+		else {
+			readback.Start(textures.packed);
+		}
+		bool temporal = options.temporalTolerance >= 0;
+		nrReusedTiles = 0;
+		for (int i = 0; i < inputCameras.size(); i++) {
+			if (!options.cpuMasks) readback.Receive(i, slot.data[i]);
+			// every tile is simplified as a separate task, the task that finishes the last tile then stitches the tiles together
+			if (options.tileSize > 0) {
+				slot.tiles[i].resize(tiles.size());
+				slot.nrTilesLeft[i] = (int)tiles.size();
 			}
-			for (int j = 0; j < Simplify::triangles.size(); j++) {
-				triangles[3 * j] = Simplify::triangles[j].v[0] + triangles_offset;
-				triangles[3 * j + 1] = Simplify::triangles[j].v[1] + triangles_offset;
-				triangles[3 * j + 2] = Simplify::triangles[j].v[2] + triangles_offset;
+			// with --temporal_tolerance, only the tiles that changed are built (and not stitched)
+			if (temporal) {
+				slot.tileMeshes[i].resize(tiles.size());
+				slot.reusedTiles[i].resize(tiles.size());
+				for (int t = 0; t < tiles.size(); t++) {
+					slot.reusedTiles[i][t] = tileHistory.Unchanged(i, t, slot.data[i]);
+					slot.nrTilesLeft[i] -= slot.reusedTiles[i][t];
+					nrReusedTiles += slot.reusedTiles[i][t];
+				}
+				if (slot.nrTilesLeft[i] == 0) {
+					writer.CameraDone(s);
+					continue;
+				}
 			}
-			if (verbose) printf("end simplification with %d triangles\n", Simplify::triangles.size());
-
-
-			// to world space
-			for (int j = 0; j < vertices.size(); j += 3) {
-				glm::vec4 vpos(vertices[j + 0], vertices[j + 1], vertices[j + 2], 1.0f);
-				glm::vec4 wpos = model * vpos;
-				vertices[j + 0] = wpos.x;
-				vertices[j + 1] = wpos.y;
-				vertices[j + 2] = wpos.z;
+			for (int t = 0; t < nrTasksPerCamera; t++) {
+				if (temporal && slot.reusedTiles[i][t]) continue;
+				// the lambda only captures two pointers, so that std::function does not need to allocate
+				MeshTask* task = &slot.tasks[i * nrTasksPerCamera + t];
+				task->slot = s;
+				task->camera = i;
+				task->tile = options.tileSize > 0 ? t : -1;
+				pool.enqueue([this, task](int worker) {
+					RunMeshTask(*task, worker);
+				});
 			}
-
-			all_vertices.insert(all_vertices.end(), vertices.begin(), vertices.end());
-			all_triangles.insert(all_triangles.end(), triangles.begin(), triangles.end());
-
-			triangles_offset = all_vertices.size() / 3;
 		}
+		return true;
+	}
 
-		int nr_vertices = all_vertices.size() / 3;
-		int nr_triangles = all_triangles.size() / 3;
-
-		// write nr_vertices and nr_triangles
-		outFile.write(reinterpret_cast<const char*>(&nr_vertices), sizeof(nr_vertices));
-		outFile.write(reinterpret_cast<const char*>(&nr_triangles), sizeof(nr_triangles));
-		// write vertex positions, vertex colors and triangle indices
-		outFile.write(reinterpret_cast<const char*>(all_vertices.data()), all_vertices.size() * sizeof(float));
-		outFile.write(reinterpret_cast<const char*>(all_triangles.data()), all_triangles.size() * sizeof(uint32_t));
-
-		outFile.close();
-		if (verbose) printf("Wrote %d vertices, %d triangles to %s\n", nr_vertices, nr_triangles, outPath.c_str());
+	void RunMeshTask(const MeshTask& task, int worker) {
+		FrameSlot& slot = writer.GetSlot(task.slot);
+		MeshBuilder& builder = meshBuilders[worker];
+		int i = task.camera;
+		if (task.tile < 0) {
+			builder.BuildMesh(inputCameras[i], slot.data[i], slot.meshes[i], i, options.verbose);
+			writer.CameraDone(task.slot);
+			return;
+		}
+		if (options.temporalTolerance >= 0) {
+			builder.BuildUnstitchedTileMesh(inputCameras[i], slot.data[i], tiles[task.tile], slot.tileMeshes[i][task.tile]);
+			if (writer.TileDone(task.slot, i)) writer.CameraDone(task.slot);
+			return;
+		}
+		builder.BuildTileMesh(inputCameras[i], slot.data[i], tiles[task.tile], slot.tiles[i][task.tile]);
+		if (writer.TileDone(task.slot, i)) {
+			builder.StitchTiles(inputCameras[i], slot.tiles[i], slot.meshes[i], i, options.verbose);
+			writer.CameraDone(task.slot);
+		}
 	}
 };
 
@@ -0,0 +1,161 @@
+#ifndef CAMERA_OVERLAP_H
+#define CAMERA_OVERLAP_H
+
+
+/*
+* CameraOverlap decides which (main, neighbor) camera pairs need to be warped in Application::CalculateMasksAndEdgeMaps().
+* Warping the main camera can only mask a pixel of the neighbor if a point of the main depth map lies inside the neighbor frustum,
+* at most 0.15 (the threshold in fragment.fs) from a depth the neighbor depth map can have.
+* So a pair is skipped if the two truncated frusta (between the near and far depth of each camera) do not intersect,
+* which is tested with the separating axis theorem.
+*
+* Init() tests all pairs once with the Depth_range of the cameras. SetFrameDepthRange() narrows the range
+* of a camera to the depth values in its current video frame, after which ShouldWarp() also tests the pairs with those.
+* Only pairs of perspective cameras are tested, the other ones are always warped. The frusta are a bit larger than needed
+* (the neighbor by 2 pixels, the depth ranges by 0.1%), since the rasterizer interpolates the depth of a triangle linearly in screen space.
+*/
+class CameraOverlap {
+private:
+	// the 8 corners of a truncated frustum, corner index = right + 2 * top + 4 * far
+	struct Frustum {
+		glm::dvec3 corners[8];
+	};
+
+	std::vector<InputCamera> cameras;
+	std::vector<char> pairOverlaps;      // for each (main, neighbor) pair: can they overlap within their Depth_range
+	std::vector<glm::dvec2> frameRanges; // per camera: the near and far depth in the current video frame
+
+public:
+	int nrOverlappingPairs = 0;          // within the Depth_range of the cameras, out of nrCameras * (nrCameras - 1) / 2
+
+	CameraOverlap() {}
+
+	void Init(const std::vector<InputCamera>& inputCameras) {
+		cameras = inputCameras;
+		int n = (int)cameras.size();
+		frameRanges.resize(n);
+		for (int i = 0; i < n; i++) {
+			frameRanges[i] = glm::dvec2(ClampDepth(cameras[i].z_near), ClampDepth(cameras[i].z_far));
+		}
+		pairOverlaps.assign(n * n, 1);
+		nrOverlappingPairs = 0;
+		for (int main = 0; main < n; main++) {
+			for (int neighbor = main + 1; neighbor < n; neighbor++) {
+				pairOverlaps[main * n + neighbor] = Overlap(main, neighbor);
+				nrOverlappingPairs += pairOverlaps[main * n + neighbor];
+			}
+		}
+	}
+
+	// minValue and maxValue are the lowest and highest normalized depth value (in [0, 1]) in the depth map of camera i
+	void SetFrameDepthRange(int i, float minValue, float maxValue) {
+		// same conversion as vertex.fs, a higher value is closer to the camera
+		const InputCamera& c = cameras[i];
+		double nearest = 1.0 / (1.0 / c.z_far + maxValue * (1.0 / c.z_near - 1.0 / c.z_far));
+		double farthest = 1.0 / (1.0 / c.z_far + minValue * (1.0 / c.z_near - 1.0 / c.z_far));
+		frameRanges[i] = glm::dvec2(ClampDepth(nearest), ClampDepth(farthest));
+	}
+
+	bool ShouldWarp(int main, int neighbor) {
+		return pairOverlaps[main * cameras.size() + neighbor] && Overlap(main, neighbor);
+	}
+
+private:
+	static double ClampDepth(double depth) {
+		return std::min(depth, 1000.0); // like the shaders
+	}
+
+	bool Overlap(int main, int neighbor) {
+		const InputCamera& m = cameras[main];
+		const InputCamera& n = cameras[neighbor];
+		if (m.projection != Projection::Perspective || n.projection != Projection::Perspective) {
+			return true;
+		}
+		// in the view space of the neighbor, where fragment.fs compares the depths
+		glm::dmat4 mainToNeighbor = glm::dmat4(n.view) * glm::dmat4(m.model);
+		Frustum a = GetFrustum(m, frameRanges[main].x * 0.999, frameRanges[main].y * 1.001, 0, mainToNeighbor);
+		Frustum b = GetFrustum(n, std::max((frameRanges[neighbor].x - 0.15) * 0.999, 1e-6), (frameRanges[neighbor].y + 0.15) * 1.001, 2, glm::dmat4(1.0));
+
+		// vertex.fs moves the vertices behind the neighbor to a fixed position, so the triangles that cross
+		// the plane of the neighbor camera do not stay inside the main frustum: always warp in that case
+		int nrBehind = 0;
+		for (int corner = 0; corner < 8; corner++) {
+			nrBehind += a.corners[corner].z >= 0;
+		}
+		if (nrBehind > 0 && nrBehind < 8) {
+			return true;
+		}
+		return Intersect(a, b);
+	}
+
+	// the part of the view frustum of the camera between depth d0 and d1, widened by margin pixels on each side, same unprojection as vertex.fs
+	static Frustum GetFrustum(const InputCamera& c, double d0, double d1, double margin, const glm::dmat4& transform) {
+		double x[2] = { (-c.principal_point_x - margin) / c.focal_x, (c.res_x - c.principal_point_x + margin) / c.focal_x };
+		double y[2] = { (c.principal_point_y - c.res_y - margin) / c.focal_y, (c.principal_point_y + margin) / c.focal_y };
+		double d[2] = { d0, d1 };
+		Frustum f;
+		for (int corner = 0; corner < 8; corner++) {
+			double depth = d[corner >> 2];
+			glm::dvec4 p = transform * glm::dvec4(x[corner & 1] * depth, y[(corner >> 1) & 1] * depth, -depth, 1.0);
+			f.corners[corner] = glm::dvec3(p) / p.w;
+		}
+		return f;
+	}
+
+	// the 12 edges, as differences between the corners
+	static void GetEdges(const Frustum& f, /*out*/ glm::dvec3 edges[12]) {
+		int e = 0;
+		for (int corner = 0; corner < 8; corner++) {
+			for (int bit = 1; bit < 8; bit <<= 1) {
+				if ((corner & bit) == 0) {
+					edges[e++] = f.corners[corner | bit] - f.corners[corner];
+				}
+			}
+		}
+	}
+
+	// true if the axis separates the corners of a and b
+	static bool Separates(const Frustum& a, const Frustum& b, const glm::dvec3& axis) {
+		if (glm::dot(axis, axis) < 1e-24) {
+			return false; // parallel edges
+		}
+		double minA = DBL_MAX, maxA = -DBL_MAX, minB = DBL_MAX, maxB = -DBL_MAX, scale = 0;
+		for (int corner = 0; corner < 8; corner++) {
+			double pa = glm::dot(axis, a.corners[corner]);
+			double pb = glm::dot(axis, b.corners[corner]);
+			minA = std::min(minA, pa); maxA = std::max(maxA, pa);
+			minB = std::min(minB, pb); maxB = std::max(maxB, pb);
+			scale = std::max(scale, std::max(std::abs(pa), std::abs(pb)));
+		}
+		double margin = 1e-9 * scale; // when in doubt, the pair overlaps
+		return maxA < minB - margin || maxB < minA - margin;
+	}
+
+	// the frusta are convex, so they do not intersect iff a face normal or the cross product of two edges separates them
+	static bool Intersect(const Frustum& a, const Frustum& b) {
+		glm::dvec3 edgesA[12], edgesB[12];
+		GetEdges(a, edgesA);
+		GetEdges(b, edgesB);
+		// every face of a frustum goes through corner 0 or corner 7
+		const Frustum* frusta[2] = { &a, &b };
+		for (int f = 0; f < 2; f++) {
+			for (int corner = 0; corner < 8; corner += 7) {
+				for (int bit = 1; bit < 8; bit <<= 1) {
+					// the face through this corner that does not contain the edge along bit
+					int c0 = corner, c1 = corner ^ (bit == 1 ? 2 : 1), c2 = corner ^ (bit == 4 ? 2 : 4);
+					glm::dvec3 normal = glm::cross(frusta[f]->corners[c1] - frusta[f]->corners[c0], frusta[f]->corners[c2] - frusta[f]->corners[c0]);
+					if (Separates(a, b, normal)) return false;
+				}
+			}
+		}
+		for (int i = 0; i < 12; i++) {
+			for (int j = 0; j < 12; j++) {
+				if (Separates(a, b, glm::cross(edgesA[i], edgesB[j]))) return false;
+			}
+		}
+		return true;
+	}
+};
+
+
+#endif
@@ -0,0 +1,445 @@
+#ifndef CPU_MASK_CALCULATOR_H
+#define CPU_MASK_CALCULATOR_H
+
+
+/*
+* CpuMaskCalculator calculates the masks and edge maps of a video frame on the CPU, from the downloaded depth maps,
+* so that Application::CalculateMasksAndEdgeMaps() and its shaders are not needed (--mask_backend cpu).
+* It follows the shaders step by step, to give the same result:
+*
+* - fragment.fs (with vertex.fs and geometry.fs): the vertex grid of every main camera is warped to every later (neighbor) camera
+*   and rasterized (pixel centers, 8 bits of subpixel precision). A pixel of the neighbor gets mask 1 if a fragment lands on it
+*   with a depth that is at most 0.15 away from the depth of the neighbor. The depth test of the GPU does not change the result,
+*   since fragments are only discarded, never overwritten with 0.
+* - erode_fragment.fs, dilate_fragment.fs and edge_fragment.fs: separable box filters (sum, min and max over rows and then columns),
+*   which the compiler vectorizes.
+*
+* Everything is in image coordinates (row 0 at the top), like CameraFrameData, instead of upside down like the GL textures.
+* The warps are split over the neighbor cameras and the filters over all cameras, on the worker threads of its own ThreadPool.
+*/
+class CpuMaskCalculator {
+public:
+	int nrWarpedPairs = 0; // by the last Calculate()
+
+private:
+	// a vertex of the warped vertex grid (see vertex.fs), in the window coordinates of the neighbor
+	struct WarpVertex {
+		float x, y;
+		float z;           // normalized depth, the clip space is [-1, 1] (w is always 1)
+		float outputDepth; // along the z axis of the neighbor
+		float inputDepth;  // of the main camera
+		bool valid;        // false outside of the fisheye circle
+	};
+
+	// a vertex of a triangle that is clipped by the near and far plane (or the guard band)
+	struct ClipVertex {
+		float x, y, z, depth;
+	};
+
+	// per worker thread
+	struct Scratch {
+		std::vector<WarpVertex> vertexRows[2]; // the previous and the current row of the vertex grid
+		std::vector<unsigned char> a, b, c;
+		std::vector<unsigned short> d0, d1, d2;
+	};
+
+	std::vector<InputCamera> cameras;
+	int width = 0;
+	int height = 0;
+	float triangle_deletion_factor = 0;     // same uniforms as the shaders, see ShaderController
+	float triangle_deletion_margin = 0;
+	const float guardBand = 16384;          // triangles that stick out of the image more than this (in pixels) are clipped
+	std::vector<std::vector<float>> depthTables; // per camera: the distance for every depth value, like vertex.fs and fragment.fs
+
+	ThreadPool pool;
+	std::vector<Scratch> scratch;
+	std::vector<std::vector<unsigned char>> rawMasks; // per camera, before erosion and dilation
+	std::vector<char> warpPairs;            // for each (main, neighbor) pair: warp it in this video frame
+	std::vector<CameraFrameData>* frame = nullptr;
+
+public:
+	CpuMaskCalculator() {}
+
+	void Init(const std::vector<InputCamera>& inputCameras, float triangle_deletion_margin, int nrThreads) {
+		cameras = inputCameras;
+		width = cameras[0].res_x;
+		height = cameras[0].res_y;
+
+		const InputCamera& input = cameras[0];
+		float max_error_x = 1.0f / (1.0f / input.z_far + 0.5f / (std::pow(2, input.bitdepth_depth) - 1.0f) * (1.0f / input.z_near - 1.0f / input.z_far));
+		float max_error = std::abs(1.0f / (1.0f / input.z_far) - max_error_x);
+		triangle_deletion_factor = max_error / std::pow(max_error_x - input.z_near, 2);
+		this->triangle_deletion_margin = triangle_deletion_margin;
+
+		depthTables.resize(cameras.size());
+		for (int i = 0; i < cameras.size(); i++) {
+			depthTables[i].resize(65536);
+			float near = cameras[i].z_near, far = cameras[i].z_far;
+			for (int d = 0; d < 65536; d++) {
+				float depth = 1.0f / (1.0f / far + (d / 65535.0f) * (1.0f / near - 1.0f / far));
+				depthTables[i][d] = std::min(depth, 1000.0f);
+			}
+		}
+
+		pool.init(nrThreads);
+		scratch.resize(nrThreads);
+		int nrPixels = width * height;
+		for (Scratch& s : scratch) {
+			s.vertexRows[0].resize(width + 1);
+			s.vertexRows[1].resize(width + 1);
+			s.a.resize(nrPixels);
+			s.b.resize(nrPixels);
+			s.c.resize(nrPixels);
+			s.d0.resize(nrPixels);
+			s.d1.resize(nrPixels);
+			s.d2.resize(nrPixels);
+		}
+		rawMasks = std::vector<std::vector<unsigned char>>(cameras.size(), std::vector<unsigned char>(nrPixels));
+	}
+
+	// calculate data[i].mask and data[i].is_edge from data[i].depth, for all input cameras,
+	// only warping the camera pairs that can overlap
+	void Calculate(/*in/out*/ std::vector<CameraFrameData>& data, CameraOverlap& overlap) {
+		frame = &data;
+		int n = (int)cameras.size();
+		for (int i = 0; i < n; i++) {
+			auto range = std::minmax_element(data[i].depth.begin(), data[i].depth.end());
+			overlap.SetFrameDepthRange(i, *range.first / 65535.0f, *range.second / 65535.0f);
+			std::fill(rawMasks[i].begin(), rawMasks[i].end(), 0);
+			data[i].mask.resize(width * height);
+			data[i].is_edge.resize(width * height);
+		}
+		warpPairs.assign(n * n, 0);
+		nrWarpedPairs = 0;
+		for (int main = 0; main < n; main++) {
+			for (int neighbor = main + 1; neighbor < n; neighbor++) {
+				warpPairs[main * n + neighbor] = overlap.ShouldWarp(main, neighbor);
+				nrWarpedPairs += warpPairs[main * n + neighbor];
+			}
+		}
+
+		// one task per neighbor, the ones with the most main cameras first
+		for (int neighbor = n - 1; neighbor > 0; neighbor--) {
+			pool.enqueue([this, neighbor](int worker) {
+				WarpToNeighbor(neighbor, scratch[worker]);
+			});
+		}
+		pool.waitUntilIdle();
+		for (int i = 0; i < n; i++) {
+			pool.enqueue([this, i](int worker) {
+				FilterMask(i, scratch[worker]);
+			});
+		}
+		pool.waitUntilIdle();
+	}
+
+	void Cleanup() {
+		pool.cleanup();
+	}
+
+private:
+	void WarpToNeighbor(int neighbor, Scratch& s) {
+		int n = (int)cameras.size();
+		for (int main = 0; main < neighbor; main++) {
+			if (warpPairs[main * n + neighbor]) {
+				Warp(main, neighbor, s);
+			}
+		}
+	}
+
+	void Warp(int main, int neighbor, Scratch& s) {
+		const unsigned short* depth = (*frame)[main].depth.data();
+		for (int row = 0; row <= height; row++) {
+			WarpVertex* current = s.vertexRows[row & 1].data();
+			WarpVertexRow(main, neighbor, depth, row, current);
+			if (row == 0) continue;
+
+			// the same 2 triangles per pixel as FrameBufferController
+			const WarpVertex* previous = s.vertexRows[(row - 1) & 1].data();
+			for (int col = 0; col < width; col++) {
+				WarpTriangle(main, neighbor, previous[col], current[col], previous[col + 1]);
+				WarpTriangle(main, neighbor, previous[col + 1], current[col], current[col + 1]);
+			}
+		}
+	}
+
+	// vertex.fs for one row of the vertex grid
+	void WarpVertexRow(int main, int neighbor, const unsigned short* depth, int row, /*out*/ WarpVertex* vertices) {
+		const InputCamera& in = cameras[main];
+		const InputCamera& out = cameras[neighbor];
+		const float* depthTable = depthTables[main].data();
+		float width_f = float(width), height_f = float(height);
+		float ty = row / height_f;
+		const unsigned short* depthRow = depth + std::min(row, height - 1) * width; // the nearest texel, clamped to the edge
+
+		for (int col = 0; col <= width; col++) {
+			WarpVertex& v = vertices[col];
+			float tx = col / width_f;
+			float d = depthTable[depthRow[std::min(col, width - 1)]];
+			v.inputDepth = d;
+			v.valid = true;
+
+			glm::vec4 worldPosition;
+			if (in.projection == Projection::Perspective) {
+				float x = (tx * width_f - in.principal_point_x) / in.focal_x * d;
+				float y = ((1.0f - ty) * height_f - (in.principal_point_y + 2.0f * (height_f * 0.5f - in.principal_point_y))) / in.focal_y * d;
+				worldPosition = in.model * glm::vec4(x, y, -d, 1.0f);
+			}
+			else if (in.projection == Projection::Equirectangular) {
+				float phi = in.hor_range.y - (in.hor_range.y - in.hor_range.x) * tx;
+				float theta = in.ver_range.y - (in.ver_range.y - in.ver_range.x) * ty;
+				worldPosition = in.model * glm::vec4(-std::cos(theta) * std::sin(phi) * d, std::sin(theta) * d, -std::cos(theta) * std::cos(phi) * d, 1.0f);
+			}
+			else {
+				float u = 2.0f * tx - 1.0f, w = 2.0f * ty - 1.0f;
+				float r = std::sqrt(u * u + w * w);
+				float theta = r * in.fov * 0.5f;
+				float nu = r > 0 ? u / r : 0, nw = r > 0 ? w / r : 0;
+				worldPosition = in.model * glm::vec4(d * std::sin(theta) * nu, -d * std::sin(theta) * nw, -d * std::cos(theta), 1.0f);
+				v.valid = r < 1.0f;
+			}
+			worldPosition /= worldPosition.w;
+
+			glm::vec4 viewPosition = out.view * worldPosition;
+			viewPosition /= viewPosition.w;
+			v.outputDepth = -viewPosition.z;
+			float ndc_x = 0, ndc_y = 0;
+			if (viewPosition.z < 0) {
+				float u = -viewPosition.x / viewPosition.z * out.focal_x + out.principal_point_x;
+				float w = -viewPosition.y / viewPosition.z * out.focal_y + (out.principal_point_y + 2.0f * (height_f * 0.5f - out.principal_point_y));
+				ndc_x = 2.0f * u / width_f - 1.0f;
+				ndc_y = 2.0f * w / height_f - 1.0f;
+				v.z = (-viewPosition.z - out.z_near) / (out.z_far - out.z_near);
+			}
+			else {
+				v.z = -10; // clipped
+			}
+			v.x = (ndc_x + 1.0f) * 0.5f * width_f;
+			v.y = (ndc_y + 1.0f) * 0.5f * height_f;
+		}
+	}
+
+	// geometry.fs, followed by clipping and rasterization
+	void WarpTriangle(int main, int neighbor, const WarpVertex& v0, const WarpVertex& v1, const WarpVertex& v2) {
+		if (!v0.valid || !v1.valid || !v2.valid) {
+			return;
+		}
+		float largest_depth_diff = std::max(std::abs(v0.inputDepth - v1.inputDepth), std::max(std::abs(v0.inputDepth - v2.inputDepth), std::abs(v1.inputDepth - v2.inputDepth)));
+		float largest_depth = std::max(v0.inputDepth, std::max(v1.inputDepth, v2.inputDepth));
+		float near = cameras[main].z_near;
+		float estimated_error = triangle_deletion_factor * (largest_depth - near) * (largest_depth - near);
+		if (!(largest_depth_diff < triangle_deletion_margin * estimated_error + 0.01f)) {
+			return;
+		}
+
+		ClipVertex polygon[9] = {
+			{ v0.x, v0.y, v0.z, v0.outputDepth },
+			{ v1.x, v1.y, v1.z, v1.outputDepth },
+			{ v2.x, v2.y, v2.z, v2.outputDepth },
+		};
+		int n = 3;
+		bool inside = true;
+		for (int k = 0; k < 3; k++) {
+			inside = inside && std::abs(polygon[k].z) <= 1.0f
+				&& polygon[k].x >= -guardBand && polygon[k].x <= width + guardBand
+				&& polygon[k].y >= -guardBand && polygon[k].y <= height + guardBand;
+		}
+		if (!inside) {
+			// the clip space planes z = -1 and z = 1, and the guard band (w = 1, so the attributes are linear in window coordinates)
+			for (int plane = 0; plane < 6 && n > 0; plane++) {
+				n = ClipPolygon(polygon, n, plane);
+			}
+		}
+		for (int k = 1; k + 1 < n; k++) {
+			Rasterize(neighbor, polygon[0], polygon[k], polygon[k + 1]);
+		}
+	}
+
+	float PlaneDistance(const ClipVertex& v, int plane) {
+		switch (plane) {
+		case 0: return v.z + 1.0f;
+		case 1: return 1.0f - v.z;
+		case 2: return v.x + guardBand;
+		case 3: return width + guardBand - v.x;
+		case 4: return v.y + guardBand;
+		default: return height + guardBand - v.y;
+		}
+	}
+
+	// Sutherland-Hodgman: keep the part of the polygon in front of the plane
+	int ClipPolygon(/*in/out*/ ClipVertex polygon[9], int n, int plane) {
+		ClipVertex result[9];
+		int m = 0;
+		for (int k = 0; k < n; k++) {
+			const ClipVertex& a = polygon[k];
+			const ClipVertex& b = polygon[(k + 1) % n];
+			float da = PlaneDistance(a, plane), db = PlaneDistance(b, plane);
+			if (da >= 0) {
+				result[m++] = a;
+			}
+			if ((da >= 0) != (db >= 0)) {
+				float t = da / (da - db);
+				result[m++] = ClipVertex{ a.x + t * (b.x - a.x), a.y + t * (b.y - a.y), a.z + t * (b.z - a.z), a.depth + t * (b.depth - a.depth) };
+			}
+		}
+		std::copy(result, result + m, polygon);
+		return m;
+	}
+
+	// fragment.fs for all pixel centers inside the triangle
+	void Rasterize(int neighbor, ClipVertex v0, ClipVertex v1, ClipVertex v2) {
+		// window coordinates with 8 bits of subpixel precision
+		int64_t x0 = ToSubpixels(v0.x), y0 = ToSubpixels(v0.y);
+		int64_t x1 = ToSubpixels(v1.x), y1 = ToSubpixels(v1.y);
+		int64_t x2 = ToSubpixels(v2.x), y2 = ToSubpixels(v2.y);
+
+		// pixel centers are at 128 + 256 * pixel, most triangles are so small that they do not contain any
+		int minCol = (int)std::max<int64_t>(0, FloorDiv(std::min(x0, std::min(x1, x2)) - 128 + 255, 256));
+		int maxCol = (int)std::min<int64_t>(width - 1, FloorDiv(std::max(x0, std::max(x1, x2)) - 128, 256));
+		int minRow = (int)std::max<int64_t>(0, FloorDiv(std::min(y0, std::min(y1, y2)) - 128 + 255, 256));
+		int maxRow = (int)std::min<int64_t>(height - 1, FloorDiv(std::max(y0, std::max(y1, y2)) - 128, 256));
+		if (minCol > maxCol || minRow > maxRow) {
+			return;
+		}
+
+		int64_t area = (x1 - x0) * (y2 - y0) - (y1 - y0) * (x2 - x0);
+		if (area == 0) {
+			return;
+		}
+		if (area < 0) {
+			// counterclockwise, so that the inside is on the left of every edge
+			std::swap(x1, x2);
+			std::swap(y1, y2);
+			std::swap(v1, v2);
+			area = -area;
+		}
+
+		// a pixel center exactly on an edge only belongs to the triangle left or below of it
+		bool inclusive0 = IsLeftOrBottomEdge(x1, y1, x2, y2);
+		bool inclusive1 = IsLeftOrBottomEdge(x2, y2, x0, y0);
+		bool inclusive2 = IsLeftOrBottomEdge(x0, y0, x1, y1);
+
+		unsigned char* mask = rawMasks[neighbor].data();
+		const unsigned short* neighborDepth = (*frame)[neighbor].depth.data();
+		const float* depthTable = depthTables[neighbor].data();
+		for (int row = minRow; row <= maxRow; row++) {
+			int64_t py = 128 + 256 * (int64_t)row;
+			// the rows of the window go up, the rows of the image down
+			int pixelRow = (height - 1 - row) * width;
+			for (int col = minCol; col <= maxCol; col++) {
+				int64_t px = 128 + 256 * (int64_t)col;
+				int64_t w0 = (x2 - x1) * (py - y1) - (y2 - y1) * (px - x1);
+				int64_t w1 = (x0 - x2) * (py - y2) - (y0 - y2) * (px - x2);
+				int64_t w2 = (x1 - x0) * (py - y0) - (y1 - y0) * (px - x0);
+				if (w0 < 0 || w1 < 0 || w2 < 0 || (w0 == 0 && !inclusive0) || (w1 == 0 && !inclusive1) || (w2 == 0 && !inclusive2)) {
+					continue;
+				}
+				int pixel = pixelRow + col;
+				if (mask[pixel] != 0) {
+					continue;
+				}
+				float depthMain = (float)((w0 * (double)v0.depth + w1 * (double)v1.depth + w2 * (double)v2.depth) / area);
+				float depthNeighbor = depthTable[neighborDepth[pixel]];
+				if (!(std::abs(depthMain - depthNeighbor) > 0.15f)) {
+					mask[pixel] = 255;
+				}
+			}
+		}
+	}
+
+	static int64_t ToSubpixels(float x) {
+		return (int64_t)std::floor(x * 256.0f + 0.5f);
+	}
+
+	static int64_t FloorDiv(int64_t a, int64_t b) {
+		return a >= 0 ? a / b : -((-a + b - 1) / b);
+	}
+
+	// for a counterclockwise triangle, with the y axis up
+	static bool IsLeftOrBottomEdge(int64_t xa, int64_t ya, int64_t xb, int64_t yb) {
+		return yb < ya || (yb == ya && xb > xa);
+	}
+
+	// erode_fragment.fs, dilate_fragment.fs and edge_fragment.fs, for input camera i
+	void FilterMask(int i, Scratch& s) {
+		const unsigned char* raw = rawMasks[i].data();
+		CameraFrameData& data = (*frame)[i];
+		int nrPixels = width * height;
+		auto plus = [](unsigned char a, unsigned char b) { return (unsigned char)(a + b); };
+		auto min8 = [](unsigned char a, unsigned char b) { return std::min(a, b); };
+		auto max8 = [](unsigned char a, unsigned char b) { return std::max(a, b); };
+		auto min16 = [](unsigned short a, unsigned short b) { return std::min(a, b); };
+		auto max16 = [](unsigned short a, unsigned short b) { return std::max(a, b); };
+
+		// erode: 0 if at least 8 of the 3x3 pixels are 0
+		for (int p = 0; p < nrPixels; p++) {
+			s.a[p] = raw[p] == 0;
+		}
+		FilterRows<1>(s.a.data(), s.b.data(), plus);
+		FilterColumns<1>(s.b.data(), s.a.data(), plus);
+		for (int p = 0; p < nrPixels; p++) {
+			s.a[p] = s.a[p] > 7 ? 0 : 255;
+		}
+
+		// dilate: 0 if any of the 5x5 pixels is 0
+		FilterRows<2>(s.a.data(), s.b.data(), min8);
+		FilterColumns<2>(s.b.data(), data.mask.data(), min8);
+
+		// edges: the 7x7 pixels do not all have the same mask, or their depth differs more than 0.01 from the center
+		FilterRows<3>(data.mask.data(), s.a.data(), min8);
+		FilterColumns<3>(s.a.data(), s.b.data(), min8);
+		FilterRows<3>(data.mask.data(), s.a.data(), max8);
+		FilterColumns<3>(s.a.data(), s.c.data(), max8);
+		FilterRows<3>(data.depth.data(), s.d0.data(), min16);
+		FilterColumns<3>(s.d0.data(), s.d1.data(), min16);
+		FilterRows<3>(data.depth.data(), s.d0.data(), max16);
+		FilterColumns<3>(s.d0.data(), s.d2.data(), max16);
+		// a difference of more than 0.01 between two normalized 16-bit depth values is a difference of more than 655
+		for (int p = 0; p < nrPixels; p++) {
+			int center = data.depth[p];
+			bool edge = s.b[p] != s.c[p] || s.d2[p] - center > 655 || center - s.d1[p] > 655;
+			data.is_edge[p] = edge ? 255 : 0;
+		}
+	}
+
+	// out[x] = op over in[x - R ... x + R] on the same row, with the coordinates clamped to the edge (like the textures)
+	template<int R, typename T, typename Op>
+	void FilterRows(const T* in, /*out*/ T* out, Op op) {
+		for (int y = 0; y < height; y++) {
+			const T* r = in + y * width;
+			T* o = out + y * width;
+			auto border = [&](int x) {
+				T v = r[std::min(std::max(x - R, 0), width - 1)];
+				for (int k = 1; k <= 2 * R; k++) v = op(v, r[std::min(std::max(x - R + k, 0), width - 1)]);
+				o[x] = v;
+			};
+			for (int x = 0; x < std::min(R, width); x++) border(x);
+			// one pass over the row per offset, which vectorizes
+			std::copy(r, r + std::max(width - 2 * R, 0), o + R);
+			for (int k = 1; k <= 2 * R; k++) {
+				for (int x = R; x < width - R; x++) {
+					o[x] = op(o[x], r[x - R + k]);
+				}
+			}
+			for (int x = std::max(width - R, R); x < width; x++) border(x);
+		}
+	}
+
+	// out[y] = op over in[y - R ... y + R] in the same column, with the coordinates clamped to the edge
+	template<int R, typename T, typename Op>
+	void FilterColumns(const T* in, /*out*/ T* out, Op op) {
+		for (int y = 0; y < height; y++) {
+			T* o = out + y * width;
+			std::copy(in + std::max(y - R, 0) * width, in + std::max(y - R, 0) * width + width, o);
+			for (int k = 1; k <= 2 * R; k++) {
+				const T* r = in + std::min(std::max(y - R + k, 0), height - 1) * width;
+				for (int x = 0; x < width; x++) {
+					o[x] = op(o[x], r[x]);
+				}
+			}
+		}
+	}
+};
+
+
+#endif
@@ -46,6 +46,7 @@ private:
     uint8_t *pDataWithHeader = NULL;
 
     unsigned int frameCount = 0;
+    bool bPacketPeeked = false; // pkt already holds the next video packet (read by SeekToKeyFrame())
 
 
 public:
@@ -207,26 +208,76 @@ public:
         return eVideoCodec;
     }
 
-    bool Demux(uint8_t **ppVideo, int *pnVideoBytes) {
+    /**
+    *   @brief  Seeks to the last key frame at or before video frame iFrame (counted from 0, at the frame rate of the stream),
+    *           so that decoding from there reaches iFrame. Returns the index of that key frame.
+    *           If the stream can not be seeked, it starts again from the beginning and returns 0.
+    */
+    int SeekToKeyFrame(int iFrame) {
         if (!fmtc) {
-            return false;
+            return 0;
+        }
+        AVStream *stream = fmtc->streams[iVideoStream];
+        AVRational frameRate = av_guess_frame_rate(fmtc, stream, NULL);
+        int64_t startTime = stream->start_time == AV_NOPTS_VALUE ? 0 : stream->start_time;
+        if (frameRate.num <= 0 || frameRate.den <= 0) {
+            Rewind();
+            return 0;
+        }
+        int64_t ts = startTime + av_rescale_q(iFrame, av_inv_q(frameRate), stream->time_base);
+        if (av_seek_frame(fmtc, iVideoStream, ts, AVSEEK_FLAG_BACKWARD) < 0) {
+            Rewind();
+            return 0;
         }
 
-        *pnVideoBytes = 0;
-
+        // read the key frame to find out where the seek ended up, Demux() returns it next
         if (pkt.data) {
             av_packet_unref(&pkt);
         }
-
         int e = 0;
         while ((e = av_read_frame(fmtc, &pkt)) >= 0 && pkt.stream_index != iVideoStream) {
             av_packet_unref(&pkt);
         }
+        int64_t pts = pkt.pts != AV_NOPTS_VALUE ? pkt.pts : pkt.dts;
+        int64_t keyFrame = av_rescale_q_rnd(pts - startTime, stream->time_base, av_inv_q(frameRate), (AVRounding)(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
+        if (e < 0 || pts == AV_NOPTS_VALUE || keyFrame < 0 || keyFrame > iFrame) {
+            Rewind();
+            return 0;
+        }
+        bPacketPeeked = true;
+        return (int)keyFrame;
+    }
+
+    // start demuxing from the beginning of the file again
+    void Rewind() {
+        bPacketPeeked = false;
+        avio_seek(fmtc->pb, 0, SEEK_SET);
+        avformat_seek_file(fmtc, iVideoStream, 0, 0, fmtc->streams[iVideoStream]->duration, 0);
+    }
+
+    bool Demux(uint8_t **ppVideo, int *pnVideoBytes) {
+        if (!fmtc) {
+            return false;
+        }
+
+        *pnVideoBytes = 0;
+
+        int e = 0;
+        if (bPacketPeeked) {
+            bPacketPeeked = false;
+        }
+        else {
+            if (pkt.data) {
+                av_packet_unref(&pkt);
+            }
+            while ((e = av_read_frame(fmtc, &pkt)) >= 0 && pkt.stream_index != iVideoStream) {
+                av_packet_unref(&pkt);
+            }
+        }
         if (e < 0) {
 			if (e == AVERROR_EOF) {
 				// reached end of file, start from the beginning
-				avio_seek(fmtc->pb, 0, SEEK_SET);
-				avformat_seek_file(fmtc, iVideoStream, 0, 0, fmtc->streams[iVideoStream]->duration, 0);
+				Rewind();
 				while ((e = av_read_frame(fmtc, &pkt)) >= 0 && pkt.stream_index != iVideoStream) {
 					av_packet_unref(&pkt);
 				}
@@ -279,6 +330,7 @@ public:
     }
 };
 
+#ifdef USE_NVDEC
 inline cudaVideoCodec FFmpeg2NvCodecId(AVCodecID id) {
     switch (id) {
     case AV_CODEC_ID_MPEG1VIDEO : return cudaVideoCodec_MPEG1;
@@ -295,5 +347,6 @@ inline cudaVideoCodec FFmpeg2NvCodecId(AVCodecID id) {
     default                     : return cudaVideoCodec_NumCodecs;
     }
 }
+#endif
 
 
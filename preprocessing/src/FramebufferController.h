@@ -8,6 +8,7 @@ private:
 	int nrFramebuffers = 1;
 	GLuint framebuffers[1];
 	GLuint depthrenderbuffers[1];
+	GLuint depthBoundsFramebuffer = 0; // only has the output texture of CalculateDepthBounds(), which is taller than the other attachments
 
 	// VBOs:
 	GLuint VAO, VBO, EBO = 0;          // for 3D warping
@@ -74,6 +75,12 @@ public:
 			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 		}
 
+		// the shader writes the bounds to location 2, like the other passes
+		glGenFramebuffers(1, &depthBoundsFramebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, depthBoundsFramebuffer);
+		GLenum depthBoundsDrawBuffers[3] = { GL_NONE, GL_NONE, GL_COLOR_ATTACHMENT2 };
+		glDrawBuffers(3, depthBoundsDrawBuffers);
+
 		// Setup the trianglemesh that will be drawn (shared by all input cameras)
 		nrIndices = 6 * width * height; // 2 triangles per pixel, since pixel is in center of square
 		indices = new unsigned int[nrIndices];
@@ -140,15 +147,16 @@ public:
 		return true;
 	}
 
-	void WarpToNeighbor(GLuint mainDepth, GLuint neighborDepth, GLuint neighborMask, bool shouldClear) {
+	void ClearMask(GLuint mask) {
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[0]);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, mask, 0);
+		glClear(GL_COLOR_BUFFER_BIT);
+	}
+
+	void WarpToNeighbor(GLuint mainDepth, GLuint neighborDepth, GLuint neighborMask) {
 		glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[0]);
 		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, neighborMask, 0);
-		if (shouldClear) { 
-			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); 
-		}
-		else {
-			glClear(GL_DEPTH_BUFFER_BIT);
-		}
+		glClear(GL_DEPTH_BUFFER_BIT);
 		glBindVertexArray(VAO);
 		glActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D, mainDepth);
@@ -193,10 +201,41 @@ public:
 		glBindVertexArray(quadVAO);
 		glDrawArrays(GL_TRIANGLES, 0, 6);
 	}
+
+	// render to the rows [rowOffset, rowOffset + outputHeight) of outputTex (the shader knows rowOffset too).
+	// outputTex holds the rows of all input cameras, so it can be taller than the attachments of framebuffers[0],
+	// outside of which nothing would be drawn: it gets a framebuffer of its own, without depth buffer
+	void CalculateDepthBounds(GLuint depthTex, int rowOffset, int outputWidth, int outputHeight, /*out*/ GLuint outputTex) {
+		glBindFramebuffer(GL_FRAMEBUFFER, depthBoundsFramebuffer);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, outputTex, 0);
+		glViewport(0, rowOffset, outputWidth, outputHeight);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, depthTex);
+		glBindVertexArray(quadVAO);
+		glDrawArrays(GL_TRIANGLES, 0, 6);
+	}
+
+	void PackForReadback(GLuint maskTex, GLuint edgeTex, GLuint depthTex, /*out*/ GLuint outputTex) {
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[0]);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, outputTexColors[0], 0);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, outputTexDepths[0], 0);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, outputTex, 0);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, maskTex);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, edgeTex);
+		glActiveTexture(GL_TEXTURE2);
+		glBindTexture(GL_TEXTURE_2D, depthTex);
+		glBindVertexArray(quadVAO);
+		glDrawArrays(GL_TRIANGLES, 0, 6);
+		glActiveTexture(GL_TEXTURE0);
+	}
 	
 
 	void cleanup() {
 		glDeleteFramebuffers(nrFramebuffers, framebuffers);
+		glDeleteFramebuffers(1, &depthBoundsFramebuffer);
 		glDeleteTextures(nrFramebuffers, outputTexColors);
 		glDeleteTextures(nrFramebuffers, outputTexDepths);
 		glDeleteTextures(nrFramebuffers, outputTexMasks);
@@ -0,0 +1,181 @@
+#ifndef GL_CONTEXT_H
+#define GL_CONTEXT_H
+
+#ifdef USE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+
+/*
+* GLContext creates the OpenGL context of CreateMeshes (--gl_context):
+*
+* - window: a GLFW window (invisible without --gui), which needs a display. Always used with --gui.
+* - egl: a surfaceless EGL context, without any display: EGL_PLATFORM_SURFACELESS_MESA (e.g. Mesa llvmpipe),
+*   or else the first EGL device (NVIDIA). Only available if built with USE_EGL.
+* - osmesa: an OSMesa context (software rendering) on the null platform of GLFW, which also does not need a display.
+* - auto (the default): window with --gui, otherwise the first of egl, osmesa and window that works.
+*
+* All rendering (except the GUI) goes to framebuffer objects, so the context does not need a default framebuffer.
+* GLFW is always initialized, since glfwGetTime() is used for the timings (on its null platform for egl and osmesa).
+*/
+class GLContext {
+public:
+	GLFWwindow* window = NULL; // NULL for egl
+
+private:
+#ifdef USE_EGL
+	EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+	EGLContext eglContext = EGL_NO_CONTEXT;
+#endif
+
+public:
+	GLContext() {}
+
+	bool Init(const std::string& backend, bool visible, int width, int height, bool verbose) {
+		if (backend == "window" || visible) {
+			return InitWindow(visible, width, height, verbose);
+		}
+		if (backend == "egl") {
+			return InitEGL(verbose);
+		}
+		if (backend == "osmesa") {
+			return InitOSMesa(verbose);
+		}
+		return InitEGL(verbose) || InitOSMesa(verbose) || InitWindow(false, width, height, verbose);
+	}
+
+	// for gladLoadGL()
+	GLADloadfunc GetProcAddress() {
+#ifdef USE_EGL
+		if (eglContext != EGL_NO_CONTEXT) return (GLADloadfunc)eglGetProcAddress;
+#endif
+		return (GLADloadfunc)glfwGetProcAddress;
+	}
+
+	void Cleanup() {
+#ifdef USE_EGL
+		if (eglContext != EGL_NO_CONTEXT) {
+			eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+			eglDestroyContext(eglDisplay, eglContext);
+			eglContext = EGL_NO_CONTEXT;
+		}
+		if (eglDisplay != EGL_NO_DISPLAY) {
+			eglTerminate(eglDisplay);
+			eglDisplay = EGL_NO_DISPLAY;
+		}
+#endif
+		if (window != NULL) glfwDestroyWindow(window);
+		window = NULL;
+		glfwTerminate();
+	}
+
+private:
+	bool InitWindow(bool visible, int width, int height, bool verbose) {
+		glfwTerminate(); // in case the null platform was initialized before
+		glfwInitHint(GLFW_PLATFORM, GLFW_ANY_PLATFORM);
+		if (!glfwInit()) {
+			std::cout << "Error: could not initialize GLFW (is there a display?)" << std::endl;
+			return false;
+		}
+		if (!visible) glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+		window = glfwCreateWindow(width, height, "CreateMeshes", NULL, NULL);
+		if (window == NULL) {
+			std::cout << "Error: could not create a GLFW window" << std::endl;
+			return false;
+		}
+		glfwMakeContextCurrent(window);
+		glfwSwapInterval(0); // disable vsync
+
+		int xpos, ypos;
+		glfwGetMonitorPos(glfwGetPrimaryMonitor(), &xpos, &ypos);
+		glfwSetWindowPos(window, xpos, ypos + 20); // Move window to top-left
+		if (verbose) printf("OpenGL context: GLFW window\n");
+		return true;
+	}
+
+	bool InitOSMesa(bool verbose) {
+		glfwTerminate();
+		glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+		if (!glfwInit()) {
+			std::cout << "Error: could not initialize the null platform of GLFW" << std::endl;
+			return false;
+		}
+		glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+		window = glfwCreateWindow(16, 16, "CreateMeshes", NULL, NULL);
+		glfwDefaultWindowHints();
+		if (window == NULL) {
+			if (verbose) printf("Could not create an OSMesa context\n");
+			return false;
+		}
+		glfwMakeContextCurrent(window);
+		if (verbose) printf("OpenGL context: OSMesa\n");
+		return true;
+	}
+
+	bool InitEGL(bool verbose) {
+#ifdef USE_EGL
+		glfwTerminate();
+		glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+		if (!glfwInit()) {
+			std::cout << "Error: could not initialize the null platform of GLFW" << std::endl;
+			return false;
+		}
+
+		// the surfaceless platform of Mesa, or else the first EGL device (NVIDIA)
+		PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		PFNEGLQUERYDEVICESEXTPROC queryDevices = (PFNEGLQUERYDEVICESEXTPROC)eglGetProcAddress("eglQueryDevicesEXT");
+		const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+		std::string extensions = clientExtensions != NULL ? clientExtensions : "";
+		const char* platform = "default display";
+		if (getPlatformDisplay != NULL && extensions.find("EGL_MESA_platform_surfaceless") != std::string::npos) {
+			eglDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+			platform = "surfaceless";
+		}
+		if (eglDisplay == EGL_NO_DISPLAY && getPlatformDisplay != NULL && queryDevices != NULL && extensions.find("EGL_EXT_platform_device") != std::string::npos) {
+			EGLDeviceEXT device;
+			EGLint nrDevices = 0;
+			if (queryDevices(1, &device, &nrDevices) && nrDevices > 0) {
+				eglDisplay = getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, device, NULL);
+				platform = "device";
+			}
+		}
+		if (eglDisplay == EGL_NO_DISPLAY) {
+			eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+			platform = "default display";
+		}
+		EGLint major = 0, minor = 0;
+		if (eglDisplay == EGL_NO_DISPLAY || !eglInitialize(eglDisplay, &major, &minor)) {
+			if (verbose) printf("Could not initialize EGL\n");
+			eglDisplay = EGL_NO_DISPLAY;
+			return false;
+		}
+
+		// no surface is needed, so any config will do
+		const EGLint configAttribs[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_SURFACE_TYPE, 0, EGL_NONE };
+		EGLConfig config;
+		EGLint nrConfigs = 0;
+		if (!eglBindAPI(EGL_OPENGL_API) || !eglChooseConfig(eglDisplay, configAttribs, &config, 1, &nrConfigs) || nrConfigs == 0) {
+			if (verbose) printf("Could not find an EGL config for OpenGL\n");
+			return false;
+		}
+		eglContext = eglCreateContext(eglDisplay, config, EGL_NO_CONTEXT, NULL);
+		if (eglContext != EGL_NO_CONTEXT && !eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, eglContext)) {
+			eglDestroyContext(eglDisplay, eglContext);
+			eglContext = EGL_NO_CONTEXT;
+		}
+		if (eglContext == EGL_NO_CONTEXT) {
+			if (verbose) printf("Could not create a surfaceless EGL context\n");
+			return false;
+		}
+		if (verbose) printf("OpenGL context: EGL %d.%d, %s platform\n", major, minor, platform);
+		return true;
+#else
+		if (verbose) printf("Built without EGL (USE_EGL=OFF)\n");
+		return false;
+#endif
+	}
+};
+
+
+#endif
@@ -0,0 +1,255 @@
+#ifndef GRID_KERNELS_H
+#define GRID_KERNELS_H
+
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+
+/*
+* The per-pixel work of MeshBuilder::BuildGrid(), for one row of pixel squares at a time.
+* The rows are processed with AVX2 if the compiler targets it (see USE_AVX2 in CMakeLists.txt),
+* and with plain loops otherwise. Both write one byte per pixel square.
+*/
+namespace GridKernels {
+
+	// bits of the bytes written by NotElongatedRow()
+	const uint8_t TOP_LEFT = 1;
+	const uint8_t TOP_RIGHT = 2;
+	const uint8_t BOTTOM_LEFT = 4;
+	const uint8_t BOTTOM_RIGHT = 8;
+
+	// for the n pixel squares between the depth rows d0 (top) and d1 (bottom):
+	// which of the 4 triangles of a square have no depth difference >= thresh between their vertices
+	inline void NotElongatedRow(const unsigned short* d0, const unsigned short* d1, int n, unsigned short thresh, /*out*/ uint8_t* out) {
+		int col = 0;
+#ifdef __AVX2__
+		const __m256i limit = _mm256_set1_epi16((short)(thresh - 1));
+		auto close = [&limit](__m256i a, __m256i b) {
+			__m256i diff = _mm256_or_si256(_mm256_subs_epu16(a, b), _mm256_subs_epu16(b, a));
+			return _mm256_cmpeq_epi16(_mm256_min_epu16(diff, limit), diff); // diff <= thresh - 1
+		};
+		for (; col + 16 <= n; col += 16) {
+			__m256i d00 = _mm256_loadu_si256((const __m256i*)(d0 + col));
+			__m256i d01 = _mm256_loadu_si256((const __m256i*)(d0 + col + 1));
+			__m256i d10 = _mm256_loadu_si256((const __m256i*)(d1 + col));
+			__m256i d11 = _mm256_loadu_si256((const __m256i*)(d1 + col + 1));
+			__m256i e_00_01 = close(d00, d01);
+			__m256i e_00_10 = close(d00, d10);
+			__m256i e_00_11 = close(d00, d11);
+			__m256i e_01_11 = close(d01, d11);
+			__m256i e_10_11 = close(d10, d11);
+			__m256i e_10_01 = close(d10, d01);
+			__m256i tl = _mm256_and_si256(_mm256_and_si256(e_00_01, e_00_10), e_10_01);
+			__m256i tr = _mm256_and_si256(_mm256_and_si256(e_00_01, e_01_11), e_00_11);
+			__m256i bl = _mm256_and_si256(_mm256_and_si256(e_00_10, e_10_11), e_00_11);
+			__m256i br = _mm256_and_si256(_mm256_and_si256(e_01_11, e_10_11), e_10_01);
+			__m256i bits = _mm256_or_si256(
+				_mm256_or_si256(_mm256_and_si256(tl, _mm256_set1_epi16(TOP_LEFT)), _mm256_and_si256(tr, _mm256_set1_epi16(TOP_RIGHT))),
+				_mm256_or_si256(_mm256_and_si256(bl, _mm256_set1_epi16(BOTTOM_LEFT)), _mm256_and_si256(br, _mm256_set1_epi16(BOTTOM_RIGHT))));
+			__m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(bits), _mm256_extracti128_si256(bits, 1));
+			_mm_storeu_si128((__m128i*)(out + col), bytes);
+		}
+#endif
+		for (; col < n; col++) {
+			int d00 = d0[col], d01 = d0[col + 1], d10 = d1[col], d11 = d1[col + 1];
+			bool e_00_01 = abs(d00 - d01) < thresh;
+			bool e_00_10 = abs(d00 - d10) < thresh;
+			bool e_00_11 = abs(d00 - d11) < thresh;
+			bool e_01_11 = abs(d01 - d11) < thresh;
+			bool e_10_11 = abs(d10 - d11) < thresh;
+			bool e_10_01 = abs(d10 - d01) < thresh;
+			out[col] = (e_00_01 && e_00_10 && e_10_01 ? TOP_LEFT : 0)
+				| (e_00_01 && e_01_11 && e_00_11 ? TOP_RIGHT : 0)
+				| (e_00_10 && e_10_11 && e_00_11 ? BOTTOM_LEFT : 0)
+				| (e_01_11 && e_10_11 && e_10_01 ? BOTTOM_RIGHT : 0);
+		}
+	}
+
+	// for the n pixel squares between the mask rows m0 (top) and m1 (bottom):
+	// which of the 4 vertices of a square are not masked away (1: top left, 2: top right, 4: bottom left, 8: bottom right)
+	inline void SquareTypesRow(const unsigned char* m0, const unsigned char* m1, int n, /*out*/ uint8_t* out) {
+		int col = 0;
+#ifdef __AVX2__
+		const __m256i zero = _mm256_setzero_si256();
+		auto bit = [&zero](const unsigned char* m, char value) {
+			__m256i keep = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)m), zero);
+			return _mm256_and_si256(keep, _mm256_set1_epi8(value));
+		};
+		for (; col + 32 <= n; col += 32) {
+			__m256i types = _mm256_or_si256(_mm256_or_si256(bit(m0 + col, 1), bit(m0 + col + 1, 2)),
+				_mm256_or_si256(bit(m1 + col, 4), bit(m1 + col + 1, 8)));
+			_mm256_storeu_si256((__m256i*)(out + col), types);
+		}
+#endif
+		for (; col < n; col++) {
+			out[col] = (m0[col] == 0) + 2 * (m0[col + 1] == 0) + 4 * (m1[col] == 0) + 8 * (m1[col + 1] == 0);
+		}
+	}
+
+	// the distance (from the camera, along the z axis or the ray, depending on the projection) for every 16-bit depth value,
+	// so that converting a depth value does not need a division
+	class DistanceTable {
+		std::vector<double> distances;
+		float near = 0;
+		float far = 0;
+
+	public:
+		const double* Get(float near, float far) {
+			if (distances.empty() || near != this->near || far != this->far) {
+				this->near = near;
+				this->far = far;
+				distances.resize(65536);
+				for (int d = 0; d < 65536; d++) {
+					distances[d] = 1.0 / (1.0f / far + (d / 65535.0) * (1.0f / near - 1.0f / far));
+				}
+			}
+			return distances.data();
+		}
+	};
+}
+
+/*
+* The unprojection of a pixel and its distance to a camera space position, specialized per Projection,
+* so that MeshBuilder::BuildGrid() can be instantiated for each projection without a branch per pixel.
+* Init() fills the tables per column and row of the image (it only allocates when the resolution grows).
+* The camera looks along -z, with +y up and +x to the right, like the shaders.
+*/
+struct PerspectiveUnprojection {
+	static const bool allPixelsValid = true;
+	std::vector<float> xFactors; // per column
+	std::vector<float> yFactors; // per row
+
+	void Init(const InputCamera& input) {
+		xFactors.resize(input.res_x);
+		yFactors.resize(input.res_y);
+		for (int col = 0; col < input.res_x; col++) {
+			xFactors[col] = -(col + 0.5f - input.principal_point_x) / input.focal_x;
+		}
+		for (int row = 0; row < input.res_y; row++) {
+			yFactors[row] = (row + 0.5f - input.principal_point_y) / input.focal_y;
+		}
+	}
+
+	bool IsValid(int col, int row) const {
+		return true;
+	}
+
+	// the distance is measured along the z axis
+	vec3f Unproject(int col, int row, double distance) const {
+		vec3f p;
+		p.z = -distance;
+		p.x = xFactors[col] * p.z;
+		p.y = yFactors[row] * p.z;
+		return p;
+	}
+
+	static double Distance(const vec3f& p) {
+		return -p.z;
+	}
+
+	static void Project(const InputCamera& input, const vec3f& p, /*out*/ int& col, /*out*/ int& row) {
+		col = (int)std::round(input.principal_point_x - p.x * input.focal_x / p.z - 0.5f);
+		row = (int)std::round(p.y * input.focal_y / p.z + input.principal_point_y - 0.5f);
+	}
+};
+
+struct EquirectangularUnprojection {
+	static const bool allPixelsValid = true;
+	std::vector<float> sinPhi, cosPhi;     // per column
+	std::vector<float> sinTheta, cosTheta; // per row
+
+	void Init(const InputCamera& input) {
+		sinPhi.resize(input.res_x);
+		cosPhi.resize(input.res_x);
+		sinTheta.resize(input.res_y);
+		cosTheta.resize(input.res_y);
+		for (int col = 0; col < input.res_x; col++) {
+			float phi = input.hor_range.y - (input.hor_range.y - input.hor_range.x) * (col + 0.5f) / input.res_x;
+			sinPhi[col] = std::sin(phi);
+			cosPhi[col] = std::cos(phi);
+		}
+		for (int row = 0; row < input.res_y; row++) {
+			float theta = input.ver_range.y - (input.ver_range.y - input.ver_range.x) * (row + 0.5f) / input.res_y;
+			sinTheta[row] = std::sin(theta);
+			cosTheta[row] = std::cos(theta);
+		}
+	}
+
+	bool IsValid(int col, int row) const {
+		return true;
+	}
+
+	// the distance is measured along the ray
+	vec3f Unproject(int col, int row, double distance) const {
+		vec3f p;
+		p.x = -cosTheta[row] * sinPhi[col] * distance;
+		p.y = sinTheta[row] * distance;
+		p.z = -cosTheta[row] * cosPhi[col] * distance;
+		return p;
+	}
+
+	static double Distance(const vec3f& p) {
+		return std::sqrt((double)p.x * p.x + (double)p.y * p.y + (double)p.z * p.z);
+	}
+
+	static void Project(const InputCamera& input, const vec3f& p, /*out*/ int& col, /*out*/ int& row) {
+		double phi = std::atan2(-p.x, -p.z);
+		double theta = std::asin(p.y / std::max(Distance(p), 1e-12));
+		col = (int)std::round((input.hor_range.y - phi) / (input.hor_range.y - input.hor_range.x) * input.res_x - 0.5);
+		row = (int)std::round((input.ver_range.y - theta) / (input.ver_range.y - input.ver_range.x) * input.res_y - 0.5);
+	}
+};
+
+struct FisheyeUnprojection {
+	static const bool allPixelsValid = false; // the pixels outside of the image circle
+	std::vector<float> u; // per column, in [-1, 1]
+	std::vector<float> v; // per row, in [-1, 1]
+	float fov = 0;
+
+	void Init(const InputCamera& input) {
+		u.resize(input.res_x);
+		v.resize(input.res_y);
+		for (int col = 0; col < input.res_x; col++) {
+			u[col] = 2.0f * (col + 0.5f) / input.res_x - 1.0f;
+		}
+		for (int row = 0; row < input.res_y; row++) {
+			v[row] = 2.0f * (row + 0.5f) / input.res_y - 1.0f;
+		}
+		fov = input.fov;
+	}
+
+	bool IsValid(int col, int row) const {
+		return u[col] * u[col] + v[row] * v[row] < 1.0f;
+	}
+
+	// the distance is measured along the ray
+	vec3f Unproject(int col, int row, double distance) const {
+		float r = std::sqrt(u[col] * u[col] + v[row] * v[row]);
+		float theta = r * fov * 0.5f;
+		double s = r > 0 ? distance * std::sin(theta) / r : 0;
+		vec3f p;
+		p.x = s * u[col];
+		p.y = -s * v[row];
+		p.z = -distance * std::cos(theta);
+		return p;
+	}
+
+	static double Distance(const vec3f& p) {
+		return std::sqrt((double)p.x * p.x + (double)p.y * p.y + (double)p.z * p.z);
+	}
+
+	static void Project(const InputCamera& input, const vec3f& p, /*out*/ int& col, /*out*/ int& row) {
+		double distance = std::max(Distance(p), 1e-12);
+		double r = std::acos(std::min(std::max(-p.z / distance, -1.0), 1.0)) / (input.fov * 0.5);
+		double rho = std::sqrt((double)p.x * p.x + (double)p.y * p.y);
+		double u = rho > 0 ? r * p.x / rho : 0;
+		double v = rho > 0 ? -r * p.y / rho : 0;
+		col = (int)std::round((u + 1.0) * 0.5 * input.res_x - 0.5);
+		row = (int)std::round((v + 1.0) * 0.5 * input.res_y - 0.5);
+	}
+};
+
+
+#endif
@@ -0,0 +1,601 @@
+#ifndef MESH_BUILDER_H
+#define MESH_BUILDER_H
+
+
+inline uint8_t popcount(uint8_t x) {
+	uint8_t c = 0;
+	while (x) {
+		x &= (x - 1);
+		++c;
+	}
+	return c;
+}
+
+/*
+* CameraFrameData holds what was downloaded from the GPU for one input camera and one video frame.
+* It is everything that is needed to build the simplified mesh of that camera.
+*/
+struct CameraFrameData {
+	std::vector<unsigned char> mask;     // mask == 0 means keep pixel
+	std::vector<unsigned char> is_edge;  // 0 means pixel is not on a depth edge
+	std::vector<unsigned short> depth;
+};
+
+/*
+* CameraMesh is the simplified mesh of one input camera.
+* The triangle indices are local to the camera, i.e. they start at 0.
+* With several levels of detail (MeshSettings::nrLevels), the levels follow each other, each with its own vertices, triangles and meshlets.
+*/
+struct CameraMesh {
+	std::vector<float> vertices;     // world space positions, 3 floats per vertex
+	std::vector<uint32_t> triangles; // 3 vertex indices per triangle
+	std::vector<Meshlet> meshlets;   // empty, or all triangles in meshlets (with their first index in triangles)
+};
+
+/*
+* Tile is a rectangle of the vertex grid of one input camera (all bounds inclusive).
+* Neighboring tiles share the vertices on their common border.
+*/
+struct Tile {
+	int r0, r1, c0, c1;
+};
+
+/*
+* TileMesh is the simplified mesh of one Tile, in camera space.
+* The vertices on the borders it shares with other tiles are locked, and their id is their pixel index.
+*/
+template<typename Real>
+struct TileMeshT {
+	std::vector<Simplify::Vertex> vertices;
+	std::vector<Simplify::TriangleT<Real>> triangles;
+};
+typedef TileMeshT<float> TileMesh;
+
+/*
+* MeshSettings are the options (see main.cpp) that change how MeshBuilder creates the meshes.
+*/
+struct MeshSettings {
+	bool useHeapSimplifier = false; // simplify with simplify_mesh_heap() instead of simplify_mesh()
+	bool useQuadtree = false;       // build the mesh with QuadtreeMesher instead of simplifying the full vertex grid
+	float quadtreeMaxError = 0.01f; // see QuadtreeMesher
+	bool quadtreeRefine = false;    // also simplify the mesh of the QuadtreeMesher
+	bool optimizeVertexCache = true; // reorder the triangles and vertices of the meshes for the GPU with MeshOptimizer
+	bool sortFrontToBack = false;   // and then also sort them front to back (see MeshOptimizer)
+	int meshletSize = 128;          // max nr of triangles of the meshlets that MeshOptimizer groups them into, 0 for none
+	int nrLevels = 1;               // nr of levels of detail of every mesh (needs meshlets to tell them apart)
+};
+
+/*
+* MeshBuilder turns the depth map of one input camera into a simplified, world space mesh.
+* It owns its own Simplify::Simplifier, so different MeshBuilders can run on different threads.
+*
+* The whole depth map is either simplified at once with BuildMesh(), or split into tiles (see GetTiles())
+* that are simplified independently with BuildTileMesh(), after which StitchTiles() merges them
+* and simplifies the triangles along the seams between the tiles (or BuildUnstitchedTileMesh() turns every tile into a mesh on its own).
+*
+* The simplification itself either uses the threshold sweeps of Simplify::Simplifier::simplify_mesh(),
+* or (if useHeapSimplifier) the priority queue of edge collapses of simplify_mesh_heap().
+* If useQuadtree, BuildMesh() does not start from the full vertex grid but from the (much smaller)
+* adaptive mesh of a QuadtreeMesher, which is only simplified further if quadtreeRefine.
+* The finished meshes are reordered for the vertex cache of the renderer by a MeshOptimizer (unless settings.optimizeVertexCache is false),
+* which also groups their triangles into meshlets.
+* With settings.nrLevels > 1, the simplified mesh is level 0 of the CameraMesh, and is then simplified further
+* (with the same two passes) into coarser levels of detail, that are appended to it (see BuildLevels()).
+* Real is the precision of the quadrics and errors stored by the simplifier (see Simplify::SimplifierT),
+* MeshBuilder (float) is what is normally used, MeshBuilderT<double> is only used to check it.
+*/
+template<typename Real>
+class MeshBuilderT {
+private:
+	typedef Simplify::TriangleT<Real> Triangle;
+	typedef TileMeshT<Real> TileMesh;
+
+	Simplify::SimplifierT<Real> simplifier;
+	QuadtreeMesher quadtree;
+	MeshOptimizer optimizer;
+	MeshSettings settings;
+	std::vector<int> gridToVertex; // BuildGrid(): for each grid vertex of the tile, the index of its simplifier vertex (or -1)
+	std::vector<int> vertexToGrid; // BuildGrid(): for each simplifier vertex, its grid vertex (row * tile width + col)
+	std::vector<uint8_t> not_elongated; // BuildGrid(): for each pixel square, which of its triangles are not elongated (see GridKernels)
+	std::vector<uint8_t> square_types;  // BuildGrid(): for each pixel square, which of its vertices are not masked away
+	std::vector<unsigned char> quadtreeMask; // BuildQuadtree(): the mask including the pixels that are not valid for the projection
+	std::vector<int> sharedVertices; // StitchTiles(): for each pixel, the index of its locked vertex or -1
+	std::vector<int> remap;          // StitchTiles()
+	std::vector<bool> nearSeam;      // StitchTiles()
+	CameraMesh levelMesh;            // BuildLevels(), the coarser level that is appended to the mesh
+	GridKernels::DistanceTable distanceTable;
+	PerspectiveUnprojection perspective;
+	EquirectangularUnprojection equirectangular;
+	FisheyeUnprojection fisheye;
+
+public:
+	MeshBuilderT(const MeshSettings& settings = MeshSettings()) : settings(settings) {}
+
+	void BuildMesh(const InputCamera& input, const CameraFrameData& data, /*out*/ CameraMesh& mesh, int cameraIdx, bool verbose) {
+		if (verbose) printf("\ncamera %d: start simplifying mesh\n", cameraIdx);
+
+		if (settings.useQuadtree) {
+			BuildQuadtree(input, data);
+			if (verbose) printf("camera %d: quadtree -> %d triangles\n", cameraIdx, (int)simplifier.triangles.size());
+			if (settings.quadtreeRefine) {
+				// the same two passes and targets as for the full vertex grid (which has about 2 triangles per unmasked pixel),
+				// the smooth areas are already coarse, so this mostly simplifies the cells of 1 pixel square along the edges and masks
+				int nrGridTriangles = 2 * (int)std::count(data.mask.begin(), data.mask.end(), 0);
+				SimplifyMesh(nrGridTriangles / 70, true);
+				SimplifyMesh(simplifier.triangles.size() / 4, false);
+			}
+			if (verbose) printf("camera %d: end simplification with %d triangles\n", cameraIdx, (int)simplifier.triangles.size());
+			BuildLevels(input, mesh, cameraIdx, verbose);
+			return;
+		}
+
+		// turn into mesh
+		BuildGrid(input, data, Tile{ 0, input.res_y - 1, 0, input.res_x - 1 });
+
+		// simplify mesh (only where edge map says there are no edges)
+		if (verbose) printf("camera %d: -> %d triangles\n", cameraIdx, (int)simplifier.triangles.size());
+		int target_triangle_count = simplifier.triangles.size() / 70;
+		SimplifyMesh(target_triangle_count, true);
+
+		// simplify mesh (only where edge map says there are edges)
+		if (verbose) printf("camera %d: -> %d triangles\n", cameraIdx, (int)simplifier.triangles.size());
+		target_triangle_count = simplifier.triangles.size() / 4;
+		SimplifyMesh(target_triangle_count, false);
+
+		if (verbose) printf("camera %d: end simplification with %d triangles\n", cameraIdx, (int)simplifier.triangles.size());
+		BuildLevels(input, mesh, cameraIdx, verbose);
+	}
+
+	// split the vertex grid into tiles of (at most) tileSize x tileSize pixel squares
+	static std::vector<Tile> GetTiles(int width, int height, int tileSize) {
+		std::vector<Tile> tiles;
+		for (int r0 = 0; r0 < height - 1; r0 += tileSize) {
+			for (int c0 = 0; c0 < width - 1; c0 += tileSize) {
+				tiles.push_back(Tile{ r0, std::min(r0 + tileSize, height - 1), c0, std::min(c0 + tileSize, width - 1) });
+			}
+		}
+		return tiles;
+	}
+
+	void BuildTileMesh(const InputCamera& input, const CameraFrameData& data, const Tile& tile, /*out*/ TileMesh& tileMesh) {
+		SimplifyTile(input, data, tile);
+		CopyWithSlack(simplifier.vertices, tileMesh.vertices);
+		CopyWithSlack(simplifier.triangles, tileMesh.triangles);
+	}
+
+	// a tile that is not stitched to the others (with --temporal_tolerance, so that its mesh can be reused in later frames on its own),
+	// its vertices on the shared borders are still those of the neighboring tiles, since they are locked
+	void BuildUnstitchedTileMesh(const InputCamera& input, const CameraFrameData& data, const Tile& tile, /*out*/ CameraMesh& mesh) {
+		SimplifyTile(input, data, tile);
+		BuildLevels(input, mesh, -1, false); // not verbose, there are too many tiles
+	}
+
+	void StitchTiles(const InputCamera& input, const std::vector<TileMesh>& tileMeshes, /*out*/ CameraMesh& mesh, int cameraIdx, bool verbose) {
+		simplifier.vertices.clear();
+		simplifier.triangles.clear();
+
+		// merge the tiles, the locked vertices with the same id become one vertex
+		sharedVertices.resize(input.res_x * input.res_y, -1); // id -> index in simplifier.vertices
+		for (const TileMesh& tileMesh : tileMeshes) {
+			remap.resize(tileMesh.vertices.size());
+			for (int j = 0; j < tileMesh.vertices.size(); j++) {
+				const Simplify::Vertex& v = tileMesh.vertices[j];
+				if (v.id >= 0) {
+					if (sharedVertices[v.id] >= 0) {
+						remap[j] = sharedVertices[v.id];
+						continue;
+					}
+					sharedVertices[v.id] = (int)simplifier.vertices.size();
+				}
+				remap[j] = (int)simplifier.vertices.size();
+				simplifier.vertices.push_back(v);
+			}
+			for (Triangle t : tileMesh.triangles) {
+				t.v[0] = remap[t.v[0]];
+				t.v[1] = remap[t.v[1]];
+				t.v[2] = remap[t.v[2]];
+				simplifier.triangles.push_back(t);
+			}
+		}
+		if (verbose) printf("camera %d: stitching %d tiles with %d triangles\n", cameraIdx, (int)tileMeshes.size(), (int)simplifier.triangles.size());
+
+		// only the seams (the formerly locked vertices and their direct neighbors) may be simplified further
+		nearSeam.assign(simplifier.vertices.size(), false);
+		for (const Triangle& t : simplifier.triangles) {
+			if (simplifier.vertices[t.v[0]].id >= 0 || simplifier.vertices[t.v[1]].id >= 0 || simplifier.vertices[t.v[2]].id >= 0) {
+				nearSeam[t.v[0]] = nearSeam[t.v[1]] = nearSeam[t.v[2]] = true;
+			}
+		}
+		for (int j = 0; j < simplifier.vertices.size(); j++) {
+			if (simplifier.vertices[j].id >= 0) sharedVertices[simplifier.vertices[j].id] = -1; // ready for the next stitch
+			simplifier.vertices[j].locked = !nearSeam[j];
+			simplifier.vertices[j].id = -1;
+		}
+		// the triangles away from the seams are already simplified, and can not change anymore.
+		// Those along the seams cover about 2 triangles of the vertex grid per pixel of their area
+		int nrFixedTriangles = 0;
+		double seamArea = 0.0;
+		WithUnprojection(input, [&](const auto& unprojection) {
+			for (const Triangle& t : simplifier.triangles) {
+				if (!nearSeam[t.v[0]] && !nearSeam[t.v[1]] && !nearSeam[t.v[2]]) {
+					nrFixedTriangles++;
+					continue;
+				}
+				int col[3], row[3];
+				for (int k = 0; k < 3; k++) {
+					unprojection.Project(input, simplifier.vertices[t.v[k]].p, col[k], row[k]);
+				}
+				seamArea += 0.5 * std::abs((double)(col[1] - col[0]) * (row[2] - row[0]) - (double)(col[2] - col[0]) * (row[1] - row[0]));
+			}
+		});
+		int nrSeamGridTriangles = (int)(2.0 * seamArea);
+
+		// the same two passes and targets as BuildMesh(), but only for the grid triangles along the seams,
+		// which the locked vertices kept the tiles from simplifying
+		int target_triangle_count = nrFixedTriangles + nrSeamGridTriangles / 70;
+		SimplifyMesh(target_triangle_count, true);
+		target_triangle_count = nrFixedTriangles + ((int)simplifier.triangles.size() - nrFixedTriangles) / 4;
+		SimplifyMesh(target_triangle_count, false);
+
+		if (verbose) printf("camera %d: end simplification with %d triangles\n", cameraIdx, (int)simplifier.triangles.size());
+		// the coarser levels may simplify the whole mesh again
+		for (Simplify::Vertex& v : simplifier.vertices) {
+			v.locked = false;
+		}
+		BuildLevels(input, mesh, cameraIdx, verbose);
+	}
+
+	// allocate the memory to build and simplify the mesh of a depth map of nrPixels pixels up front,
+	// so that (after the first video frame) building meshes of that size does not allocate anymore
+	void Reserve(int nrPixels) {
+		simplifier.vertices.reserve(nrPixels);
+		simplifier.triangles.reserve(2 * nrPixels);
+		simplifier.quadrics.reserve(nrPixels);
+		simplifier.refs.reserve(6 * nrPixels);
+		gridToVertex.reserve(nrPixels);
+		vertexToGrid.reserve(nrPixels);
+		not_elongated.reserve(nrPixels);
+		square_types.reserve(nrPixels);
+	}
+
+	// nr of bytes used by the simplifier (the peak, since its vectors never shrink)
+	size_t SimplifierMemory() {
+		return simplifier.memory_usage();
+	}
+
+	// mean distance (along the z axis, or along the ray for non-perspective projections)
+	// between the vertices of the last simplified mesh (its coarsest level of detail) and the input depth map
+	double MeanDepthError(const InputCamera& input, const CameraFrameData& data) {
+		float near = input.z_near;
+		float far = input.z_far;
+		double sum = 0;
+		WithUnprojection(input, [&](const auto& unprojection) {
+			for (const Simplify::Vertex& v : simplifier.vertices) {
+				int col, row;
+				unprojection.Project(input, v.p, col, row);
+				col = std::min(std::max(col, 0), input.res_x - 1);
+				row = std::min(std::max(row, 0), input.res_y - 1);
+				double distance = 1.0 / (1.0f / far + (data.depth[row * input.res_x + col] / 65535.0) * (1.0f / near - 1.0f / far));
+				sum += std::abs(unprojection.Distance(v.p) - distance);
+			}
+		});
+		return simplifier.vertices.empty() ? 0 : sum / simplifier.vertices.size();
+	}
+
+private:
+	// builds and simplifies the vertex grid of the tile in the simplifier
+	void SimplifyTile(const InputCamera& input, const CameraFrameData& data, const Tile& tile) {
+		BuildGrid(input, data, tile);
+
+		// lock the vertices that are shared with neighboring tiles, so the tiles still fit together after simplification
+		int tileWidth = tile.c1 - tile.c0 + 1;
+		for (int j = 0; j < simplifier.vertices.size(); j++) {
+			int row = tile.r0 + vertexToGrid[j] / tileWidth;
+			int col = tile.c0 + vertexToGrid[j] % tileWidth;
+			bool onSharedBorder = (row == tile.r0 && row > 0) || (row == tile.r1 && row < input.res_y - 1)
+				|| (col == tile.c0 && col > 0) || (col == tile.c1 && col < input.res_x - 1);
+			simplifier.vertices[j].locked = onSharedBorder;
+			simplifier.vertices[j].id = onSharedBorder ? row * input.res_x + col : -1;
+		}
+
+		// same two passes as BuildMesh(), with targets relative to the size of the tile
+		int target_triangle_count = simplifier.triangles.size() / 70;
+		SimplifyMesh(target_triangle_count, true);
+		target_triangle_count = simplifier.triangles.size() / 4;
+		SimplifyMesh(target_triangle_count, false);
+	}
+
+	void SimplifyMesh(int target_triangle_count, bool useKeep) {
+		if (settings.useHeapSimplifier) {
+			simplifier.simplify_mesh_heap(target_triangle_count, 7.0, useKeep);
+		}
+		else {
+			simplifier.simplify_mesh(target_triangle_count, 7.0, useKeep);
+		}
+	}
+
+	// copy, but leave some room in the destination, so that copying a slightly larger mesh next time does not allocate again
+	template<typename T>
+	static void CopyWithSlack(const std::vector<T>& from, /*out*/ std::vector<T>& to) {
+		if (to.capacity() < from.size()) {
+			to.clear();
+			to.reserve(from.size() + from.size() / 2);
+		}
+		to.assign(from.begin(), from.end());
+	}
+
+	// the mesh of the QuadtreeMesher, in camera space
+	void BuildQuadtree(const InputCamera& input, const CameraFrameData& data) {
+		simplifier.vertices.clear();
+		simplifier.triangles.clear();
+		const double* distances = distanceTable.Get(input.z_near, input.z_far);
+		WithUnprojection(input, [&](const auto& unprojection) {
+			const unsigned char* mask = data.mask.data();
+			if (!unprojection.allPixelsValid) {
+				// pixels without a ray (e.g. outside of the image circle of a fisheye) are treated as masked away
+				quadtreeMask = data.mask;
+				for (int row = 0; row < input.res_y; row++) {
+					for (int col = 0; col < input.res_x; col++) {
+						if (!unprojection.IsValid(col, row)) quadtreeMask[row * input.res_x + col] = 255;
+					}
+				}
+				mask = quadtreeMask.data();
+			}
+			quadtree.Build(input, data.depth.data(), mask, data.is_edge.data(), settings.quadtreeMaxError);
+
+			Simplify::Vertex v;
+			for (int pixel : quadtree.vertexPixels) {
+				v.p = unprojection.Unproject(pixel % input.res_x, pixel / input.res_x, distances[data.depth[pixel]]);
+				simplifier.vertices.push_back(v);
+			}
+		});
+		Triangle t;
+		t.deleted = false;
+		t.attr = 0;
+		t.material = -1;
+		for (int j = 0; j < quadtree.keep.size(); j++) {
+			t.v[0] = quadtree.triangles[3 * j];
+			t.v[1] = quadtree.triangles[3 * j + 1];
+			t.v[2] = quadtree.triangles[3 * j + 2];
+			t.keep = quadtree.keep[j];
+			simplifier.triangles.push_back(t);
+		}
+	}
+
+	// calls f with the unprojection of the Projection of the input camera (see GridKernels.h),
+	// so that f is compiled separately for each projection
+	template<typename F>
+	void WithUnprojection(const InputCamera& input, F f) {
+		switch (input.projection) {
+		case Projection::Equirectangular:
+			equirectangular.Init(input);
+			f(equirectangular);
+			break;
+		case Projection::Fisheye_equidistant:
+			fisheye.Init(input);
+			f(fisheye);
+			break;
+		default:
+			perspective.Init(input);
+			f(perspective);
+			break;
+		}
+	}
+
+	// create two triangles for every square of 4 pixels in the tile (unless pixels are masked away, or the triangles would be elongated),
+	// and a vertex for every pixel that is used by one of those triangles
+	void BuildGrid(const InputCamera& input, const CameraFrameData& data, const Tile& tile) {
+		WithUnprojection(input, [&](const auto& unprojection) {
+			BuildGrid(unprojection, input, data, tile);
+		});
+	}
+
+	template<typename Unprojection>
+	void BuildGrid(const Unprojection& unprojection, const InputCamera& input, const CameraFrameData& data, const Tile& tile) {
+		int image_width = input.res_x;
+		int width = tile.c1 - tile.c0 + 1;
+		int height = tile.r1 - tile.r0 + 1;
+		unsigned short depth_thresh = 500; // TODO user-defined threshold
+
+		// the tile starts at pixel (tile.r0, tile.c0)
+		const unsigned char* mask = data.mask.data() + tile.r0 * image_width + tile.c0;
+		const unsigned char* is_edge = data.is_edge.data() + tile.r0 * image_width + tile.c0;
+		const unsigned short* depth = data.depth.data() + tile.r0 * image_width + tile.c0;
+
+		Simplify::Vertex v;
+		Triangle t;
+		t.keep = false;
+		t.deleted = false;
+		t.attr = 0;
+		t.material = -1;
+
+		simplifier.vertices.clear();
+		simplifier.triangles.clear();
+
+		// check for elongated triangles and for masked vertices in each square, one row of squares at a time
+		int nrSquares = (width - 1) * (height - 1);
+		not_elongated.resize(nrSquares);
+		square_types.resize(nrSquares);
+		for (int row = 0; row < height - 1; row++) {
+			GridKernels::NotElongatedRow(depth + row * image_width, depth + (row + 1) * image_width, width - 1, depth_thresh, not_elongated.data() + row * (width - 1));
+			GridKernels::SquareTypesRow(mask + row * image_width, mask + (row + 1) * image_width, width - 1, square_types.data() + row * (width - 1));
+			if (!Unprojection::allPixelsValid) {
+				// pixels without a ray (e.g. outside of the image circle of a fisheye) are treated as masked away
+				uint8_t* types = square_types.data() + row * (width - 1);
+				for (int col = 0; col < width; col++) {
+					if (!unprojection.IsValid(tile.c0 + col, tile.r0 + row)) {
+						if (col < width - 1) types[col] &= ~1;
+						if (col > 0) types[col - 1] &= ~2;
+					}
+					if (!unprojection.IsValid(tile.c0 + col, tile.r0 + row + 1)) {
+						if (col < width - 1) types[col] &= ~4;
+						if (col > 0) types[col - 1] &= ~8;
+					}
+				}
+			}
+		}
+
+		// define triangles, their indices are the grid indices (row * width + col) of their vertices for now
+		int o = 0;
+		for (int row = 0; row < height - 1; row++) {
+			for (int col = 0; col < width - 1; col++) {
+
+				// check which of the 4 verts were not masked away
+				int square_type = square_types[row * (width - 1) + col];
+
+				// we can only draw triangles if there are 3+ verts
+				int nr_valid_verts = popcount(square_type);
+				if (nr_valid_verts < 3) {
+					o++;
+					continue;
+				}
+
+				// don't simplify triangles if on edge
+				t.keep = (is_edge[row * image_width + col] > 0) && (mask[row * image_width + col] == 0);
+
+				uint8_t not_elongated_triangles = not_elongated[row * (width - 1) + col];
+				bool check_every_triangle = false;
+				if (square_type == 15) { // two triangles
+					// check if all 4 verts have more or less the same depth
+					if ((not_elongated_triangles & GridKernels::TOP_LEFT) && (not_elongated_triangles & GridKernels::BOTTOM_LEFT)) {
+						// top left triangle
+						t.v[0] = o;
+						t.v[1] = o + width;
+						t.v[2] = o + 1;
+						simplifier.triangles.push_back(t);
+						// bottom right triangle
+						t.v[0] = o + 1;
+						t.v[1] = o + width;
+						t.v[2] = o + width + 1;
+						simplifier.triangles.push_back(t);
+					}
+					else {
+						check_every_triangle = true;
+					}
+				}
+				else if ((check_every_triangle || square_type == 7) && (not_elongated_triangles & GridKernels::TOP_LEFT)) { // top left triangle
+					t.v[0] = o;
+					t.v[1] = o + width;
+					t.v[2] = o + 1;
+					simplifier.triangles.push_back(t);
+				}
+				else if ((check_every_triangle || square_type == 11) && (not_elongated_triangles & GridKernels::TOP_RIGHT)) { // top right triangle
+					t.v[0] = o;
+					t.v[1] = o + width + 1;
+					t.v[2] = o + 1;
+					simplifier.triangles.push_back(t);
+				}
+				else if ((check_every_triangle || square_type == 13) && (not_elongated_triangles & GridKernels::BOTTOM_LEFT)) { // bottom left triangle
+					t.v[0] = o;
+					t.v[1] = o + width;
+					t.v[2] = o + width + 1;
+					simplifier.triangles.push_back(t);
+				}
+				else if ((check_every_triangle || square_type == 14) && (not_elongated_triangles & GridKernels::BOTTOM_RIGHT)) { // bottom right triangle
+					t.v[0] = o + 1;
+					t.v[1] = o + width;
+					t.v[2] = o + width + 1;
+					simplifier.triangles.push_back(t);
+				}
+				o++;
+			}
+			o++;
+		}
+
+		// define vertices, but only for the grid vertices that are used by a triangle (so not for most masked pixels),
+		// in grid order so that the simplification does not depend on which vertices were skipped
+		gridToVertex.assign(width * height, -1);
+		for (const Triangle& t : simplifier.triangles) {
+			gridToVertex[t.v[0]] = gridToVertex[t.v[1]] = gridToVertex[t.v[2]] = 0;
+		}
+		vertexToGrid.clear();
+		const double* distances = distanceTable.Get(input.z_near, input.z_far);
+		for (int g = 0; g < width * height; g++) {
+			if (gridToVertex[g] < 0) continue;
+			int row = g / width;
+			int col = g % width;
+			v.p = unprojection.Unproject(tile.c0 + col, tile.r0 + row, distances[depth[row * image_width + col]]);
+			gridToVertex[g] = (int)simplifier.vertices.size();
+			vertexToGrid.push_back(g);
+			simplifier.vertices.push_back(v);
+		}
+		for (Triangle& t : simplifier.triangles) {
+			t.v[0] = gridToVertex[t.v[0]];
+			t.v[1] = gridToVertex[t.v[1]];
+			t.v[2] = gridToVertex[t.v[2]];
+		}
+	}
+
+	// ToWorldSpaceMesh() of the simplified mesh, followed by its coarser levels of detail: each one simplifies it further to a quarter
+	// of the triangles of the level before it, with the same two passes (first away from the depth edges, and then along them if that is not enough).
+	// The vertices of the tiles that are not stitched stay locked on the shared borders, so the tiles still fit together at every level
+	void BuildLevels(const InputCamera& input, /*out*/ CameraMesh& mesh, int cameraIdx, bool verbose) {
+		ToWorldSpaceMesh(input, mesh, cameraIdx, verbose);
+		for (int level = 1; level < settings.nrLevels; level++) {
+			int target_triangle_count = simplifier.triangles.size() / 4;
+			SimplifyMesh(target_triangle_count, true);
+			SimplifyMesh(target_triangle_count, false);
+			if (verbose) printf("camera %d: level of detail %d with %d triangles\n", cameraIdx, level, (int)simplifier.triangles.size());
+
+			ToWorldSpaceMesh(input, levelMesh, cameraIdx, false);
+			uint32_t firstVertex = (uint32_t)mesh.vertices.size() / 3;
+			uint32_t firstIndex = (uint32_t)mesh.triangles.size();
+			mesh.vertices.insert(mesh.vertices.end(), levelMesh.vertices.begin(), levelMesh.vertices.end());
+			for (uint32_t index : levelMesh.triangles) {
+				mesh.triangles.push_back(firstVertex + index);
+			}
+			for (Meshlet meshlet : levelMesh.meshlets) {
+				meshlet.firstIndex += firstIndex;
+				meshlet.level = (uint16_t)level;
+				mesh.meshlets.push_back(meshlet);
+			}
+		}
+	}
+
+	// copy the simplified mesh to a CameraMesh, reorder it (while it is still in camera space, so the input camera is at the origin),
+	// and transform it to world space
+	void ToWorldSpaceMesh(const InputCamera& input, /*out*/ CameraMesh& mesh, int cameraIdx, bool verbose) {
+		glm::mat4 model = input.model;
+
+		mesh.vertices.resize(simplifier.vertices.size() * 3);
+		mesh.triangles.resize(simplifier.triangles.size() * 3);
+		for (int j = 0; j < simplifier.vertices.size(); j ++) {
+			mesh.vertices[3 * j] = simplifier.vertices[j].p.x;
+			mesh.vertices[3 * j + 1] = simplifier.vertices[j].p.y;
+			mesh.vertices[3 * j + 2] = simplifier.vertices[j].p.z;
+		}
+		for (int j = 0; j < simplifier.triangles.size(); j++) {
+			mesh.triangles[3 * j] = simplifier.triangles[j].v[0];
+			mesh.triangles[3 * j + 1] = simplifier.triangles[j].v[1];
+			mesh.triangles[3 * j + 2] = simplifier.triangles[j].v[2];
+		}
+		int meshletSize = 0;
+		if (settings.optimizeVertexCache) {
+			int nrVertices = (int)simplifier.vertices.size();
+			double acmr = verbose ? optimizer.ACMR(mesh.triangles, nrVertices) : 0.0;
+			meshletSize = settings.meshletSize;
+			optimizer.Optimize(mesh.vertices, mesh.triangles, settings.sortFrontToBack, meshletSize);
+			if (verbose) printf("camera %d: ACMR %.3f -> %.3f (vertex cache of %d)\n", cameraIdx, acmr, optimizer.ACMR(mesh.triangles, nrVertices), MeshOptimizer::cacheSize);
+		}
+
+		// to world space
+		for (int j = 0; j < mesh.vertices.size(); j += 3) {
+			glm::vec4 vpos(mesh.vertices[j + 0], mesh.vertices[j + 1], mesh.vertices[j + 2], 1.0f);
+			glm::vec4 wpos = model * vpos;
+			mesh.vertices[j + 0] = wpos.x;
+			mesh.vertices[j + 1] = wpos.y;
+			mesh.vertices[j + 2] = wpos.z;
+		}
+		if (meshletSize > 0) {
+			optimizer.MeshletBounds(mesh.vertices, mesh.triangles, glm::vec3(model[3]), mesh.meshlets);
+			if (verbose) printf("camera %d: %d meshlets\n", cameraIdx, (int)mesh.meshlets.size());
+		}
+		else {
+			mesh.meshlets.clear();
+		}
+	}
+};
+typedef MeshBuilderT<float> MeshBuilder;
+
+
+#endif
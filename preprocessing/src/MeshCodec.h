@@ -0,0 +1,267 @@
+#ifndef MESH_CODEC_H
+#define MESH_CODEC_H
+
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+
+/*
+* MeshCodec compresses the quantized vertices and indices of one block of a v4 mesh file (see MeshFile.h) into a chunk,
+* which can be decoded on its own (so the frames, and the blocks of a frame, can be decoded in parallel).
+* The same file is in preprocessing/src and open-dibr/src, they must stay the same.
+*
+* - Every coordinate of a vertex is coded as the difference with that of the vertex before it in the block.
+* - Every index is coded as the difference with the number of vertices used so far: QuantizedMeshEncoder numbers the vertices
+*   of a block in the order in which the triangles use them, so a new vertex is coded as 0 and a recent one as a small number.
+* - The (zigzag coded) 16-bit differences are split into a plane of low bytes and a plane of high bytes per coordinate (and for the indices),
+*   so that the high bytes, which are mostly 0, are together.
+* - Every plane is entropy coded with rANS (order 0, with 12-bit frequencies), or stored as is if that is not smaller.
+*   The even and odd bytes of a plane are coded with two interleaved rANS states, so that the decoder can work on both at the same time.
+*
+* A chunk is the 8 planes one after the other (low and high bytes of x, y, z and of the indices),
+* each as [uint8 mode, uint32 size, size bytes]. A rANS plane is [uint8 nr symbols - 1, (uint8 symbol, uint16 frequency) per symbol,
+* uint32 state of the even bytes, uint32 state of the odd bytes, the renormalization bytes].
+*/
+class MeshCodec {
+private:
+	static const int nrPlanes = 8;
+	static const uint32_t scaleBits = 12;          // the frequencies add up to 1 << scaleBits
+	static const uint32_t ransLow = 1u << 23;      // the state is kept in [ransLow, ransLow << 8)
+	enum PlaneMode : uint8_t { Raw = 0, Rans = 1 };
+
+	// what the decoder needs to know about a slot of [0, 1 << scaleBits), i.e. about the symbol that it belongs to
+	struct Slot {
+		uint16_t freq;
+		uint16_t bias;                             // the slot minus the start of the symbol
+		uint8_t symbol;
+	};
+
+public:
+	// appends the chunk of a block with these vertices (3 per vertex) and indices (local to the block) to chunk,
+	// planes and buffer are scratch space that can be reused for the next block
+	static void Encode(const uint16_t* vertices, uint32_t nrVertices, const uint16_t* indices, uint32_t nrIndices,
+		/*out*/ std::vector<uint8_t>& chunk, std::vector<uint8_t>& planes, std::vector<uint8_t>& buffer) {
+		planes.resize(6 * (size_t)nrVertices + 2 * (size_t)nrIndices);
+		uint8_t* plane = planes.data();
+		for (int c = 0; c < 3; c++) {
+			uint16_t previous = 0;
+			for (uint32_t v = 0; v < nrVertices; v++) {
+				uint16_t q = vertices[3 * v + c];
+				uint16_t z = ZigZag((uint16_t)(q - previous));
+				plane[v] = (uint8_t)z;
+				plane[nrVertices + v] = (uint8_t)(z >> 8);
+				previous = q;
+			}
+			plane += 2 * (size_t)nrVertices;
+		}
+		uint32_t next = 0;
+		for (uint32_t i = 0; i < nrIndices; i++) {
+			uint16_t z = (uint16_t)(next - indices[i]);
+			plane[i] = (uint8_t)z;
+			plane[nrIndices + i] = (uint8_t)(z >> 8);
+			if (indices[i] >= next) next = indices[i] + 1u;
+		}
+
+		plane = planes.data();
+		for (int p = 0; p < nrPlanes; p++) {
+			size_t size = p < 6 ? nrVertices : nrIndices;
+			EncodePlane(plane, size, chunk, buffer);
+			plane += size;
+		}
+	}
+
+	// decodes a chunk of Encode() to the vertices and indices of the block, false if the chunk does not match their number.
+	// planes is scratch space that can be reused for the next block
+	static bool Decode(const uint8_t* chunk, size_t chunkSize, /*out*/ uint16_t* vertices, uint32_t nrVertices, /*out*/ uint16_t* indices, uint32_t nrIndices,
+		std::vector<uint8_t>& planes) {
+		planes.resize(6 * (size_t)nrVertices + 2 * (size_t)nrIndices);
+		const uint8_t* end = chunk + chunkSize;
+		uint8_t* plane = planes.data();
+		for (int p = 0; p < nrPlanes; p++) {
+			size_t size = p < 6 ? nrVertices : nrIndices;
+			if (!DecodePlane(chunk, end, plane, size)) return false;
+			plane += size;
+		}
+
+		plane = planes.data();
+		for (int c = 0; c < 3; c++) {
+			uint16_t previous = 0;
+			for (uint32_t v = 0; v < nrVertices; v++) {
+				uint16_t z = (uint16_t)(plane[v] | (plane[nrVertices + v] << 8));
+				previous = (uint16_t)(previous + UnZigZag(z));
+				vertices[3 * v + c] = previous;
+			}
+			plane += 2 * (size_t)nrVertices;
+		}
+		uint32_t next = 0;
+		for (uint32_t i = 0; i < nrIndices; i++) {
+			uint16_t z = (uint16_t)(plane[i] | (plane[nrIndices + i] << 8));
+			uint16_t index = (uint16_t)(next - z);
+			indices[i] = index;
+			if (index >= next) next = index + 1u;
+		}
+		return true;
+	}
+
+private:
+	static uint16_t ZigZag(uint16_t d) {
+		return (uint16_t)((d << 1) ^ (uint16_t)((int16_t)d >> 15));
+	}
+
+	static uint16_t UnZigZag(uint16_t z) {
+		return (uint16_t)((z >> 1) ^ (uint16_t)-(int16_t)(z & 1));
+	}
+
+	static void Write32(std::vector<uint8_t>& out, size_t at, uint32_t value) {
+		for (int k = 0; k < 4; k++) {
+			out[at + k] = (uint8_t)(value >> (8 * k));
+		}
+	}
+
+	static uint32_t Read32(const uint8_t* in) {
+		return (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+	}
+
+	// scales the counts of the symbols to frequencies that add up to 1 << scaleBits, every symbol that occurs keeps at least 1
+	static void NormalizeFrequencies(const uint32_t* counts, size_t total, /*out*/ uint32_t* freqs) {
+		const uint32_t scale = 1u << scaleBits;
+		uint32_t sum = 0;
+		int largest = 0;
+		for (int s = 0; s < 256; s++) {
+			freqs[s] = counts[s] == 0 ? 0 : std::max<uint32_t>(1, (uint32_t)((uint64_t)counts[s] * scale / total));
+			sum += freqs[s];
+			if (freqs[s] > freqs[largest]) largest = s;
+		}
+		// rounding a count up to 1 can make the sum too large, take it from the most frequent symbols
+		while (sum > scale) {
+			int s = 0;
+			for (int t = 1; t < 256; t++) {
+				if (freqs[t] > freqs[s]) s = t;
+			}
+			freqs[s]--;
+			sum--;
+		}
+		freqs[largest] += scale - sum;
+	}
+
+	static void EncodePlane(const uint8_t* bytes, size_t size, /*out*/ std::vector<uint8_t>& out, std::vector<uint8_t>& buffer) {
+		size_t start = out.size();
+		out.resize(start + 5);
+		out[start] = Raw;
+		if (size > 0) {
+			uint32_t counts[256] = {};
+			for (size_t i = 0; i < size; i++) {
+				counts[bytes[i]]++;
+			}
+			uint32_t freqs[256];
+			uint32_t starts[256];
+			NormalizeFrequencies(counts, size, freqs);
+			int nrSymbols = 0;
+			for (int s = 0, cumulative = 0; s < 256; s++) {
+				starts[s] = cumulative;
+				cumulative += freqs[s];
+				nrSymbols += freqs[s] > 0;
+			}
+
+			// rANS encodes back to front, so the bytes are written from the end of the buffer to its start.
+			// Together the symbols take at most scaleBits bits each
+			buffer.resize(size * 2 + 8);
+			uint8_t* bufferEnd = buffer.data() + buffer.size();
+			uint8_t* ptr = bufferEnd;
+			uint32_t x[2] = { ransLow, ransLow };
+			for (size_t i = size; i-- > 0;) {
+				uint32_t& state = x[i & 1];
+				uint32_t freq = freqs[bytes[i]];
+				uint32_t xMax = ((ransLow >> scaleBits) << 8) * freq;
+				while (state >= xMax) {
+					*--ptr = (uint8_t)state;
+					state >>= 8;
+				}
+				state = ((state / freq) << scaleBits) + (state % freq) + starts[bytes[i]];
+			}
+			size_t ransSize = 1 + 3 * nrSymbols + 8 + (bufferEnd - ptr);
+			if (ransSize < size) {
+				out[start] = Rans;
+				Write32(out, start + 1, (uint32_t)ransSize);
+				out.push_back((uint8_t)(nrSymbols - 1));
+				for (int s = 0; s < 256; s++) {
+					if (freqs[s] == 0) continue;
+					out.push_back((uint8_t)s);
+					out.push_back((uint8_t)freqs[s]);
+					out.push_back((uint8_t)(freqs[s] >> 8));
+				}
+				out.resize(out.size() + 8);
+				Write32(out, out.size() - 8, x[0]);
+				Write32(out, out.size() - 4, x[1]);
+				out.insert(out.end(), ptr, bufferEnd);
+				return;
+			}
+		}
+		Write32(out, start + 1, (uint32_t)size);
+		out.insert(out.end(), bytes, bytes + size);
+	}
+
+	// decodes the plane at in (which is moved past it) to size bytes
+	static bool DecodePlane(const uint8_t*& in, const uint8_t* end, /*out*/ uint8_t* bytes, size_t size) {
+		if (end - in < 5) return false;
+		uint8_t mode = in[0];
+		uint32_t planeSize = Read32(in + 1);
+		in += 5;
+		if ((size_t)(end - in) < planeSize) return false;
+		const uint8_t* planeEnd = in + planeSize;
+		if (mode == Raw) {
+			if (planeSize != size) return false;
+			memcpy(bytes, in, size);
+			in = planeEnd;
+			return true;
+		}
+		if (mode != Rans || planeSize < 1) return false;
+
+		// the frequency table, as the symbol of every slot
+		Slot slots[1u << scaleBits];
+		int nrSymbols = in[0] + 1;
+		const uint8_t* ptr = in + 1;
+		if (planeEnd - ptr < 3 * nrSymbols + 8) return false;
+		uint32_t cumulative = 0;
+		for (int k = 0; k < nrSymbols; k++, ptr += 3) {
+			uint32_t freq = ptr[1] | (ptr[2] << 8);
+			if (freq == 0 || cumulative + freq > (1u << scaleBits)) return false;
+			for (uint32_t bias = 0; bias < freq; bias++) {
+				Slot& slot = slots[cumulative + bias];
+				slot.freq = (uint16_t)freq;
+				slot.bias = (uint16_t)bias;
+				slot.symbol = ptr[0];
+			}
+			cumulative += freq;
+		}
+		if (cumulative != (1u << scaleBits)) return false;
+
+		uint32_t x0 = Read32(ptr);
+		uint32_t x1 = Read32(ptr + 4);
+		ptr += 8;
+		size_t i = 0;
+		for (; i + 1 < size; i += 2) {
+			if (!DecodeSymbol(x0, slots, ptr, planeEnd, bytes[i]) || !DecodeSymbol(x1, slots, ptr, planeEnd, bytes[i + 1])) return false;
+		}
+		if (i < size && !DecodeSymbol(x0, slots, ptr, planeEnd, bytes[i])) return false;
+		in = planeEnd;
+		return true;
+	}
+
+	static inline bool DecodeSymbol(uint32_t& x, const Slot* slots, const uint8_t*& ptr, const uint8_t* end, /*out*/ uint8_t& symbol) {
+		const Slot& slot = slots[x & ((1u << scaleBits) - 1)];
+		symbol = slot.symbol;
+		x = slot.freq * (x >> scaleBits) + slot.bias;
+		while (x < ransLow) {
+			if (ptr == end) return false;
+			x = (x << 8) | *ptr++;
+		}
+		return true;
+	}
+};
+
+
+#endif
@@ -0,0 +1,807 @@
+#ifndef MESH_FILE_H
+#define MESH_FILE_H
+
+
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include "MeshCodec.h"
+
+
+/*
+* meshes.bin comes in four versions:
+*
+* - v1: a bare stream of frames [int nr_vertices, int nr_triangles, float xyz * nr_vertices, uint32 indices * 3 * nr_triangles],
+*   without anything in front of or between them, so the frames have to be walked one by one to find frame k.
+* - v2 (--mesh_format v2, the default): a MeshFileHeader, a table with one MeshFrameEntry per frame, and the payloads
+*   of the frames (the same vertices and indices as in v1), each starting at a multiple of 64 bytes.
+*   The renderer memory-maps it and only touches the frames that it shows. The layout must match open-dibr/src/MeshFile.h.
+* - v3 (--mesh_format v3): the same header and frame table as v2, but the payload of a frame is quantized to about half the size:
+*   a MeshBlockTable with MeshBlocks, the vertices as uint16 xyz and the indices as uint16 (local to their block),
+*   the vertices and indices each starting at a multiple of 64 bytes. The renderer decodes the vertices in its vertex shader.
+*   A v3 frame can also keep blocks of earlier frames (see MeshBlockSource), whose vertices and indices are then not stored again.
+* - v4 (--mesh_format v4): the same as v3, but the vertices and indices of every block are compressed (see MeshCodec) into a chunk
+*   of its own (see MeshChunk), which the renderer decodes on its loader threads. This makes the file several times smaller than v3.
+*
+* The triangles of a v2, v3 or v4 frame can also be grouped into Meshlets, which the renderer culls before drawing.
+* With --lod_levels, the mesh of every input camera is stored at several levels of detail, and the renderer draws one of them per camera.
+*
+* All values are little-endian.
+*/
+struct MeshFileHeader {          // 64 bytes
+	char magic[8];               // "DIBRMESH"
+	uint32_t version;            // 2, 3 or 4
+	uint32_t nrCameras;          // nr input cameras (0 if unknown)
+	uint32_t width;              // resolution of the input cameras (0 if unknown)
+	uint32_t height;
+	uint32_t nrFrames;           // nr entries in the frame table
+	uint32_t maxNrVertices;      // of all frames, so that the renderer can allocate its buffers up front
+	uint32_t maxNrTriangles;
+	uint32_t alignment;          // of the payloads, 64
+	uint64_t frameTableOffset;   // the MeshFrameEntry of frame k is at frameTableOffset + k * sizeof(MeshFrameEntry)
+	uint32_t nrLevels;           // nr of levels of detail of the meshlets, 0 (in older files) is the same as 1
+	uint8_t reserved[12];
+};
+
+struct MeshFrameEntry {          // 32 bytes, all 0 for a frame that is not written (yet)
+	uint64_t offset;             // of the vertices (float xyz * nrVertices), v3 and v4: of the MeshBlockTable
+	uint64_t size;               // of the whole payload (vertices, padding, indices and the MeshletTable)
+	uint32_t nrVertices;
+	uint32_t nrTriangles;
+	uint64_t indexOffset;        // of the indices (uint32 * 3 * nrTriangles), v3: uint16 * 3 * nrTriangles, v4: 0
+};
+
+/*
+* In a v3 or v4 file, the vertices and triangles of a frame are split into blocks of at most 65536 vertices, so that uint16 indices suffice.
+* A block holds (part of) the mesh of one input camera. Its vertices are 3 uint16 q per vertex, and decode * (q, 1)
+* is the homogeneous world space position. For a perspective camera q is the pixel position and the inverse depth (so the quantization
+* steps follow those of the depth map and decode includes the projection), for other projections it is the world space position.
+*/
+struct MeshBlockTable {          // 16 bytes, followed by nrBlocks MeshBlocks, nrKeptBlocks MeshBlockSources and nrMeshlets Meshlets (and in v4 the MeshChunks)
+	uint32_t nrBlocks;
+	uint32_t vertexOffset;       // of the vertices, relative to the MeshBlockTable (v4: of the chunks)
+	uint32_t nrKeptBlocks;       // the last nrKeptBlocks of the blocks
+	uint32_t nrMeshlets;         // 0 if the frame has none
+};
+
+struct MeshBlock {               // 80 bytes
+	float decode[16];            // column-major 4x4 matrix
+	uint32_t firstVertex;        // in the vertices of the frame
+	uint32_t nrVertices;         // at most 65536
+	uint32_t firstIndex;         // in the indices of the frame
+	uint32_t nrIndices;
+};
+
+/*
+* The last nrKeptBlocks blocks of a v3 frame are kept from an earlier frame (with --temporal_tolerance, for the tiles whose depth did not change):
+* only their MeshBlock is stored, with firstVertex and firstIndex right after the vertices and indices that the frame does store,
+* and the MeshBlockSource tells in which frame the vertices and indices are. That block is always a block that was stored in that frame
+* (not a kept one), and it is also a block of every frame in between, so a kept block is always in the frame right before it as well.
+*/
+struct MeshBlockSource {         // 8 bytes
+	uint32_t frame;
+	uint32_t block;              // index in the blocks of that frame
+};
+
+/*
+* In a v4 file, the MeshBlockSources are followed by a MeshChunk for every block that the frame stores (not for the kept ones),
+* and then the chunks themselves: the vertices and indices of the block, compressed by MeshCodec::Encode().
+*/
+struct MeshChunk {               // 8 bytes
+	uint32_t offset;             // relative to the MeshBlockTable
+	uint32_t size;
+};
+
+/*
+* A Meshlet is a small, spatially coherent group of triangles of one input camera (at most --meshlet_size, 128 by default), that are consecutive
+* in the indices of one block. Its bounding sphere and normal cone (in world space) let the renderer skip the meshlets that are
+* outside of the view frustum, or (optionally) that only have triangles that face away from the viewer: with eye the position of the viewer,
+* they all do if dot(center - eye, coneAxis) >= coneCutoff * |center - eye| + radius. The normals face the input camera,
+* and coneCutoff is 1 if the cone is too wide to ever cull the meshlet.
+* If a frame has meshlets, every triangle is in exactly one of them.
+* With header.nrLevels > 1, the mesh of every input camera is there once per level of detail (level 0 is the finest,
+* every next level has about a quarter of its triangles), each with its own vertices and meshlets.
+* In v3 and v4 the Meshlets follow the MeshBlockSources, in v2 (where the frame is block 0) they are in a MeshletTable
+* that starts at the first multiple of 64 bytes after the indices (the frame has none if its payload ends before that).
+*/
+struct Meshlet {                 // 48 bytes
+	float center[3];             // of the bounding sphere
+	float radius;
+	float coneAxis[3];           // the mean normal of the triangles (unit length)
+	float coneCutoff;            // the sine of the angle between coneAxis and the normal furthest from it, or 1
+	uint32_t block;              // in the blocks of the frame (0 in v2)
+	uint32_t firstIndex;         // relative to the first index of that block
+	uint32_t nrIndices;
+	uint16_t camera;             // the input camera that the triangles are from
+	uint16_t level;              // of detail, 0 unless header.nrLevels > 1
+};
+
+struct MeshletTable {            // 16 bytes, followed by nrMeshlets Meshlets
+	uint32_t nrMeshlets;
+	uint32_t reserved[3];
+};
+
+/*
+* The header of a shard file, which CreateMeshes writes instead of a meshes.bin when only a range of the frames
+* is processed (--start_frame and --end_frame). The frames startFrame, ..., endFrame - 1 follow it, in the v1 format.
+* MergeShards (in the tools folder) concatenates the shards of all frames into one meshes.bin.
+*/
+struct ShardHeader {
+	char magic[8];
+	int32_t version;
+	int32_t startFrame;
+	int32_t endFrame;
+	int32_t nrCameras;
+	int32_t width;
+	int32_t height;
+};
+
+/*
+* MeshFile has the helpers to read back the files that MeshWriter writes.
+*/
+class MeshFile {
+public:
+	static const int32_t shardVersion = 2;
+	static const uint32_t meshFileVersion = 2;
+	static const uint32_t quantizedMeshFileVersion = 3;
+	static const uint32_t compressedMeshFileVersion = 4;
+	static const uint32_t alignment = 64;
+
+	static ShardHeader MakeShardHeader(int startFrame, int endFrame, int nrCameras, int width, int height) {
+		ShardHeader header;
+		memcpy(header.magic, "DIBRSHRD", 8);
+		header.version = shardVersion;
+		header.startFrame = startFrame;
+		header.endFrame = endFrame;
+		header.nrCameras = nrCameras;
+		header.width = width;
+		header.height = height;
+		return header;
+	}
+
+	// false if the stream does not start with a ShardHeader (of this version)
+	static bool ReadShardHeader(std::istream& in, /*out*/ ShardHeader& header) {
+		in.read(reinterpret_cast<char*>(&header), sizeof(header));
+		return in.gcount() == sizeof(header) && memcmp(header.magic, "DIBRSHRD", 8) == 0 && header.version == shardVersion;
+	}
+
+	static MeshFileHeader MakeMeshFileHeader(int nrCameras, int width, int height, int nrFrames, uint32_t version, int nrLevels = 1) {
+		MeshFileHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, "DIBRMESH", 8);
+		header.version = version;
+		header.nrCameras = nrCameras;
+		header.width = width;
+		header.height = height;
+		header.nrFrames = nrFrames;
+		header.alignment = alignment;
+		header.frameTableOffset = sizeof(MeshFileHeader);
+		header.nrLevels = nrLevels;
+		return header;
+	}
+
+	// false if the stream does not start with a MeshFileHeader (of v2, v3 or v4)
+	static bool ReadMeshFileHeader(std::istream& in, /*out*/ MeshFileHeader& header) {
+		in.read(reinterpret_cast<char*>(&header), sizeof(header));
+		return in.gcount() == sizeof(header) && memcmp(header.magic, "DIBRMESH", 8) == 0
+			&& header.version >= meshFileVersion && header.version <= compressedMeshFileVersion;
+	}
+
+	static uint64_t Align(uint64_t offset) {
+		return (offset + alignment - 1) / alignment * alignment;
+	}
+
+	// read the next v1 frame, false at the end of the stream (or if the frame is incomplete)
+	static bool ReadFrame(std::istream& in, /*out*/ std::vector<float>& vertices, /*out*/ std::vector<uint32_t>& triangles) {
+		int32_t counts[2];
+		if (!in.read(reinterpret_cast<char*>(counts), sizeof(counts)) || counts[0] < 0 || counts[1] < 0) return false;
+		vertices.resize(3 * (size_t)counts[0]);
+		triangles.resize(3 * (size_t)counts[1]);
+		in.read(reinterpret_cast<char*>(vertices.data()), vertices.size() * sizeof(float));
+		in.read(reinterpret_cast<char*>(triangles.data()), triangles.size() * sizeof(uint32_t));
+		return (bool)in;
+	}
+
+	// read the frame of a v2, v3 or v4 file with this entry, the vertices and indices of a v3 or v4 file are decoded
+	static bool ReadFrame(std::istream& in, const MeshFileHeader& header, const MeshFrameEntry& entry, /*out*/ std::vector<float>& vertices, /*out*/ std::vector<uint32_t>& triangles) {
+		std::vector<Meshlet> meshlets;
+		return ReadFrame(in, header, entry, vertices, triangles, meshlets);
+	}
+
+	// the same, with the meshlets of the frame (as in v2, i.e. with their first index in the triangles)
+	static bool ReadFrame(std::istream& in, const MeshFileHeader& header, const MeshFrameEntry& entry, /*out*/ std::vector<float>& vertices,
+		/*out*/ std::vector<uint32_t>& triangles, /*out*/ std::vector<Meshlet>& meshlets) {
+		if (header.version == meshFileVersion) {
+			vertices.resize(3 * (size_t)entry.nrVertices);
+			triangles.resize(3 * (size_t)entry.nrTriangles);
+			in.seekg(entry.offset);
+			in.read(reinterpret_cast<char*>(vertices.data()), vertices.size() * sizeof(float));
+			in.seekg(entry.indexOffset);
+			in.read(reinterpret_cast<char*>(triangles.data()), triangles.size() * sizeof(uint32_t));
+			return in && ReadMeshletsV2(in, entry, meshlets);
+		}
+		std::vector<MeshBlock> blocks;
+		std::vector<MeshBlockSource> sources;
+		std::vector<uint16_t> quantizedVertices;
+		std::vector<uint16_t> quantizedIndices;
+		if (!ReadQuantizedFrame(in, header, entry, blocks, sources, meshlets, quantizedVertices, quantizedIndices)) return false;
+		size_t nrStoredBlocks = blocks.size() - sources.size();
+		for (size_t k = 0; k < sources.size(); k++) {
+			if (!ReadKeptBlock(in, header, sources[k], blocks[nrStoredBlocks + k], quantizedVertices.data(), quantizedIndices.data())) return false;
+		}
+		Dequantize(blocks, quantizedVertices.data(), quantizedIndices.data(), vertices, triangles);
+		// Dequantize() puts the indices of the blocks one after the other
+		for (Meshlet& meshlet : meshlets) {
+			meshlet.firstIndex += blocks[meshlet.block].firstIndex;
+			meshlet.block = 0;
+		}
+		return true;
+	}
+
+	// v2: where the MeshletTable of the frame with this entry would start
+	static uint64_t MeshletTableOffset(const MeshFrameEntry& entry) {
+		return Align(entry.indexOffset + 12 * (uint64_t)entry.nrTriangles);
+	}
+
+	// v2: read the meshlets of the frame with this entry (none if it has no MeshletTable)
+	static bool ReadMeshletsV2(std::istream& in, const MeshFrameEntry& entry, /*out*/ std::vector<Meshlet>& meshlets) {
+		meshlets.clear();
+		uint64_t tableOffset = MeshletTableOffset(entry);
+		if (entry.offset + entry.size <= tableOffset) return true;
+		MeshletTable table;
+		in.seekg(tableOffset);
+		if (!in.read(reinterpret_cast<char*>(&table), sizeof(table))
+			|| tableOffset + sizeof(table) + (uint64_t)table.nrMeshlets * sizeof(Meshlet) > entry.offset + entry.size) return false;
+		meshlets.resize(table.nrMeshlets);
+		in.read(reinterpret_cast<char*>(meshlets.data()), meshlets.size() * sizeof(Meshlet));
+		return (bool)in;
+	}
+
+	// v3 and v4: the offset of the first MeshChunk (v4), relative to the MeshBlockTable
+	static uint64_t ChunkTableOffset(const MeshBlockTable& table) {
+		return sizeof(table) + (uint64_t)table.nrBlocks * sizeof(MeshBlock) + (uint64_t)table.nrKeptBlocks * sizeof(MeshBlockSource)
+			+ (uint64_t)table.nrMeshlets * sizeof(Meshlet);
+	}
+
+	// read the blocks and meshlets of a v3 or v4 frame with this entry and the quantized vertices and indices that it stores (decompressed for v4).
+	// quantizedVertices and quantizedIndices get room for the whole frame, but the kept blocks are not read (see ReadKeptBlock())
+	static bool ReadQuantizedFrame(std::istream& in, const MeshFileHeader& header, const MeshFrameEntry& entry, /*out*/ std::vector<MeshBlock>& blocks,
+		/*out*/ std::vector<MeshBlockSource>& sources, /*out*/ std::vector<Meshlet>& meshlets,
+		/*out*/ std::vector<uint16_t>& quantizedVertices, /*out*/ std::vector<uint16_t>& quantizedIndices) {
+		MeshBlockTable table;
+		in.seekg(entry.offset);
+		if (!in.read(reinterpret_cast<char*>(&table), sizeof(table)) || table.nrKeptBlocks > table.nrBlocks) return false;
+		blocks.resize(table.nrBlocks);
+		sources.resize(table.nrKeptBlocks);
+		meshlets.resize(table.nrMeshlets);
+		quantizedVertices.resize(3 * (size_t)entry.nrVertices);
+		quantizedIndices.resize(3 * (size_t)entry.nrTriangles);
+		in.read(reinterpret_cast<char*>(blocks.data()), blocks.size() * sizeof(MeshBlock));
+		in.read(reinterpret_cast<char*>(sources.data()), sources.size() * sizeof(MeshBlockSource));
+		in.read(reinterpret_cast<char*>(meshlets.data()), meshlets.size() * sizeof(Meshlet));
+		for (const Meshlet& meshlet : meshlets) {
+			if (meshlet.block >= table.nrBlocks) return false;
+		}
+		// the frame only stores the vertices and indices in front of the kept blocks
+		uint32_t nrStoredBlocks = table.nrBlocks - table.nrKeptBlocks;
+		if (header.version == compressedMeshFileVersion) {
+			std::vector<MeshChunk> chunks(nrStoredBlocks);
+			std::vector<uint8_t> data, planes;
+			in.read(reinterpret_cast<char*>(chunks.data()), chunks.size() * sizeof(MeshChunk));
+			for (uint32_t b = 0; b < nrStoredBlocks && in; b++) {
+				if (!ReadChunk(in, entry.offset, chunks[b], blocks[b], quantizedVertices.data(), quantizedIndices.data(), data, planes)) return false;
+			}
+			return (bool)in;
+		}
+		size_t nrStoredVertices = nrStoredBlocks < table.nrBlocks ? blocks[nrStoredBlocks].firstVertex : entry.nrVertices;
+		size_t nrStoredIndices = nrStoredBlocks < table.nrBlocks ? blocks[nrStoredBlocks].firstIndex : 3 * (size_t)entry.nrTriangles;
+		in.seekg(entry.offset + table.vertexOffset);
+		in.read(reinterpret_cast<char*>(quantizedVertices.data()), 3 * nrStoredVertices * sizeof(uint16_t));
+		in.seekg(entry.indexOffset);
+		in.read(reinterpret_cast<char*>(quantizedIndices.data()), nrStoredIndices * sizeof(uint16_t));
+		return (bool)in;
+	}
+
+	// read the vertices and indices of a kept block from the frame they are stored in, to where block says they are in this frame
+	static bool ReadKeptBlock(std::istream& in, const MeshFileHeader& header, const MeshBlockSource& source, const MeshBlock& block,
+		/*out*/ uint16_t* quantizedVertices, /*out*/ uint16_t* quantizedIndices) {
+		MeshFrameEntry entry;
+		MeshBlockTable table;
+		MeshBlock stored;
+		if (source.frame >= header.nrFrames) return false;
+		in.seekg(header.frameTableOffset + (uint64_t)source.frame * sizeof(MeshFrameEntry));
+		in.read(reinterpret_cast<char*>(&entry), sizeof(entry));
+		in.seekg(entry.offset);
+		in.read(reinterpret_cast<char*>(&table), sizeof(table));
+		if (!in || source.block >= table.nrBlocks - table.nrKeptBlocks) return false;
+		in.seekg(entry.offset + sizeof(table) + (uint64_t)source.block * sizeof(MeshBlock));
+		in.read(reinterpret_cast<char*>(&stored), sizeof(stored));
+		if (!in || stored.nrVertices != block.nrVertices || stored.nrIndices != block.nrIndices) return false;
+		if (header.version == compressedMeshFileVersion) {
+			MeshChunk chunk;
+			std::vector<uint8_t> data, planes;
+			in.seekg(entry.offset + ChunkTableOffset(table) + (uint64_t)source.block * sizeof(MeshChunk));
+			in.read(reinterpret_cast<char*>(&chunk), sizeof(chunk));
+			return in && ReadChunk(in, entry.offset, chunk, block, quantizedVertices, quantizedIndices, data, planes);
+		}
+		in.seekg(entry.offset + table.vertexOffset + 6 * (uint64_t)stored.firstVertex);
+		in.read(reinterpret_cast<char*>(quantizedVertices + 3 * (size_t)block.firstVertex), 6 * (std::streamsize)block.nrVertices);
+		in.seekg(entry.indexOffset + 2 * (uint64_t)stored.firstIndex);
+		in.read(reinterpret_cast<char*>(quantizedIndices + block.firstIndex), 2 * (std::streamsize)block.nrIndices);
+		return (bool)in;
+	}
+
+	// v4: read the chunk of a block of the frame whose MeshBlockTable is at tableOffset, and decode it to where block says it is.
+	// data and planes are scratch space
+	static bool ReadChunk(std::istream& in, uint64_t tableOffset, const MeshChunk& chunk, const MeshBlock& block,
+		/*out*/ uint16_t* quantizedVertices, /*out*/ uint16_t* quantizedIndices, std::vector<uint8_t>& data, std::vector<uint8_t>& planes) {
+		data.resize(chunk.size);
+		in.seekg(tableOffset + chunk.offset);
+		if (!in.read(reinterpret_cast<char*>(data.data()), data.size())) return false;
+		return MeshCodec::Decode(data.data(), data.size(), quantizedVertices + 3 * (size_t)block.firstVertex, block.nrVertices,
+			quantizedIndices + block.firstIndex, block.nrIndices, planes);
+	}
+
+	// the world space vertices and (frame) indices of the blocks of a v3 frame
+	static void Dequantize(const std::vector<MeshBlock>& blocks, const uint16_t* quantizedVertices, const uint16_t* quantizedIndices,
+		/*out*/ std::vector<float>& vertices, /*out*/ std::vector<uint32_t>& triangles) {
+		vertices.clear();
+		triangles.clear();
+		for (const MeshBlock& block : blocks) {
+			const float* m = block.decode;
+			for (uint32_t j = block.firstVertex; j < block.firstVertex + block.nrVertices; j++) {
+				float q[4] = { (float)quantizedVertices[3 * j], (float)quantizedVertices[3 * j + 1], (float)quantizedVertices[3 * j + 2], 1.0f };
+				float p[4];
+				for (int row = 0; row < 4; row++) {
+					p[row] = m[row] * q[0] + m[4 + row] * q[1] + m[8 + row] * q[2] + m[12 + row] * q[3];
+				}
+				vertices.push_back(p[0] / p[3]);
+				vertices.push_back(p[1] / p[3]);
+				vertices.push_back(p[2] / p[3]);
+			}
+			for (uint32_t i = block.firstIndex; i < block.firstIndex + block.nrIndices; i++) {
+				triangles.push_back(block.firstVertex + quantizedIndices[i]);
+			}
+		}
+	}
+
+	// count the complete v1 frames (at most maxFrames) from the current position to the end of the stream,
+	// endOfFrames is set to the offset right after the last counted frame (a crash can leave half a frame after it)
+	static int CountFrames(std::istream& in, int maxFrames, /*out*/ uint64_t& endOfFrames) {
+		uint64_t position = (uint64_t)in.tellg();
+		in.seekg(0, std::ios::end);
+		uint64_t size = (uint64_t)in.tellg();
+		int nrFrames = 0;
+		endOfFrames = position;
+		while (nrFrames < maxFrames && position + 8 <= size) {
+			int32_t counts[2];
+			in.seekg(position);
+			in.read(reinterpret_cast<char*>(counts), sizeof(counts));
+			if (!in || counts[0] < 0 || counts[1] < 0) break;
+			uint64_t frameSize = 8 + 12 * ((uint64_t)counts[0] + (uint64_t)counts[1]);
+			if (position + frameSize > size) break;
+			position += frameSize;
+			endOfFrames = position;
+			nrFrames++;
+		}
+		in.clear();
+		return nrFrames;
+	}
+
+	// count the frames at the start of the frame table of a v2, v3 or v4 file that are completely written,
+	// endOfFrames is set to the end of the payload of the last one
+	static int CountFramesV2(std::istream& in, const MeshFileHeader& header, /*out*/ uint64_t& endOfFrames) {
+		in.seekg(0, std::ios::end);
+		uint64_t size = (uint64_t)in.tellg();
+		endOfFrames = header.frameTableOffset + (uint64_t)header.nrFrames * sizeof(MeshFrameEntry);
+		int nrFrames = 0;
+		in.seekg(header.frameTableOffset);
+		for (; nrFrames < (int)header.nrFrames; nrFrames++) {
+			MeshFrameEntry entry;
+			if (!in.read(reinterpret_cast<char*>(&entry), sizeof(entry)) || entry.size == 0 || entry.offset + entry.size > size) break;
+			endOfFrames = entry.offset + entry.size;
+		}
+		in.clear();
+		return nrFrames;
+	}
+
+	// for --resume: count the frames that are already in the output file (0 if it does not exist yet),
+	// and cut off a frame that was only partially written. append is set if new frames should be added to the file.
+	static bool PrepareResume(const std::string& path, bool shard, int meshFormat, int nrLevels, int startFrame, int endFrame, /*out*/ int& nrFramesDone, /*out*/ bool& append) {
+		nrFramesDone = 0;
+		append = false;
+		std::ifstream in(path, std::ios::binary);
+		if (!in.is_open()) {
+			return true;
+		}
+		in.seekg(0, std::ios::end);
+		uint64_t size = (uint64_t)in.tellg();
+		in.seekg(0);
+		uint64_t endOfFrames = 0;
+		if (shard) {
+			ShardHeader header;
+			if (!ReadShardHeader(in, header)) {
+				if (size < sizeof(ShardHeader)) {
+					return true; // the crash happened before the header was written, start over
+				}
+				std::cout << "Error: can not resume " << path << ", since it is not a shard file" << std::endl;
+				return false;
+			}
+			if (header.startFrame != startFrame || header.endFrame != endFrame) {
+				std::cout << "Error: can not resume " << path << ", since it is a shard of frames " << header.startFrame << " to " << header.endFrame
+					<< " instead of " << startFrame << " to " << endFrame << std::endl;
+				return false;
+			}
+			nrFramesDone = CountFrames(in, endFrame - startFrame, endOfFrames);
+		}
+		else if (meshFormat >= 2) {
+			MeshFileHeader header;
+			if (!ReadMeshFileHeader(in, header) || header.version != (uint32_t)meshFormat) {
+				if (size < sizeof(MeshFileHeader)) {
+					return true;
+				}
+				std::cout << "Error: can not resume " << path << ", since it is not a v" << meshFormat << " mesh file (see --mesh_format)" << std::endl;
+				return false;
+			}
+			if (header.nrFrames != endFrame) {
+				std::cout << "Error: can not resume " << path << ", since it is a mesh file of " << header.nrFrames << " frames instead of " << endFrame << std::endl;
+				return false;
+			}
+			if (std::max(header.nrLevels, 1u) != (uint32_t)nrLevels) {
+				std::cout << "Error: can not resume " << path << ", since it has " << std::max(header.nrLevels, 1u) << " levels of detail instead of " << nrLevels << " (see --lod_levels)" << std::endl;
+				return false;
+			}
+			nrFramesDone = CountFramesV2(in, header, endOfFrames);
+		}
+		else {
+			char magic[8] = {};
+			in.read(magic, 8);
+			if (memcmp(magic, "DIBRMESH", 8) == 0 || memcmp(magic, "DIBRSHRD", 8) == 0) {
+				std::cout << "Error: can not resume " << path << ", since it is not a v1 mesh file (see --mesh_format)" << std::endl;
+				return false;
+			}
+			in.clear();
+			in.seekg(0);
+			nrFramesDone = CountFrames(in, endFrame - startFrame, endOfFrames);
+		}
+		in.close();
+		std::filesystem::resize_file(path, endOfFrames);
+		append = true;
+		return true;
+	}
+};
+
+/*
+* QuantizedMeshEncoder turns meshes into the MeshBlocks, uint16 vertices and uint16 indices of a v3 frame (see MeshBlock).
+* Add() appends a mesh: its triangles are split into blocks (in their order) of at most 65536 vertices,
+* and per block every coordinate is quantized to 16 bits between its minimum and maximum in that block.
+* If the mesh has meshlets, its triangles are added meshlet by meshlet instead, and a block only ends between two meshlets.
+* Keep() adds a block of an earlier frame instead (see MeshBlockSource), MeshFileWriter puts those after the new blocks.
+*/
+class QuantizedMeshEncoder {
+private:
+	std::vector<int> local;              // for each vertex of the mesh, its index in the current block, or -1
+	std::vector<uint32_t> blockVertices; // the vertices of the mesh in the current block
+
+public:
+	std::vector<MeshBlock> blocks;
+	std::vector<uint16_t> vertices;      // 3 per vertex
+	std::vector<uint16_t> indices;       // local to their block
+	std::vector<MeshBlock> keptBlocks;   // of earlier frames
+	std::vector<MeshBlockSource> keptSources;
+	std::vector<Meshlet> meshlets;       // of blocks
+	std::vector<Meshlet> keptMeshlets;   // of keptBlocks, their block is the index in keptBlocks
+
+	void Clear() {
+		blocks.clear();
+		vertices.clear();
+		indices.clear();
+		keptBlocks.clear();
+		keptSources.clear();
+		meshlets.clear();
+		keptMeshlets.clear();
+	}
+
+	// reuse a block that is stored in an earlier frame, block is its MeshBlock in that frame
+	void Keep(const MeshBlock& block, const MeshBlockSource& source) {
+		keptBlocks.push_back(block);
+		keptSources.push_back(source);
+	}
+
+	// coords has 3 floats per vertex, toWorld is the column-major 4x4 matrix from (coords, 1) to homogeneous world space.
+	// The meshlets of the mesh (if any) have their first index in triangles, and must hold every triangle
+	void Add(const float* coords, int nrVertices, const uint32_t* triangles, int nrTriangles, const float* toWorld,
+		const Meshlet* meshMeshlets = NULL, int nrMeshlets = 0) {
+		local.assign(nrVertices, -1);
+		size_t firstMeshlet = meshlets.size();
+		// the triangles are added in runs that are never split over two blocks: a meshlet, or a single triangle
+		int nrRuns = nrMeshlets > 0 ? nrMeshlets : nrTriangles;
+		int r = 0;
+		while (r < nrRuns) {
+			blockVertices.clear();
+			size_t firstIndex = indices.size();
+			for (; r < nrRuns; r++) {
+				uint32_t first = nrMeshlets > 0 ? meshMeshlets[r].firstIndex : 3 * r;
+				uint32_t end = first + (nrMeshlets > 0 ? meshMeshlets[r].nrIndices : 3);
+				// at most, a vertex that the run uses more than once is counted more than once
+				int nrNewVertices = 0;
+				for (uint32_t i = first; i < end; i++) {
+					nrNewVertices += local[triangles[i]] < 0;
+				}
+				if (blockVertices.size() + nrNewVertices > 65536) break;
+				if (nrMeshlets > 0) {
+					Meshlet meshlet = meshMeshlets[r];
+					meshlet.block = (uint32_t)blocks.size();
+					meshlet.firstIndex = (uint32_t)(indices.size() - firstIndex);
+					meshlets.push_back(meshlet);
+				}
+				for (uint32_t i = first; i < end; i++) {
+					uint32_t v = triangles[i];
+					if (local[v] < 0) {
+						local[v] = (int)blockVertices.size();
+						blockVertices.push_back(v);
+					}
+					indices.push_back((uint16_t)local[v]);
+				}
+			}
+			for (uint32_t v : blockVertices) {
+				local[v] = -1;
+			}
+			AddBlock(coords, toWorld, firstIndex);
+			GrowMeshlets(firstMeshlet);
+			firstMeshlet = meshlets.size();
+		}
+	}
+
+private:
+	void AddBlock(const float* coords, const float* toWorld, size_t firstIndex) {
+		double minimum[3] = { INFINITY, INFINITY, INFINITY };
+		double maximum[3] = { -INFINITY, -INFINITY, -INFINITY };
+		for (uint32_t v : blockVertices) {
+			for (int c = 0; c < 3; c++) {
+				minimum[c] = std::min(minimum[c], (double)coords[3 * v + c]);
+				maximum[c] = std::max(maximum[c], (double)coords[3 * v + c]);
+			}
+		}
+		double step[3];
+		for (int c = 0; c < 3; c++) {
+			step[c] = (maximum[c] - minimum[c]) / 65535.0;
+		}
+
+		MeshBlock block;
+		block.firstVertex = (uint32_t)(vertices.size() / 3);
+		block.nrVertices = (uint32_t)blockVertices.size();
+		block.firstIndex = (uint32_t)firstIndex;
+		block.nrIndices = (uint32_t)(indices.size() - firstIndex);
+		for (uint32_t v : blockVertices) {
+			for (int c = 0; c < 3; c++) {
+				double q = step[c] > 0 ? std::round((coords[3 * v + c] - minimum[c]) / step[c]) : 0.0;
+				vertices.push_back((uint16_t)std::min(std::max(q, 0.0), 65535.0));
+			}
+		}
+		// decode = toWorld * dequantize, with dequantize(q) = minimum + q * step
+		for (int row = 0; row < 4; row++) {
+			for (int c = 0; c < 3; c++) {
+				block.decode[4 * c + row] = (float)(toWorld[4 * c + row] * step[c]);
+			}
+			block.decode[12 + row] = (float)(toWorld[row] * minimum[0] + toWorld[4 + row] * minimum[1] + toWorld[8 + row] * minimum[2] + toWorld[12 + row]);
+		}
+		blocks.push_back(block);
+	}
+
+	// the quantized vertices can be just outside of the bounding spheres of the meshlets, which are grown to hold them
+	void GrowMeshlets(size_t firstMeshlet) {
+		const MeshBlock& block = blocks.back();
+		const float* m = block.decode;
+		for (size_t k = firstMeshlet; k < meshlets.size(); k++) {
+			Meshlet& meshlet = meshlets[k];
+			for (uint32_t i = block.firstIndex + meshlet.firstIndex; i < block.firstIndex + meshlet.firstIndex + meshlet.nrIndices; i++) {
+				const uint16_t* q = &vertices[3 * ((size_t)block.firstVertex + indices[i])];
+				float p[4];
+				for (int row = 0; row < 4; row++) {
+					p[row] = m[row] * q[0] + m[4 + row] * q[1] + m[8 + row] * q[2] + m[12 + row];
+				}
+				float dx = p[0] / p[3] - meshlet.center[0];
+				float dy = p[1] / p[3] - meshlet.center[1];
+				float dz = p[2] / p[3] - meshlet.center[2];
+				meshlet.radius = std::max(meshlet.radius, std::sqrt(dx * dx + dy * dy + dz * dz));
+			}
+		}
+	}
+};
+
+/*
+* MeshFileWriter writes a v2 (or v3 or v4) mesh file, in which the frames can be written in any order:
+* the header and an empty frame table are written up front, every frame is appended to the end of the file
+* and then filled in in the frame table. The header (with the maximum vertex and triangle count) is rewritten after every frame,
+* so a file that is cut off after a frame is still valid (see MeshFile::PrepareResume()).
+*/
+class MeshFileWriter {
+private:
+	std::fstream file;
+	MeshFileHeader header;
+	std::string path;
+	std::vector<MeshBlock> keptBlocks; // v3, of the frame that is written
+	std::vector<Meshlet> keptMeshlets;
+	std::vector<MeshChunk> chunks;     // v4, of the frame that is written
+	std::vector<uint8_t> chunkData;
+	std::vector<uint8_t> planes;       // scratch space of MeshCodec
+	std::vector<uint8_t> buffer;
+
+public:
+	MeshFileWriter() {}
+
+	bool Create(const std::string& path, int nrCameras, int width, int height, int nrFrames, uint32_t version = MeshFile::meshFileVersion, int nrLevels = 1) {
+		this->path = path;
+		header = MeshFile::MakeMeshFileHeader(nrCameras, width, height, nrFrames, version, nrLevels);
+		file.open(path, std::ios::binary | std::ios::out | std::ios::trunc);
+		if (!file.is_open()) {
+			std::cout << "Error: could not create " << path << std::endl;
+			return false;
+		}
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		MeshFrameEntry empty;
+		memset(&empty, 0, sizeof(empty));
+		for (uint32_t f = 0; f < header.nrFrames; f++) {
+			file.write(reinterpret_cast<const char*>(&empty), sizeof(empty));
+		}
+		return (bool)file;
+	}
+
+	// continue writing an existing file (after MeshFile::PrepareResume())
+	bool Open(const std::string& path) {
+		this->path = path;
+		file.open(path, std::ios::binary | std::ios::in | std::ios::out);
+		if (!file.is_open() || !MeshFile::ReadMeshFileHeader(file, header)) {
+			std::cout << "Error: could not open " << path << " as a v2, v3 or v4 mesh file" << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	// v2, the meshlets (if any) have their first index in triangles
+	bool WriteFrame(int frame, const float* vertices, int nrVertices, const uint32_t* triangles, int nrTriangles, const Meshlet* meshlets = NULL, int nrMeshlets = 0) {
+		file.seekp(0, std::ios::end);
+		uint64_t end = (uint64_t)file.tellp();
+
+		MeshFrameEntry entry;
+		entry.offset = MeshFile::Align(end);
+		entry.indexOffset = MeshFile::Align(entry.offset + 12 * (uint64_t)nrVertices);
+		entry.size = entry.indexOffset + 12 * (uint64_t)nrTriangles - entry.offset;
+		entry.nrVertices = nrVertices;
+		entry.nrTriangles = nrTriangles;
+		WritePadding(entry.offset - end);
+		file.write(reinterpret_cast<const char*>(vertices), 12 * (std::streamsize)nrVertices);
+		WritePadding(entry.indexOffset - entry.offset - 12 * (uint64_t)nrVertices);
+		file.write(reinterpret_cast<const char*>(triangles), 12 * (std::streamsize)nrTriangles);
+		if (nrMeshlets > 0) {
+			uint64_t tableOffset = MeshFile::MeshletTableOffset(entry);
+			MeshletTable table;
+			memset(&table, 0, sizeof(table));
+			table.nrMeshlets = (uint32_t)nrMeshlets;
+			WritePadding(tableOffset - (entry.offset + entry.size));
+			file.write(reinterpret_cast<const char*>(&table), sizeof(table));
+			file.write(reinterpret_cast<const char*>(meshlets), nrMeshlets * sizeof(Meshlet));
+			entry.size = tableOffset + sizeof(table) + nrMeshlets * sizeof(Meshlet) - entry.offset;
+		}
+		return WriteEntry(frame, entry);
+	}
+
+	// v3 or v4 (compressed), the kept blocks of the encoder come after its new blocks (see MeshBlockSource)
+	bool WriteFrame(int frame, const QuantizedMeshEncoder& encoder) {
+		bool compressed = header.version == MeshFile::compressedMeshFileVersion;
+		file.seekp(0, std::ios::end);
+		uint64_t end = (uint64_t)file.tellp();
+		uint64_t nrVertices = encoder.vertices.size() / 3;
+		uint64_t nrTriangles = encoder.indices.size() / 3;
+
+		// the kept blocks are placed after the vertices and indices that are stored
+		keptBlocks.assign(encoder.keptBlocks.begin(), encoder.keptBlocks.end());
+		uint32_t firstVertex = (uint32_t)nrVertices;
+		uint32_t firstIndex = (uint32_t)encoder.indices.size();
+		for (MeshBlock& block : keptBlocks) {
+			block.firstVertex = firstVertex;
+			block.firstIndex = firstIndex;
+			firstVertex += block.nrVertices;
+			firstIndex += block.nrIndices;
+		}
+
+		// and their meshlets after the new ones
+		keptMeshlets.assign(encoder.keptMeshlets.begin(), encoder.keptMeshlets.end());
+		for (Meshlet& meshlet : keptMeshlets) {
+			meshlet.block += (uint32_t)encoder.blocks.size();
+		}
+
+		MeshBlockTable table;
+		memset(&table, 0, sizeof(table));
+		table.nrBlocks = (uint32_t)(encoder.blocks.size() + keptBlocks.size());
+		table.nrKeptBlocks = (uint32_t)keptBlocks.size();
+		table.nrMeshlets = (uint32_t)(encoder.meshlets.size() + keptMeshlets.size());
+		uint64_t tableSize = MeshFile::ChunkTableOffset(table);
+		MeshFrameEntry entry;
+		entry.offset = MeshFile::Align(end);
+		entry.nrVertices = firstVertex;
+		entry.nrTriangles = firstIndex / 3;
+		uint64_t vertexOffset = 0;
+		if (compressed) {
+			// the chunks follow the table right away
+			tableSize += encoder.blocks.size() * sizeof(MeshChunk);
+			CompressBlocks(encoder, (uint32_t)tableSize);
+			table.vertexOffset = (uint32_t)tableSize;
+			entry.indexOffset = 0;
+			entry.size = tableSize + chunkData.size();
+		}
+		else {
+			vertexOffset = MeshFile::Align(entry.offset + tableSize);
+			table.vertexOffset = (uint32_t)(vertexOffset - entry.offset);
+			entry.indexOffset = MeshFile::Align(vertexOffset + 6 * nrVertices);
+			entry.size = entry.indexOffset + 6 * nrTriangles - entry.offset;
+		}
+		WritePadding(entry.offset - end);
+		file.write(reinterpret_cast<const char*>(&table), sizeof(table));
+		file.write(reinterpret_cast<const char*>(encoder.blocks.data()), encoder.blocks.size() * sizeof(MeshBlock));
+		file.write(reinterpret_cast<const char*>(keptBlocks.data()), keptBlocks.size() * sizeof(MeshBlock));
+		file.write(reinterpret_cast<const char*>(encoder.keptSources.data()), encoder.keptSources.size() * sizeof(MeshBlockSource));
+		file.write(reinterpret_cast<const char*>(encoder.meshlets.data()), encoder.meshlets.size() * sizeof(Meshlet));
+		file.write(reinterpret_cast<const char*>(keptMeshlets.data()), keptMeshlets.size() * sizeof(Meshlet));
+		if (compressed) {
+			file.write(reinterpret_cast<const char*>(chunks.data()), chunks.size() * sizeof(MeshChunk));
+			file.write(reinterpret_cast<const char*>(chunkData.data()), chunkData.size());
+			return WriteEntry(frame, entry);
+		}
+		WritePadding(vertexOffset - (entry.offset + tableSize));
+		file.write(reinterpret_cast<const char*>(encoder.vertices.data()), 6 * (std::streamsize)nrVertices);
+		WritePadding(entry.indexOffset - vertexOffset - 6 * nrVertices);
+		file.write(reinterpret_cast<const char*>(encoder.indices.data()), 6 * (std::streamsize)nrTriangles);
+		return WriteEntry(frame, entry);
+	}
+
+	void Close() {
+		file.close();
+	}
+
+private:
+	// v4: the chunk of every (new) block of the encoder, the chunks start at firstOffset from the MeshBlockTable
+	void CompressBlocks(const QuantizedMeshEncoder& encoder, uint32_t firstOffset) {
+		chunks.clear();
+		chunkData.clear();
+		for (const MeshBlock& block : encoder.blocks) {
+			MeshChunk chunk;
+			chunk.offset = firstOffset + (uint32_t)chunkData.size();
+			MeshCodec::Encode(encoder.vertices.data() + 3 * (size_t)block.firstVertex, block.nrVertices, encoder.indices.data() + block.firstIndex, block.nrIndices,
+				chunkData, planes, buffer);
+			chunk.size = (uint32_t)(firstOffset + chunkData.size() - chunk.offset);
+			chunks.push_back(chunk);
+		}
+	}
+
+	void WritePadding(uint64_t size) {
+		static const char zeros[MeshFile::alignment] = {};
+		file.write(zeros, size);
+	}
+
+	bool WriteEntry(int frame, const MeshFrameEntry& entry) {
+		// the entry after the payload, so that a crash in between leaves the frame unwritten
+		file.seekp(header.frameTableOffset + (uint64_t)frame * sizeof(MeshFrameEntry));
+		file.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+		header.maxNrVertices = std::max(header.maxNrVertices, entry.nrVertices);
+		header.maxNrTriangles = std::max(header.maxNrTriangles, entry.nrTriangles);
+		file.seekp(0);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.flush();
+		if (!file) {
+			std::cout << "Error: could not write frame " << frame << " to " << path << std::endl;
+			return false;
+		}
+		return true;
+	}
+};
+
+
+#endif
@@ -0,0 +1,324 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+
+/*
+* MeshOptimizer reorders the triangles and vertices of a simplified mesh for the GPU of the renderer,
+* without changing the mesh itself. The simplifier leaves the triangles in whatever order its collapses left them,
+* so a vertex is often transformed again (by the rather expensive vertex shader of the renderer) because it already left the post-transform cache.
+*
+* - The triangles are reordered with Tipsify (Sander et al., "Fast triangle reordering for vertex locality and reduced overdraw", 2007):
+*   it emits all remaining triangles around one vertex (a fan), and then continues with a vertex of those triangles that is still in the (simulated FIFO)
+*   cache, so that the next fans reuse the vertices that were just transformed.
+* - Optionally, the runs of triangles that start with an empty cache (the clusters) are then sorted front to back, i.e. by their distance to the origin
+*   (the input camera, for a mesh in camera space), so that more of the hidden fragments are rejected by the depth test. That barely changes the cache misses.
+* - With meshlets, the triangles are then grouped into meshlets (see Meshlet in MeshFile.h) instead: starting from the first triangle in that order
+*   that is not in a meshlet yet, a meshlet takes the triangles that share a vertex with its triangles (breadth first) until it is full,
+*   so that it is compact and its bounding sphere is small. The triangles of a meshlet keep their order, so the cache misses only go up a little.
+*   With sortFrontToBack, the meshlets are sorted instead of the clusters.
+* - Finally the vertices are renumbered in the order in which the triangles first use them, so that they are also fetched in order.
+*
+* ACMR() is the average cache miss ratio: the nr of vertices that are transformed per triangle (0.5 for a large regular grid, 3 if no vertex is reused).
+* MeshletBounds() computes the bounding spheres and normal cones of the meshlets, once the mesh is in world space.
+* All memory is kept between meshes, so each MeshBuilder has its own MeshOptimizer.
+*/
+class MeshOptimizer {
+public:
+	static const int cacheSize = 16; // entries of the simulated post-transform cache
+
+private:
+	struct Cluster {
+		float distance;              // mean distance of its vertices to the origin
+		uint32_t start, end;         // in order
+	};
+
+	std::vector<uint32_t> adjacencyOffsets; // for each vertex, where its triangles start in adjacency
+	std::vector<uint32_t> adjacency;        // the triangles of every vertex
+	std::vector<int> liveTriangles;         // for each vertex, the nr of its triangles that are not emitted yet
+	std::vector<int> cacheTimes;            // for each vertex, the time (nr of cache misses) at which it last entered the cache
+	std::vector<bool> emitted;              // for each triangle
+	std::vector<uint32_t> deadEnds;         // the vertices that were used recently, to continue from when a fan has no candidate
+	std::vector<uint32_t> candidates;       // the vertices of the last fan
+	std::vector<uint32_t> order;            // the triangles in their new order
+	std::vector<uint32_t> clusterStarts;    // where each cluster starts in order
+	std::vector<Cluster> clusters;
+	std::vector<uint32_t> sortedOrder;
+	std::vector<uint32_t> rank;             // for each triangle, its position in the order of Tipsify
+	std::vector<int> remap;                 // for each vertex, its new index or -1
+	std::vector<float> newVertices;
+	std::vector<uint32_t> newTriangles;
+	std::vector<glm::vec3> normals;         // MeshletBounds(), of the triangles of one meshlet
+
+public:
+	std::vector<uint32_t> meshletStarts;    // after Optimize() with meshlets: the first triangle of every meshlet
+
+	MeshOptimizer() {}
+
+	// vertices has 3 floats per vertex and triangles 3 vertex indices per triangle, both are reordered in place.
+	// meshletSize is the maximum nr of triangles of a meshlet, 0 for no meshlets
+	void Optimize(std::vector<float>& vertices, std::vector<uint32_t>& triangles, bool sortFrontToBack, int meshletSize = 0) {
+		int nrVertices = (int)vertices.size() / 3;
+		int nrTriangles = (int)triangles.size() / 3;
+		meshletStarts.clear();
+		if (nrTriangles == 0) {
+			return;
+		}
+		Tipsify(triangles.data(), nrVertices, nrTriangles);
+		if (meshletSize > 0) {
+			BuildMeshlets(triangles.data(), nrTriangles, meshletSize);
+			if (sortFrontToBack) SortClusters(vertices.data(), triangles.data(), meshletStarts);
+		}
+		else if (sortFrontToBack) {
+			SortClusters(vertices.data(), triangles.data(), clusterStarts);
+		}
+
+		// renumber the vertices in the order of first use, a vertex that no triangle uses goes to the end
+		remap.assign(nrVertices, -1);
+		newVertices.resize(vertices.size());
+		newTriangles.resize(triangles.size());
+		int nrUsed = 0;
+		for (size_t j = 0; j < order.size(); j++) {
+			const uint32_t* t = &triangles[3 * order[j]];
+			for (int k = 0; k < 3; k++) {
+				int& r = remap[t[k]];
+				if (r < 0) {
+					r = nrUsed++;
+					memcpy(&newVertices[3 * r], &vertices[3 * t[k]], 3 * sizeof(float));
+				}
+				newTriangles[3 * j + k] = r;
+			}
+		}
+		for (int v = 0; v < nrVertices; v++) {
+			if (remap[v] >= 0) continue;
+			memcpy(&newVertices[3 * nrUsed], &vertices[3 * v], 3 * sizeof(float));
+			nrUsed++;
+		}
+		std::copy(newVertices.begin(), newVertices.end(), vertices.begin());
+		std::copy(newTriangles.begin(), newTriangles.end(), triangles.begin());
+	}
+
+	double ACMR(const std::vector<uint32_t>& triangles, int nrVertices) {
+		if (triangles.empty()) {
+			return 0.0;
+		}
+		cacheTimes.assign(nrVertices, 0);
+		int time = cacheSize + 1;
+		for (uint32_t v : triangles) {
+			if (time - cacheTimes[v] > cacheSize) {
+				cacheTimes[v] = time++;
+			}
+		}
+		return (time - cacheSize - 1) / (triangles.size() / 3.0);
+	}
+
+	// the meshlets of meshletStarts, for the (reordered, world space) mesh of an input camera at eye.
+	// Their block is 0 and their first index is in triangles
+	void MeshletBounds(const std::vector<float>& vertices, const std::vector<uint32_t>& triangles, const glm::vec3& eye, /*out*/ std::vector<Meshlet>& meshlets) {
+		meshlets.clear();
+		const glm::vec3* p = reinterpret_cast<const glm::vec3*>(vertices.data());
+		uint32_t nrTriangles = (uint32_t)triangles.size() / 3;
+		for (size_t m = 0; m < meshletStarts.size(); m++) {
+			uint32_t start = meshletStarts[m];
+			uint32_t end = m + 1 < meshletStarts.size() ? meshletStarts[m + 1] : nrTriangles;
+
+			// the sphere around the center of the bounding box
+			glm::vec3 minimum(INFINITY), maximum(-INFINITY);
+			for (uint32_t i = 3 * start; i < 3 * end; i++) {
+				minimum = glm::min(minimum, p[triangles[i]]);
+				maximum = glm::max(maximum, p[triangles[i]]);
+			}
+			glm::vec3 center = 0.5f * (minimum + maximum);
+			float radius = 0.0f;
+			for (uint32_t i = 3 * start; i < 3 * end; i++) {
+				radius = std::max(radius, glm::length(p[triangles[i]] - center));
+			}
+
+			// the normals, turned towards the input camera (the mesh is a depth map seen from there, so no triangle faces away from it)
+			glm::vec3 axis(0.0f);
+			normals.clear();
+			for (uint32_t t = start; t < end; t++) {
+				const glm::vec3& a = p[triangles[3 * t]];
+				glm::vec3 n = glm::cross(p[triangles[3 * t + 1]] - a, p[triangles[3 * t + 2]] - a);
+				float length = glm::length(n);
+				if (length == 0.0f) continue;
+				n /= length;
+				if (glm::dot(n, eye - a) < 0.0f) n = -n;
+				normals.push_back(n);
+				axis += n;
+			}
+			float axisLength = glm::length(axis);
+			float cutoff = 1.0f;
+			if (axisLength > 0.0f) {
+				axis /= axisLength;
+				float minimumDot = 1.0f;
+				for (const glm::vec3& n : normals) {
+					minimumDot = std::min(minimumDot, glm::dot(n, axis));
+				}
+				// a cone of 90 degrees or more always has a normal that faces the viewer
+				if (minimumDot > 0.0f) cutoff = std::sqrt(1.0f - minimumDot * minimumDot);
+			}
+			else {
+				axis = glm::vec3(0.0f, 0.0f, 1.0f);
+			}
+
+			Meshlet meshlet;
+			memcpy(meshlet.center, &center[0], sizeof(meshlet.center));
+			meshlet.radius = radius;
+			memcpy(meshlet.coneAxis, &axis[0], sizeof(meshlet.coneAxis));
+			meshlet.coneCutoff = cutoff;
+			meshlet.block = 0;
+			meshlet.firstIndex = 3 * start;
+			meshlet.nrIndices = 3 * (end - start);
+			meshlet.camera = 0;
+			meshlet.level = 0;
+			meshlets.push_back(meshlet);
+		}
+	}
+
+private:
+	// fills order with the triangles in the order of Tipsify, and clusterStarts with the positions in order where the cache was empty
+	void Tipsify(const uint32_t* triangles, int nrVertices, int nrTriangles) {
+		// the triangles of every vertex, cacheTimes is used as the position to add the next triangle of a vertex at
+		adjacencyOffsets.assign(nrVertices + 1, 0);
+		for (int i = 0; i < 3 * nrTriangles; i++) {
+			adjacencyOffsets[triangles[i] + 1]++;
+		}
+		liveTriangles.resize(nrVertices);
+		cacheTimes.resize(nrVertices);
+		for (int v = 0; v < nrVertices; v++) {
+			liveTriangles[v] = adjacencyOffsets[v + 1];
+			adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+			cacheTimes[v] = adjacencyOffsets[v];
+		}
+		adjacency.resize(3 * (size_t)nrTriangles);
+		for (int i = 0; i < 3 * nrTriangles; i++) {
+			adjacency[cacheTimes[triangles[i]]++] = i / 3;
+		}
+
+		cacheTimes.assign(nrVertices, 0);
+		emitted.assign(nrTriangles, false);
+		deadEnds.clear();
+		order.clear();
+		clusterStarts.clear();
+		int time = cacheSize + 1; // so that no vertex is in the cache at the start
+		int cursor = 0;           // the vertices before it have no triangles left
+		int fan = 0;
+		while (fan >= 0) {
+			if (time - cacheTimes[fan] > cacheSize && (clusterStarts.empty() || clusterStarts.back() < order.size())) {
+				clusterStarts.push_back((uint32_t)order.size());
+			}
+			candidates.clear();
+			for (uint32_t a = adjacencyOffsets[fan]; a < adjacencyOffsets[fan + 1]; a++) {
+				uint32_t t = adjacency[a];
+				if (emitted[t]) continue;
+				emitted[t] = true;
+				order.push_back(t);
+				for (int k = 0; k < 3; k++) {
+					uint32_t v = triangles[3 * t + k];
+					deadEnds.push_back(v);
+					candidates.push_back(v);
+					liveTriangles[v]--;
+					if (time - cacheTimes[v] > cacheSize) {
+						cacheTimes[v] = time++;
+					}
+				}
+			}
+			fan = NextFan(time, cursor, nrVertices);
+		}
+	}
+
+	// the vertex of the last fan that entered the cache the longest ago, but is still in the cache after emitting its remaining triangles,
+	// otherwise the most recently used vertex that still has triangles left, or the next such vertex in index order. -1 when all triangles are emitted
+	int NextFan(int time, /*in,out*/ int& cursor, int nrVertices) {
+		int best = -1;
+		int bestPriority = -1;
+		for (uint32_t v : candidates) {
+			if (liveTriangles[v] <= 0) continue;
+			int priority = 0;
+			if (time - cacheTimes[v] + 2 * liveTriangles[v] <= cacheSize) {
+				priority = time - cacheTimes[v];
+			}
+			if (priority > bestPriority) {
+				best = (int)v;
+				bestPriority = priority;
+			}
+		}
+		if (best >= 0) {
+			return best;
+		}
+		while (!deadEnds.empty()) {
+			uint32_t v = deadEnds.back();
+			deadEnds.pop_back();
+			if (liveTriangles[v] > 0) {
+				return (int)v;
+			}
+		}
+		for (; cursor < nrVertices; cursor++) {
+			if (liveTriangles[cursor] > 0) {
+				return cursor;
+			}
+		}
+		return -1;
+	}
+
+	// groups the triangles of order into meshlets of at most meshletSize triangles, see above
+	void BuildMeshlets(const uint32_t* triangles, int nrTriangles, int meshletSize) {
+		rank.resize(nrTriangles);
+		for (uint32_t j = 0; j < order.size(); j++) {
+			rank[order[j]] = j;
+		}
+		emitted.assign(nrTriangles, false);
+		sortedOrder.clear();
+		for (uint32_t seed : order) {
+			if (emitted[seed]) continue;
+			size_t start = sortedOrder.size();
+			meshletStarts.push_back((uint32_t)start);
+			emitted[seed] = true;
+			sortedOrder.push_back(seed);
+			// the meshlet so far is also the queue of the breadth first search
+			for (size_t q = start; q < sortedOrder.size() && sortedOrder.size() - start < (size_t)meshletSize; q++) {
+				for (int k = 0; k < 3; k++) {
+					uint32_t v = triangles[3 * sortedOrder[q] + k];
+					for (uint32_t a = adjacencyOffsets[v]; a < adjacencyOffsets[v + 1] && sortedOrder.size() - start < (size_t)meshletSize; a++) {
+						uint32_t t = adjacency[a];
+						if (emitted[t]) continue;
+						emitted[t] = true;
+						sortedOrder.push_back(t);
+					}
+				}
+			}
+			std::sort(sortedOrder.begin() + start, sortedOrder.end(), [this](uint32_t a, uint32_t b) { return rank[a] < rank[b]; });
+		}
+		order.swap(sortedOrder);
+	}
+
+	// sorts the runs of order that start at starts front to back, starts is updated to where they are then
+	void SortClusters(const float* vertices, const uint32_t* triangles, std::vector<uint32_t>& starts) {
+		clusters.clear();
+		for (size_t c = 0; c < starts.size(); c++) {
+			Cluster cluster;
+			cluster.start = starts[c];
+			cluster.end = c + 1 < starts.size() ? starts[c + 1] : (uint32_t)order.size();
+			double sum = 0;
+			for (uint32_t j = cluster.start; j < cluster.end; j++) {
+				for (int k = 0; k < 3; k++) {
+					const float* p = vertices + 3 * triangles[3 * order[j] + k];
+					sum += std::sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+				}
+			}
+			cluster.distance = (float)(sum / (3.0 * (cluster.end - cluster.start)));
+			clusters.push_back(cluster);
+		}
+		std::sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) { return a.distance < b.distance; });
+		sortedOrder.clear();
+		starts.clear();
+		for (const Cluster& cluster : clusters) {
+			starts.push_back((uint32_t)sortedOrder.size());
+			sortedOrder.insert(sortedOrder.end(), order.begin() + cluster.start, order.begin() + cluster.end);
+		}
+		order.swap(sortedOrder);
+	}
+};
+
+
+#endif
@@ -0,0 +1,375 @@
+#ifndef MESH_WRITER_H
+#define MESH_WRITER_H
+
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+
+/*
+* MeshTask is what a worker thread needs to know to build (a tile of) the mesh of one input camera.
+* The tasks live in their FrameSlot, so the worker threads only get a pointer to them.
+*/
+struct MeshTask {
+	int slot = 0;
+	int camera = 0;
+	int tile = -1; // -1 if the whole depth map is simplified at once
+};
+
+/*
+* FrameSlot holds one video frame that is in flight:
+* the data downloaded from the GPU and the simplified mesh of every input camera.
+*/
+struct FrameSlot {
+	int frame = -1;
+	std::vector<CameraFrameData> data;   // one per input camera
+	std::vector<CameraMesh> meshes;      // one per input camera
+	int nrCamerasLeft = 0;               // nr of meshes that still need to be built
+	std::vector<std::vector<TileMesh>> tiles; // one per input camera, only used when simplifying per tile
+	std::vector<int> nrTilesLeft;        // one per input camera, nr of tiles that still need to be simplified
+	std::vector<std::vector<CameraMesh>> tileMeshes; // with --temporal_tolerance: one per tile of every input camera, the tiles are not stitched
+	std::vector<std::vector<char>> reusedTiles;      // with --temporal_tolerance: per tile of every input camera, 1 if its mesh of an earlier frame is reused
+	std::vector<MeshTask> tasks;         // the tasks of this frame that are given to the worker threads
+};
+
+/*
+* MeshWriter owns a fixed number of FrameSlots, so that several video frames can be in flight at the same time.
+*
+* The main thread calls AcquireSlot() (which blocks while all slots are in use) and fills in the slot,
+* the worker threads call CameraDone() after building the mesh of one input camera of that slot.
+* A separate writer thread appends the finished frames to the output file in frame order,
+* and then frees the slot again.
+* The frames are firstFrame, ..., options.endFrame - 1, in the format of options.meshFormat (see MeshFile).
+* A shard file starts with a ShardHeader and then has the frames in the v1 format,
+* and with append (--resume) the frames are added to the existing file.
+* For v3 and v4, the mesh of every input camera is quantized separately (see QuantizeCamera()), v4 then compresses every block.
+*
+* With --temporal_tolerance, every tile is a mesh on its own, and the tiles that are reused (see TileHistory) are not in the slot:
+* the writer keeps the last mesh that was built for every tile, and in a v3 or v4 file only refers to its blocks in the frame they are stored in.
+*/
+class MeshWriter {
+	std::thread writer;
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::vector<FrameSlot> slots;
+	std::vector<int> freeSlots;         // a vector instead of a queue, since any free slot will do
+	int nextFrameToWrite = 0;
+	int endFrame = 0;
+	bool terminate_writer = false;
+
+	std::string outPath;
+	bool shard = false;
+	int shardStartFrame = 0;
+	int meshFormat = 1;                 // 1, 2, 3 or 4
+	std::vector<InputCamera> inputCameras;
+	int width = 0;
+	int height = 0;
+	bool append = false;
+	bool verbose = false;
+	bool temporal = false;              // options.temporalTolerance >= 0
+	int nrLevels = 1;                   // options.lodLevels
+	MeshFileWriter v2Writer;
+
+	// the concatenated meshes of the frame that is being written, kept so that their memory is reused
+	std::vector<float> all_vertices;
+	std::vector<uint32_t> all_triangles;
+	QuantizedMeshEncoder encoder;       // v3 and v4
+	std::vector<float> coords;          // v3 and v4, of the mesh of one input camera
+	std::vector<const CameraMesh*> frameMeshes; // v1 and v2, the meshes that are concatenated
+	std::vector<int> frameCameras;      // v2, the input camera of each of them
+	std::vector<Meshlet> all_meshlets;  // v2
+
+	// with temporal, the last mesh that was built for every tile of every input camera (v1 and v2),
+	// or the blocks it was stored as (v3 and v4), with the frame and index of each block
+	std::vector<std::vector<CameraMesh>> builtTiles;
+	struct StoredBlocks {
+		std::vector<MeshBlock> blocks;
+		std::vector<MeshBlockSource> sources;
+		std::vector<Meshlet> meshlets;  // their block is the index in blocks
+	};
+	std::vector<std::vector<StoredBlocks>> storedTiles;
+
+public:
+
+	MeshWriter() {}
+
+	// firstFrame is after options.startFrame when resuming
+	void Init(std::string outPath, const Options& options, const std::vector<InputCamera>& inputCameras, int firstFrame, bool append) {
+		int nrSlots = options.framesInFlight;
+		int nrCameras = (int)inputCameras.size();
+		this->outPath = outPath;
+		this->endFrame = options.endFrame;
+		this->shard = options.shard;
+		this->shardStartFrame = options.startFrame;
+		this->meshFormat = options.shard ? 1 : options.meshFormat;  // Options only allows v1 and v2 (and no meshlets) for shards
+		this->inputCameras = inputCameras;
+		this->width = inputCameras[0].res_x;
+		this->height = inputCameras[0].res_y;
+		this->append = append;
+		this->verbose = options.verbose;
+		this->temporal = options.temporalTolerance >= 0;
+		this->nrLevels = options.lodLevels;
+		builtTiles = std::vector<std::vector<CameraMesh>>(nrCameras);
+		storedTiles = std::vector<std::vector<StoredBlocks>>(nrCameras);
+		slots = std::vector<FrameSlot>(nrSlots);
+		freeSlots.reserve(nrSlots);
+		for (int s = 0; s < nrSlots; s++) {
+			slots[s].data = std::vector<CameraFrameData>(nrCameras);
+			slots[s].meshes = std::vector<CameraMesh>(nrCameras);
+			slots[s].tiles = std::vector<std::vector<TileMesh>>(nrCameras);
+			slots[s].nrTilesLeft = std::vector<int>(nrCameras, 0);
+			slots[s].tileMeshes = std::vector<std::vector<CameraMesh>>(nrCameras);
+			slots[s].reusedTiles = std::vector<std::vector<char>>(nrCameras);
+			freeSlots.push_back(s);
+		}
+		nextFrameToWrite = firstFrame;
+		terminate_writer = false;
+		writer = std::thread(&MeshWriter::write_loop, this);
+	}
+
+	// blocks until a slot is free, returns its index
+	int AcquireSlot(int frame) {
+		std::unique_lock<std::mutex> lock(mutex);
+		condition.wait(lock, [this] { return !freeSlots.empty(); });
+		int s = freeSlots.back();
+		freeSlots.pop_back();
+		slots[s].frame = frame;
+		slots[s].nrCamerasLeft = (int)slots[s].meshes.size();
+		return s;
+	}
+
+	// give back a slot that was not filled in (e.g. because decoding the frame failed)
+	void ReleaseSlot(int s) {
+		std::lock_guard<std::mutex> lock(mutex);
+		slots[s].frame = -1;
+		freeSlots.push_back(s);
+	}
+
+	FrameSlot& GetSlot(int s) {
+		return slots[s];
+	}
+
+	// returns true if this was the last tile of that input camera, i.e. the tiles can be stitched together
+	bool TileDone(int s, int camera) {
+		std::lock_guard<std::mutex> lock(mutex);
+		slots[s].nrTilesLeft[camera]--;
+		return slots[s].nrTilesLeft[camera] == 0;
+	}
+
+	void CameraDone(int s) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			slots[s].nrCamerasLeft--;
+		} // to unlock
+		condition.notify_all();
+	}
+
+	// waits until all acquired frames are written to disk
+	void Finish() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			terminate_writer = true;
+		} // to unlock
+		condition.notify_all();
+		if (writer.joinable()) {
+			writer.join();
+		}
+	}
+
+private:
+	int finished_slot() {
+		for (int s = 0; s < slots.size(); s++) {
+			if (slots[s].frame == nextFrameToWrite && slots[s].nrCamerasLeft == 0) {
+				return s;
+			}
+		}
+		return -1;
+	}
+
+	void write_loop() {
+		std::ofstream outFile;
+		int nrCameras = (int)inputCameras.size();
+		if (meshFormat >= 2) {
+			if (append) v2Writer.Open(outPath);
+			else v2Writer.Create(outPath, nrCameras, width, height, endFrame, meshFormat, nrLevels);
+		}
+		else {
+			outFile.open(outPath, append ? std::ios::binary | std::ios::app : std::ios::binary);
+		}
+		if (shard && !append) {
+			ShardHeader header = MeshFile::MakeShardHeader(shardStartFrame, endFrame, nrCameras, width, height);
+			outFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		}
+		while (true) {
+			int s = -1;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				condition.wait(lock, [this, &s] {
+					s = finished_slot();
+					return s >= 0 || (terminate_writer && freeSlots.size() == slots.size());
+				});
+				if (s < 0) {
+					break;
+				}
+			}
+
+			WriteFrame(outFile, slots[s]);
+			printf("frame %d / %d done\n", slots[s].frame + 1, endFrame);
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				slots[s].frame = -1;
+				freeSlots.push_back(s);
+				nextFrameToWrite++;
+			} // to unlock
+			condition.notify_all();
+		}
+		outFile.close();
+		v2Writer.Close();
+	}
+
+	void WriteFrame(std::ofstream& outFile, FrameSlot& slot) {
+		if (meshFormat >= 3) {
+			encoder.Clear();
+			for (int i = 0; i < slot.meshes.size(); i++) {
+				if (temporal) QuantizeTiles(i, slot);
+				else QuantizeCamera(i, slot.meshes[i]);
+			}
+			v2Writer.WriteFrame(slot.frame, encoder);
+			if (verbose) printf("Wrote %d vertices, %d triangles in %d blocks and %d meshlets (and kept %d blocks of earlier frames) to %s\n",
+				(int)encoder.vertices.size() / 3, (int)encoder.indices.size() / 3, (int)encoder.blocks.size(), (int)(encoder.meshlets.size() + encoder.keptMeshlets.size()),
+				(int)encoder.keptBlocks.size(), outPath.c_str());
+			return;
+		}
+
+		frameMeshes.clear();
+		frameCameras.clear();
+		for (int i = 0; i < slot.meshes.size(); i++) {
+			if (!temporal) {
+				frameMeshes.push_back(&slot.meshes[i]);
+				frameCameras.push_back(i);
+				continue;
+			}
+			builtTiles[i].resize(slot.tileMeshes[i].size());
+			for (int t = 0; t < slot.tileMeshes[i].size(); t++) {
+				// swapped, so that the memory of the old mesh is reused by the slot
+				if (!slot.reusedTiles[i][t]) std::swap(builtTiles[i][t], slot.tileMeshes[i][t]);
+				frameMeshes.push_back(&builtTiles[i][t]);
+				frameCameras.push_back(i);
+			}
+		}
+
+		// concatenate the meshes in camera order
+		all_vertices.clear();
+		all_triangles.clear();
+		all_meshlets.clear();
+		int triangles_offset = 0;
+		for (int m = 0; m < frameMeshes.size(); m++) {
+			const CameraMesh& mesh = *frameMeshes[m];
+			for (Meshlet meshlet : mesh.meshlets) {
+				meshlet.firstIndex += (uint32_t)all_triangles.size();
+				meshlet.camera = frameCameras[m];
+				all_meshlets.push_back(meshlet);
+			}
+			all_vertices.insert(all_vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+			for (uint32_t index : mesh.triangles) {
+				all_triangles.push_back(index + triangles_offset);
+			}
+			triangles_offset = all_vertices.size() / 3;
+		}
+
+		int nr_vertices = all_vertices.size() / 3;
+		int nr_triangles = all_triangles.size() / 3;
+
+		if (meshFormat == 2) {
+			v2Writer.WriteFrame(slot.frame, all_vertices.data(), nr_vertices, all_triangles.data(), nr_triangles, all_meshlets.data(), (int)all_meshlets.size());
+		}
+		else {
+			// write nr_vertices and nr_triangles
+			outFile.write(reinterpret_cast<const char*>(&nr_vertices), sizeof(nr_vertices));
+			outFile.write(reinterpret_cast<const char*>(&nr_triangles), sizeof(nr_triangles));
+			// write vertex positions and triangle indices
+			outFile.write(reinterpret_cast<const char*>(all_vertices.data()), all_vertices.size() * sizeof(float));
+			outFile.write(reinterpret_cast<const char*>(all_triangles.data()), all_triangles.size() * sizeof(uint32_t));
+			outFile.flush();
+		}
+
+		if (verbose) printf("Wrote %d vertices, %d triangles to %s\n", nr_vertices, nr_triangles, outPath.c_str());
+	}
+
+	// add the (world space) mesh of an input camera to the encoder. For a perspective camera, the vertices are quantized
+	// as their pixel position (col + 0.5, row + 0.5) and inverse depth 1 / d, which is what the depth map stores,
+	// and the decode matrix of the blocks also unprojects them. Other projections are quantized in world space.
+	void QuantizeCamera(int camera, const CameraMesh& mesh) {
+		const InputCamera& input = inputCameras[camera];
+		int nrVertices = (int)mesh.vertices.size() / 3;
+		int nrTriangles = (int)mesh.triangles.size() / 3;
+		bool perspective = input.projection == Projection::Perspective;
+		coords.resize(mesh.vertices.size());
+		for (int j = 0; j < nrVertices && perspective; j++) {
+			glm::vec4 p = input.view * glm::vec4(mesh.vertices[3 * j], mesh.vertices[3 * j + 1], mesh.vertices[3 * j + 2], 1.0f);
+			if (p.z >= 0) {
+				perspective = false; // not in front of the camera, so it can not be unprojected
+				break;
+			}
+			coords[3 * j] = input.principal_point_x - input.focal_x * p.x / p.z;
+			coords[3 * j + 1] = input.principal_point_y + input.focal_y * p.y / p.z;
+			coords[3 * j + 2] = -1.0f / p.z;
+		}
+		glm::mat4 toWorld = glm::mat4(1.0f);
+		if (perspective) {
+			// (u, v, 1 / d, 1) -> ((u - pp_x) / f_x, -(v - pp_y) / f_y, -1, 1 / d), i.e. the camera space position times 1 / d
+			glm::mat4 unproject = glm::mat4(0.0f);
+			unproject[0][0] = 1.0f / input.focal_x;
+			unproject[3][0] = -input.principal_point_x / input.focal_x;
+			unproject[1][1] = -1.0f / input.focal_y;
+			unproject[3][1] = input.principal_point_y / input.focal_y;
+			unproject[3][2] = -1.0f;
+			unproject[2][3] = 1.0f;
+			toWorld = input.model * unproject;
+		}
+		else {
+			coords.assign(mesh.vertices.begin(), mesh.vertices.end());
+		}
+		size_t firstMeshlet = encoder.meshlets.size();
+		encoder.Add(coords.data(), nrVertices, mesh.triangles.data(), nrTriangles, glm::value_ptr(toWorld), mesh.meshlets.data(), (int)mesh.meshlets.size());
+		for (size_t m = firstMeshlet; m < encoder.meshlets.size(); m++) {
+			encoder.meshlets[m].camera = camera;
+		}
+	}
+
+	// with temporal: quantize the tiles of the input camera that are built in this frame, and keep the blocks of the others
+	void QuantizeTiles(int camera, const FrameSlot& slot) {
+		storedTiles[camera].resize(slot.tileMeshes[camera].size());
+		for (int t = 0; t < slot.tileMeshes[camera].size(); t++) {
+			StoredBlocks& stored = storedTiles[camera][t];
+			if (slot.reusedTiles[camera][t]) {
+				uint32_t firstKept = (uint32_t)encoder.keptBlocks.size();
+				for (int b = 0; b < stored.blocks.size(); b++) {
+					encoder.Keep(stored.blocks[b], stored.sources[b]);
+				}
+				for (Meshlet meshlet : stored.meshlets) {
+					meshlet.block += firstKept;
+					encoder.keptMeshlets.push_back(meshlet);
+				}
+				continue;
+			}
+			size_t firstBlock = encoder.blocks.size();
+			size_t firstMeshlet = encoder.meshlets.size();
+			QuantizeCamera(camera, slot.tileMeshes[camera][t]);
+			stored.blocks.assign(encoder.blocks.begin() + firstBlock, encoder.blocks.end());
+			stored.sources.clear();
+			for (size_t b = firstBlock; b < encoder.blocks.size(); b++) {
+				stored.sources.push_back(MeshBlockSource{ (uint32_t)slot.frame, (uint32_t)b });
+			}
+			stored.meshlets.assign(encoder.meshlets.begin() + firstMeshlet, encoder.meshlets.end());
+			for (Meshlet& meshlet : stored.meshlets) {
+				meshlet.block -= (uint32_t)firstBlock;
+			}
+		}
+	}
+};
+
+
+#endif
@@ -0,0 +1,271 @@
+#ifndef QUADTREE_MESHER_H
+#define QUADTREE_MESHER_H
+
+
+/*
+* QuadtreeMesher builds an adaptive triangle mesh directly from the depth map of one input camera,
+* instead of creating two triangles per pixel square and simplifying them afterwards.
+*
+* The vertex grid (one vertex per pixel) is covered by square cells of at most 2^maxLevel pixel squares.
+* A cell is split into 4 while it contains masked pixels (unless all of them are) or edge pixels, or while the depth map inside it
+* deviates more than maxError (in scene units, along the z axis) from the plane through its corners.
+* The quadtree is then restricted (neighboring cells differ at most one level), so that each cell can be
+* triangulated without cracks: with 2 triangles, or with a fan around its center if a neighbor is smaller.
+* Cells of 1 pixel square are triangulated like the full vertex grid would be.
+*/
+class QuadtreeMesher {
+public:
+	const int maxLevel = 6; // the largest cells are 64x64 pixel squares
+
+	// output of Build()
+	std::vector<int> vertexPixels;   // the pixel (row * width + col) of each vertex
+	std::vector<uint32_t> triangles; // 3 vertex indices per triangle
+	std::vector<bool> keep;          // one per triangle, true if it lies on a depth edge
+
+private:
+	struct Cell {
+		int x, y, level; // covers the pixel squares [x, x + 2^level) x [y, y + 2^level)
+	};
+
+	int width = 0;                   // nr of vertices per row (= nr pixels)
+	int height = 0;
+	int nrSquaresX = 0;              // nr of pixel squares per row (= width - 1)
+	int nrSquaresY = 0;
+	std::vector<Cell> leaves;
+	std::vector<int8_t> squareLevels; // for each pixel square, the level of the leaf that covers it
+	std::vector<int> vertexIndices;   // for each pixel, the index of its vertex or -1
+
+	const unsigned short* depth = nullptr;
+	const unsigned char* mask = nullptr;    // mask == 0 means keep pixel
+	const unsigned char* is_edge = nullptr; // 0 means pixel is not on a depth edge
+	float depth_thresh = 500; // same threshold for elongated triangles as MeshBuilder
+	double maxError = 0;
+	double w_offset = 0;      // inverse depth = w_offset + depth * w_scale
+	double w_scale = 0;
+
+public:
+	QuadtreeMesher() {}
+
+	// depth, mask and is_edge are the res_x * res_y maps of one input camera (see CameraFrameData)
+	void Build(const InputCamera& input, const unsigned short* depth, const unsigned char* mask, const unsigned char* is_edge, double maxError) {
+		this->depth = depth;
+		this->mask = mask;
+		this->is_edge = is_edge;
+		this->maxError = maxError;
+		width = input.res_x;
+		height = input.res_y;
+		nrSquaresX = width - 1;
+		nrSquaresY = height - 1;
+		w_offset = 1.0 / input.z_far;
+		w_scale = (1.0 / input.z_near - 1.0 / input.z_far) / 65535.0;
+
+		vertexPixels.clear();
+		triangles.clear();
+		keep.clear();
+		leaves.clear();
+		squareLevels.assign(nrSquaresX * nrSquaresY, 0);
+		vertexIndices.assign(width * height, -1);
+
+		int rootSize = 1 << maxLevel;
+		for (int y = 0; y < nrSquaresY; y += rootSize) {
+			for (int x = 0; x < nrSquaresX; x += rootSize) {
+				Subdivide(Cell{ x, y, maxLevel });
+			}
+		}
+		Restrict();
+		for (const Cell& cell : leaves) {
+			Triangulate(cell);
+		}
+	}
+
+private:
+	void Subdivide(const Cell& cell) {
+		int s = 1 << cell.level;
+		if (cell.x >= nrSquaresX || cell.y >= nrSquaresY) {
+			return; // outside of the image
+		}
+		bool insideImage = cell.x + s <= nrSquaresX && cell.y + s <= nrSquaresY;
+		if (cell.level > 0 && (!insideImage || NeedsSplit(cell))) {
+			int h = s / 2;
+			Subdivide(Cell{ cell.x,     cell.y,     cell.level - 1 });
+			Subdivide(Cell{ cell.x + h, cell.y,     cell.level - 1 });
+			Subdivide(Cell{ cell.x,     cell.y + h, cell.level - 1 });
+			Subdivide(Cell{ cell.x + h, cell.y + h, cell.level - 1 });
+			return;
+		}
+		AddLeaf(cell);
+	}
+
+	void AddLeaf(const Cell& cell) {
+		leaves.push_back(cell);
+		SetSquareLevels(cell);
+	}
+
+	void SetSquareLevels(const Cell& cell) {
+		int s = 1 << cell.level;
+		for (int y = cell.y; y < cell.y + s; y++) {
+			std::fill(squareLevels.begin() + y * nrSquaresX + cell.x, squareLevels.begin() + y * nrSquaresX + cell.x + s, (int8_t)cell.level);
+		}
+	}
+
+	bool NeedsSplit(const Cell& cell) {
+		int s = 1 << cell.level;
+		int tl = cell.y * width + cell.x;
+		double d_tl = depth[tl];
+		double du = (depth[tl + s] - d_tl) / s;           // plane through the top left, top right
+		double dv = (depth[tl + s * width] - d_tl) / s;   // and bottom left corner
+
+		if (IsMasked(cell)) {
+			return false; // no triangles at all
+		}
+		for (int y = 0; y <= s; y++) {
+			int pixel = tl + y * width;
+			for (int x = 0; x <= s; x++, pixel++) {
+				if (mask[pixel] != 0 || is_edge[pixel] > 0) {
+					return true;
+				}
+				// a jump in depth, the full vertex grid would not connect these pixels either
+				if (x < s && abs(depth[pixel + 1] - depth[pixel]) >= depth_thresh) return true;
+				if (y < s && abs(depth[pixel + width] - depth[pixel]) >= depth_thresh) return true;
+				// |z - z_plane| = |1/w - 1/w_plane| = |w_plane - w| / (w * w_plane)
+				double w = w_offset + w_scale * depth[pixel];
+				double w_plane = w_offset + w_scale * (d_tl + du * x + dv * y);
+				if (std::abs(w_plane - w) > maxError * w * w_plane) {
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	// true if all pixels of the cell are masked away
+	bool IsMasked(const Cell& cell) {
+		int s = 1 << cell.level;
+		for (int y = cell.y; y <= cell.y + s; y++) {
+			const unsigned char* row = mask + y * width;
+			if (std::find(row + cell.x, row + cell.x + s + 1, 0) != row + cell.x + s + 1) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// lowest level of the leaves that touch the given edge of the cell from the outside, or 127 if there are none
+	int NeighborLevel(const Cell& cell, int side) {
+		int s = 1 << cell.level;
+		int level = 127;
+		if (side == 0 && cell.y > 0) { // top
+			for (int x = cell.x; x < cell.x + s; x++) level = std::min(level, (int)squareLevels[(cell.y - 1) * nrSquaresX + x]);
+		}
+		else if (side == 1 && cell.x > 0) { // left
+			for (int y = cell.y; y < cell.y + s; y++) level = std::min(level, (int)squareLevels[y * nrSquaresX + cell.x - 1]);
+		}
+		else if (side == 2 && cell.y + s < nrSquaresY) { // bottom
+			for (int x = cell.x; x < cell.x + s; x++) level = std::min(level, (int)squareLevels[(cell.y + s) * nrSquaresX + x]);
+		}
+		else if (side == 3 && cell.x + s < nrSquaresX) { // right
+			for (int y = cell.y; y < cell.y + s; y++) level = std::min(level, (int)squareLevels[y * nrSquaresX + cell.x + s]);
+		}
+		return level;
+	}
+
+	// split leaves until all neighboring leaves differ at most one level
+	void Restrict() {
+		bool changed = true;
+		while (changed) {
+			changed = false;
+			for (int i = 0; i < leaves.size(); i++) {
+				Cell cell = leaves[i];
+				if (cell.level < 2) continue;
+				bool split = false;
+				for (int side = 0; side < 4 && !split; side++) {
+					split = NeighborLevel(cell, side) < cell.level - 1;
+				}
+				if (!split) continue;
+
+				// replace the leaf by its 4 children, and check the first child again
+				int h = 1 << (cell.level - 1);
+				leaves[i] = Cell{ cell.x, cell.y, cell.level - 1 };
+				AddLeaf(Cell{ cell.x + h, cell.y,     cell.level - 1 });
+				AddLeaf(Cell{ cell.x,     cell.y + h, cell.level - 1 });
+				AddLeaf(Cell{ cell.x + h, cell.y + h, cell.level - 1 });
+				SetSquareLevels(leaves[i]);
+				changed = true;
+				i--;
+			}
+		}
+	}
+
+	int GetVertex(int col, int row) {
+		int pixel = row * width + col;
+		if (vertexIndices[pixel] < 0) {
+			vertexIndices[pixel] = (int)vertexPixels.size();
+			vertexPixels.push_back(pixel);
+		}
+		return vertexIndices[pixel];
+	}
+
+	bool IsNotElongated(int p0, int p1, int p2) {
+		return abs(depth[p0] - depth[p1]) < depth_thresh && abs(depth[p1] - depth[p2]) < depth_thresh && abs(depth[p0] - depth[p2]) < depth_thresh;
+	}
+
+	// pixels are given as (col, row) pairs
+	void AddTriangle(int c0, int r0, int c1, int r1, int c2, int r2, bool onEdge) {
+		triangles.push_back(GetVertex(c0, r0));
+		triangles.push_back(GetVertex(c1, r1));
+		triangles.push_back(GetVertex(c2, r2));
+		keep.push_back(onEdge);
+	}
+
+	void Triangulate(const Cell& cell) {
+		int s = 1 << cell.level;
+		int x0 = cell.x, y0 = cell.y, x1 = cell.x + s, y1 = cell.y + s;
+
+		if (cell.level == 0) {
+			// same triangles as the full vertex grid, but only those that are not masked away or elongated
+			int tl = y0 * width + x0, tr = tl + 1, bl = tl + width, br = bl + 1;
+			int square_type = (mask[tl] == 0) + 2 * (mask[tr] == 0) + 4 * (mask[bl] == 0) + 8 * (mask[br] == 0);
+			bool onEdge = is_edge[tl] > 0 && mask[tl] == 0;
+			if ((square_type & 7) == 7 && IsNotElongated(tl, bl, tr)) AddTriangle(x0, y0, x0, y1, x1, y0, onEdge);     // top left triangle
+			if ((square_type & 14) == 14 && IsNotElongated(tr, bl, br)) AddTriangle(x1, y0, x0, y1, x1, y1, onEdge);   // bottom right triangle
+			if (square_type == 11 && IsNotElongated(tl, br, tr)) AddTriangle(x0, y0, x1, y1, x1, y0, onEdge);          // top right triangle
+			if (square_type == 13 && IsNotElongated(tl, bl, br)) AddTriangle(x0, y0, x0, y1, x1, y1, onEdge);          // bottom left triangle
+			return;
+		}
+
+		if (mask[y0 * width + x0] != 0) {
+			return; // the cell was not split, so all of its pixels are masked away
+		}
+
+		// a neighbor that is one level smaller has a vertex in the middle of the shared edge
+		int h = s / 2;
+		bool midTop = NeighborLevel(cell, 0) < cell.level;
+		bool midLeft = NeighborLevel(cell, 1) < cell.level;
+		bool midBottom = NeighborLevel(cell, 2) < cell.level;
+		bool midRight = NeighborLevel(cell, 3) < cell.level;
+		if (!midTop && !midLeft && !midBottom && !midRight) {
+			AddTriangle(x0, y0, x0, y1, x1, y0, false);
+			AddTriangle(x1, y0, x0, y1, x1, y1, false);
+			return;
+		}
+
+		// fan around the center, along the border in the same orientation as the triangles above
+		int border[8][2];
+		int n = 0;
+		border[n][0] = x0; border[n][1] = y0; n++;
+		if (midLeft) { border[n][0] = x0; border[n][1] = y0 + h; n++; }
+		border[n][0] = x0; border[n][1] = y1; n++;
+		if (midBottom) { border[n][0] = x0 + h; border[n][1] = y1; n++; }
+		border[n][0] = x1; border[n][1] = y1; n++;
+		if (midRight) { border[n][0] = x1; border[n][1] = y0 + h; n++; }
+		border[n][0] = x1; border[n][1] = y0; n++;
+		if (midTop) { border[n][0] = x0 + h; border[n][1] = y0; n++; }
+		for (int i = 0; i < n; i++) {
+			int j = (i + 1) % n;
+			AddTriangle(x0 + h, y0 + h, border[i][0], border[i][1], border[j][0], border[j][1], false);
+		}
+	}
+};
+
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef READBACK_CONTROLLER_H
+#define READBACK_CONTROLLER_H
+
+
+/*
+* ReadbackController downloads the packed textures (see pack_fragment.fs) of the input cameras to CameraFrameData
+* without stalling the GL pipeline: each download goes to one of a ring of pixel buffer objects, and a fence
+* tells when it has arrived. While the CPU copies camera i out of its buffer, the downloads of the next cameras are in flight.
+* The packed textures are upside down, so the rows are flipped during the copy.
+* With depthOnly, the depth textures are downloaded instead (for CpuMaskCalculator, which calculates the rest itself).
+*/
+class ReadbackController {
+private:
+	static const int ringSize = 3;
+	GLuint buffers[ringSize] = {};
+	GLsync fences[ringSize] = {};
+
+	int width = 0;
+	int height = 0;
+	std::vector<GLuint> textures; // packed (or depth) texture per input camera, of the current frame
+	bool depthOnly = false;
+
+public:
+	ReadbackController() {}
+
+	void Init(int width, int height) {
+		this->width = width;
+		this->height = height;
+		glGenBuffers(ringSize, buffers);
+		for (int b = 0; b < ringSize; b++) {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[b]);
+			glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 4, NULL, GL_STREAM_READ);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1); // rows of 16-bit depth values are not always a multiple of 4 bytes
+	}
+
+	// start downloading the first cameras, Receive() has to be called for every camera afterwards, in order
+	void Start(const std::vector<GLuint>& packedTextures, bool depthOnly = false) {
+		textures = packedTextures;
+		this->depthOnly = depthOnly;
+		for (int i = 0; i < std::min(ringSize, (int)textures.size()); i++) {
+			Request(i);
+		}
+	}
+
+	// wait for the download of camera i, copy it to data and start the download of camera i + ringSize
+	void Receive(int i, /*out*/ CameraFrameData& data) {
+		int nrPixels = width * height;
+		data.mask.resize(nrPixels);
+		data.is_edge.resize(nrPixels);
+		data.depth.resize(nrPixels);
+
+		int b = i % ringSize;
+		while (glClientWaitSync(fences[b], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {}
+		glDeleteSync(fences[b]);
+		fences[b] = 0;
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[b]);
+		const unsigned char* packed = (const unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)nrPixels * (depthOnly ? 2 : 4), GL_MAP_READ_BIT);
+		if (depthOnly) {
+			std::copy((const unsigned short*)packed, (const unsigned short*)packed + nrPixels, data.depth.begin()); // the depth is not upside down
+		}
+		else {
+			for (int row = 0; row < height; row++) {
+				const unsigned char* src = packed + (size_t)(height - 1 - row) * width * 4;
+				int dst = row * width;
+				for (int col = 0; col < width; col++, src += 4, dst++) {
+					data.mask[dst] = src[0];
+					data.is_edge[dst] = src[1];
+					data.depth[dst] = (unsigned short)(src[2] | (src[3] << 8));
+				}
+			}
+		}
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		if (i + ringSize < textures.size()) {
+			Request(i + ringSize);
+		}
+	}
+
+	void Cleanup() {
+		for (int b = 0; b < ringSize; b++) {
+			if (fences[b] != 0) glDeleteSync(fences[b]);
+			fences[b] = 0;
+		}
+		glDeleteBuffers(ringSize, buffers);
+	}
+
+private:
+	void Request(int i) {
+		int b = i % ringSize;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[b]);
+		glBindTexture(GL_TEXTURE_2D, textures[i]);
+		// returns immediately, the data goes to the buffer
+		if (depthOnly) {
+			glGetTexImage(GL_TEXTURE_2D, 0, GL_RED, GL_UNSIGNED_SHORT, (void*)0);
+		}
+		else {
+			glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+		}
+		fences[b] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+};
+
+
+#endif
@@ -9,6 +9,8 @@ public:
 	Shader dilateShader;   // dilate a mask
 	Shader erodeShader;    // erode a mask
 	Shader edgeShader;     // determine where the edges in a depth map are
+	Shader packShader;     // pack the mask, edge map and depth map into one texture for the readback
+	Shader depthBoundsShader; // the lowest and highest depth value per block of pixels
 
 
 public:
@@ -18,6 +20,8 @@ public:
 		dilateShader = Shader();
 		erodeShader = Shader();
 		edgeShader = Shader();
+		packShader = Shader();
+		depthBoundsShader = Shader();
 	}
 
 	bool Init(InputCamera input, Options options) {
@@ -109,10 +113,32 @@ public:
 		edgeShader.setFloat("width", float(input.res_x));
 		edgeShader.setFloat("height", float(input.res_y));
 
+		if (!packShader.init(
+			(basePath + "copy_vertex.fs").c_str(),
+			(basePath + "pack_fragment.fs").c_str())) {
+			std::cout << "failed to compile " << basePath + "copy_vertex.fs"
+				<< " or " << basePath + "pack_fragment.fs" << std::endl;
+			return false;
+		}
+		packShader.use();
+		packShader.setInt("maskTex", 0);
+		packShader.setInt("edgeTex", 1);
+		packShader.setInt("depthTex", 2);
+
+		if (!depthBoundsShader.init(
+			(basePath + "copy_vertex.fs").c_str(),
+			(basePath + "depth_bounds_fragment.fs").c_str())) {
+			std::cout << "failed to compile " << basePath + "copy_vertex.fs"
+				<< " or " << basePath + "depth_bounds_fragment.fs" << std::endl;
+			return false;
+		}
+		depthBoundsShader.use();
+		depthBoundsShader.setInt("depthTex", 0);
+
 		return true;
 	}
 
-	void updateInputParams(InputCamera input) {
+	void updateInputParams(const InputCamera& input) {
 		shader.use();
 		shader.setVec2("near_far", glm::vec2(input.z_near, input.z_far));
 		shader.setMat4("model", input.model);
@@ -123,7 +149,7 @@ public:
 		}
 	}
 
-	void updateOutputParams(InputCamera output) {
+	void updateOutputParams(const InputCamera& output) {
 		shader.use();
 		shader.setVec2("out_f", glm::vec2(output.focal_x, output.focal_y));
 		shader.setVec2("out_near_far", glm::vec2(output.z_near, output.z_far));
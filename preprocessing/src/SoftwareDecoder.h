@@ -0,0 +1,151 @@
+#ifndef SOFTWARE_DECODER_H
+#define SOFTWARE_DECODER_H
+
+
+/*
+* SoftwareDecoder decodes a depth video on the CPU with libavcodec (--decoder cpu), instead of with NVDEC.
+* The packets come from an FFmpegDemuxer (which restarts at the end of the video, like for NVDEC).
+* The decoder uses frame threading: it decodes the next frames on its own threads while the previous one is returned,
+* so it needs a few packets before the first frame comes out.
+* To start at a later frame (--start_frame), the demuxer seeks to the key frame before it and the frames in between are decoded and dropped.
+*
+* DecodeNextFrame() writes the luma plane straight into the depth map of a CameraFrameData,
+* with the same 16-bit values as the depth texture of the NVDEC path (P016, i.e. the samples are in the most significant bits).
+*/
+class SoftwareDecoder {
+private:
+	FFmpegDemuxer* demuxer = NULL;
+	AVCodecContext* context = NULL;
+	AVPacket* packet = NULL;
+	AVFrame* avFrame = NULL;
+	std::string path;
+
+public:
+	SoftwareDecoder() {}
+
+	bool Init(const std::string& path, int nrThreads, bool printInfo, int firstFrame) {
+		this->path = path;
+		demuxer = new FFmpegDemuxer(path.c_str(), printInfo);
+		const AVCodec* codec = avcodec_find_decoder(demuxer->GetVideoCodec());
+		if (codec == NULL) {
+			std::cout << "Error: libavcodec has no decoder for " << path << std::endl;
+			return false;
+		}
+		context = avcodec_alloc_context3(codec);
+		context->thread_count = nrThreads;
+		context->thread_type = FF_THREAD_FRAME;
+		if (avcodec_open2(context, codec, NULL) < 0) {
+			std::cout << "Error: could not open the libavcodec decoder for " << path << std::endl;
+			return false;
+		}
+		packet = av_packet_alloc();
+		avFrame = av_frame_alloc();
+
+		if (firstFrame > 0) {
+			int keyFrame = demuxer->SeekToKeyFrame(firstFrame);
+			for (int frame = keyFrame; frame < firstFrame; frame++) {
+				if (!ReceiveFrame()) return false;
+				av_frame_unref(avFrame);
+			}
+		}
+		return true;
+	}
+
+	// decode the next frame into data.depth (width x height pixels, row 0 at the top)
+	bool DecodeNextFrame(int width, int height, /*out*/ CameraFrameData& data) {
+		if (!ReceiveFrame()) return false;
+		if (avFrame->width != width || avFrame->height != height) {
+			std::cout << "Error: " << path << " has a resolution of " << avFrame->width << "x" << avFrame->height << " instead of " << width << "x" << height << std::endl;
+			av_frame_unref(avFrame);
+			return false;
+		}
+		int bitDepth = BitDepth((AVPixelFormat)avFrame->format);
+		if (bitDepth == 0) {
+			std::cout << "Error: unsupported pixel format " << avFrame->format << " in " << path << std::endl;
+			av_frame_unref(avFrame);
+			return false;
+		}
+
+		data.depth.resize(width * height);
+		int shift = 16 - bitDepth;
+		for (int row = 0; row < height; row++) {
+			unsigned short* dst = data.depth.data() + row * width;
+			const uint8_t* src = avFrame->data[0] + (size_t)row * avFrame->linesize[0];
+			if (bitDepth == 8) {
+				for (int col = 0; col < width; col++) {
+					dst[col] = (unsigned short)(src[col] << shift);
+				}
+			}
+			else {
+				const uint16_t* src16 = (const uint16_t*)src;
+				for (int col = 0; col < width; col++) {
+					dst[col] = (unsigned short)(src16[col] << shift);
+				}
+			}
+		}
+		av_frame_unref(avFrame);
+		return true;
+	}
+
+	void Cleanup() {
+		av_frame_free(&avFrame);
+		av_packet_free(&packet);
+		avcodec_free_context(&context);
+		delete demuxer;
+		demuxer = NULL;
+	}
+
+private:
+	// the next decoded frame goes to avFrame
+	bool ReceiveFrame() {
+		int e = 0;
+		while ((e = avcodec_receive_frame(context, avFrame)) == AVERROR(EAGAIN)) {
+			// the decoder needs more packets
+			uint8_t* video = NULL;
+			int nrVideoBytes = 0;
+			if (!demuxer->Demux(&video, &nrVideoBytes)) {
+				std::cout << "Error: demuxing failed for " << path << std::endl;
+				return false;
+			}
+			packet->data = video;
+			packet->size = nrVideoBytes;
+			if (avcodec_send_packet(context, packet) < 0) {
+				std::cout << "Error: decoding failed for " << path << std::endl;
+				return false;
+			}
+		}
+		if (e < 0) {
+			std::cout << "Error: decoding failed for " << path << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	// of the luma plane, 0 if the format is not supported
+	static int BitDepth(AVPixelFormat format) {
+		switch (format) {
+		case AV_PIX_FMT_YUV420P:
+		case AV_PIX_FMT_YUVJ420P:
+		case AV_PIX_FMT_YUV444P:
+		case AV_PIX_FMT_GRAY8:
+			return 8;
+		case AV_PIX_FMT_YUV420P10LE:
+		case AV_PIX_FMT_YUV444P10LE:
+		case AV_PIX_FMT_GRAY10LE:
+			return 10;
+		case AV_PIX_FMT_YUV420P12LE:
+		case AV_PIX_FMT_YUV444P12LE:
+		case AV_PIX_FMT_GRAY12LE:
+			return 12;
+		case AV_PIX_FMT_YUV420P16LE:
+		case AV_PIX_FMT_YUV444P16LE:
+		case AV_PIX_FMT_GRAY16LE:
+			return 16;
+		default:
+			return 0;
+		}
+	}
+};
+
+
+#endif
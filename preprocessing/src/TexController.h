@@ -5,15 +5,18 @@ class TexController {
 private:
 
 	// video decoding
+#ifdef USE_NVDEC
 	std::vector<CUgraphicsResource*> glGraphicsResources;
 	std::vector<FFmpegDemuxer*> demuxers;
 	std::vector<NvDecoder*> decoders;
 	CUcontext* cuContext = NULL;
+#endif
+	std::vector<SoftwareDecoder> softwareDecoders; // with --decoder cpu: one per depth video, the color videos are not needed then
+	int width = 0;
+	int height = 0;
 
 public:
-	TexController() {
-		cuContext = new CUcontext();
-	}
+	TexController() {}
 	
 	std::vector<GLuint> images;
 	std::vector<GLuint> depths;
@@ -21,20 +24,38 @@ public:
 	std::vector<GLuint> masks_eroded;
 	std::vector<GLuint> masks_dilated;
 	std::vector<GLuint> edges;
+	std::vector<GLuint> packed; // RGBA: dilated mask, edge map, depth (2 bytes), see pack_fragment.fs
+
+	// the lowest and highest depth value per block of 16x16 pixels (see depth_bounds_fragment.fs), of all input cameras below each other
+	static const int depthBoundsBlockSize = 16;
+	GLuint depthBounds = 0;
+	int depthBoundsWidth = 0;
+	int depthBoundsHeight = 0; // per input camera
 
-	bool Init(std::vector<InputCamera> inputCameras, bool verbose) {
+	// with cpuDecoder, the depth videos are decoded on nrThreads threads per video with DecodeNextDepthMaps(), without CUDA.
+	// The first decoded frame is firstFrame (the videos are seeked to the key frame before it, and decoded from there)
+	bool Init(std::vector<InputCamera> inputCameras, bool verbose, bool cpuDecoder, int nrThreads, int firstFrame) {
+		width = inputCameras[0].res_x;
+		height = inputCameras[0].res_y;
 		images = std::vector<GLuint>(inputCameras.size());
 		depths = std::vector<GLuint>(inputCameras.size());
 		masks = std::vector<GLuint>(inputCameras.size());
 		masks_eroded = std::vector<GLuint>(inputCameras.size());
 		masks_dilated = std::vector<GLuint>(inputCameras.size());
 		edges = std::vector<GLuint>(inputCameras.size());
+		packed = std::vector<GLuint>(inputCameras.size());
 		glGenTextures((GLsizei)inputCameras.size(), images.data());
 		glGenTextures((GLsizei)inputCameras.size(), depths.data());
 		glGenTextures((GLsizei)inputCameras.size(), masks.data());
 		glGenTextures((GLsizei)inputCameras.size(), masks_eroded.data());
 		glGenTextures((GLsizei)inputCameras.size(), masks_dilated.data());
 		glGenTextures((GLsizei)inputCameras.size(), edges.data());
+		glGenTextures((GLsizei)inputCameras.size(), packed.data());
+
+		depthBoundsWidth = (inputCameras[0].res_x + depthBoundsBlockSize - 1) / depthBoundsBlockSize;
+		depthBoundsHeight = (inputCameras[0].res_y + depthBoundsBlockSize - 1) / depthBoundsBlockSize;
+		glGenTextures(1, &depthBounds);
+		glDefineTexture(depthBounds, GL_RG32F, depthBoundsWidth, depthBoundsHeight * (int)inputCameras.size(), GL_RG, GL_FLOAT);
 
 		for (int i = 0; i < inputCameras.size(); i++) {
 			// create mask and edge maps
@@ -42,12 +63,28 @@ public:
 			glDefineTexture(masks_eroded[i], GL_R8, inputCameras[0].res_x, inputCameras[0].res_y, GL_RED, GL_UNSIGNED_BYTE);
 			glDefineTexture(masks_dilated[i], GL_R8, inputCameras[0].res_x, inputCameras[0].res_y, GL_RED, GL_UNSIGNED_BYTE);
 			glDefineTexture(edges[i], GL_R8, inputCameras[0].res_x, inputCameras[0].res_y, GL_RED, GL_UNSIGNED_BYTE);
+			glDefineTexture(packed[i], GL_RGBA8, inputCameras[0].res_x, inputCameras[0].res_y, GL_RGBA, GL_UNSIGNED_BYTE);
 		}
 
 		int luma_height = inputCameras[0].res_y;
 		int luma_height_rounded = ((luma_height + 16 - 1) / 16) * 16; //round luma height up to multiple of 16
 		int texture_height = luma_height_rounded + /*chroma height */luma_height / 2;
+		for (int i = 0; i < inputCameras.size(); i++) {
+			glDefineTexture(images[i], GL_R8, inputCameras[0].res_x, texture_height, GL_RED, GL_UNSIGNED_BYTE);
+			glDefineTexture(depths[i], GL_R16, inputCameras[0].res_x, inputCameras[0].res_y, GL_RED, GL_UNSIGNED_SHORT);
+		}
+
+		if (cpuDecoder) {
+			softwareDecoders.resize(inputCameras.size());
+			for (int i = 0; i < inputCameras.size(); i++) {
+				if (verbose) printf("depth path %d: %s\n", i, inputCameras[i].pathDepth.c_str());
+				if (!softwareDecoders[i].Init(inputCameras[i].pathDepth, nrThreads, i == 0, firstFrame)) return false;
+			}
+			return true;
+		}
 
+#ifdef USE_NVDEC
+		cuContext = new CUcontext();
 		ck(cuInit(0));
 		
 		CUdevice cuDevice = 0;
@@ -60,9 +97,6 @@ public:
 		ck(cuCtxSetCurrent(*cuContext));
 		
 		for (int i = 0; i < inputCameras.size(); i++) {
-			glDefineTexture(images[i], GL_R8, inputCameras[0].res_x, texture_height, GL_RED, GL_UNSIGNED_BYTE);
-			glDefineTexture(depths[i], GL_R16, inputCameras[0].res_x, inputCameras[0].res_y, GL_RED, GL_UNSIGNED_SHORT);
-		
 			// register OpenGL textures for Cuda interop
 			CUgraphicsResource* glGraphicsResource_color = new CUgraphicsResource();
 			CUgraphicsResource* glGraphicsResource_depth = new CUgraphicsResource();
@@ -93,20 +127,30 @@ public:
 
 		// prepare the decoders
 		for (int i = 0; i < demuxers.size(); i++) {
+			int keyFrame = firstFrame > 0 ? demuxers[i]->SeekToKeyFrame(firstFrame) : 0;
 			// Note: for some reason, we have to decode once before actually decoding the first frame
-			int nVideoBytes = 0;
-			uint8_t* pVideo = NULL;
-			if (!demuxers[i]->Demux(&pVideo, &nVideoBytes)) {
-				std::cout << "Error: demuxing failed for input " << i / 2 << (i % 2 == 0 ? " color" : " depth") << std::endl;
-				return false;
+			// (and then the frames between the key frame and firstFrame are decoded without copying them to the textures)
+			for (int frame = keyFrame; frame <= firstFrame; frame++) {
+				int nVideoBytes = 0;
+				uint8_t* pVideo = NULL;
+				if (!demuxers[i]->Demux(&pVideo, &nVideoBytes)) {
+					std::cout << "Error: demuxing failed for input " << i / 2 << (i % 2 == 0 ? " color" : " depth") << std::endl;
+					return false;
+				}
+				decoders[i]->Decode(pVideo, nVideoBytes);
 			}
-			decoders[i]->Decode(pVideo, nVideoBytes);
 		}
 
 		return true;
+#else
+		std::cout << "Error: built without NVDEC (USE_NVDEC=OFF), use --decoder cpu" << std::endl;
+		return false;
+#endif
 	}
 
+	// decode the next frame of all videos into the textures, with NVDEC
 	bool DecodeNextVideoFrame() {
+#ifdef USE_NVDEC
 		for (int i = 0; i < demuxers.size(); i++) {
 			int nVideoBytes = 0;
 			uint8_t* pVideo = NULL;
@@ -119,9 +163,25 @@ public:
 			decoders[i]->HandlePictureDisplay(decoders[i]->picture_index);
 		}
 		return true;
+#else
+		return false;
+#endif
+	}
+
+	// decode the next frame of the depth videos straight into data[i].depth, with the SoftwareDecoders
+	bool DecodeNextDepthMaps(/*out*/ std::vector<CameraFrameData>& data) {
+		for (int i = 0; i < softwareDecoders.size(); i++) {
+			if (!softwareDecoders[i].DecodeNextFrame(width, height, data[i])) return false;
+		}
+		return true;
 	}
 
 	void Cleanup() {
+		for (SoftwareDecoder& decoder : softwareDecoders) {
+			decoder.Cleanup();
+		}
+		softwareDecoders.clear();
+#ifdef USE_NVDEC
 		for (auto& glGraphicsResource : glGraphicsResources) {
 			ck(cuGraphicsUnregisterResource(*glGraphicsResource));
 			delete glGraphicsResource;
@@ -138,7 +198,9 @@ public:
 		if (cuContext) {
 			ck(cuCtxDestroy(*cuContext));
 			delete cuContext;
+			cuContext = NULL;
 		}
+#endif
 
 		glDeleteTextures(images.size(), images.data());
 		glDeleteTextures(depths.size(), depths.data());
@@ -146,12 +208,15 @@ public:
 		glDeleteTextures(masks_eroded.size(), masks_eroded.data());
 		glDeleteTextures(masks_dilated.size(), masks_dilated.data());
 		glDeleteTextures(edges.size(), edges.data());
+		glDeleteTextures(packed.size(), packed.data());
+		glDeleteTextures(1, &depthBounds);
 		images.clear();
 		depths.clear();
 		masks.clear();
 		masks_eroded.clear();
 		masks_dilated.clear();
 		edges.clear();
+		packed.clear();
 	}
 
 private:
@@ -0,0 +1,114 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <functional>
+#include <condition_variable>
+
+
+/*
+* ThreadPool runs tasks on a fixed number of worker threads.
+*
+* A task receives the index of the worker thread that executes it (in range [0, size()-1]),
+* so that tasks can use per-worker state (e.g. one MeshBuilder per worker) without locking.
+* waitUntilIdle() blocks until all tasks that were enqueued so far have finished.
+* The queue is a ring buffer that only grows, so enqueueing does not allocate once it is large enough
+* (as long as the tasks are small enough for the small buffer of std::function, e.g. lambdas that capture two pointers).
+*/
+class ThreadPool {
+	std::vector<std::thread> pool;
+	std::mutex queue_mutex;
+	std::condition_variable task_condition;
+	std::condition_variable idle_condition;
+	std::vector<std::function<void(int)>> queue; // ring buffer
+	int queueStart = 0;
+	int queueSize = 0;
+	int nrBusyThreads = 0;
+	bool terminate_pool = false;
+
+public:
+
+	ThreadPool() {}
+
+	void init(int nrThreads) {
+		terminate_pool = false;
+		for (int i = 0; i < nrThreads; i++) {
+			pool.push_back(std::thread(&ThreadPool::update_loop, this, i));
+		}
+	}
+
+	int size() {
+		return (int)pool.size();
+	}
+
+	void enqueue(std::function<void(int)> task) {
+		{
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			if (queueSize == queue.size()) {
+				// full, so move the tasks to a larger ring buffer
+				std::vector<std::function<void(int)>> larger(std::max(16, 2 * (int)queue.size()));
+				for (int k = 0; k < queueSize; k++) {
+					larger[k] = std::move(queue[(queueStart + k) % queue.size()]);
+				}
+				queue.swap(larger);
+				queueStart = 0;
+			}
+			queue[(queueStart + queueSize) % queue.size()] = std::move(task);
+			queueSize++;
+		} // to unlock
+		task_condition.notify_one();
+	}
+
+	void waitUntilIdle() {
+		std::unique_lock<std::mutex> lock(queue_mutex);
+		idle_condition.wait(lock, [this] { return queueSize == 0 && nrBusyThreads == 0; });
+	}
+
+	void cleanup() {
+		{
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			terminate_pool = true;
+		} // to unlock
+		task_condition.notify_all();
+		for (std::thread& t : pool) {
+			t.join();
+		}
+		pool.clear();
+		queue.clear();
+		queueStart = 0;
+		queueSize = 0;
+	}
+
+private:
+	void update_loop(int threadIdx) {
+		while (true) {
+			std::function<void(int)> task;
+			{
+				std::unique_lock<std::mutex> lock(queue_mutex);
+				task_condition.wait(lock, [this] { return queueSize > 0 || terminate_pool; });
+				if (terminate_pool && queueSize == 0) {
+					return;
+				}
+				task = std::move(queue[queueStart]);
+				queueStart = (queueStart + 1) % queue.size();
+				queueSize--;
+				nrBusyThreads++;
+			}
+			task(threadIdx);
+			{
+				std::lock_guard<std::mutex> lock(queue_mutex);
+				nrBusyThreads--;
+				if (queueSize == 0 && nrBusyThreads == 0) {
+					idle_condition.notify_all();
+				}
+			}
+		}
+	}
+};
+
+
+#endif
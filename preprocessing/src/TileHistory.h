@@ -0,0 +1,67 @@
+#ifndef TILE_HISTORY_H
+#define TILE_HISTORY_H
+
+
+/*
+* TileHistory remembers, for every tile of every input camera, the depth and mask that its mesh was last built from (with --temporal_tolerance).
+* If the mask of a tile is the same and its depth changed at most tolerance since then, the tile is unchanged:
+* it is not built again, and the mesh of that earlier frame is reused (see MeshWriter).
+* Every tile keeps its own copy of its pixels (neighboring tiles share their border pixels, but can be built in different frames),
+* and a reused tile is always compared with the frame it was built in, so small changes do not add up over the frames.
+* The frames have to be given in order (SimplifyMeshesInBackground() does this on the main thread).
+*/
+class TileHistory {
+private:
+	std::vector<Tile> tiles;
+	int width = 0;
+	int tolerance = 0;                            // in steps of the 16-bit depth map
+	std::vector<std::vector<unsigned short>> depths; // per tile of every input camera (camera * nrTiles + tile), empty if not built yet
+	std::vector<std::vector<unsigned char>> masks;
+
+public:
+	TileHistory() {}
+
+	// tolerance is a fraction of the depth range (i.e. of the normalized depth values in the depth map)
+	void Init(int nrCameras, int width, const std::vector<Tile>& tiles, float tolerance) {
+		this->tiles = tiles;
+		this->width = width;
+		this->tolerance = (int)std::round(tolerance * 65535.0f);
+		depths = std::vector<std::vector<unsigned short>>(nrCameras * tiles.size());
+		masks = std::vector<std::vector<unsigned char>>(nrCameras * tiles.size());
+	}
+
+	// true if the mesh of the tile can be reused, otherwise the tile is remembered as built from data
+	bool Unchanged(int camera, int t, const CameraFrameData& data) {
+		const Tile& tile = tiles[t];
+		std::vector<unsigned short>& depth = depths[camera * tiles.size() + t];
+		std::vector<unsigned char>& mask = masks[camera * tiles.size() + t];
+		int tileWidth = tile.c1 - tile.c0 + 1;
+		bool unchanged = !depth.empty();
+		for (int row = tile.r0; row <= tile.r1 && unchanged; row++) {
+			const unsigned short* d = data.depth.data() + row * width + tile.c0;
+			const unsigned char* m = data.mask.data() + row * width + tile.c0;
+			int i = (row - tile.r0) * tileWidth;
+			for (int col = 0; col < tileWidth; col++) {
+				if (m[col] != mask[i + col] || std::abs((int)d[col] - (int)depth[i + col]) > tolerance) {
+					unchanged = false;
+					break;
+				}
+			}
+		}
+		if (unchanged) {
+			return true;
+		}
+
+		depth.resize(tileWidth * (tile.r1 - tile.r0 + 1));
+		mask.resize(depth.size());
+		for (int row = tile.r0; row <= tile.r1; row++) {
+			int i = (row - tile.r0) * tileWidth;
+			memcpy(depth.data() + i, data.depth.data() + row * width + tile.c0, tileWidth * sizeof(unsigned short));
+			memcpy(mask.data() + i, data.mask.data() + row * width + tile.c0, tileWidth);
+		}
+		return false;
+	}
+};
+
+
+#endif
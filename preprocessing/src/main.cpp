@@ -12,6 +12,7 @@
 #include <vector>
 #include <bitset>
 #include <algorithm>
+#include <thread>
 #include <gtx/string_cast.hpp>
 #ifndef CXXOPTS_NO_EXCEPTIONS
 #define CXXOPTS_NO_EXCEPTIONS
@@ -38,12 +39,42 @@ public:
 	unsigned int SCR_HEIGHT = 1080;   // height in pixels of the ImGUI window
 
 	int nrFrames = 0;               // nr video frames
+	int startFrame = 0;             // only the frames startFrame, ..., endFrame - 1 are processed
+	int endFrame = 0;
+	bool shard = false;             // true if --start_frame or --end_frame is given, then the output is a shard file (see MeshFile.h)
+	bool resume = false;            // continue after the frames that are already in the output file
+	int meshFormat = 2;             // version of the output file (see MeshFile.h), shards are always v1
 	int outputNrFrames = 1;
 	int StartingFrameNr = 0;        // the number of the video frame that will be shown first
 	
 	bool headless = true;
+	std::string glContext = "auto";   // how the OpenGL context is created, see GLContext
 	bool verbose = false;
 
+	int nrThreads = 1;              // the number of worker threads that build and simplify the meshes of the input cameras
+	int framesInFlight = 2;         // the number of video frames that are processed at the same time
+	bool useHeapSimplifier = false; // if true, use the priority queue edge collapse simplifier instead of the threshold sweeps
+	bool benchmarkSimplifiers = false;
+	bool checkSimplifierPrecision = false;
+	bool useQuadtree = false;       // if true, build the meshes with the QuadtreeMesher instead of simplifying the full vertex grid
+	float quadtreeMaxError = 0.01f; // in scene units
+	bool quadtreeRefine = false;
+	bool optimizeVertexCache = true; // reorder the triangles and vertices of the meshes for the vertex cache of the renderer (see MeshOptimizer)
+	bool sortFrontToBack = false;   // and then sort the clusters of triangles front to back
+	int meshletSize = 128;          // max nr of triangles per meshlet, 0 to not group the triangles into meshlets (see Meshlet in MeshFile.h)
+	int lodLevels = 1;              // nr of levels of detail of the mesh of every input camera, the renderer picks one of them per camera
+	bool benchmarkMeshers = false;
+	bool checkPairPruning = false;
+	bool cpuMasks = false;          // if true, calculate the masks and edge maps with the CpuMaskCalculator instead of the shaders
+	bool checkMaskBackends = false;
+#ifdef USE_NVDEC
+	bool cpuDecoder = false;        // if true, decode the depth videos with libavcodec on the CPU instead of with NVDEC
+#else
+	bool cpuDecoder = true;
+#endif
+	int tileSize = 0;               // if > 0, the depth map of each input camera is split into tiles of tileSize x tileSize pixels that are simplified in parallel
+	float temporalTolerance = -1.0f; // if >= 0, a tile whose depth changed at most this much (as a fraction of the depth range) reuses its mesh of an earlier frame
+
 	// some tunable shader uniforms:
 	float triangle_deletion_margin = 100.0f;        // used in geometry shader for the threshold for stretched triangle deletion
 public:
@@ -63,12 +94,37 @@ public:
 		options.add_options("Saving to disk")
 			// save to disk
 			("o,output_bin", "File (.bin) where the output mesh will be saved", cxxopts::value<std::string>())
+			("start_frame", "Only process the video frames from this one on, and write them to a shard file (merge the shards with MergeShards)", cxxopts::value<int>())
+			("end_frame", "Only process the video frames before this one, and write them to a shard file (default: Number_of_frames)", cxxopts::value<int>())
+			("resume", "If the output file already contains some of the frames (e.g. after a crash), only process and append the remaining ones")
+			("mesh_format", "\"v2\" (default): indexed file that the renderer can memory-map, \"v3\": the same with 16-bit quantized vertices and indices (about half the size), \"v4\": v3 compressed (several times smaller, decoded on the loader threads of the renderer), or \"v1\": the frames one after the other (shards are always v1)", cxxopts::value<std::string>())
 			;
 		options.add_options("Settings to improve quality")
 			("triangle_deletion_margin", "The higher this value, the less strict the threshold for deletion of stretched triangles.", cxxopts::value<float>()->default_value("100.0"))
 			;
+		options.add_options("Settings to improve performance")
+			("t,threads", "Number of worker threads that build and simplify the meshes of the input cameras in parallel (default: number of CPU cores)", cxxopts::value<int>())
+			("frames_in_flight", "Number of video frames processed at the same time: the GPU decodes and masks the next frames while the meshes of the previous ones are still being simplified", cxxopts::value<int>()->default_value("2"))
+			("simplifier", "Mesh simplification algorithm: \"sweep\" (repeated sweeps over all triangles with a growing error threshold) or \"heap\" (always collapse the edge with the lowest error first, using a priority queue)", cxxopts::value<std::string>()->default_value("sweep"))
+			("benchmark_simplifiers", "Simplify the meshes of the first video frame with both simplifiers and print their run time and triangle count, instead of creating the output file")
+			("check_simplifier_precision", "Simplify the meshes of the first video frame with float (the default) and with double precision quadrics and print the differences, instead of creating the output file")
+			("mesher", "How the meshes are built: \"grid\" (simplify a mesh with a vertex per pixel) or \"quadtree\" (directly build an adaptive mesh with a quadtree, which is much faster)", cxxopts::value<std::string>()->default_value("grid"))
+			("quadtree_max_error", "Maximum distance (along the z axis, in scene units) between the depth map and a quadtree cell that is not split further", cxxopts::value<float>()->default_value("0.01"))
+			("quadtree_refine", "Also simplify the quadtree meshes further with the simplifier")
+			("triangle_order", "The order of the triangles in the output: \"cache\" (reordered for the vertex cache of the renderer, and the vertices in the order they are used), \"overdraw\" (the same, and then the clusters of triangles sorted front to back) or \"simplifier\" (as the simplifier leaves them)", cxxopts::value<std::string>()->default_value("cache"))
+			("meshlet_size", "The maximum number of triangles of the meshlets that the triangles are grouped into (with a bounding sphere and normal cone each, so that the renderer can skip the ones it does not see), 0 for no meshlets. Ignored with --triangle_order simplifier", cxxopts::value<int>()->default_value("128"))
+			("lod_levels", "Number of levels of detail (1 to 4) of the mesh of every input camera, each with about a quarter of the triangles of the previous one, so that the renderer can draw a coarser mesh for the cameras that are far away or when the GPU can not keep up (needs meshlets and --mesh_format v2, v3 or v4)", cxxopts::value<int>()->default_value("1"))
+			("benchmark_meshers", "Build the meshes of the first video frame with both meshers and print their run time, triangle count and mean depth error, instead of creating the output file")
+			("check_pair_pruning", "Calculate the masks of the first video frame with and without skipping the camera pairs that can not overlap, and print how many pairs are skipped and whether the masks differ, instead of creating the output file")
+			("decoder", "How the depth videos are decoded: \"nvdec\" (on the GPU, needs CUDA) or \"cpu\" (with libavcodec, implies --mask_backend cpu)", cxxopts::value<std::string>())
+			("mask_backend", "Where the masks and edge maps are calculated: \"gpu\" (with shaders) or \"cpu\" (on the worker threads, from the downloaded depth maps)", cxxopts::value<std::string>()->default_value("gpu"))
+			("check_mask_backends", "Calculate the masks and edge maps of the first video frame with both mask backends and print their run time and how many pixels differ, instead of creating the output file")
+			("tile_size", "Split the depth map of each input camera into tiles of this many pixels wide and high, that are simplified in parallel and then stitched together (default: 0, i.e. no tiles)", cxxopts::value<int>()->default_value("0"))
+			("temporal_tolerance", "Reuse the mesh of a tile whose mask is the same and whose depth changed at most this much (as a fraction of the depth range, e.g. 0.002) since the frame it was built for, instead of building it again. The tiles are then not stitched together, and a v3 or v4 file only stores the tiles that changed (needs --tile_size, default: -1, i.e. every tile is built in every frame)", cxxopts::value<float>()->default_value("-1"))
+			;
 		options.add_options("Misc.")
 			("gui", "Disable headless mode to display a GUI with the masks and edge maps.")
+			("gl_context", "How the OpenGL context is created: \"window\" (a GLFW window, needs a display), \"egl\" (surfaceless EGL), \"osmesa\" or \"auto\" (window with --gui, otherwise the first of egl, osmesa and window that works)", cxxopts::value<std::string>()->default_value("auto"))
 			("v,verbose", "Verbose prints")
 			;
 
@@ -76,7 +132,7 @@ public:
 		// print help if necessary
 		if (argc < 2 || result.count("help"))
 		{
-			std::cout << options.help({ "Input videos/images" , "Saving to disk", "Settings to improve quality", "Misc."}) << std::endl;
+			std::cout << options.help({ "Input videos/images" , "Saving to disk", "Settings to improve quality", "Settings to improve performance", "Misc."}) << std::endl;
 			exit(0);
 		}
 		// filter out common errors in the user - provided files and paths
@@ -84,6 +140,30 @@ public:
 			exit(-1);
 		}
 
+		endFrame = nrFrames;
+		if (result.count("start_frame")) {
+			startFrame = result["start_frame"].as<int>();
+			shard = true;
+		}
+		if (result.count("end_frame")) {
+			endFrame = result["end_frame"].as<int>();
+			shard = true;
+		}
+		if (startFrame < 0 || endFrame > nrFrames || startFrame >= endFrame) {
+			std::cout << "Options --start_frame and --end_frame should satisfy 0 <= start_frame < end_frame <= " << nrFrames << " (Number_of_frames)" << std::endl;
+			exit(-1);
+		}
+		if (result.count("resume")) {
+			resume = true;
+		}
+		if (result.count("mesh_format")) {
+			std::string format = result["mesh_format"].as<std::string>();
+			if (format != "v1" && format != "v2" && format != "v3" && format != "v4") {
+				std::cout << "Option --mesh_format should be \"v1\", \"v2\", \"v3\" or \"v4\"" << std::endl;
+				exit(-1);
+			}
+			meshFormat = format[1] - '0';
+		}
 		if (result.count("triangle_deletion_margin")) {
 			triangle_deletion_margin = result["triangle_deletion_margin"].as<float>();
 			if (triangle_deletion_margin < 1) {
@@ -91,8 +171,183 @@ public:
 				exit(-1);
 			}
 		}
+		nrThreads = std::max(1, (int)std::thread::hardware_concurrency());
+		if (result.count("threads")) {
+			nrThreads = result["threads"].as<int>();
+			if (nrThreads < 1) {
+				std::cout << "Option --threads should be at least 1" << std::endl;
+				exit(-1);
+			}
+		}
+		if (result.count("frames_in_flight")) {
+			framesInFlight = result["frames_in_flight"].as<int>();
+			if (framesInFlight < 1) {
+				std::cout << "Option --frames_in_flight should be at least 1" << std::endl;
+				exit(-1);
+			}
+		}
+		if (result.count("simplifier")) {
+			std::string simplifier = result["simplifier"].as<std::string>();
+			if (simplifier != "sweep" && simplifier != "heap") {
+				std::cout << "Option --simplifier should be \"sweep\" or \"heap\"" << std::endl;
+				exit(-1);
+			}
+			useHeapSimplifier = simplifier == "heap";
+		}
+		if (result.count("benchmark_simplifiers")) {
+			benchmarkSimplifiers = true;
+		}
+		if (result.count("check_simplifier_precision")) {
+			checkSimplifierPrecision = true;
+		}
+		if (result.count("mesher")) {
+			std::string mesher = result["mesher"].as<std::string>();
+			if (mesher != "grid" && mesher != "quadtree") {
+				std::cout << "Option --mesher should be \"grid\" or \"quadtree\"" << std::endl;
+				exit(-1);
+			}
+			useQuadtree = mesher == "quadtree";
+		}
+		if (result.count("quadtree_max_error")) {
+			quadtreeMaxError = result["quadtree_max_error"].as<float>();
+			if (quadtreeMaxError <= 0) {
+				std::cout << "Option --quadtree_max_error should be larger than 0" << std::endl;
+				exit(-1);
+			}
+		}
+		if (result.count("quadtree_refine")) {
+			quadtreeRefine = true;
+		}
+		if (result.count("triangle_order")) {
+			std::string order = result["triangle_order"].as<std::string>();
+			if (order != "cache" && order != "overdraw" && order != "simplifier") {
+				std::cout << "Option --triangle_order should be \"cache\", \"overdraw\" or \"simplifier\"" << std::endl;
+				exit(-1);
+			}
+			optimizeVertexCache = order != "simplifier";
+			sortFrontToBack = order == "overdraw";
+		}
+		if (result.count("meshlet_size")) {
+			meshletSize = result["meshlet_size"].as<int>();
+			if (meshletSize < 0 || meshletSize > 4096) {
+				std::cout << "Option --meshlet_size should be between 0 and 4096" << std::endl;
+				exit(-1);
+			}
+		}
+		if (result.count("lod_levels")) {
+			lodLevels = result["lod_levels"].as<int>();
+			if (lodLevels < 1 || lodLevels > 4) {
+				std::cout << "Option --lod_levels should be between 1 and 4" << std::endl;
+				exit(-1);
+			}
+			// the levels are told apart by their meshlets, which v1 (and so the shards) does not have
+			if (lodLevels > 1 && (meshletSize == 0 || !optimizeVertexCache)) {
+				std::cout << "Option --lod_levels needs meshlets, so it can not be combined with --meshlet_size 0 or --triangle_order simplifier" << std::endl;
+				exit(-1);
+			}
+			if (lodLevels > 1 && (shard || meshFormat == 1)) {
+				std::cout << "Option --lod_levels needs --mesh_format v2, v3 or v4, so it can not be combined with --mesh_format v1, --start_frame or --end_frame" << std::endl;
+				exit(-1);
+			}
+		}
+		if (result.count("benchmark_meshers")) {
+			benchmarkMeshers = true;
+		}
+		if (result.count("check_pair_pruning")) {
+			checkPairPruning = true;
+		}
+		if (result.count("mask_backend")) {
+			std::string maskBackend = result["mask_backend"].as<std::string>();
+			if (maskBackend != "gpu" && maskBackend != "cpu") {
+				std::cout << "Option --mask_backend should be \"gpu\" or \"cpu\"" << std::endl;
+				exit(-1);
+			}
+			cpuMasks = maskBackend == "cpu";
+		}
+		if (result.count("check_mask_backends")) {
+			checkMaskBackends = true;
+		}
+		if (result.count("decoder")) {
+			std::string decoder = result["decoder"].as<std::string>();
+			if (decoder != "nvdec" && decoder != "cpu") {
+				std::cout << "Option --decoder should be \"nvdec\" or \"cpu\"" << std::endl;
+				exit(-1);
+			}
+			cpuDecoder = decoder == "cpu";
+#ifndef USE_NVDEC
+			if (!cpuDecoder) {
+				std::cout << "Option --decoder nvdec is not available, since CreateMeshes was built without NVDEC (USE_NVDEC=OFF)" << std::endl;
+				exit(-1);
+			}
+#endif
+		}
+		if (cpuDecoder) {
+			// the depth maps are never uploaded to the GPU then
+			if (result.count("mask_backend") && !cpuMasks) {
+				std::cout << "Option --decoder cpu can not be combined with --mask_backend gpu" << std::endl;
+				exit(-1);
+			}
+			if (checkPairPruning || checkMaskBackends) {
+				std::cout << "Options --check_pair_pruning and --check_mask_backends need --decoder nvdec" << std::endl;
+				exit(-1);
+			}
+			cpuMasks = true;
+		}
+		if (result.count("tile_size")) {
+			tileSize = result["tile_size"].as<int>();
+			if (tileSize != 0 && tileSize < 16) {
+				std::cout << "Option --tile_size should be 0 (no tiles) or at least 16" << std::endl;
+				exit(-1);
+			}
+			if (tileSize != 0 && useQuadtree) {
+				std::cout << "Option --tile_size can not be combined with --mesher quadtree" << std::endl;
+				exit(-1);
+			}
+		}
+		if (result.count("temporal_tolerance")) {
+			temporalTolerance = result["temporal_tolerance"].as<float>();
+			if (temporalTolerance >= 1.0f) {
+				std::cout << "Option --temporal_tolerance should be below 1 (or negative, to build every tile in every frame)" << std::endl;
+				exit(-1);
+			}
+			if (temporalTolerance >= 0 && tileSize == 0) {
+				std::cout << "Option --temporal_tolerance needs --tile_size" << std::endl;
+				exit(-1);
+			}
+		}
+		if (shard) {
+			// the frames of a shard are v1 (see MeshFile.h), which MergeShards can only merge into a v1 or v2 file without meshlets
+			if (meshFormat > 2) {
+				std::cout << "Options --start_frame and --end_frame can not be combined with --mesh_format v3 or v4, convert the merged shards with ConvertMeshes instead" << std::endl;
+				exit(-1);
+			}
+			if (result.count("meshlet_size") && meshletSize > 0) {
+				std::cout << "Options --start_frame and --end_frame can not be combined with --meshlet_size, since the shards can not store meshlets" << std::endl;
+				exit(-1);
+			}
+			if (temporalTolerance >= 0) {
+				std::cout << "Options --start_frame and --end_frame can not be combined with --temporal_tolerance" << std::endl;
+				exit(-1);
+			}
+			meshletSize = 0;
+		}
 		if (result.count("gui")) {
 			headless = false;
+			if (cpuMasks) {
+				std::cout << "Option --gui shows the textures of the gpu mask backend, so it can not be combined with --mask_backend cpu or --decoder cpu" << std::endl;
+				exit(-1);
+			}
+		}
+		if (result.count("gl_context")) {
+			glContext = result["gl_context"].as<std::string>();
+			if (glContext != "auto" && glContext != "window" && glContext != "egl" && glContext != "osmesa") {
+				std::cout << "Option --gl_context should be \"auto\", \"window\", \"egl\" or \"osmesa\"" << std::endl;
+				exit(-1);
+			}
+			if (!headless && glContext != "auto" && glContext != "window") {
+				std::cout << "Option --gui needs --gl_context window" << std::endl;
+				exit(-1);
+			}
 		}
 		if (result.count("verbose")) {
 			verbose = true;
@@ -229,7 +484,9 @@ private:
 };
 
 
+#ifdef USE_NVDEC
 #include "AppDecUtils.h"
+#endif
 #include "Application.h"
 
 int main(int argc, char* argv[]){
@@ -244,7 +501,24 @@ int main(int argc, char* argv[]){
 		return 1;
 	}
 
-	app.RunMeshLoop(options.outputPath);
+	if (options.benchmarkSimplifiers) {
+		app.RunSimplifierBenchmark();
+	}
+	else if (options.benchmarkMeshers) {
+		app.RunMesherBenchmark();
+	}
+	else if (options.checkSimplifierPrecision) {
+		app.RunPrecisionCheck();
+	}
+	else if (options.checkPairPruning) {
+		app.RunPairPruningCheck();
+	}
+	else if (options.checkMaskBackends) {
+		app.RunMaskBackendCheck();
+	}
+	else {
+		app.RunMeshLoop(options.outputPath);
+	}
 	
 	app.Shutdown();
 	
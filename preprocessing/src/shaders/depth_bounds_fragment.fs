@@ -0,0 +1,25 @@
+#version 330 core
+layout(location = 2) out vec2 FragBounds;
+
+uniform sampler2D depthTex;
+uniform int rowOffset; // the first row of this input camera in the output texture
+
+const int blockSize = 16; // same as TexController::depthBoundsBlockSize
+
+void main()
+{
+	// the lowest and highest depth value in a block of blockSize x blockSize pixels
+	ivec2 size = textureSize(depthTex, 0);
+	ivec2 start = ivec2(int(gl_FragCoord.x), int(gl_FragCoord.y) - rowOffset) * blockSize;
+	ivec2 end = min(start + blockSize, size);
+	float lowest = 1.0f;
+	float highest = 0.0f;
+	for(int y = start.y; y < end.y; y++){
+		for(int x = start.x; x < end.x; x++){
+			float depth = texelFetch(depthTex, ivec2(x, y), 0).r;
+			lowest = min(lowest, depth);
+			highest = max(highest, depth);
+		}
+	}
+	FragBounds = vec2(lowest, highest);
+}
@@ -0,0 +1,21 @@
+#version 330 core
+layout(location = 2) out vec4 FragPacked;
+
+in vec2 TexCoords;
+
+uniform sampler2D maskTex;
+uniform sampler2D edgeTex;
+uniform sampler2D depthTex;
+
+void main()
+{
+	// the mask and edge map are upside down compared to the depth map (see edge_fragment.fs)
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	float mask = texelFetch(maskTex, pixel, 0).r;
+	float edge = texelFetch(edgeTex, pixel, 0).r;
+	float depth = texelFetch(depthTex, ivec2(pixel.x, textureSize(depthTex, 0).y - 1 - pixel.y), 0).r;
+
+	// the 16-bit depth value is split over 2 bytes (low byte first)
+	uint d = uint(round(depth * 65535.0f));
+	FragPacked = vec4(mask, edge, float(d & 255u) / 255.0f, float(d >> 8u) / 255.0f);
+}
@@ -0,0 +1,187 @@
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#ifndef CXXOPTS_NO_EXCEPTIONS
+#define CXXOPTS_NO_EXCEPTIONS
+#endif
+#include "cxxopts.hpp"
+#include "MeshFile.h"
+
+
+/*
+* ConvertMeshes converts a meshes.bin between the v1, v2, v3 and v4 format (see MeshFile.h): by default a v1 file (written by older
+* versions of CreateMeshes, or with --mesh_format v1) to a v2 file that the renderer can memory-map, and a v2, v3 or v4 file to v1.
+* A v1 or v2 file does not know the number of input cameras and their resolution, so they can be given for the header of the v2/v3/v4 file.
+* It does not know the input cameras either, so a v3 or v4 file written by ConvertMeshes from a v1 or v2 file is quantized in world space
+* (CreateMeshes --mesh_format v3 quantizes the mesh of a perspective camera as pixel positions and inverse depths instead).
+* Between v3 and v4 the quantized blocks are copied as they are, so that only compresses or decompresses them.
+* The meshlets of the frames are kept, except in a v1 file (which can not store them).
+* A file with several levels of detail (CreateMeshes --lod_levels) can not be converted to v1, since its levels are only told apart by their meshlets.
+*/
+int main(int argc, char* argv[]) {
+	cxxopts::Options options("ConvertMeshes", "Convert a meshes.bin between the v1, v2, v3 and v4 format.");
+	options.add_options()
+		("h,help", "Print help")
+		("i,input_bin", "The meshes.bin to convert (v1, v2, v3 or v4)", cxxopts::value<std::string>())
+		("o,output_bin", "The converted file", cxxopts::value<std::string>())
+		("mesh_format", "The format of the converted file: \"v1\", \"v2\", \"v3\" or \"v4\" (default: v2 if the input is v1, otherwise v1)", cxxopts::value<std::string>())
+		("nr_cameras", "The number of input cameras, stored in the header of the v2/v3/v4 file", cxxopts::value<int>()->default_value("0"))
+		("width", "The width of the input cameras, stored in the header of the v2/v3/v4 file", cxxopts::value<int>()->default_value("0"))
+		("height", "The height of the input cameras, stored in the header of the v2/v3/v4 file", cxxopts::value<int>()->default_value("0"))
+		;
+	cxxopts::ParseResult result = options.parse(argc, argv);
+	if (argc < 2 || result.count("help") || !result.count("input_bin") || !result.count("output_bin")) {
+		std::cout << options.help() << std::endl;
+		return result.count("help") ? 0 : -1;
+	}
+	std::string inputPath = result["input_bin"].as<std::string>();
+	std::string outputPath = result["output_bin"].as<std::string>();
+
+	std::ifstream in(inputPath, std::ios::binary);
+	if (!in.is_open()) {
+		std::cout << "Error: could not open " << inputPath << std::endl;
+		return -1;
+	}
+
+	// the format and number of frames of the input
+	int inputFormat = 1;
+	int nrFrames = 0;
+	int nrCameras = result["nr_cameras"].as<int>();
+	int width = result["width"].as<int>();
+	int height = result["height"].as<int>();
+	int nrLevels = 1;
+	MeshFileHeader header;
+	if (MeshFile::ReadMeshFileHeader(in, header)) {
+		inputFormat = (int)header.version;
+		uint64_t endOfFrames = 0;
+		nrFrames = MeshFile::CountFramesV2(in, header, endOfFrames);
+		if (nrFrames != (int)header.nrFrames) {
+			std::cout << "Error: " << inputPath << " only contains " << nrFrames << " of its " << header.nrFrames << " frames" << std::endl;
+			return -1;
+		}
+		if (!result.count("nr_cameras")) nrCameras = header.nrCameras;
+		if (!result.count("width")) width = header.width;
+		if (!result.count("height")) height = header.height;
+		nrLevels = std::max((int)header.nrLevels, 1);
+	}
+	else {
+		in.clear();
+		in.seekg(0);
+		uint64_t endOfFrames = 0;
+		nrFrames = MeshFile::CountFrames(in, INT32_MAX, endOfFrames);
+		in.seekg(0, std::ios::end);
+		if ((uint64_t)in.tellg() != endOfFrames) {
+			std::cout << "Warning: " << inputPath << " ends with an incomplete frame, which is skipped" << std::endl;
+		}
+		in.seekg(0);
+	}
+
+	int outputFormat = inputFormat == 1 ? 2 : 1;
+	if (result.count("mesh_format")) {
+		std::string format = result["mesh_format"].as<std::string>();
+		if (format != "v1" && format != "v2" && format != "v3" && format != "v4") {
+			std::cout << "Option --mesh_format should be \"v1\", \"v2\", \"v3\" or \"v4\"" << std::endl;
+			return -1;
+		}
+		outputFormat = format[1] - '0';
+	}
+	if (outputFormat == inputFormat) {
+		std::cout << "Error: " << inputPath << " already is a v" << inputFormat << " mesh file" << std::endl;
+		return -1;
+	}
+	if (outputFormat == 1 && nrLevels > 1) {
+		std::cout << "Error: " << inputPath << " has " << nrLevels << " levels of detail, which a v1 mesh file can not store" << std::endl;
+		return -1;
+	}
+
+	std::ofstream out;
+	MeshFileWriter writer;
+	if (outputFormat == 1) {
+		out.open(outputPath, std::ios::binary);
+	}
+	else if (!writer.Create(outputPath, nrCameras, width, height, nrFrames, outputFormat, nrLevels)) {
+		return -1;
+	}
+	std::vector<float> vertices;
+	std::vector<uint32_t> triangles;
+	QuantizedMeshEncoder encoder;
+	std::vector<MeshBlock> blocks;
+	std::vector<MeshBlockSource> sources;
+	std::vector<Meshlet> meshlets;
+	bool transcode = inputFormat >= 3 && outputFormat >= 3;
+	const float identity[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+	for (int frame = 0; frame < nrFrames; frame++) {
+		bool read = false;
+		if (transcode) {
+			MeshFrameEntry entry;
+			in.seekg(header.frameTableOffset + (uint64_t)frame * sizeof(MeshFrameEntry));
+			encoder.Clear();
+			read = in.read(reinterpret_cast<char*>(&entry), sizeof(entry))
+				&& MeshFile::ReadQuantizedFrame(in, header, entry, blocks, sources, meshlets, encoder.vertices, encoder.indices);
+			if (read) {
+				// the stored blocks as they are, and the kept blocks refer to the same blocks of the same frames
+				size_t nrStoredBlocks = blocks.size() - sources.size();
+				encoder.blocks.assign(blocks.begin(), blocks.begin() + nrStoredBlocks);
+				if (nrStoredBlocks < blocks.size()) {
+					encoder.vertices.resize(3 * (size_t)blocks[nrStoredBlocks].firstVertex);
+					encoder.indices.resize(blocks[nrStoredBlocks].firstIndex);
+				}
+				for (size_t k = 0; k < sources.size(); k++) {
+					encoder.Keep(blocks[nrStoredBlocks + k], sources[k]);
+				}
+				for (Meshlet meshlet : meshlets) {
+					if (meshlet.block < nrStoredBlocks) {
+						encoder.meshlets.push_back(meshlet);
+						continue;
+					}
+					meshlet.block -= (uint32_t)nrStoredBlocks;
+					encoder.keptMeshlets.push_back(meshlet);
+				}
+				read = writer.WriteFrame(frame, encoder);
+			}
+			if (!read) {
+				std::cout << "Error: could not convert frame " << frame << " of " << inputPath << std::endl;
+				return -1;
+			}
+			continue;
+		}
+		if (inputFormat == 1) {
+			read = MeshFile::ReadFrame(in, vertices, triangles);
+		}
+		else {
+			MeshFrameEntry entry;
+			in.seekg(header.frameTableOffset + (uint64_t)frame * sizeof(MeshFrameEntry));
+			read = in.read(reinterpret_cast<char*>(&entry), sizeof(entry)) && MeshFile::ReadFrame(in, header, entry, vertices, triangles, meshlets);
+		}
+		if (!read) {
+			std::cout << "Error: could not read frame " << frame << " of " << inputPath << std::endl;
+			return -1;
+		}
+
+		int nrVertices = (int)vertices.size() / 3;
+		int nrTriangles = (int)triangles.size() / 3;
+		if (outputFormat == 1) {
+			int32_t counts[2] = { nrVertices, nrTriangles };
+			out.write(reinterpret_cast<const char*>(counts), sizeof(counts));
+			out.write(reinterpret_cast<const char*>(vertices.data()), vertices.size() * sizeof(float));
+			out.write(reinterpret_cast<const char*>(triangles.data()), triangles.size() * sizeof(uint32_t));
+		}
+		else if (outputFormat == 2) {
+			if (!writer.WriteFrame(frame, vertices.data(), nrVertices, triangles.data(), nrTriangles, meshlets.data(), (int)meshlets.size())) return -1;
+		}
+		else {
+			encoder.Clear();
+			encoder.Add(vertices.data(), nrVertices, triangles.data(), nrTriangles, identity, meshlets.data(), (int)meshlets.size());
+			if (!writer.WriteFrame(frame, encoder)) return -1;
+		}
+	}
+	out.close();
+	writer.Close();
+	if (outputFormat == 1 && !out) {
+		std::cout << "Error: could not write " << outputPath << std::endl;
+		return -1;
+	}
+	printf("Converted %d frames from v%d to v%d\n", nrFrames, inputFormat, outputFormat);
+	return 0;
+}
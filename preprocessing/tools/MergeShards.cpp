@@ -0,0 +1,132 @@
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#ifndef CXXOPTS_NO_EXCEPTIONS
+#define CXXOPTS_NO_EXCEPTIONS
+#endif
+#include "cxxopts.hpp"
+#include "MeshFile.h"
+
+
+/*
+* MergeShards concatenates the shard files that CreateMeshes writes with --start_frame and --end_frame into one meshes.bin.
+* The shards can be given in any order. It checks that every shard is complete, and that together they contain
+* every frame (from 0 to the end of the last shard, or to --nr_frames) exactly once.
+* The output is a v2 mesh file, or with --mesh_format v1 the frames of the shards one after the other (see MeshFile.h).
+* The shards are v1, so they have no meshlets (CreateMeshes does not allow --mesh_format v3 or v4, --meshlet_size or
+* --temporal_tolerance with --start_frame and --end_frame); ConvertMeshes converts the merged file to v3 or v4.
+*/
+struct Shard {
+	std::string path;
+	ShardHeader header;
+	uint64_t endOfFrames = 0;
+};
+
+int main(int argc, char* argv[]) {
+	cxxopts::Options options("MergeShards", "Merge the shard files written by CreateMeshes --start_frame --end_frame into one meshes.bin.");
+	options.add_options()
+		("h,help", "Print help")
+		("o,output_bin", "The merged meshes.bin", cxxopts::value<std::string>())
+		("nr_frames", "Check that the shards contain exactly this many frames (e.g. Number_of_frames of the JSON)", cxxopts::value<int>())
+		("mesh_format", "\"v2\" (default) or \"v1\", see CreateMeshes", cxxopts::value<std::string>()->default_value("v2"))
+		("shards", "The shard files", cxxopts::value<std::vector<std::string>>())
+		;
+	options.parse_positional({ "shards" });
+	options.positional_help("shard1.bin shard2.bin ...");
+	cxxopts::ParseResult result = options.parse(argc, argv);
+	if (argc < 2 || result.count("help") || !result.count("output_bin") || !result.count("shards")) {
+		std::cout << options.help() << std::endl;
+		return result.count("help") ? 0 : -1;
+	}
+	std::string outputPath = result["output_bin"].as<std::string>();
+	std::string meshFormat = result["mesh_format"].as<std::string>();
+	if (meshFormat != "v1" && meshFormat != "v2") {
+		std::cout << "Option --mesh_format should be \"v1\" or \"v2\"" << std::endl;
+		return -1;
+	}
+
+	// read the headers and check that every shard is complete
+	std::vector<Shard> shards;
+	for (const std::string& path : result["shards"].as<std::vector<std::string>>()) {
+		Shard shard;
+		shard.path = path;
+		std::ifstream in(path, std::ios::binary);
+		if (!in.is_open()) {
+			std::cout << "Error: could not open " << path << std::endl;
+			return -1;
+		}
+		if (!MeshFile::ReadShardHeader(in, shard.header)) {
+			std::cout << "Error: " << path << " is not a shard file" << std::endl;
+			return -1;
+		}
+		int nrFrames = shard.header.endFrame - shard.header.startFrame;
+		int nrFramesDone = MeshFile::CountFrames(in, nrFrames, shard.endOfFrames);
+		if (nrFramesDone != nrFrames) {
+			std::cout << "Error: " << path << " only contains " << nrFramesDone << " of its " << nrFrames << " frames (" << shard.header.startFrame << " to "
+				<< shard.header.endFrame << "), finish it with CreateMeshes --resume" << std::endl;
+			return -1;
+		}
+		shards.push_back(shard);
+	}
+
+	// every frame exactly once
+	std::sort(shards.begin(), shards.end(), [](const Shard& a, const Shard& b) { return a.header.startFrame < b.header.startFrame; });
+	int nextFrame = 0;
+	for (const Shard& shard : shards) {
+		if (shard.header.startFrame > nextFrame) {
+			std::cout << "Error: frames " << nextFrame << " to " << shard.header.startFrame << " are missing (before " << shard.path << ")" << std::endl;
+			return -1;
+		}
+		if (shard.header.startFrame < nextFrame) {
+			std::cout << "Error: frames " << shard.header.startFrame << " to " << std::min(nextFrame, (int)shard.header.endFrame) << " are in more than one shard (" << shard.path << ")" << std::endl;
+			return -1;
+		}
+		nextFrame = shard.header.endFrame;
+	}
+	if (result.count("nr_frames") && nextFrame != result["nr_frames"].as<int>()) {
+		std::cout << "Error: the shards contain " << nextFrame << " frames instead of " << result["nr_frames"].as<int>() << std::endl;
+		return -1;
+	}
+
+	if (meshFormat == "v2") {
+		const ShardHeader& first = shards[0].header;
+		MeshFileWriter writer;
+		if (!writer.Create(outputPath, first.nrCameras, first.width, first.height, nextFrame)) return -1;
+		std::vector<float> vertices;
+		std::vector<uint32_t> triangles;
+		for (const Shard& shard : shards) {
+			std::ifstream in(shard.path, std::ios::binary);
+			in.seekg(sizeof(ShardHeader));
+			for (int frame = shard.header.startFrame; frame < shard.header.endFrame; frame++) {
+				MeshFile::ReadFrame(in, vertices, triangles);
+				if (!writer.WriteFrame(frame, vertices.data(), (int)vertices.size() / 3, triangles.data(), (int)triangles.size() / 3)) return -1;
+			}
+		}
+		writer.Close();
+	}
+	else {
+		// concatenate the frames, without the headers
+		std::ofstream out(outputPath, std::ios::binary);
+		std::vector<char> buffer(1 << 20);
+		for (const Shard& shard : shards) {
+			std::ifstream in(shard.path, std::ios::binary);
+			in.seekg(sizeof(ShardHeader));
+			uint64_t left = shard.endOfFrames - sizeof(ShardHeader);
+			while (left > 0) {
+				std::streamsize n = (std::streamsize)std::min<uint64_t>(left, buffer.size());
+				in.read(buffer.data(), n);
+				out.write(buffer.data(), n);
+				left -= n;
+			}
+		}
+		out.close();
+		if (!out) {
+			std::cout << "Error: could not write " << outputPath << std::endl;
+			return -1;
+		}
+	}
+	printf("Merged %d shards with %d frames into %s\n", (int)shards.size(), nextFrame, outputPath.c_str());
+	return 0;
+}